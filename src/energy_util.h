@@ -0,0 +1,76 @@
+// 能量管理的决策：按电池电压等级和每日能量预算决定拍摄间隔、访问窗口、闪光灯、WiFi和分辨率（固件和电脑上的电压模拟共用）
+//
+// 不依赖Arduino，也不访问ADC；电压测量和耗电统计在固件中，这里只根据测得的数值做决定。
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#define BATTERY_SAVE_MV 3600               // 低于此电压进入省电等级
+#define BATTERY_CRITICAL_MV 3400           // 低于此电压进入极低电量等级
+#define BATTERY_HYSTERESIS_MV 100          // 电压回升到阈值+此值以上才恢复，避免在阈值附近来回切换
+#define ENERGY_DAILY_BUDGET_MAH 400        // 每日能量预算（例如太阳能板每天能补充的电量）
+#define ENERGY_SLEEP_CURRENT_MA 6.0f       // 深度睡眠电流（板载稳压器和PSRAM使其远高于芯片本身）
+#define ENERGY_MAX_INTERVAL_S (4 * 3600)   // 拍摄间隔上限
+#define ENERGY_SAVE_FRAMESIZE 10           // 省电等级的分辨率上限（FRAMESIZE_XGA）
+#define ENERGY_CRITICAL_FRAMESIZE 9        // 极低电量等级的分辨率上限（FRAMESIZE_SVGA）
+
+enum EnergyLevel : uint8_t {
+  ENERGY_NORMAL = 0,
+  ENERGY_SAVE,
+  ENERGY_CRITICAL,
+};
+
+// 本次唤醒采用的策略
+struct EnergyPolicy {
+  uint8_t level;
+  uint32_t intervalS;     // 拍摄间隔
+  uint32_t webWindowMs;   // 唤醒后的访问窗口（0=不开窗口）
+  bool flash;             // 拍照时是否打开闪光灯
+  bool wifi;              // 是否连接WiFi
+  uint8_t frameSize;      // 拍照分辨率上限（framesize_t）
+};
+
+// 以电量正常时的策略（拍摄配置本身）为基础，根据电池电压、上次的等级和平均每次唤醒耗电决定策略（mv为0表示未测量）
+inline EnergyPolicy energyDecide(const EnergyPolicy& base, uint32_t mv, uint8_t prevLevel, float wakeMah) {
+  uint8_t level = ENERGY_NORMAL;
+  if (mv > 0) {
+    uint32_t saveMv = BATTERY_SAVE_MV + (prevLevel >= ENERGY_SAVE ? BATTERY_HYSTERESIS_MV : 0);
+    uint32_t criticalMv = BATTERY_CRITICAL_MV + (prevLevel >= ENERGY_CRITICAL ? BATTERY_HYSTERESIS_MV : 0);
+    if (mv < criticalMv) {
+      level = ENERGY_CRITICAL;
+    } else if (mv < saveMv) {
+      level = ENERGY_SAVE;
+    }
+  }
+
+  EnergyPolicy p = base;
+  p.level = level;
+  if (level == ENERGY_SAVE) {
+    p.intervalS *= 2;
+    p.webWindowMs = std::min(p.webWindowMs, (uint32_t)10000);
+    p.flash = false;
+    p.frameSize = std::min(p.frameSize, (uint8_t)ENERGY_SAVE_FRAMESIZE);
+  } else if (level == ENERGY_CRITICAL) {
+    p.intervalS *= 6;
+    p.webWindowMs = 0;
+    p.flash = false;
+    p.wifi = false;
+    p.frameSize = std::min(p.frameSize, (uint8_t)ENERGY_CRITICAL_FRAMESIZE);
+  }
+
+  // 每日能量预算：预计用电超过预算时延长拍摄间隔
+  float availableMah = ENERGY_DAILY_BUDGET_MAH - ENERGY_SLEEP_CURRENT_MA * 24;
+  if (availableMah <= 0) {
+    p.intervalS = ENERGY_MAX_INTERVAL_S;
+  } else if (wakeMah > 0) {
+    p.intervalS = std::max(p.intervalS, (uint32_t)(86400.0f * wakeMah / availableMah));
+  }
+  p.intervalS = std::min(p.intervalS, (uint32_t)ENERGY_MAX_INTERVAL_S);
+  return p;
+}
+
+// 按策略预计的每日用电
+inline float energyDailyMah(const EnergyPolicy& p, float wakeMah) {
+  return 86400.0f / p.intervalS * wakeMah + ENERGY_SLEEP_CURRENT_MA * 24;
+}
@@ -0,0 +1,177 @@
+// 请求参数解析、百分号编解码、HTML转义和照片路径校验（固件的Web处理函数共用，也在电脑上编译做模糊测试和性能测试）
+//
+// 所有函数只读写调用者提供的定长缓冲区，不分配内存，不依赖Arduino。
+// 写缓冲区的函数返回写入的长度（不含结尾的NUL），输入无效或缓冲区不够时返回-1，此时缓冲区内容无意义。
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#define HTTP_PATH_MAX 96  // 照片路径最大长度（/2026_W03/2026_01_15_10_20_roi.jpg 约40字节）
+
+inline int httpHexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// 百分号解码（'+'解码为空格，不完整的%XX原样保留）。dst可以等于src（原地解码，结果不会比输入长）。
+// 解码出NUL时返回-1，避免 "a.jpg%00.txt" 这样的值在后面按C字符串处理时被截断。
+inline int urlDecodeTo(const char* src, size_t len, char* dst, size_t cap) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) {
+    char c = src[i];
+    if (c == '+') {
+      c = ' ';
+    } else if (c == '%' && i + 2 < len && httpHexValue(src[i + 1]) >= 0 && httpHexValue(src[i + 2]) >= 0) {
+      c = (char)(httpHexValue(src[i + 1]) * 16 + httpHexValue(src[i + 2]));
+      i += 2;
+      if (c == '\0') {
+        return -1;
+      }
+    } else if (c == '\0') {
+      return -1;
+    }
+    if (n + 1 >= cap) {
+      return -1;
+    }
+    dst[n++] = c;
+  }
+  if (cap == 0) {
+    return -1;
+  }
+  dst[n] = '\0';
+  return (int)n;
+}
+
+// 百分号编码，只保留 A-Z a-z 0-9 - _ . ~ 不编码（用于把路径放进查询参数或Location头）
+inline int urlEncodeTo(const char* src, size_t len, char* dst, size_t cap) {
+  static const char hex[] = "0123456789ABCDEF";
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)src[i];
+    bool plain = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                 c == '-' || c == '_' || c == '.' || c == '~';
+    if (n + (plain ? 1 : 3) >= cap) {
+      return -1;
+    }
+    if (plain) {
+      dst[n++] = (char)c;
+    } else {
+      dst[n++] = '%';
+      dst[n++] = hex[c >> 4];
+      dst[n++] = hex[c & 0x0F];
+    }
+  }
+  if (cap == 0) {
+    return -1;
+  }
+  dst[n] = '\0';
+  return (int)n;
+}
+
+// HTML转义 & < > " '（把请求参数或文件名放进页面时使用）
+inline int htmlEscapeTo(const char* src, size_t len, char* dst, size_t cap) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) {
+    const char* rep = NULL;
+    switch (src[i]) {
+      case '&': rep = "&amp;"; break;
+      case '<': rep = "&lt;"; break;
+      case '>': rep = "&gt;"; break;
+      case '"': rep = "&quot;"; break;
+      case '\'': rep = "&#39;"; break;
+    }
+    size_t repLen = rep ? strlen(rep) : 1;
+    if (n + repLen >= cap) {
+      return -1;
+    }
+    if (rep) {
+      memcpy(dst + n, rep, repLen);
+    } else {
+      dst[n] = src[i];
+    }
+    n += repLen;
+  }
+  if (cap == 0) {
+    return -1;
+  }
+  dst[n] = '\0';
+  return (int)n;
+}
+
+// 依次取出 a=1&b=2 形式的参数（查询字符串和表单请求体格式相同），原地解码。
+// str[len]必须可写（通常是结尾的NUL）；name/value指向str内部并以NUL结尾，没有'='时value为空串。
+// pos从0开始，每次调用后指向下一个参数；名字为空或解码出NUL的参数被跳过。没有更多参数时返回false。
+inline bool queryNext(char* str, size_t len, size_t& pos, const char*& name, const char*& value) {
+  while (pos < len) {
+    size_t start = pos;
+    size_t end = start;
+    while (end < len && str[end] != '&') end++;
+    size_t eq = start;
+    while (eq < end && str[eq] != '=') eq++;
+    pos = end + 1;
+    if (eq == start) {
+      continue;
+    }
+    // 先解码值再解码名字：两段都只会变短，解码名字写入的NUL最多落在'='上
+    int valueLen = 0;
+    if (eq < end) {
+      valueLen = urlDecodeTo(str + eq + 1, end - eq - 1, str + eq + 1, end - eq);
+    }
+    int nameLen = urlDecodeTo(str + start, eq - start, str + start, eq - start + 1);
+    if (nameLen <= 0 || valueLen < 0) {
+      continue;
+    }
+    name = str + start;
+    value = eq < end ? str + eq + 1 : "";
+    return true;
+  }
+  return false;
+}
+
+// 把（已解码的）照片路径规范化为 /目录/文件名 的形式：补上开头的'/'，合并连续的'/'。
+// 拒绝空路径、'.'和'..'路径段、反斜杠、控制字符、以'/'结尾的路径，以及超过cap的路径。
+inline int pathCanonicalize(const char* src, size_t len, char* dst, size_t cap) {
+  if (len == 0 || cap < 2) {
+    return -1;
+  }
+  size_t n = 0;
+  size_t i = 0;
+  while (i < len) {
+    while (i < len && src[i] == '/') i++;  // 跳过段前的'/'（包括重复的'/'）
+    if (i == len) {
+      break;
+    }
+    size_t segStart = i;
+    while (i < len && src[i] != '/') {
+      unsigned char c = (unsigned char)src[i];
+      if (c < 0x20 || c == 0x7F || c == '\\') {
+        return -1;
+      }
+      i++;
+    }
+    size_t segLen = i - segStart;
+    if ((segLen == 1 && src[segStart] == '.') || (segLen == 2 && src[segStart] == '.' && src[segStart + 1] == '.')) {
+      return -1;
+    }
+    if (n + 1 + segLen >= cap) {
+      return -1;
+    }
+    dst[n++] = '/';
+    memcpy(dst + n, src + segStart, segLen);
+    n += segLen;
+  }
+  if (n == 0 || src[len - 1] == '/') {
+    return -1;
+  }
+  dst[n] = '\0';
+  return (int)n;
+}
+
+// 路径是否以指定扩展名结尾（区分大小写，与设备生成的文件名一致）
+inline bool pathHasExtension(const char* path, size_t len, const char* ext) {
+  size_t extLen = strlen(ext);
+  return len > extLen && memcmp(path + len - extLen, ext, extLen) == 0;
+}
@@ -0,0 +1,149 @@
+// 照片写入日志：写临时文件 -> 校验 -> 重命名提交，断电后下次唤醒据日志完成或回滚（固件和电脑上的故障注入测试共用）
+//
+// 这里只决定文件操作的顺序和恢复动作，不依赖Arduino。文件操作由模板参数 fs 提供
+// （固件中是SD卡，测试中是可以在任意一步"断电"的内存文件系统），fs 需要提供：
+//   bool setRecord(JournalState, const char* path, uint32_t size, uint32_t crc, uint32_t seq)  原地覆盖日志记录
+//   bool readRecord(JournalRecord&)                  读取日志记录（不存在或不完整时返回false）
+//   bool create(const char* path)                    创建（截断）文件并打开用于写入
+//   size_t write(const uint8_t* data, size_t len)    写入打开的文件，返回写入的字节数
+//   void close()                                     刷新并关闭写入的文件
+//   bool remove(const char* path)  bool exists(const char* path)  bool rename(const char* from, const char* to)
+//   bool verify(const char* path, uint32_t size)     大小一致且以JPEG起止标记开头/结尾
+//   uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len)   标准CRC-32（与zlib相同）
+//   void faultPoint(int step)                        故障注入点：1=写入一半, 2=校验后重命名前, 3=重命名后登记前
+//   void invalidate(const char* path)                最终路径上的照片被替换（作废日历汇总等派生数据）
+//   uint32_t changeSeq()                             当前的同步序号（每登记一张照片加1）
+//   bool isRegistered(const char* path, uint32_t seq)  序号seq之后是否已登记这张照片（最后一条同步记录是否就是它）
+//   void finish(const char* path, uint32_t size, uint32_t crc)  登记已提交的照片，最后把日志改回IDLE
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#define JOURNAL_MAGIC 0x4A524E4CUL  // "JRNL"
+#define JOURNAL_TMP_SUFFIX ".tmp"
+#define JOURNAL_TMP_PATH_MAX 80     // 临时文件路径缓冲区（照片路径约40字节）
+
+enum JournalState : uint8_t {
+  JOURNAL_IDLE = 0,        // 没有正在写入的照片
+  JOURNAL_WRITING = 1,     // 正在写临时文件（断电后回滚：删除临时文件）
+  JOURNAL_COMMITTING = 2,  // 临时文件已校验，正在重命名和登记（断电后继续完成）
+};
+
+struct JournalRecord {
+  uint32_t magic;
+  uint8_t state;
+  uint8_t reserved[3];
+  uint32_t size;     // 照片字节数
+  uint32_t crc;      // 照片CRC32（COMMITTING状态有效，恢复时写入校验文件）
+  char path[40];     // 最终路径（临时文件为 path + ".tmp"）
+  uint32_t seq;      // 提交时的同步序号（同一分钟内覆盖同名照片时，旧照片的同步记录不算新照片已登记）
+};
+
+enum JournalResult {
+  JOURNAL_OK = 0,
+  JOURNAL_ERR_RECORD,   // 无法写入日志记录
+  JOURNAL_ERR_CREATE,   // 无法创建临时文件
+  JOURNAL_ERR_VERIFY,   // 写入不完整或校验失败
+  JOURNAL_ERR_RENAME,   // 无法重命名为最终路径
+};
+
+enum JournalRecovery {
+  JOURNAL_RECOVERY_NONE = 0,     // 上次没有中断的写入
+  JOURNAL_RECOVERY_COMPLETED,    // 临时文件已校验，完成了重命名和登记
+  JOURNAL_RECOVERY_ROLLED_BACK,  // 临时文件可能不完整，已删除
+};
+
+inline bool journalTmpPath(const char* path, char* dst, size_t cap) {
+  int n = snprintf(dst, cap, "%s%s", path, JOURNAL_TMP_SUFFIX);
+  return n > 0 && (size_t)n < cap;
+}
+
+// 写入一张照片，每次写4KB并逐块计算CRC32（不需要再读一遍）；written返回写入临时文件的字节数。
+// 返回JOURNAL_OK后调用者需调用 fs.finish() 登记；失败时临时文件已删除，最终路径上的旧照片不受影响。
+template <class Fs>
+JournalResult journalWriteFrameTo(Fs& fs, const char* path, const uint8_t* data, size_t size, uint32_t& crc,
+                                  size_t& written) {
+  const size_t chunkSize = 4096;
+  char tmpPath[JOURNAL_TMP_PATH_MAX];
+  written = 0;
+  crc = 0;
+  if (!journalTmpPath(path, tmpPath, sizeof(tmpPath))) {
+    return JOURNAL_ERR_CREATE;
+  }
+  if (!fs.setRecord(JOURNAL_WRITING, path, (uint32_t)size, 0, 0)) {
+    return JOURNAL_ERR_RECORD;
+  }
+  fs.remove(tmpPath);
+  if (!fs.create(tmpPath)) {
+    fs.setRecord(JOURNAL_IDLE, "", 0, 0, 0);
+    return JOURNAL_ERR_CREATE;
+  }
+
+  while (written < size) {
+    size_t toWrite = size - written < chunkSize ? size - written : chunkSize;
+    size_t n = fs.write(data + written, toWrite);
+    if (n == 0) {
+      break;
+    }
+    crc = fs.crc32(crc, data + written, n);
+    written += n;
+    if (written >= size / 2) {
+      fs.faultPoint(1);
+    }
+  }
+  fs.close();
+
+  if (written != size || !fs.verify(tmpPath, (uint32_t)size)) {
+    fs.remove(tmpPath);
+    fs.setRecord(JOURNAL_IDLE, "", 0, 0, 0);
+    return JOURNAL_ERR_VERIFY;
+  }
+  if (!fs.setRecord(JOURNAL_COMMITTING, path, (uint32_t)size, crc, fs.changeSeq())) {
+    fs.remove(tmpPath);  // 日志仍是WRITING，断电恢复时按回滚处理
+    return JOURNAL_ERR_RECORD;
+  }
+  fs.faultPoint(2);
+  if (fs.remove(path)) {  // 同一分钟内重复拍摄时覆盖旧文件
+    fs.invalidate(path);
+  }
+  if (!fs.rename(tmpPath, path)) {
+    fs.remove(tmpPath);
+    fs.setRecord(JOURNAL_IDLE, "", 0, 0, 0);
+    return JOURNAL_ERR_RENAME;
+  }
+  fs.faultPoint(3);
+  return JOURNAL_OK;
+}
+
+// 启动时恢复上次中断的写入：只读一条日志记录，与卡上照片数量无关。record返回读到的记录（path已以NUL结尾）
+template <class Fs>
+JournalRecovery journalRecoverWith(Fs& fs, JournalRecord& record) {
+  if (!fs.readRecord(record) || record.magic != JOURNAL_MAGIC || record.state == JOURNAL_IDLE) {
+    return JOURNAL_RECOVERY_NONE;
+  }
+  record.path[sizeof(record.path) - 1] = '\0';
+  char tmpPath[JOURNAL_TMP_PATH_MAX];
+  journalTmpPath(record.path, tmpPath, sizeof(tmpPath));
+
+  if (record.state == JOURNAL_COMMITTING && (fs.exists(record.path) || fs.verify(tmpPath, record.size))) {
+    // 临时文件已校验通过：完成重命名，补登记（如果断电前已登记则跳过）
+    // 不确定断电前是否已计入派生数据，作废后重新生成
+    fs.invalidate(record.path);
+    if (fs.exists(tmpPath)) {
+      fs.remove(record.path);
+      fs.rename(tmpPath, record.path);
+    }
+    if (fs.isRegistered(record.path, record.seq)) {
+      fs.setRecord(JOURNAL_IDLE, "", 0, 0, 0);
+    } else {
+      fs.finish(record.path, record.size, record.crc);
+    }
+    return JOURNAL_RECOVERY_COMPLETED;
+  }
+  // 临时文件可能不完整：删除，最终路径上的照片不受影响
+  fs.remove(tmpPath);
+  fs.setRecord(JOURNAL_IDLE, "", 0, 0, 0);
+  return JOURNAL_RECOVERY_ROLLED_BACK;
+}
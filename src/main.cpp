@@ -2,10 +2,28 @@
 #include "FS.h"
 #include "SD_MMC.h"
 #include <WiFi.h>
-#include <WebServer.h>
+#include "esp_http_server.h"
 #include <Preferences.h>
 #include <time.h>
+#include <sys/time.h>
+#include <stdarg.h>
+#include <atomic>
+#include <algorithm>
 #include "esp_sleep.h"
+#include "driver/rtc_io.h"
+#include "esp_rom_crc.h"
+#include "esp_task_wdt.h"
+#include "esp_pm.h"
+#include "esp_wifi.h"
+#include "esp_heap_caps.h"
+#include "img_converters.h"
+#include "esp_jpg_decode.h"
+#include "http_util.h"
+#include "journal.h"
+#include "ntp_util.h"
+#include "energy_util.h"
+#include "tile_scaler.h"
+#include "mqtt_util.h"
 
 // 配置AP模式（首次配置时使用）
 const char* ap_ssid = "ESP32-CAM-Config";
@@ -18,14 +36,37 @@ Preferences preferences;
 String wifi_ssid = "";
 String wifi_password = "";
 
-// Web服务器（用于配置界面）
-WebServer server(80);
+// 上传地址（可选，HTTP PUT / S3兼容的对象存储，如 http://192.168.1.10:9000/timelapse）
+String upload_url = "";
 
-// NTP服务器配置
-const char* ntpServer = "pool.ntp.org";
+// MQTT服务器（可选，每次唤醒发布一条事件，如 mqtt://192.168.1.10:1883/timelapse）
+String mqtt_url = "";
+
+// NTP服务器配置：同时向所有服务器发送请求，采用最先返回的有效结果
+const char* const ntpServers[] = {"pool.ntp.org", "cn.pool.ntp.org", "ntp.aliyun.com"};
+#define NTP_SERVER_COUNT (sizeof(ntpServers) / sizeof(ntpServers[0]))
 const long gmtOffset_sec = 8 * 3600;  // GMT+8 (北京时间)
 const int daylightOffset_sec = 0;
 
+// 时间同步：偏移和漂移估计保存在RTC内存，估计误差超过容差时才重新同步
+#define NTP_TIMEOUT_MS 1500              // 每轮请求等待回复的时间
+#define NTP_ROUNDS 2                     // 最多请求轮数
+#define TIME_SYNC_TOLERANCE_MS 2000      // 估计误差超过此值时重新同步
+#define TIME_SYNC_MAX_INTERVAL_S (24 * 3600)  // 无论估计误差多小，超过此间隔都重新同步
+#define TIME_DEFAULT_DRIFT_PPM 1000      // 还没有测得漂移时假设的误差（深度睡眠的RTC时钟精度较低）
+#define TIME_SLEW_MAX_US 500000          // 小于此值的校正用adjtime平滑调整，否则直接设置
+
+RTC_DATA_ATTR int64_t timeLastSyncUs = 0;      // 上次同步时的时间（微秒）
+RTC_DATA_ATTR int64_t timeLastCorrectUs = 0;   // 上次按漂移校正时的时间
+RTC_DATA_ATTR float timeDriftPpm = 0;          // 估计的时钟漂移（正数表示本地时钟偏慢）
+RTC_DATA_ATTR float timeResidualPpm = TIME_DEFAULT_DRIFT_PPM;  // 校正后剩余误差的估计
+RTC_DATA_ATTR uint32_t timeSkippedCaptures = 0;  // 因时间无效跳过的拍摄次数
+RTC_DATA_ATTR uint32_t ntpServerIps[NTP_SERVER_COUNT] = {0};  // 上次解析出的服务器地址（下次同步不必先等DNS）
+bool timeSyncStarted = false;
+volatile bool timeSyncDone = true;
+volatile bool timeSyncOk = false;
+volatile bool timeSyncCancel = false;
+
 // 相机引脚定义 (ESP32-CAM)
 #define PWDN_GPIO_NUM     32
 #define RESET_GPIO_NUM    -1
@@ -48,1414 +89,5982 @@ const int daylightOffset_sec = 0;
 // 深度睡眠时间（微秒）- 10分钟
 #define SLEEP_DURATION_US (10 * 60 * 1000000ULL)
 
+// 外部触发（PIR/门磁）唤醒：触发后立即初始化相机拍一张，不连WiFi、不对时，用RTC时间命名
+// 启用后SD卡改用1-bit模式，空出GPIO13作为触发输入
+#define TRIGGER_ENABLE 0                   // 1=启用外部触发唤醒
+#define TRIGGER_GPIO_NUM GPIO_NUM_13       // 触发输入引脚（必须是RTC GPIO）
+#define TRIGGER_ACTIVE_LEVEL 1             // 触发电平：PIR输出高电平为1，接地的门磁开关为0（启用内部上拉）
+#define TRIGGER_MIN_INTERVAL_S 30          // 两次触发拍摄的最小间隔，间隔内的触发只计数不拍摄
+#define TRIGGER_MERGE_WINDOW_S 60          // 距下次定时拍摄不到此时间时，触发按定时唤醒的完整流程处理
+
+// 触发统计和定时节奏（保存在RTC内存）
+RTC_DATA_ATTR int64_t timelapseNextUs = 0;   // 下一次定时拍摄的时间，触发唤醒不改变它
+RTC_DATA_ATTR int64_t triggerLastUs = 0;     // 上次触发拍摄的时间
+RTC_DATA_ATTR uint32_t triggerEvents = 0;    // 触发唤醒次数
+RTC_DATA_ATTR uint32_t triggerCaptures = 0;  // 触发拍摄的照片数
+RTC_DATA_ATTR uint32_t triggerSuppressed = 0;  // 因限流未拍摄的触发次数
+RTC_DATA_ATTR uint32_t triggerMerged = 0;    // 并入定时拍摄的触发次数
+bool triggerWakeActive = false;              // 本次是触发拍摄唤醒（睡眠时不重新计算定时节奏）
+
 // 白平衡模式配置
 // 0 = Auto (自动), 1 = Sunny (日光), 2 = Cloudy (阴天), 3 = Office (办公室), 4 = Home (室内)
 // 如果照片偏绿，尝试使用 1 (Sunny) 或 2 (Cloudy)
 #define WB_MODE 1  // 默认使用日光模式，改善偏绿问题
 
+// 传感器参数表：每个配置是一组目标参数，初始化时和传感器上电后的状态比较，只写不同的项
+// 1 = 每项都写（用于对比初始化耗时）
+#define CAMERA_PROFILE_FORCE_ALL 0
+
+enum CameraProfileId {
+  CAMERA_PROFILE_DAY,      // 白天（原来的固定参数）
+  CAMERA_PROFILE_NIGHT,    // 夜间/低光：启用AEC2，提高增益上限
+  CAMERA_PROFILE_PREVIEW,  // 实时预览：自动白平衡，关闭较慢的校正
+  CAMERA_PROFILE_COUNT
+};
+
+struct CameraProfile {
+  const char* name;
+  int8_t brightness, contrast, saturation, specialEffect;  // -2~2，特效0-6
+  int8_t awb, awbGain, wbMode;                             // 白平衡 0-Auto 1-Sunny 2-Cloudy 3-Office 4-Home
+  int8_t aec, aec2, aeLevel;                               // 曝光
+  int16_t aecValue;                                        // 0-1200
+  int8_t agc, agcGain, gainceiling;                        // 增益 0-30，上限0-6
+  int8_t bpc, wpc, rawGma, lenc, dcw;                      // 图像处理
+  int8_t hmirror, vflip, colorbar;                         // 其他
+};
+
+constexpr CameraProfile cameraProfiles[CAMERA_PROFILE_COUNT] = {
+  {"day",     0, 0, 0, 0,  1, 1, WB_MODE,  1, 0, 0, 300,  1, 0, 0,  0, 1, 1, 1, 1,  0, 0, 0},
+  {"night",   0, 0, 0, 0,  1, 1, 0,        1, 1, 1, 300,  1, 0, 4,  1, 1, 1, 1, 1,  0, 0, 0},
+  {"preview", 0, 0, 0, 0,  1, 1, 0,        1, 0, 0, 300,  1, 0, 2,  0, 1, 1, 0, 1,  0, 0, 0},
+};
+
+// 感兴趣区域（ROI）：由传感器只输出画面的一部分（窗口+缩放在传感器内完成），照片更小，写卡和上传更快
+// 窗口坐标按UXGA (1600x1200) 计算，取8的倍数；输出尺寸为0表示与窗口相同（不缩放，只裁剪），不能大于窗口
+enum CameraRoiId {
+  ROI_FULL,    // 全幅
+  ROI_SITE,    // 示例：画面下部2/3（如工地），缩小一半输出
+  ROI_ZOOM2X,  // 数码变焦预设：中心1/2
+  ROI_ZOOM4X,  // 数码变焦预设：中心1/4
+  ROI_COUNT
+};
+
+struct CameraRoi {
+  const char* name;
+  char tag;               // 文件名后缀 _<tag>（受校验记录文件名长度限制只用一个字符，FAT不区分大小写）
+  uint16_t x, y, w, h;    // 传感器窗口
+  uint16_t outW, outH;    // 输出尺寸
+};
+
+constexpr CameraRoi cameraRois[ROI_COUNT] = {
+  {"full",   0,   0,   0,   1600, 1200, 0,   0},
+  {"site",   's', 0,   400, 1600, 800,  800, 400},
+  {"zoom2x", '2', 400, 300, 800,  600,  0,   0},
+  {"zoom4x", '4', 600, 450, 400,  300,  0,   0},
+};
+
+// 定时拍摄依次拍摄的区域（全幅照片保持原文件名，其他区域加 _<tag> 后缀）
+constexpr uint8_t timelapseRois[] = {ROI_FULL};
+// 触发拍摄只拍一个区域，使用触发照片的文件名
+#define TRIGGER_ROI ROI_FULL
+
+// 各区域最近一次的照片大小、拍摄和写卡耗时（保存在RTC内存，用于和全幅比较）
+RTC_DATA_ATTR uint32_t roiLastBytes[ROI_COUNT] = {0};
+RTC_DATA_ATTR uint16_t roiLastCaptureMs[ROI_COUNT] = {0};
+RTC_DATA_ATTR uint16_t roiLastWriteMs[ROI_COUNT] = {0};
+
 // JPEG质量配置 (0-63，数值越小质量越高，文件越大)
 // 推荐值: 10-12 (平衡质量和大小), 8-10 (高质量), 5-8 (最高质量，文件较大)
-// 当前50KB左右，提高质量后预计80-120KB
+// 照片大小和拍摄/写卡耗时与场景有关，在现场用 /bench/capture 实测后再选
 #define JPEG_QUALITY 10  // 从12提高到10，提升照片质量
 
+// 拍摄参数测试（/bench/capture）：分辨率 × JPEG质量 × 闪光灯 的每种组合拍几张，记录大小、耗时和内存
+#define BENCH_DIR "/bench"
+#define BENCH_DEFAULT_SIZES "svga,xga,sxga,uxga"
+#define BENCH_DEFAULT_QUALITIES "8,10,12,20"
+#define BENCH_DEFAULT_FRAMES 3             // 每种组合拍摄的张数
+#define BENCH_MAX_FRAMES 10
+#define BENCH_MAX_CELLS 64
+#define BENCH_DEFAULT_BUDGET_MS 30000      // 测试时间上限，超出后剩下的组合不再测试
+#define BENCH_MAX_BUDGET_MS 60000          // 须远小于唤醒截止时间（wakeDeadlineMs()）
+
+struct BenchCell {
+  uint8_t frameSize;
+  uint8_t quality;
+  bool flash;
+  uint8_t frames;
+  uint32_t minBytes, maxBytes;
+  uint64_t totalBytes;
+  uint32_t totalCaptureMs, maxCaptureMs;
+  uint32_t totalWriteMs, maxWriteMs;
+  uint32_t internalUsed, psramUsed;  // 每张照片写卡后（仍持有帧缓冲区时）相对测试开始前少了多少空闲内存，取最大值（采样值，不是峰值）
+  uint32_t internalMinFree, psramMinFree;  // 本组合结束时开机以来的最低空闲内存（heap_caps_get_minimum_free_size）
+  bool newLow;                       // 最低空闲内存在本组合中下降了（上面两个值就是本组合的峰值占用）
+};
+
+// 拍摄配置：分辨率、画质、间隔、闪光灯、访问窗口等可通过 /api/config 修改，下次唤醒生效，无需重新烧录
+// 上面的 SLEEP_DURATION_US、JPEG_QUALITY 等宏只作为默认配置的值
+#define CAPTURE_CONFIG_KEY "capture"       // Preferences中的键名
+#define CAPTURE_CONFIG_MAGIC 0x4643        // "CF"
+#define CAPTURE_CONFIG_VERSION 1           // 结构改变时加1，旧版本的数据不再使用
+#define CAPTURE_PROFILE_MAX 4              // 最多保存的配置数量
+
+struct CaptureProfile {
+  char name[12];
+  uint8_t frameSize;     // 拍照分辨率（framesize_t）
+  uint8_t quality;       // JPEG质量 4-63，数值越小质量越高
+  int8_t wbMode;         // 白平衡模式 0-4（同WB_MODE），-1=使用传感器参数配置中的值
+  uint8_t sensor;        // 传感器参数配置（CameraProfileId，day/night）
+  uint8_t flash;         // 拍照时是否打开闪光灯
+  uint32_t intervalS;    // 拍摄间隔
+  uint32_t webWindowMs;  // 唤醒后的访问窗口（0=不开窗口）
+};
+
+struct CaptureConfig {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t active;        // 当前使用的配置序号
+  uint8_t count;
+  CaptureProfile profiles[CAPTURE_PROFILE_MAX];
+};
+
+// 冷启动时从NVS读取一次，之后每次唤醒直接使用RTC内存中的副本；修改时同时写入NVS和这里
+RTC_DATA_ATTR CaptureConfig captureConfig = {0};
+// 本次唤醒使用的配置（唤醒开始时取出，期间修改的配置从下次唤醒开始生效）
+CaptureProfile captureProfile;
+
+#define CAPTURE_INTERVAL_MIN_S 60          // 拍摄间隔范围
+#define CAPTURE_INTERVAL_MAX_S 86400
+#define CAPTURE_WEB_WINDOW_MAX_MS 90000    // 访问窗口上限（唤醒截止时间随访问窗口延长）
+
+struct FrameSizeName {
+  const char* name;
+  framesize_t size;
+};
+const FrameSizeName frameSizeNames[] = {
+  {"qvga", FRAMESIZE_QVGA}, {"cif", FRAMESIZE_CIF}, {"vga", FRAMESIZE_VGA}, {"svga", FRAMESIZE_SVGA},
+  {"xga", FRAMESIZE_XGA}, {"hd", FRAMESIZE_HD}, {"sxga", FRAMESIZE_SXGA}, {"uxga", FRAMESIZE_UXGA},
+};
+
+// 实时预览（MJPEG流）配置，用于调整相机角度和对焦
+#define STREAM_PORT 81                    // 预览流使用独立的服务器端口，避免阻塞页面和照片请求
+#define STREAM_FRAME_SIZE FRAMESIZE_VGA   // 默认预览分辨率，可通过 /stream?res=svga 切换
+#define STREAM_JPEG_QUALITY 12            // 预览画质（预览只求流畅，画质可以低一些）
+
+// Web访问窗口省电：射频按DTIM间隔休眠，CPU空闲时自动浅睡眠（需要固件启用电源管理，否则只有射频省电）
+#define WEB_WINDOW_CPU_MIN_MHZ 80          // 空闲时CPU降到的频率（不低于80MHz，APB时钟保持不变）
+#define WIFI_PS_IDLE_DUTY_PERCENT 3        // 省电模式下空闲时射频开启时间的估计比例（DTIM=1时每个信标约3ms）
+
+// 上次访问窗口的统计（保存在RTC内存，下次唤醒时在状态页显示）
+RTC_DATA_ATTR uint32_t webLastWindowMs = 0;
+RTC_DATA_ATTR uint32_t webLastRequests = 0;
+RTC_DATA_ATTR uint32_t webLastAvgLatencyUs = 0;
+RTC_DATA_ATTR uint32_t webLastMaxLatencyUs = 0;
+RTC_DATA_ATTR uint32_t webLastRadioOnMs = 0;
+
+// 上传队列配置：每次唤醒在Web访问窗口内把未上传的照片批量PUT到上传地址
+#define UPLOAD_DIR "/upload"
+#define UPLOAD_QUEUE_FILE "/upload/queue.txt"     // 待上传照片路径，每行一个，只追加
+#define UPLOAD_STATE_FILE "/upload/state.bin"     // 队列读取位置、待上传数量等
+#define UPLOAD_MAX_BYTES_PER_WAKE (4 * 1024 * 1024)  // 每次唤醒最多上传的字节数
+#define UPLOAD_MAX_RETRIES 3                      // 单张照片本次唤醒内的最大重试次数
+#define UPLOAD_MAX_SKIP_WAKES 32                  // 连续失败后最多跳过的唤醒次数（指数退避上限）
+
+// 上传队列状态（持久化在SD卡上）
+struct UploadState {
+  uint32_t queueOffset;    // 队列文件中下一条待上传记录的位置
+  uint32_t reserved;       // 以前的断点续传位置，已不再使用（保留以兼容已保存的状态文件）
+  uint32_t pending;        // 队列中待上传的照片数
+  char lastUploaded[40];   // 最近一张上传成功的照片路径（文件名按时间排序，之前的都已上传）
+};
+UploadState uploadState = {0, 0, 0, ""};
+
+// 连续上传失败时按唤醒次数指数退避（保存在RTC内存，深度睡眠不丢失）
+RTC_DATA_ATTR uint32_t uploadFailStreak = 0;
+RTC_DATA_ATTR uint32_t uploadSkipWakes = 0;
+
+// MQTT事件配置：每次唤醒结束前把本次唤醒的结果作为一条事件发布到MQTT服务器，离线时暂存在SD卡上
+#define MQTT_DIR "/mqtt"
+#define MQTT_QUEUE_FILE "/mqtt/queue.txt"       // 待发布事件（JSON），每行一条，只追加
+#define MQTT_STATE_FILE "/mqtt/state.bin"       // 队列读取位置、事件序号（序号的副本，断电后从这里恢复）
+#define MQTT_DEFAULT_PORT 1883
+#define MQTT_KEEPALIVE_S 30
+#define MQTT_TIMEOUT_MS 2000                    // 连接和等待CONNACK/PUBACK的超时
+#define MQTT_BATCH 16                           // 每批连续发送的事件数，等齐这批的PUBACK再发下一批
+#define MQTT_BUDGET_MS 3000                     // 每次唤醒发布事件的时间上限（不含连接）
+
+// MQTT事件队列状态（持久化在SD卡上）
+struct MqttState {
+  uint32_t queueOffset;  // 队列文件中下一条待发布事件的位置
+  uint32_t pending;      // 队列中待发布的事件数
+  uint32_t seq;          // mqttSeq 的副本
+};
+MqttState mqttState = {0, 0, 0};
+// 下一条事件的序号（订阅方据此发现丢失的事件、去掉重发的事件）。保存在RTC内存中，SD卡不可用的唤醒也不会重复使用序号；
+// 每次保存队列状态时写入SD卡，断电后取两者中较大的一个
+RTC_DATA_ATTR uint32_t mqttSeq = 0;
+
+// 本次唤醒的拍摄结果（只记录第一张照片），唤醒结束时写入事件
+struct MqttCapture {
+  bool attempted;
+  bool ok;
+  uint32_t bytes;
+  uint16_t width;
+  uint16_t height;
+  uint8_t quality;
+  uint8_t retries;       // 写卡重试次数
+  uint16_t captureMs;
+  uint16_t writeMs;
+};
+MqttCapture mqttCapture = {false};
+
+// 上次发布的统计（保存在RTC内存，下次唤醒时在状态页显示）
+RTC_DATA_ATTR uint32_t mqttLastSent = 0;
+RTC_DATA_ATTR uint32_t mqttLastConnectMs = 0;   // 建立TCP连接到收到CONNACK
+RTC_DATA_ATTR uint32_t mqttLastPublishMs = 0;   // 第一条PUBLISH到最后一个PUBACK
+RTC_DATA_ATTR uint32_t mqttLastAwakeMs = 0;     // 发布事件使唤醒延长的时间
+
+// 自动清理配置：剩余空间低于低水位时，从最旧的周目录开始整目录删除，直到恢复到高水位
+#define RETENTION_LOW_WATER_PERCENT 10     // 剩余空间低于10%时开始清理
+#define RETENTION_HIGH_WATER_PERCENT 20    // 清理到剩余空间不低于20%
+#define RETENTION_MAX_AGE_DAYS 0           // 按时间清理：删除早于N天的照片（0=不按时间清理）
+#define RETENTION_TIME_BUDGET_MS 5000      // 每次唤醒清理的最长时间，未完成的下次继续
+#define RETENTION_MAX_WEEK_DIRS 128        // 最多处理的周目录数量
+
+// 增量同步：每次新增/删除照片都追加一条定长记录，第N条记录的序号就是N，按序号直接定位
+#define SYNC_DIR "/sync"
+#define SYNC_LOG_FILE "/sync/changes.bin"
+#define SYNC_MAX_CHANGES_PER_REQUEST 500   // 每次 /api/changes 最多返回的记录数
+
+struct ChangeRecord {
+  uint32_t seq;      // 序号（从1开始连续递增）
+  uint32_t size;     // 文件大小（删除记录为0）
+  uint8_t op;        // '+' 新增, '-' 删除
+  char path[39];     // 照片完整路径
+};
+uint32_t syncSeq = 0;  // 最新的序号（= 记录数）
+
+// 照片写入日志：先写临时文件并校验，再重命名提交；日志记录正在写入的照片，断电后下次唤醒据此完成或回滚
+// 写入顺序和恢复动作在 journal.h 中（tools/journal/journal_fault_test 在电脑上对每一步模拟断电）
+#define JOURNAL_DIR "/journal"
+#define JOURNAL_FILE "/journal/inflight.bin"
+#ifndef JOURNAL_FAULT_STEP
+#define JOURNAL_FAULT_STEP 0    // 故障注入测试：1=写入一半, 2=校验后重命名前, 3=重命名后登记前 模拟断电（0=关闭）
+#endif
+
+// 延时视频：每张全幅照片同时追加到当天（或本周）的MJPEG AVI文件，放在周目录中，标准播放器可直接播放
+// 追加只改写文件头（一个扇区内，一次写入）作为提交点，断电最多丢失正在追加的一帧；换文件时写入idx1索引收尾
+#define AVI_ENABLE 1
+#define AVI_PERIOD_WEEKLY 0              // 0=每天一个文件，1=每周一个文件
+#define AVI_FPS 10                       // 播放帧率
+#define AVI_INDEX_SUFFIX ".idx"          // 帧索引暂存文件（每帧16字节，收尾时复制到idx1）
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEYFRAME 0x10
+
+// 文件开头的固定部分：RIFF头 + hdrl（avih、strl/strh、strf）+ movi列表头，共224字节
+struct AviHeader {
+  char riff[4];  uint32_t riffSize;  char aviType[4];
+  char hdrlList[4];  uint32_t hdrlSize;  char hdrl[4];
+  char avih[4];  uint32_t avihSize;
+  uint32_t usPerFrame, maxBytesPerSec, paddingGranularity, flags, totalFrames, initialFrames, streams,
+           suggestedBufferSize, width, height, reserved[4];
+  char strlList[4];  uint32_t strlSize;  char strl[4];
+  char strh[4];  uint32_t strhSize;
+  char fccType[4];  char fccHandler[4];
+  uint32_t strhFlags;  uint16_t priority, language;
+  uint32_t strhInitialFrames, scale, rate, start, length, strhSuggestedBufferSize, quality, sampleSize;
+  int16_t frameLeft, frameTop, frameRight, frameBottom;
+  char strf[4];  uint32_t strfSize;
+  uint32_t biSize;  int32_t biWidth, biHeight;  uint16_t biPlanes, biBitCount;  char biCompression[4];
+  uint32_t biSizeImage;  int32_t biXPelsPerMeter, biYPelsPerMeter;  uint32_t biClrUsed, biClrImportant;
+  char moviList[4];  uint32_t moviSize;  char movi[4];
+} __attribute__((packed));
+static_assert(sizeof(AviHeader) == 224, "AVI header layout");
+#define AVI_MOVI_OFFSET 220              // 'movi' 标记在文件中的位置（idx1中的偏移以此为基准）
+
+struct AviIndexEntry {
+  char id[4];
+  uint32_t flags;
+  uint32_t offset;
+  uint32_t size;
+};
+
+RTC_DATA_ATTR char aviCurrentPath[40] = "";  // 正在追加的AVI文件（换文件时收尾）
+RTC_DATA_ATTR uint32_t aviLastAppendMs = 0;  // 最近一次追加耗时
+RTC_DATA_ATTR uint32_t aviMaxAppendMs = 0;
+RTC_DATA_ATTR uint32_t aviFrames = 0;        // 当前文件的帧数
+
+// 每日缩略图墙：每张全幅照片按1/8比例解码（只取DCT直流分量，几乎不做反变换）后缩成小图，按拍摄时刻放进当天的网格
+// 小图以RGB565存在周目录的 YYYY_MM_DD.sht 文件中，/contactsheet?day=YYYY_MM_DD 时拼成JPEG（需要PSRAM）
+#define CONTACT_SHEET_ENABLE 1              // 格子尺寸 CONTACT_SHEET_TILE_W/H 和缩放在 src/tile_scaler.h 中
+#define CONTACT_SHEET_COLUMNS 12
+#define CONTACT_SHEET_SLOTS 144              // 每天的格子数（每格10分钟），同一格内后拍的照片覆盖先拍的
+#define CONTACT_SHEET_QUALITY 80             // 缩略图墙JPEG质量（0-100）
+#define CONTACT_SHEET_MAGIC 0x54454853UL     // "SHET"
+
+// .sht 文件头，之后是 CONTACT_SHEET_SLOTS 个小图（每个 TILE_W*TILE_H*2 字节，大端RGB565）
+struct SheetHeader {
+  uint32_t magic;
+  uint16_t tileW, tileH, slots, columns;
+  uint8_t filled[(CONTACT_SHEET_SLOTS + 7) / 8];  // 已写入的格子（未写入的格子内容不确定，显示为黑色）
+};
+
+RTC_DATA_ATTR uint32_t sheetLastScaleMs = 0;  // 最近一次解码+缩放耗时
+RTC_DATA_ATTR uint32_t sheetLastWriteMs = 0;  // 最近一次写入耗时
+
+// 周汇总：每个周目录一条定长记录（按天按小时的照片数、总字节数、最小/最大文件），/api/calendar 只读这些记录
+// 删除照片、覆盖写入或断电恢复时删除该记录，下次查询时重新遍历目录生成（拍照时不重建）
+#define SUMMARY_FILE_NAME "summary.bin"
+#define SUMMARY_MAGIC 0x594D5553UL           // "SUMY"
+#define SUMMARY_VERSION 2                    // 2: 按小时的计数只含定时拍摄的全幅照片，区域和触发照片单独计数
+#define CALENDAR_DEFAULT_DAYS 30             // 未指定范围时返回最近30天
+#define CALENDAR_MAX_DAYS 366
+#define CALENDAR_REBUILD_BUDGET_MS 5000      // 每次请求重建过期汇总的最长时间，超出的周在 pending 中列出
+
+// 照片种类（按文件名区分）：定时拍摄的全幅 YYYY_MM_DD_HH_MM.jpg，区域 YYYY_MM_DD_HH_MM_<tag>.jpg，触发 YYYY_MM_DD_HH_MM_SS.jpg
+enum PhotoKind : uint8_t {
+  PHOTO_TIMELAPSE = 0,
+  PHOTO_ROI,
+  PHOTO_TRIGGER,
+};
+
+struct WeekSummary {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t frames;         // 定时拍摄的全幅照片数（minSize、maxSize、hours也只统计这些照片）
+  uint32_t minSize, maxSize;
+  uint64_t bytes;          // 所有照片的总字节数
+  uint32_t roiFrames;      // 区域照片数
+  uint32_t triggerFrames;  // 外部触发的照片数
+  uint16_t hours[7][24];  // [周内第几天][小时]，周内第几天 = tm_yday - (周数-1)*7（与 getWeekNumber() 一致）
+};
+
+// 完整性校验：写入时边写边算CRC32，按目录记录到校验文件；/scrub 在时间预算内增量复核
+#define CRC_SIDECAR_NAME "crc.bin"             // 每个目录下的校验文件，每张照片一条定长记录
+#define SCRUB_STATE_FILE "/journal/scrub.bin"  // 复核进度（当前目录和校验文件读取位置）
+#define SCRUB_CORRUPT_FILE "/journal/corrupt.txt"  // 发现的损坏照片，每行一个
+#define SCRUB_TIME_BUDGET_MS 3000              // 每次 /scrub 默认的最长复核时间
+#define SCRUB_MAX_REPORTED 20                  // 每次响应中最多列出的损坏照片数
+
+struct CrcRecord {
+  char name[24];     // 文件名（不含目录）
+  uint32_t size;
+  uint32_t crc;      // 标准CRC-32（与zlib crc32相同）
+};
+
+struct ScrubState {
+  char dir[16];      // 当前复核的目录（"/" 或 "/YYYY_Www"）
+  uint32_t offset;   // 该目录校验文件中下一条记录的位置
+  uint32_t passes;   // 已完成的完整复核轮数
+  uint32_t corrupt;  // 累计发现的损坏照片数
+};
+
+// 唤醒监督：每个阶段有时间预算，超出时记录；整次唤醒有硬性截止时间，由任务看门狗强制执行
+// 定时唤醒的截止时间 = 访问窗口 + 其他各阶段预算之和 + 余量（wakeDeadlineMs()，访问窗口可通过 /api/config 修改）
+#define WAKE_DEADLINE_MARGIN_MS 10000                        // 截止时间在各阶段预算之和以外的余量
+#define WAKE_FIRST_BOOT_DEADLINE_MS (SLEEP_DURATION_US / 1000 + 120000)  // 首次上电（含10分钟访问窗口）
+#define CONFIG_PORTAL_TIMEOUT_MS (10 * 60 * 1000)            // 配置模式最长等待时间（上电/按复位键时）
+
+enum WakePhase : uint8_t {
+  WAKE_PHASE_NONE = 0,
+  WAKE_PHASE_BOOT,
+  WAKE_PHASE_CAMERA,
+  WAKE_PHASE_SD,
+  WAKE_PHASE_WIFI,
+  WAKE_PHASE_NTP,
+  WAKE_PHASE_RETENTION,
+  WAKE_PHASE_UPLOAD,
+  WAKE_PHASE_WEB,
+  WAKE_PHASE_CAPTURE,
+  WAKE_PHASE_CONFIG,
+  WAKE_PHASE_FIRST_WINDOW,
+  WAKE_PHASE_SLEEP,
+  WAKE_PHASE_MQTT,
+  WAKE_PHASE_COUNT
+};
+
+// 各阶段的名称和时间预算（毫秒），顺序与 WakePhase 一致；Web窗口和上传的预算随访问窗口变化（见 wakePhaseBudget()）
+const char* const wakePhaseNames[WAKE_PHASE_COUNT] = {
+  "无", "启动", "相机", "SD卡", "WiFi", "NTP", "清理", "上传", "Web窗口", "拍照", "配置模式", "首次访问窗口", "睡眠", "MQTT"
+};
+const uint32_t wakePhaseBudgetMs[WAKE_PHASE_COUNT] = {
+  0, 3000, 5000, 8000, 12000, 12000, 6000, 30000, 10000, 10000, CONFIG_PORTAL_TIMEOUT_MS,
+  (uint32_t)(SLEEP_DURATION_US / 1000) + 5000, 5000, MQTT_BUDGET_MS + 2 * MQTT_TIMEOUT_MS
+};
+
+// 唤醒统计：看门狗复位和崩溃后启动代码会重新加载 .rtc.data（RTC_DATA_ATTR变量恢复初值），
+// 所以放在不初始化的RTC内存中，启动时用魔数和校验和判断内容是否有效（上电时是随机值）
+#define WAKE_STATE_MAGIC 0x57414B45UL  // "WAKE"
+struct WakeState {
+  uint32_t magic;
+  uint8_t phase;           // 正在执行的阶段（复位后据此判断卡在哪里）
+  uint8_t overrunPhase;    // 最近一次超出预算的阶段
+  uint8_t reserved[2];
+  uint32_t overruns;       // 阶段超预算累计次数
+  uint32_t watchdogResets; // 因超过截止时间被看门狗复位的次数
+  uint32_t lastMs;         // 上次唤醒时长
+  uint32_t maxMs;          // 最长唤醒时长
+  uint32_t checksum;       // 以上字段的CRC32
+};
+RTC_NOINIT_ATTR WakeState wakeState;
+unsigned long wakePhaseStart = 0;
+uint32_t wakePhaseMs[WAKE_PHASE_COUNT] = {0};  // 本次唤醒各阶段累计用时（用于能量估计）
+
+// 能量管理：每次唤醒测量电池电压，按电量等级和每日能量预算调整拍摄间隔、访问窗口、闪光灯和分辨率
+#define ENERGY_ENABLE 0                    // 1=启用（需要把电池分压后接到 BATTERY_ADC_GPIO_NUM）
+#define BATTERY_ADC_GPIO_NUM 33            // ADC1引脚（板载红色LED也接在GPIO33，需拆掉LED或换用其他ADC1引脚）
+#define BATTERY_DIVIDER_RATIO 2.0f         // 分压比（两个等值电阻时为2）
+// 电压阈值、每日能量预算和各等级的限制在 src/energy_util.h 中
+static_assert(ENERGY_SAVE_FRAMESIZE == FRAMESIZE_XGA && ENERGY_CRITICAL_FRAMESIZE == FRAMESIZE_SVGA, "分辨率上限与framesize_t不一致");
+const char* const energyLevelNames[] = {"正常", "省电", "极低"};
+
+// 各唤醒阶段的估计电流（毫安），顺序与 WakePhase 一致；乘以实测的阶段用时得到每次唤醒的耗电
+const float wakePhaseCurrentMa[WAKE_PHASE_COUNT] = {
+  0, 60, 120, 100, 160, 120, 90, 170, 60, 180, 130, 60, 80, 160
+};
+
+EnergyPolicy energyPolicy = {ENERGY_NORMAL, (uint32_t)(SLEEP_DURATION_US / 1000000), 30000, true, true, FRAMESIZE_UXGA};
+
+RTC_DATA_ATTR uint8_t energyLevel = ENERGY_NORMAL;
+RTC_DATA_ATTR float energyWakeMah = 0;      // 定时唤醒平均耗电（指数滑动平均）
+RTC_DATA_ATTR uint32_t batteryMv = 0;       // 最近一次测得的电池电压
+
+// 离线模式：WiFi连接失败时继续按计划拍照（使用RTC维持的时间），重连按唤醒次数指数退避
+#define OFFLINE_MAX_SKIP_WAKES 16          // 重连失败后最多跳过的唤醒次数（指数退避上限）
+#define OFFLINE_PORTAL_EVERY_WAKES 6       // 离线时每N次唤醒开启一次配置热点
+#define OFFLINE_PORTAL_WINDOW_MS 60000     // 定时开启的配置热点持续时间
+#define TIME_VALID_AFTER 1700000000        // 早于此时间（2023-11）视为时钟未设置
+
+RTC_DATA_ATTR uint32_t offlineFailStreak = 0;   // 连续重连失败次数
+RTC_DATA_ATTR uint32_t offlineSkipWakes = 0;    // 还要跳过的唤醒次数
+RTC_DATA_ATTR uint32_t offlineWakes = 0;        // 本次离线期间的唤醒次数
+RTC_DATA_ATTR uint32_t offlineFrames = 0;       // 本次离线期间拍摄的照片数
+RTC_DATA_ATTR uint32_t offlineLastFrames = 0;   // 上次离线期间拍摄的照片数（恢复联网后显示）
+RTC_DATA_ATTR uint32_t offlineLastWakes = 0;
+RTC_DATA_ATTR uint32_t portalTotalMs = 0;       // 配置热点累计开启时间
+
 // 配置标志
 bool wifiConfigured = false;
 
-void setup() {
-  Serial.begin(115200);
-  delay(1000);  // 等待串口稳定
-  Serial.setDebugOutput(true);
-  Serial.println("\n\nESP32-CAM 定时拍摄程序启动");
-  Serial.flush();
+// SD卡是否已挂载（日志持久化等后台功能据此判断能否访问SD卡）
+bool sdReady = false;
 
-  // 初始化Preferences
-  preferences.begin("wifi-config", false);
-  
-  // 读取保存的WiFi配置
-  wifi_ssid = preferences.getString("ssid", "");
-  wifi_password = preferences.getString("password", "");
+// SD卡访问锁：Web请求在服务器任务中处理，需要与主任务的拍照写卡互斥
+SemaphoreHandle_t sdMutex = NULL;
 
-  // 检查是否已配置WiFi
-  if (wifi_ssid.length() == 0) {
-    Serial.println("未检测到WiFi配置，进入配置模式...");
-    startConfigMode();
-    return;  // 配置模式不会返回
+struct SdLock {
+  SdLock() {
+    if (sdMutex != NULL) xSemaphoreTakeRecursive(sdMutex, portMAX_DELAY);
+  }
+  ~SdLock() {
+    if (sdMutex != NULL) xSemaphoreGiveRecursive(sdMutex);
   }
+};
 
-  Serial.printf("读取到保存的WiFi配置: %s\n", wifi_ssid.c_str());
+// ==================== 日志系统 ====================
+// 日志级别（数值越大越详细）
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
 
-  // 初始化相机
-  if (!initCamera()) {
-    Serial.println("相机初始化失败！");
-    goToSleep();
-    return;
-  }
+// 编译期日志级别：高于此级别的日志调用在编译时整体移除（不格式化、不占代码空间）
+// 调试时可在 platformio.ini 的 build_flags 中加入 -DLOG_LEVEL=4 打开DEBUG日志
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
 
-  // 初始化SD卡
-  if (!initSDCard()) {
-    Serial.println("SD卡初始化失败！");
-    goToSleep();
-    return;
-  }
+// 日志环形缓冲区大小（字节，必须是2的幂），由低优先级任务异步输出到串口
+#define LOG_RING_SIZE 8192
+// 单条日志最大长度（超出部分截断）
+#define LOG_LINE_MAX 256
+// 是否将日志持久化到SD卡（/logs/log.txt，超过LOG_FILE_MAX_SIZE后轮转为log.1.txt）
+#define LOG_TO_SD 1
+#define LOG_FILE_MAX_SIZE (64 * 1024)
+#define LOG_SD_STAGING_SIZE 4096
+#define LOG_DIR "/logs"
+#define LOG_FILE "/logs/log.txt"
+#define LOG_FILE_OLD "/logs/log.1.txt"
 
-  // 连接Wi-Fi
-  if (!connectWiFi()) {
-    Serial.println("Wi-Fi连接失败！进入配置模式...");
-    startConfigMode();
-    return;
-  }
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOGE(fmt, ...) logWrite('E', fmt, ##__VA_ARGS__)
+#else
+#define LOGE(fmt, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOGW(fmt, ...) logWrite('W', fmt, ##__VA_ARGS__)
+#else
+#define LOGW(fmt, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOGI(fmt, ...) logWrite('I', fmt, ##__VA_ARGS__)
+#else
+#define LOGI(fmt, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOGD(fmt, ...) logWrite('D', fmt, ##__VA_ARGS__)
+#else
+#define LOGD(fmt, ...) do {} while (0)
+#endif
 
-  // 同步NTP时间
-  if (!syncTime()) {
-    Serial.println("时间同步失败！");
-    goToSleep();
-    return;
-  }
+// 单生产者/单消费者环形缓冲区，head/tail为自由增长的计数，取模得到下标
+struct LogRing {
+  char* buf;
+  uint32_t size;
+  std::atomic<uint32_t> head;  // 写入位置（生产者推进）
+  std::atomic<uint32_t> tail;  // 读取位置（消费者推进）
+};
 
-  // 所有初始化完成，闪光灯闪烁3次表示就绪
-  Serial.println("所有初始化完成，系统就绪！");
-  Serial.flush();
-  flashLED(3, 200);  // 闪烁3次，每次200ms
+static char logRingBuf[LOG_RING_SIZE];
+static LogRing logRing = {logRingBuf, LOG_RING_SIZE, {0}, {0}};
+#if LOG_TO_SD
+// 输出任务把已经打到串口的日志再放进这里，由主任务在安全的时机写入SD卡
+static char logSdBuf[LOG_SD_STAGING_SIZE];
+static LogRing logSdRing = {logSdBuf, LOG_SD_STAGING_SIZE, {0}, {0}};
+#endif
 
-  // 启动Web服务器（用于查看状态、浏览照片和重新配置）
-  server.on("/", handleStatus);
-  server.on("/config", handleRoot);
-  server.on("/save", HTTP_POST, handleSave);
-  server.on("/reset", handleReset);
-  server.on("/photos", handlePhotos);  // 照片列表页面
-  server.on("/photo", handlePhoto);    // 查看/下载单个照片
-  server.on("/delete", HTTP_GET, handleDelete);  // 删除照片
-  server.on("/test", []() {  // 测试路由
-    server.send(200, "text/plain", "Web服务器正常工作！");
-  });
-  server.onNotFound(handleNotFound);
-  server.begin();
-  Serial.printf("Web服务器已启动！\n");
-  Serial.printf("访问地址: http://%s/\n", WiFi.localIP().toString().c_str());
-  Serial.printf("照片浏览: http://%s/photos\n", WiFi.localIP().toString().c_str());
-  Serial.printf("测试页面: http://%s/test\n", WiFi.localIP().toString().c_str());
-  Serial.flush();
+// 多个任务都可能写日志：生产者之间用临界区保护（只包住一次memcpy），与输出任务之间无锁
+static portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t logTaskHandle = NULL;
 
-  // 检查唤醒原因
-  esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
-  
-  if (wakeup_reason == ESP_SLEEP_WAKEUP_UNDEFINED) {
-    // 首次上电（不是深度睡眠唤醒）
-    Serial.println("首次上电，拍摄第一张照片...");
-    Serial.flush();
-    
-    // 拍摄第一张照片
-    captureAndSavePhoto();
-    
-    // 保持10分钟不休眠（只是等待，不进入深度睡眠）
-    Serial.println("首次上电，保持10分钟不休眠...");
-    Serial.println("在此期间，可以通过Web界面访问设备");
-    Serial.printf("Web服务器地址: http://%s\n", WiFi.localIP().toString().c_str());
-    Serial.flush();
-    
-    // 等待10分钟，但需要处理Web服务器请求
-    unsigned long waitTime = SLEEP_DURATION_US / 1000;  // 转换为毫秒
-    unsigned long startTime = millis();
-    unsigned long elapsedTime = 0;
-    unsigned long lastPrintTime = 0;
-    
-    while (elapsedTime < waitTime) {
-      // 处理Web服务器请求（重要：让Web服务器能够响应）
-      server.handleClient();
-      
-      // 非阻塞延迟
-      delay(100);
-      
-      elapsedTime = millis() - startTime;
-      unsigned long remaining = (waitTime - elapsedTime) / 1000;
-      
-      // 每分钟打印一次剩余时间
-      if (remaining != lastPrintTime && remaining % 60 == 0 && remaining > 0) {
-        Serial.printf("首次上电等待中，剩余时间: %lu 分钟\n", remaining / 60);
-        Serial.flush();
-        lastPrintTime = remaining;
-      }
-    }
-    
-    Serial.println("首次上电10分钟等待完成，现在进入正常休眠循环模式...");
-    Serial.flush();
-  } else {
-    // 深度睡眠唤醒，正常模式
-    Serial.println("深度睡眠唤醒，正常拍摄模式");
-    Serial.printf("Web服务器已启动，可以通过以下地址访问:\n");
-    Serial.printf("主页: http://%s/\n", WiFi.localIP().toString().c_str());
-    Serial.printf("照片浏览: http://%s/photos\n", WiFi.localIP().toString().c_str());
-    Serial.flush();
-    
-    // 深度睡眠唤醒后，给Web服务器一些时间处理请求（30秒）
-    Serial.println("深度睡眠唤醒后，Web服务器将运行30秒供访问...");
-    unsigned long webTime = 30000;  // 30秒
-    unsigned long webStart = millis();
-    while (millis() - webStart < webTime) {
-      server.handleClient();
-      delay(100);
-    }
-    Serial.println("30秒Web服务器访问时间结束，开始拍摄照片...");
-    Serial.flush();
+// 日志统计（用于评估异步日志节省的时间）
+static uint32_t logLines = 0;       // 写入的日志条数
+static uint32_t logBytes = 0;       // 写入的日志字节数
+static uint32_t logDropped = 0;     // 缓冲区满被丢弃的条数
+static uint32_t logSdDropped = 0;   // SD暂存区满被丢弃的字节数
+static uint32_t logCallMicros = 0;  // 日志调用本身的总耗时
+static uint32_t logSerialBytes = 0;   // 输出任务写到串口的字节数
+static uint32_t logSerialMicros = 0;  // 输出任务写串口并等待发送完成的实测耗时（同步输出时由调用者承担）
+
+// 写入环形缓冲区，空间不足时整条丢弃（不阻塞调用者）
+bool logRingPush(LogRing& r, const char* data, uint32_t len) {
+  uint32_t head = r.head.load(std::memory_order_relaxed);
+  uint32_t tail = r.tail.load(std::memory_order_acquire);
+  if (r.size - (head - tail) < len) {
+    return false;
   }
+  uint32_t idx = head & (r.size - 1);
+  uint32_t first = min(len, r.size - idx);
+  memcpy(r.buf + idx, data, first);
+  memcpy(r.buf, data + first, len - first);
+  r.head.store(head + len, std::memory_order_release);
+  return true;
+}
 
-  // 拍摄照片
-  captureAndSavePhoto();
+// 返回可连续读取的一段数据（不跨越缓冲区末尾）
+uint32_t logRingPeek(LogRing& r, const char** data) {
+  uint32_t tail = r.tail.load(std::memory_order_relaxed);
+  uint32_t head = r.head.load(std::memory_order_acquire);
+  uint32_t idx = tail & (r.size - 1);
+  *data = r.buf + idx;
+  return min(head - tail, r.size - idx);
+}
 
-  // 进入深度睡眠前，给Web服务器一些时间处理请求
-  Serial.println("进入深度睡眠10分钟...");
-  Serial.printf("深度睡眠期间Web服务器将停止，唤醒后会重新启动\n");
-  Serial.printf("如需访问Web界面，请在设备唤醒后立即访问: http://%s\n", WiFi.localIP().toString().c_str());
-  Serial.flush();
-  
-  // 在进入深度睡眠前，处理一些Web请求（最多等待5秒）
-  unsigned long sleepDelay = 5000;  // 给5秒时间处理Web请求
-  unsigned long startDelay = millis();
-  while (millis() - startDelay < sleepDelay) {
-    server.handleClient();
-    delay(100);
-  }
-  
-  delay(500);  // 确保所有输出都发送完毕
-  goToSleep();
+void logRingConsume(LogRing& r, uint32_t len) {
+  r.tail.store(r.tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
 }
 
-void loop() {
-  // 处理Web服务器请求（配置模式和正常模式都处理）
-  server.handleClient();
-  delay(10);
-  
-  // 注意：正常模式下，setup函数执行完会进入深度睡眠，所以loop不会运行
-  // 但在首次上电等待10分钟期间，loop会运行，可以处理web请求
+// 日志输出任务：把缓冲区内容写到串口，阻塞只发生在这个低优先级任务里
+void logDrainTask(void* param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    const char* data;
+    uint32_t len;
+    while ((len = logRingPeek(logRing, &data)) > 0) {
+      // 等待发送完成再计时，得到的就是以前同步输出（write + flush）时调用者被阻塞的时间
+      uint32_t start = micros();
+      Serial.write((const uint8_t*)data, len);
+      Serial.flush();
+      logSerialMicros += micros() - start;
+      logSerialBytes += len;
+#if LOG_TO_SD
+      if (!logRingPush(logSdRing, data, len)) {
+        logSdDropped += len;
+      }
+#endif
+      logRingConsume(logRing, len);
+    }
+  }
 }
 
-bool initCamera() {
-  camera_config_t config;
-  config.ledc_channel = LEDC_CHANNEL_0;
-  config.ledc_timer = LEDC_TIMER_0;
-  config.pin_d0 = Y2_GPIO_NUM;
-  config.pin_d1 = Y3_GPIO_NUM;
-  config.pin_d2 = Y4_GPIO_NUM;
-  config.pin_d3 = Y5_GPIO_NUM;
-  config.pin_d4 = Y6_GPIO_NUM;
-  config.pin_d5 = Y7_GPIO_NUM;
-  config.pin_d6 = Y8_GPIO_NUM;
-  config.pin_d7 = Y9_GPIO_NUM;
-  config.pin_xclk = XCLK_GPIO_NUM;
-  config.pin_pclk = PCLK_GPIO_NUM;
-  config.pin_vsync = VSYNC_GPIO_NUM;
-  config.pin_href = HREF_GPIO_NUM;
-  config.pin_sscb_sda = SIOD_GPIO_NUM;
-  config.pin_sscb_scl = SIOC_GPIO_NUM;
-  config.pin_pwdn = PWDN_GPIO_NUM;
-  config.pin_reset = RESET_GPIO_NUM;
-  config.xclk_freq_hz = 20000000;
-  config.pixel_format = PIXFORMAT_JPEG;
+// 启动日志输出任务（优先级1，低于Arduino主任务）
+void logInit() {
+  if (logTaskHandle == NULL) {
+    xTaskCreate(logDrainTask, "log", 3072, NULL, 1, &logTaskHandle);
+  }
+}
 
-  // 高分辨率设置 - UXGA (1600x1200)
-  config.frame_size = FRAMESIZE_UXGA;
-  config.jpeg_quality = JPEG_QUALITY;  // 使用宏定义的质量值 (0-63，数值越小质量越高)
-  config.fb_count = 1;
+// 格式化一条日志并放入缓冲区，格式：[级别][毫秒] 内容
+void logWrite(char level, const char* fmt, ...) {
+  uint32_t start = micros();
+  char line[LOG_LINE_MAX];
+  int n = snprintf(line, sizeof(line), "[%c][%7lu] ", level, millis());
+  va_list args;
+  va_start(args, fmt);
+  int m = vsnprintf(line + n, sizeof(line) - n - 1, fmt, args);
+  va_end(args);
+  n += (m < 0) ? 0 : min(m, (int)(sizeof(line) - n - 2));
+  line[n++] = '\n';
 
-  // 如果PSRAM可用，使用更大的缓冲区
-  if (psramFound()) {
-    config.fb_count = 2;
-    config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+  portENTER_CRITICAL(&logMux);
+  bool ok = logRingPush(logRing, line, n);
+  if (ok) {
+    logLines++;
+    logBytes += n;
   } else {
-    // 如果没有PSRAM，降低分辨率
-    config.frame_size = FRAMESIZE_SVGA;
-    config.fb_count = 1;
+    logDropped++;
   }
+  logCallMicros += micros() - start;
+  portEXIT_CRITICAL(&logMux);
 
-  // 初始化相机
-  esp_err_t err = esp_camera_init(&config);
-  if (err != ESP_OK) {
-    Serial.printf("相机初始化失败，错误代码: 0x%x\n", err);
-    return false;
+  if (logTaskHandle != NULL) {
+    xTaskNotifyGive(logTaskHandle);
   }
+}
 
-  // 获取相机传感器信息
-  sensor_t *s = esp_camera_sensor_get();
-  if (s != NULL) {
-    // 基础图像参数
-    s->set_brightness(s, 0);     // -2 to 2
-    s->set_contrast(s, 0);       // -2 to 2
-    s->set_saturation(s, 0);    // -2 to 2 (0=正常，负值降低饱和度，正值增加饱和度)
-    
-    // 确保特殊效果关闭（4=Green Tint，可能是偏绿的原因）
-    s->set_special_effect(s, 0); // 0 to 6 (0-No Effect, 1-Negative, 2-Grayscale, 3-Red Tint, 4-Green Tint, 5-Blue Tint, 6-Sepia)
-    
-    // 白平衡设置 - 改善偏绿问题
-    s->set_whitebal(s, 1);       // 0 = disable , 1 = enable (启用白平衡)
-    s->set_awb_gain(s, 1);       // 0 = disable , 1 = enable (启用自动白平衡增益)
-    // 白平衡模式：0-Auto, 1-Sunny(日光), 2-Cloudy(阴天), 3-Office(办公室), 4-Home(室内)
-    // 使用WB_MODE宏定义的值，默认使用日光模式改善偏绿问题
-    s->set_wb_mode(s, WB_MODE);
-    
-    // 曝光控制
-    s->set_exposure_ctrl(s, 1);  // 0 = disable , 1 = enable
-    s->set_aec2(s, 0);           // 0 = disable , 1 = enable (AEC2通常用于低光环境)
-    s->set_ae_level(s, 0);       // -2 to 2
-    s->set_aec_value(s, 300);    // 0 to 1200
-    
-    // 增益控制
-    s->set_gain_ctrl(s, 1);      // 0 = disable , 1 = enable
-    s->set_agc_gain(s, 0);       // 0 to 30
-    s->set_gainceiling(s, (gainceiling_t)0);  // 0 to 6
-    
-    // 图像处理
-    s->set_bpc(s, 0);            // 0 = disable , 1 = enable (黑像素校正)
-    s->set_wpc(s, 1);            // 0 = disable , 1 = enable (白像素校正) - 保持启用
-    s->set_raw_gma(s, 1);        // 0 = disable , 1 = enable (原始伽马校正)
-    s->set_lenc(s, 1);           // 0 = disable , 1 = enable (镜头校正)
-    s->set_dcw(s, 1);            // 0 = disable , 1 = enable (DCW - 降噪和色彩校正)
-    
-    // 其他设置
-    s->set_hmirror(s, 0);        // 0 = disable , 1 = enable (水平镜像)
-    s->set_vflip(s, 0);          // 0 = disable , 1 = enable (垂直翻转)
-    s->set_colorbar(s, 0);       // 0 = disable , 1 = enable (测试条)
-    
-    Serial.println("相机参数配置完成");
-    Serial.printf("JPEG质量: %d (0-63，数值越小质量越高)\n", JPEG_QUALITY);
-    Serial.printf("预计文件大小: %s\n", JPEG_QUALITY <= 8 ? "100-150KB (高质量)" : JPEG_QUALITY <= 10 ? "80-120KB (较高质量)" : "50-80KB (标准质量)");
-    const char* wbModeNames[] = {"Auto", "Sunny", "Cloudy", "Office", "Home"};
-    if (WB_MODE >= 0 && WB_MODE <= 4) {
-      Serial.printf("白平衡模式: %d (%s)\n", WB_MODE, wbModeNames[WB_MODE]);
-    } else {
-      Serial.printf("白平衡模式: %d (自定义)\n", WB_MODE);
+// 等待缓冲区中的日志全部写出（重启/休眠前调用）
+void logFlush(uint32_t timeoutMs) {
+  unsigned long start = millis();
+  const char* data;
+  while (logRingPeek(logRing, &data) > 0 && millis() - start < timeoutMs) {
+    if (logTaskHandle != NULL) {
+      xTaskNotifyGive(logTaskHandle);
     }
-    Serial.println("提示: 如需调整质量，修改代码中的JPEG_QUALITY值 (推荐范围: 8-12)");
-    Serial.flush();
+    delay(5);
   }
-
-  // 初始化闪光灯引脚（默认关闭）
-  pinMode(LED_GPIO_NUM, OUTPUT);
-  digitalWrite(LED_GPIO_NUM, LOW);
-  
-  Serial.println("相机初始化成功");
-  return true;
+  Serial.flush();
 }
 
-bool initSDCard() {
-  Serial.println("初始化SD卡...");
-  
-  // 尝试挂载SD卡，如果失败则重试一次
-  if (!SD_MMC.begin()) {
-    Serial.println("SD卡挂载失败，尝试重新挂载...");
-    delay(500);
-    if (!SD_MMC.begin()) {
-      Serial.println("SD卡挂载失败");
-      return false;
-    }
+// 把暂存的日志追加到SD卡日志文件（持有SD卡锁，不会与拍照写卡冲突）
+void logPersist() {
+#if LOG_TO_SD
+  if (!sdReady) {
+    return;
   }
-  
-  delay(200);  // 等待SD卡稳定
-
-  uint8_t cardType = SD_MMC.cardType();
-  if (cardType == CARD_NONE) {
-    Serial.println("未检测到SD卡");
-    return false;
+  const char* data;
+  if (logRingPeek(logSdRing, &data) == 0) {
+    return;
   }
 
-  Serial.print("SD卡类型: ");
-  if (cardType == CARD_MMC) {
-    Serial.println("MMC");
-  } else if (cardType == CARD_SD) {
-    Serial.println("SDSC");
-  } else if (cardType == CARD_SDHC) {
-    Serial.println("SDHC");
-  } else {
-    Serial.println("未知");
+  SdLock lock;
+  File file = SD_MMC.open(LOG_FILE, FILE_APPEND);
+  if (!file) {
+    SD_MMC.mkdir(LOG_DIR);
+    file = SD_MMC.open(LOG_FILE, FILE_APPEND);
+    if (!file) {
+      return;
+    }
   }
+  uint32_t len;
+  while ((len = logRingPeek(logSdRing, &data)) > 0) {
+    file.write((const uint8_t*)data, len);
+    logRingConsume(logSdRing, len);
+  }
+  size_t fileSize = file.size();
+  file.close();
 
-  uint64_t cardSize = SD_MMC.cardSize() / (1024 * 1024);
-  Serial.printf("SD卡大小: %lluMB\n", cardSize);
+  // 日志文件过大时轮转，只保留一个旧文件
+  if (fileSize > LOG_FILE_MAX_SIZE) {
+    SD_MMC.remove(LOG_FILE_OLD);
+    SD_MMC.rename(LOG_FILE, LOG_FILE_OLD);
+  }
+#endif
+}
 
-  return true;
+// 按输出任务实测的每字节串口耗时，换算输出len字节日志需要的同步等待时间（还没有输出过日志时返回0）
+uint32_t logSerialCostUs(uint32_t len) {
+  return logSerialBytes > 0 ? (uint32_t)((uint64_t)len * logSerialMicros / logSerialBytes) : 0;
 }
 
-bool connectWiFi() {
-  if (wifi_ssid.length() == 0) {
-    Serial.println("未配置WiFi");
-    return false;
+// 打印本次唤醒的日志统计
+// 以前每条日志后都调用 Serial.flush()，调用者要等串口发送完成；现在这段时间由输出任务实测并承担
+void logPrintStats() {
+  LOGI("日志统计: %lu 条, %lu 字节, 丢弃 %lu 条, 调用耗时 %lu us, 串口输出实测 %lu ms（%lu 字节，已不再阻塞调用者）",
+       logLines, logBytes, logDropped, logCallMicros, logSerialMicros / 1000, logSerialBytes);
+#if LOG_TO_SD
+  if (logSdDropped > 0) {
+    LOGW("SD日志暂存区溢出，丢弃 %lu 字节", logSdDropped);
   }
+#endif
+}
 
-  Serial.printf("正在连接Wi-Fi: %s\n", wifi_ssid.c_str());
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(wifi_ssid.c_str(), wifi_password.c_str());
+// ==================== Web服务器 ====================
+// 基于ESP-IDF自带的esp_http_server：服务器运行在独立任务中，用select()事件循环同时处理多个连接，
+// 支持HTTP/1.1 keep-alive（图库页面加载大量图片时复用同一个TCP连接），主流程不再需要轮询handleClient()。
+// 接口与Arduino WebServer保持一致（on/arg/send/sendHeader…），原有处理函数基本无需修改。
+// 处理函数在服务器任务中逐个执行，所以可以安全地保存"当前请求"的状态。
 
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
-  }
+#define HTTP_MAX_ROUTES 32       // 最多路由数
+#define HTTP_MAX_HEADERS 8       // 每个响应最多附加的头部数
+#define HTTP_MAX_ARGS 16         // 每个请求最多解析的参数数
+#define HTTP_MAX_BODY 4096       // 表单/JSON请求体最大长度
+#define HTTP_MAX_SOCKETS 7       // 同时打开的连接数（LWIP默认最多10个socket，留3个给其他用途）
+#define HTTP_CHUNK_SIZE 4096     // 文件分块发送大小
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define HTTP_ANY_METHOD ((httpd_method_t)-1)
 
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWi-Fi连接成功！");
-    Serial.print("IP地址: ");
-    Serial.println(WiFi.localIP());
-    return true;
-  } else {
-    Serial.println("\nWi-Fi连接失败");
-    return false;
+// 内存：访问窗口内反复malloc/free 4KB缓冲区和逐段增长的String会让内部RAM碎片化，
+// 最大空闲块小到WiFi缓冲区都分配不出来。改为：
+// - 文件读写/分块发送的缓冲区来自启动时一次分配好的固定缓冲池（内部RAM，SD卡DMA可直接读入）
+// - 每个请求的临时数据（参数解析、缩略图等）从PSRAM中的请求内存区按顺序分配，响应结束时整体清空
+// - 大页面边生成边分块发送，不再拼成一个大String
+#define IO_POOL_BUFFERS 3            // 缓冲池中的缓冲区数（两个服务器任务各一个，另留一个给同时读文件和生成页面的请求）
+#define HTTP_ARENA_SIZE (16 * 1024)  // 每个服务器实例的请求内存区（PSRAM）
+#define HTTP_ARENA_OVERFLOW 4        // 请求内存区不够时额外分配、响应结束时释放的块数
+#define HEAP_SAMPLE_INTERVAL_MS 10000  // 访问窗口内记录内存状态的间隔
+#define HEAP_SAMPLE_COUNT 60           // 保留的记录数（10秒间隔约10分钟，覆盖首次上电的访问时间）
+
+// 内存统计：缓冲池和请求内存区每满足一次请求就少一对malloc/free
+struct MemStats {
+  std::atomic<uint32_t> poolHits;       // 由缓冲池提供的缓冲区
+  std::atomic<uint32_t> poolMisses;     // 缓冲池用完，临时malloc
+  std::atomic<uint32_t> arenaAllocs;    // 由请求内存区提供的分配
+  std::atomic<uint32_t> arenaOverflows; // 请求内存区不够，临时分配
+  std::atomic<uint32_t> arenaPeak;      // 单个请求使用请求内存区的最大字节数
+  std::atomic<uint32_t> streamedBytes;  // 分块发送的页面字节数（以前整页拼在String里）
+};
+MemStats memStats;
+
+struct HeapSample {
+  uint32_t ms;
+  uint32_t internalFree, internalLargest;
+  uint32_t psramFree, psramLargest;
+};
+HeapSample heapSamples[HEAP_SAMPLE_COUNT];
+uint32_t heapSampleCount = 0;  // 已记录的总数（环形保存最近HEAP_SAMPLE_COUNT条）
+unsigned long heapLastSampleMs = 0;
+
+uint8_t* ioPoolBuffers[IO_POOL_BUFFERS];
+std::atomic<uint32_t> ioPoolFreeMask(0);  // 第i位为1表示第i个缓冲区空闲
+
+// 启动时（碎片化之前）分配缓冲池
+void ioPoolInit() {
+  uint32_t mask = 0;
+  for (int i = 0; i < IO_POOL_BUFFERS; i++) {
+    ioPoolBuffers[i] = (uint8_t*)heap_caps_malloc(HTTP_CHUNK_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    if (ioPoolBuffers[i] != NULL) {
+      mask |= 1UL << i;
+    }
   }
+  ioPoolFreeMask = mask;
+  LOGD("缓冲池: %d x %d 字节", __builtin_popcount(mask), HTTP_CHUNK_SIZE);
 }
 
-// 配置模式：创建AP和Web服务器
-void startConfigMode() {
-  wifiConfigured = false;
-  
-  Serial.println("启动配置模式...");
-  Serial.printf("AP SSID: %s\n", ap_ssid);
-  Serial.printf("AP Password: %s\n", ap_password);
-  
-  // 创建AP
-  WiFi.mode(WIFI_AP);
-  WiFi.softAP(ap_ssid, ap_password);
+// 从缓冲池取一个HTTP_CHUNK_SIZE大小的缓冲区（用完时临时malloc），离开作用域时归还
+class IoBuffer {
+public:
+  IoBuffer() { acquire(); }
+  explicit IoBuffer(bool acquireNow) {
+    if (acquireNow) acquire();
+  }
+  ~IoBuffer() { release(); }
+
+  bool acquire() {
+    if (_data != NULL) {
+      return true;
+    }
+    uint32_t mask = ioPoolFreeMask.load();
+    while (mask != 0) {
+      int i = __builtin_ctz(mask);
+      if (ioPoolFreeMask.compare_exchange_weak(mask, mask & ~(1UL << i))) {
+        _slot = i;
+        _data = ioPoolBuffers[i];
+        memStats.poolHits++;
+        return true;
+      }
+    }
+    _data = (uint8_t*)malloc(HTTP_CHUNK_SIZE);
+    memStats.poolMisses++;
+    return _data != NULL;
+  }
+
+  void release() {
+    if (_slot >= 0) {
+      ioPoolFreeMask |= 1UL << _slot;
+    } else {
+      free(_data);
+    }
+    _data = NULL;
+    _slot = -1;
+  }
+
+  IoBuffer(const IoBuffer&) = delete;
+  IoBuffer& operator=(const IoBuffer&) = delete;
+
+  uint8_t* data() { return _data; }
+  size_t size() const { return HTTP_CHUNK_SIZE; }
+  explicit operator bool() const { return _data != NULL; }
+
+private:
+  uint8_t* _data = NULL;
+  int _slot = -1;
+};
+
+// 记录一次内存状态（距上次不到HEAP_SAMPLE_INTERVAL_MS且不强制时跳过）
+void heapSample(bool force) {
+  unsigned long now = millis();
+  if (!force && heapSampleCount > 0 && now - heapLastSampleMs < HEAP_SAMPLE_INTERVAL_MS) {
+    return;
+  }
+  heapLastSampleMs = now;
+  HeapSample& h = heapSamples[heapSampleCount % HEAP_SAMPLE_COUNT];
+  h.ms = now;
+  h.internalFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  h.internalLargest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+  h.psramFree = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+  h.psramLargest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+  heapSampleCount++;
+}
+
+class HttpServer {
+public:
+  typedef void (*Handler)();
+
+  HttpServer(uint16_t port) : _port(port) {}
+
+  // 注册路由（不指定方法时同时接受GET和POST，与WebServer行为一致）
+  void on(const char* uri, Handler handler) {
+    on(uri, HTTP_ANY_METHOD, handler);
+  }
+
+  void on(const char* uri, httpd_method_t method, Handler handler) {
+    if (_routeCount >= HTTP_MAX_ROUTES) {
+      LOGE("路由数量超过上限: %s", uri);
+      return;
+    }
+    Route& r = _routes[_routeCount++];
+    r.server = this;
+    r.uri = uri;
+    r.method = method;
+    r.handler = handler;
+  }
+
+  void onNotFound(Handler handler) {
+    _notFound = handler;
+  }
+
+  bool begin() {
+    if (_arena == NULL && psramFound()) {
+      _arena = (uint8_t*)ps_malloc(HTTP_ARENA_SIZE);  // 只分配一次，服务器重启时复用
+    }
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = _port;
+    config.stack_size = 8192;
+    config.max_open_sockets = HTTP_MAX_SOCKETS;
+    config.max_uri_handlers = HTTP_MAX_ROUTES * 2;
+    config.max_resp_headers = HTTP_MAX_HEADERS;
+    config.lru_purge_enable = true;  // 连接占满时关闭最久未使用的keep-alive连接
+    config.ctrl_port = 32768 + _port;  // 多个服务器实例需要不同的控制端口
+    config.global_user_ctx = this;     // 404处理时据此找到对应的服务器实例
+    config.global_user_ctx_free_fn = noFree;
+    if (httpd_start(&_handle, &config) != ESP_OK) {
+      LOGE("Web服务器启动失败");
+      _handle = NULL;
+      return false;
+    }
+
+    for (int i = 0; i < _routeCount; i++) {
+      Route& r = _routes[i];
+      httpd_uri_t uri = {};
+      uri.uri = r.uri;
+      uri.handler = dispatch;
+      uri.user_ctx = &r;
+      if (r.method == HTTP_ANY_METHOD) {
+        uri.method = HTTP_GET;
+        httpd_register_uri_handler(_handle, &uri);
+        uri.method = HTTP_POST;
+        httpd_register_uri_handler(_handle, &uri);
+      } else {
+        uri.method = r.method;
+        httpd_register_uri_handler(_handle, &uri);
+      }
+    }
+    httpd_register_err_handler(_handle, HTTPD_404_NOT_FOUND, notFoundDispatch);
+    return true;
+  }
+
+  void stop() {
+    if (_handle != NULL) {
+      httpd_stop(_handle);
+      _handle = NULL;
+    }
+  }
+
+  // ---- 请求 ----
+  String uri() {
+    return _req ? String(_req->uri) : String();
+  }
+
+  httpd_req_t* request() {
+    return _req;
+  }
+
+  bool hasArg(const String& name) {
+    return findArg(name.c_str()) >= 0;
+  }
+
+  // 返回已解码的参数值；"plain"返回原始请求体（与WebServer一致）
+  String arg(const String& name) {
+    int i = findArg(name.c_str());
+    return i >= 0 ? String(_argValues[i]) : String();
+  }
+
+  // 同arg()，但直接返回请求内存区中的值（不分配String，响应结束前有效）；没有该参数时返回NULL
+  const char* argValue(const char* name) {
+    int i = findArg(name);
+    return i >= 0 ? _argValues[i] : NULL;
+  }
+
+  // ---- 响应 ----
+  void sendHeader(const String& name, const String& value, bool first = false) {
+    if (_headerCount < HTTP_MAX_HEADERS) {
+      _headerNames[_headerCount] = name;
+      _headerValues[_headerCount] = value;
+      _headerCount++;
+    }
+  }
+
+  // 设为CONTENT_LENGTH_UNKNOWN时使用分块传输，之后用sendContent()发送内容，以sendContent("")结束
+  void setContentLength(size_t length) {
+    _chunked = (length == CONTENT_LENGTH_UNKNOWN);
+  }
+
+  void send(int code, const char* contentType, const String& content) {
+    if (_req == NULL) {
+      return;
+    }
+    beginResponse(code, contentType);
+    if (_chunked) {
+      if (content.length() > 0) {
+        sendContent(content);
+      }
+      return;
+    }
+    httpd_resp_send(_req, content.c_str(), content.length());
+    _done = true;
+  }
+
+  void sendContent(const String& content) {
+    sendContent(content.c_str(), content.length());
+  }
+
+  bool sendContent(const char* data, size_t length) {
+    if (_req == NULL || _done) {
+      return false;
+    }
+    flushOutput();
+    esp_err_t err = httpd_resp_send_chunk(_req, length > 0 ? data : NULL, length);
+    if (length == 0 || err != ESP_OK) {
+      _done = true;
+    }
+    return err == ESP_OK;
+  }
+
+  // 分块传输时追加页面内容：先攒到缓冲池的缓冲区中，满了再作为一块发送（生成大页面时不必拼接整页String）
+  void print(const char* data, size_t length) {
+    if (_req == NULL || _done || !_chunked) {
+      return;
+    }
+    if (!_out.acquire()) {
+      httpd_resp_send_chunk(_req, data, length);  // 内存不足时直接发送
+      return;
+    }
+    while (length > 0) {
+      size_t n = std::min(length, _out.size() - _outLen);
+      memcpy(_out.data() + _outLen, data, n);
+      _outLen += n;
+      data += n;
+      length -= n;
+      if (_outLen == _out.size()) {
+        flushOutput();
+      }
+    }
+  }
+
+  void print(const char* str) {
+    print(str, strlen(str));
+  }
+
+  void print(const String& content) {
+    print(content.c_str(), content.length());
+  }
+
+  // 请求内的临时内存：从请求内存区按顺序分配，响应结束后自动释放（不需要也不能free）
+  void* scratch(size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (_arena != NULL && _arenaUsed + size <= HTTP_ARENA_SIZE) {
+      void* p = _arena + _arenaUsed;
+      _arenaUsed += size;
+      memStats.arenaAllocs++;
+      return p;
+    }
+    if (_overflowCount >= HTTP_ARENA_OVERFLOW) {
+      return NULL;
+    }
+    void* p = psramFound() ? ps_malloc(size) : malloc(size);
+    if (p != NULL) {
+      _overflow[_overflowCount++] = p;
+      memStats.arenaOverflows++;
+    }
+    return p;
+  }
+
+  // 分块发送文件内容，返回实际发送的字节数（调用前可以先sendHeader()）
+  // 只在读每一块时持有SD卡锁，发送时释放：客户端很慢时也不会挡住拍照写卡和其他请求
+  size_t streamFile(File& file, const char* contentType) {
+    setContentLength(CONTENT_LENGTH_UNKNOWN);
+    send(200, contentType, "");
+
+    IoBuffer buffer;
+    if (!buffer) {
+      LOGE("错误: 内存分配失败");
+      sendContent("", 0);
+      return 0;
+    }
+
+    size_t totalSent = 0;
+    while (true) {
+      size_t bytesRead;
+      {
+        SdLock lock;
+        bytesRead = file.read(buffer.data(), buffer.size());
+      }
+      if (bytesRead == 0) {
+        break;
+      }
+      if (!sendContent((const char*)buffer.data(), bytesRead)) {
+        LOGW("警告: 客户端断开，已发送 %zu 字节", totalSent);
+        break;
+      }
+      totalSent += bytesRead;
+    }
+    sendContent("", 0);
+    return totalSent;
+  }
+
+  // 请求处理统计（访问窗口结束时用于估计延迟和射频开启时间）
+  struct Stats {
+    uint32_t requests;
+    uint64_t busyUs;   // 处理请求的总时间（期间射频一直开启）
+    uint32_t maxUs;
+  };
+  Stats stats() const { return _stats; }
+  void resetStats() { _stats = Stats{0, 0, 0}; }
+
+private:
+  struct Route {
+    HttpServer* server;
+    const char* uri;
+    httpd_method_t method;
+    Handler handler;
+  };
+
+  static esp_err_t dispatch(httpd_req_t* req) {
+    Route* r = (Route*)req->user_ctx;
+    r->server->handle(req, r->handler);
+    return ESP_OK;
+  }
+
+  static esp_err_t notFoundDispatch(httpd_req_t* req, httpd_err_code_t err) {
+    HttpServer* self = (HttpServer*)httpd_get_global_user_ctx(req->handle);
+    if (self == NULL || self->_notFound == NULL) {
+      httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+      return ESP_OK;
+    }
+    self->handle(req, self->_notFound);
+    return ESP_OK;
+  }
+
+  // 服务器实例是全局对象，httpd停止时不能释放它
+  static void noFree(void* ctx) {}
+
+  void handle(httpd_req_t* req, Handler handler) {
+    unsigned long start = micros();
+    _req = req;
+    _done = false;
+    _chunked = false;
+    _headerCount = 0;
+    _argCount = 0;
+    parseQuery();
+    parseBody();
+
+    handler();
+
+    // 处理函数开始了分块传输却没有结束时，补上结束块
+    if (_chunked && !_done) {
+      flushOutput();
+      httpd_resp_send_chunk(_req, NULL, 0);
+    }
+    releaseOutput();
+    releaseScratch();
+    uint32_t elapsed = micros() - start;
+    _stats.requests++;
+    _stats.busyUs += elapsed;
+    _stats.maxUs = std::max(_stats.maxUs, elapsed);
+    LOGD("HTTP %s 处理耗时 %lu us", req->uri, elapsed);
+    _req = NULL;
+    _argCount = 0;  // 参数指向请求内存区，不需要释放
+    for (int i = 0; i < _headerCount; i++) {
+      _headerNames[i] = String();
+      _headerValues[i] = String();
+    }
+  }
+
+  // 发送print()攒下的内容
+  void flushOutput() {
+    if (_out && _outLen > 0) {
+      if (httpd_resp_send_chunk(_req, (const char*)_out.data(), _outLen) != ESP_OK) {
+        _done = true;  // 客户端已断开，之后的print()直接丢弃
+      }
+      memStats.streamedBytes += _outLen;
+      _outLen = 0;
+    }
+  }
+
+  void releaseOutput() {
+    _out.release();
+    _outLen = 0;
+  }
+
+  void releaseScratch() {
+    if (_arenaUsed > memStats.arenaPeak) {
+      memStats.arenaPeak = _arenaUsed;
+    }
+    _arenaUsed = 0;
+    for (int i = 0; i < _overflowCount; i++) {
+      free(_overflow[i]);
+    }
+    _overflowCount = 0;
+  }
+
+  void beginResponse(int code, const char* contentType) {
+    httpd_resp_set_status(_req, statusText(code));
+    _contentType = contentType;
+    httpd_resp_set_type(_req, _contentType.c_str());
+    for (int i = 0; i < _headerCount; i++) {
+      if (_headerNames[i].equalsIgnoreCase("Content-Type")) {
+        continue;  // 由httpd_resp_set_type设置
+      }
+      httpd_resp_set_hdr(_req, _headerNames[i].c_str(), _headerValues[i].c_str());
+    }
+  }
+
+  static const char* statusText(int code) {
+    switch (code) {
+      case 200: return "200 OK";
+      case 204: return "204 No Content";
+      case 206: return "206 Partial Content";
+      case 302: return "302 Found";
+      case 304: return "304 Not Modified";
+      case 400: return "400 Bad Request";
+      case 404: return "404 Not Found";
+      case 409: return "409 Conflict";
+      case 413: return "413 Payload Too Large";
+      case 503: return "503 Service Unavailable";
+      default: return "500 Internal Server Error";
+    }
+  }
+
+  int findArg(const char* name) {
+    for (int i = 0; i < _argCount; i++) {
+      if (strcmp(_argNames[i], name) == 0) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void addArg(const char* name, const char* value) {
+    if (_argCount < HTTP_MAX_ARGS) {
+      _argNames[_argCount] = name;
+      _argValues[_argCount] = value;
+      _argCount++;
+    }
+  }
+
+  // 解析 a=1&b=2 形式的参数：在请求内存区中原地解码，参数直接指向解码结果（str[len]须可写）
+  void parseArgs(char* str, size_t len) {
+    size_t pos = 0;
+    const char* name;
+    const char* value;
+    while (queryNext(str, len, pos, name, value)) {
+      addArg(name, value);
+    }
+  }
+
+  void parseQuery() {
+    size_t len = httpd_req_get_url_query_len(_req);
+    if (len == 0) {
+      return;
+    }
+    char* query = (char*)scratch(len + 1);
+    if (query == NULL) {
+      return;
+    }
+    if (httpd_req_get_url_query_str(_req, query, len + 1) == ESP_OK) {
+      parseArgs(query, len);
+    }
+  }
+
+  void parseBody() {
+    size_t len = _req->content_len;
+    if (len == 0 || len > HTTP_MAX_BODY) {
+      return;
+    }
+    // 前一半保存原始请求体（"plain"），后一半复制一份用于原地解码表单参数
+    char* body = (char*)scratch(2 * (len + 1));
+    if (body == NULL) {
+      return;
+    }
+    size_t received = 0;
+    while (received < len) {
+      int n = httpd_req_recv(_req, body + received, len - received);
+      if (n == HTTPD_SOCK_ERR_TIMEOUT) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      received += n;
+    }
+    body[received] = '\0';
+    char* form = body + received + 1;
+    memcpy(form, body, received + 1);
+    addArg("plain", body);
+    parseArgs(form, received);
+  }
+
+  uint16_t _port;
+  httpd_handle_t _handle = NULL;
+  Route _routes[HTTP_MAX_ROUTES];
+  int _routeCount = 0;
+  Handler _notFound = NULL;
+  Stats _stats = {0, 0, 0};
+
+  httpd_req_t* _req = NULL;
+  bool _chunked = false;
+  bool _done = false;
+  String _contentType;
+  String _headerNames[HTTP_MAX_HEADERS];
+  String _headerValues[HTTP_MAX_HEADERS];
+  int _headerCount = 0;
+  const char* _argNames[HTTP_MAX_ARGS];   // 指向请求内存区中已解码的参数
+  const char* _argValues[HTTP_MAX_ARGS];
+  int _argCount = 0;
+  IoBuffer _out{false};  // print()的发送缓冲区（第一次print()时从缓冲池取，响应结束归还）
+  size_t _outLen = 0;
+  uint8_t* _arena = NULL;  // 请求内存区（PSRAM，没有PSRAM时scratch()直接分配）
+  size_t _arenaUsed = 0;
+  void* _overflow[HTTP_ARENA_OVERFLOW];
+  int _overflowCount = 0;
+};
+
+// Web服务器（用于配置界面、状态页和照片浏览）
+HttpServer server(80);
+// 预览流服务器（MJPEG流会长时间占用处理任务，所以单独运行）
+HttpServer streamServer(STREAM_PORT);
+
+// 相机访问锁：预览流在服务器任务中取帧，需要与主任务的定时拍摄互斥
+SemaphoreHandle_t cameraMutex = NULL;
+// 定时拍摄等待相机时置位，预览流看到后立即结束
+volatile bool previewStopRequested = false;
+// 传感器当前是否处于静态拍摄配置（initCamera()中的分辨率和拍摄配置的JPEG质量）
+bool cameraStillMode = true;
+framesize_t stillFrameSize = FRAMESIZE_UXGA;
+// 静态拍摄使用的传感器参数配置（来自拍摄配置，可通过 /profile 切换）
+uint8_t cameraProfileId = CAMERA_PROFILE_DAY;
+// 传感器当前的输出窗口（ROI_FULL表示按stillFrameSize或预览分辨率输出）
+uint8_t cameraRoiId = ROI_FULL;
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);  // 等待串口稳定
+  Serial.setDebugOutput(true);
+  sdMutex = xSemaphoreCreateRecursiveMutex();
+  cameraMutex = xSemaphoreCreateMutex();
+  logInit();  // 尽早启动异步日志，之后的输出都不再阻塞主流程
+  ioPoolInit();  // 内存还没有碎片化时分配Web服务器的缓冲池
+  LOGI("ESP32-CAM 定时拍摄程序启动");
+
+  // 上次唤醒超时被看门狗复位（或崩溃）时不再重复执行，直接按计划睡眠
+  esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
+  captureConfigLoad();  // 睡眠间隔等都来自拍摄配置，最先读取
+  if (wakeSupervisorRecover()) {
+    goToSleep();
+    return;
+  }
+  wakeSupervisorBegin(wakeup_reason == ESP_SLEEP_WAKEUP_UNDEFINED ? WAKE_FIRST_BOOT_DEADLINE_MS : wakeDeadlineMs());
+  energyUpdate();  // WiFi启动前测量电池电压（负载最小，读数最稳定）
+  if (wakeup_reason != ESP_SLEEP_WAKEUP_UNDEFINED) {
+    wakeSetDeadline(wakeDeadlineMs());  // 按电量等级调整后的访问窗口重新计算
+  }
+
+  // 初始化Preferences
+  preferences.begin("wifi-config", false);
   
-  IPAddress IP = WiFi.softAPIP();
-  Serial.print("AP IP地址: ");
-  Serial.println(IP);
-  Serial.println("请连接到WiFi网络并访问: http://192.168.4.1");
+  // 读取保存的WiFi配置
+  wifi_ssid = preferences.getString("ssid", "");
+  wifi_password = preferences.getString("password", "");
+  upload_url = preferences.getString("upload_url", "");
+  mqtt_url = preferences.getString("mqtt_url", "");
 
-  // 配置Web服务器路由
-  server.on("/", handleRoot);
-  server.on("/config", handleConfig);
+  // 外部触发唤醒：走低延迟拍摄路径后直接睡眠（临近定时拍摄时并入下面的正常流程）
+  if (wakeup_reason == ESP_SLEEP_WAKEUP_EXT0 && triggerWakeRun()) {
+    return;
+  }
+
+  // 检查是否已配置WiFi（上电时开启配置热点等待配置，定时唤醒时只开启一小段时间）
+  if (wifi_ssid.length() == 0) {
+    LOGI("未检测到WiFi配置，进入配置模式...");
+    startConfigMode(wakeup_reason == ESP_SLEEP_WAKEUP_UNDEFINED ? CONFIG_PORTAL_TIMEOUT_MS : OFFLINE_PORTAL_WINDOW_MS);
+    goToSleep();
+    return;
+  }
+
+  LOGI("读取到保存的WiFi配置: %s", wifi_ssid.c_str());
+
+  // 尽早开始连接WiFi；需要对时时由后台任务在连上后同步，与相机和SD卡初始化并行
+  timeApplyZone();
+  timeApplyDriftCorrection();
+  bool tryWiFi = energyPolicy.wifi && offlineShouldTryWiFi(wakeup_reason);
+  if (tryWiFi) {
+    wifiBegin();
+    if (timeNeedsSync()) {
+      timeSyncStart();
+    }
+  }
+
+  // 初始化相机
+  wakePhaseBegin(WAKE_PHASE_CAMERA);
+  if (!initCamera()) {
+    LOGE("相机初始化失败！");
+    goToSleep();
+    return;
+  }
+
+  // 初始化SD卡
+  wakePhaseBegin(WAKE_PHASE_SD);
+  if (!initSDCard()) {
+    LOGE("SD卡初始化失败！");
+    goToSleep();
+    return;
+  }
+
+  // 连接Wi-Fi；失败时进入离线模式继续拍照，不再一直停在配置模式
+  wakePhaseBegin(WAKE_PHASE_WIFI);
+  bool online = tryWiFi && connectWiFi();
+  if (online) {
+    offlineEnd();
+  } else {
+    timeSyncCancel = true;
+    if (energyPolicy.wifi) {
+      offlineBegin(wakeup_reason);
+    } else {
+      LOGW("电量极低，本次不连接WiFi");
+    }
+  }
+
+  // 等待后台时间同步完成；离线或同步失败时使用RTC维持的时间
+  wakePhaseBegin(WAKE_PHASE_NTP);
+  if (online && !timeSyncWait(NTP_TIMEOUT_MS * NTP_ROUNDS + 2000)) {
+    LOGW("时间同步失败，使用RTC时间");
+  }
+  if (time(NULL) < TIME_VALID_AFTER) {
+    timeSkippedCaptures++;
+    LOGE("时间未同步且RTC时间无效，无法拍照！（累计跳过 %lu 次）", timeSkippedCaptures);
+    goToSleep();
+    return;
+  }
+
+  // 检查剩余空间，必要时清理旧照片
+  wakePhaseBegin(WAKE_PHASE_RETENTION);
+  retentionRun();
+
+  if (!online) {
+    // 离线：只拍照（照片照常进入上传队列，联网后再上传），不启动Web服务器
+    wakePhaseBegin(WAKE_PHASE_CAPTURE);
+    if (captureAndSavePhoto()) {
+      offlineFrames++;
+    }
+    LOGI("离线模式：已连续离线 %lu 次唤醒，拍摄 %lu 张", offlineWakes, offlineFrames);
+    goToSleep();
+    return;
+  }
+  wakePhaseBegin(WAKE_PHASE_WEB);
+
+  // 所有初始化完成，闪光灯闪烁3次表示就绪
+  LOGI("所有初始化完成，系统就绪！");
+  flashLED(3, 200);  // 闪烁3次，每次200ms
+
+  // 启动Web服务器（用于查看状态、浏览照片和重新配置）
+  server.on("/", handleStatus);
+  server.on("/config", handleRoot);
   server.on("/save", HTTP_POST, handleSave);
+  server.on("/reset", handleReset);
+  server.on("/photos", handlePhotos);  // 照片列表页面
+  server.on("/photo", handlePhoto);    // 查看/下载单个照片
+  server.on("/delete", HTTP_GET, handleDelete);  // 删除照片
+  server.on("/logs", handleLogs);      // 查看日志
+  server.on("/api/changes", HTTP_GET, handleApiChanges);  // 增量同步
+  server.on("/scrub", HTTP_GET, handleScrub);  // 照片完整性复核
+  server.on("/profile", HTTP_GET, handleProfile);  // 切换传感器参数配置
+  server.on("/api/config", HTTP_GET, handleApiConfig);  // 查看拍摄配置
+  server.on("/contactsheet", HTTP_GET, handleContactSheet);  // 当天的缩略图墙
+  server.on("/api/calendar", HTTP_GET, handleApiCalendar);  // 按天按小时的照片数
+  server.on("/heap", HTTP_GET, handleHeap);  // 内存碎片情况
+  server.on("/bench/capture", HTTP_GET, handleBenchCapture);  // 拍摄参数测试
+  server.on("/api/config", HTTP_POST, handleApiConfigPost);  // 修改拍摄配置（下次唤醒生效）
+  server.on("/stream", handleStreamRedirect);  // 实时预览（跳转到预览流端口）
+  server.on("/test", []() {  // 测试路由
+    server.send(200, "text/plain", "Web服务器正常工作！");
+  });
   server.onNotFound(handleNotFound);
-  
   server.begin();
-  Serial.println("Web服务器已启动，等待配置...");
-  
-  // 在配置模式下保持运行
-  while (true) {
-    server.handleClient();
-    delay(10);
+  streamServer.on("/stream", HTTP_GET, handleStream);
+  streamServer.begin();
+  LOGI("Web服务器已启动！");
+  LOGI("访问地址: http://%s/", WiFi.localIP().toString().c_str());
+  LOGI("实时预览: http://%s:%d/stream", WiFi.localIP().toString().c_str(), STREAM_PORT);
+  LOGI("照片浏览: http://%s/photos", WiFi.localIP().toString().c_str());
+  LOGI("测试页面: http://%s/test", WiFi.localIP().toString().c_str());
+
+  // 检查唤醒原因
+  if (wakeup_reason == ESP_SLEEP_WAKEUP_UNDEFINED) {
+    // 首次上电（不是深度睡眠唤醒）
+    LOGI("首次上电，拍摄第一张照片...");
+    
+    // 拍摄第一张照片
+    wakePhaseBegin(WAKE_PHASE_CAPTURE);
+    captureAndSavePhoto();
+    wakePhaseBegin(WAKE_PHASE_UPLOAD);
+    uploadPending(60000);
+    wakePhaseBegin(WAKE_PHASE_FIRST_WINDOW);
+    webWindowBegin();
+    
+    // 保持10分钟不休眠（只是等待，不进入深度睡眠）
+    LOGI("首次上电，保持10分钟不休眠...");
+    LOGI("在此期间，可以通过Web界面访问设备");
+    LOGI("Web服务器地址: http://%s", WiFi.localIP().toString().c_str());
+    
+    // 等待10分钟（Web服务器在独立任务中处理请求，这里只需等待）
+    unsigned long waitTime = SLEEP_DURATION_US / 1000;  // 转换为毫秒
+    unsigned long startTime = millis();
+    unsigned long elapsedTime = 0;
+    unsigned long lastPrintTime = 0;
+    
+    while (elapsedTime < waitTime) {
+      delay(1000);
+      heapSample(false);
+      
+      elapsedTime = millis() - startTime;
+      unsigned long remaining = (waitTime - elapsedTime) / 1000;
+      
+      // 每分钟打印一次剩余时间
+      if (remaining != lastPrintTime && remaining % 60 == 0 && remaining > 0) {
+        LOGI("首次上电等待中，剩余时间: %lu 分钟", remaining / 60);
+        lastPrintTime = remaining;
+      }
+    }
+    
+    webWindowEnd("首次上电");
+    LOGI("首次上电10分钟等待完成，现在进入正常休眠循环模式...");
+  } else {
+    // 深度睡眠唤醒，正常模式
+    LOGI("深度睡眠唤醒，正常拍摄模式");
+    LOGI("Web服务器已启动，可以通过以下地址访问:");
+    LOGI("主页: http://%s/", WiFi.localIP().toString().c_str());
+    LOGI("照片浏览: http://%s/photos", WiFi.localIP().toString().c_str());
+    
+    // 深度睡眠唤醒后，给Web服务器一些时间处理请求（30秒）
+    // 主任务在此期间空闲，顺便上传队列中的照片（不额外延长唤醒时间）
+    unsigned long webTime = energyPolicy.webWindowMs;  // 默认30秒，电量低时缩短
+    LOGI("深度睡眠唤醒后，Web服务器将运行%lu秒供访问...", webTime / 1000);
+    unsigned long webStart = millis();
+    webWindowBegin();
+    wakePhaseBegin(WAKE_PHASE_UPLOAD);
+    uploadPending(webTime > 2000 ? webTime - 2000 : 0);
+    wakePhaseBegin(WAKE_PHASE_WEB);
+    while (millis() - webStart < webTime) {
+      delay(std::min(1000UL, webTime - (millis() - webStart)));
+      heapSample(false);
+    }
+    webWindowEnd("唤醒后");
+    LOGI("Web服务器访问时间结束，开始拍摄照片...");
+  }
+
+  // 拍摄照片
+  wakePhaseBegin(WAKE_PHASE_CAPTURE);
+  captureAndSavePhoto();
+  wakePhaseBegin(WAKE_PHASE_WEB);
+
+  // 进入深度睡眠前，给Web服务器一些时间处理请求
+  LOGI("进入深度睡眠10分钟...");
+  LOGI("深度睡眠期间Web服务器将停止，唤醒后会重新启动");
+  LOGI("如需访问Web界面，请在设备唤醒后立即访问: http://%s", WiFi.localIP().toString().c_str());
+  
+  // 在进入深度睡眠前，处理一些Web请求（最多等待5秒）
+  unsigned long sleepDelay = std::min(5000UL, (unsigned long)energyPolicy.webWindowMs);  // 给5秒时间处理Web请求
+  unsigned long startDelay = millis();
+  webWindowBegin();
+  while (millis() - startDelay < sleepDelay) {
+    delay(std::min(1000UL, sleepDelay - (millis() - startDelay)));
+  }
+  webWindowEnd("睡眠前");
+  
+  goToSleep();
+}
+
+void loop() {
+  // Web服务器在独立任务中运行，这里无需轮询
+  delay(1000);
+  
+  // 注意：正常模式下，setup函数执行完会进入深度睡眠，所以loop不会运行
+}
+
+bool initCamera() {
+  camera_config_t config;
+  config.ledc_channel = LEDC_CHANNEL_0;
+  config.ledc_timer = LEDC_TIMER_0;
+  config.pin_d0 = Y2_GPIO_NUM;
+  config.pin_d1 = Y3_GPIO_NUM;
+  config.pin_d2 = Y4_GPIO_NUM;
+  config.pin_d3 = Y5_GPIO_NUM;
+  config.pin_d4 = Y6_GPIO_NUM;
+  config.pin_d5 = Y7_GPIO_NUM;
+  config.pin_d6 = Y8_GPIO_NUM;
+  config.pin_d7 = Y9_GPIO_NUM;
+  config.pin_xclk = XCLK_GPIO_NUM;
+  config.pin_pclk = PCLK_GPIO_NUM;
+  config.pin_vsync = VSYNC_GPIO_NUM;
+  config.pin_href = HREF_GPIO_NUM;
+  config.pin_sscb_sda = SIOD_GPIO_NUM;
+  config.pin_sscb_scl = SIOC_GPIO_NUM;
+  config.pin_pwdn = PWDN_GPIO_NUM;
+  config.pin_reset = RESET_GPIO_NUM;
+  config.xclk_freq_hz = 20000000;
+  config.pixel_format = PIXFORMAT_JPEG;
+
+  // 高分辨率设置 - UXGA (1600x1200)
+  config.frame_size = FRAMESIZE_UXGA;
+  config.jpeg_quality = captureProfile.quality;  // 拍摄配置的质量值 (0-63，数值越小质量越高)
+  config.fb_count = 1;
+
+  // 如果PSRAM可用，使用更大的缓冲区
+  // 双缓冲时总是取最新的一帧：预览时慢速客户端直接丢帧而不是排队，拍照时也不会拿到旧帧
+  if (psramFound()) {
+    config.fb_count = 2;
+    config.grab_mode = CAMERA_GRAB_LATEST;
+  } else {
+    // 如果没有PSRAM，降低分辨率
+    config.frame_size = FRAMESIZE_SVGA;
+    config.fb_count = 1;
+  }
+  // 电量低时降低分辨率
+  config.frame_size = (framesize_t)std::min((int)config.frame_size, (int)energyPolicy.frameSize);
+  stillFrameSize = config.frame_size;
+  cameraStillMode = true;
+
+  // 初始化相机
+  unsigned long initStart = millis();
+  esp_err_t err = esp_camera_init(&config);
+  if (err != ESP_OK) {
+    LOGE("相机初始化失败，错误代码: 0x%x", err);
+    return false;
+  }
+  unsigned long initMs = millis() - initStart;
+
+  // 写入当前拍摄配置的传感器参数（只写和上电状态不同的项）
+  unsigned long profileStart = millis();
+  int written = cameraApplyProfile(cameraProfileId);
+  if (written >= 0) {
+    LOGI("相机参数配置完成: 配置 %s，写入 %d 项，驱动初始化 %lu ms，参数 %lu ms",
+         cameraProfiles[cameraProfileId].name, written, initMs, millis() - profileStart);
+    int quality = config.jpeg_quality;
+    LOGI("JPEG质量: %d (0-63，数值越小质量越高)", quality);
+    LOGI("预计文件大小: %s", quality <= 8 ? "100-150KB (高质量)" : quality <= 10 ? "80-120KB (较高质量)" : "50-80KB (标准质量)");
+    const char* wbModeNames[] = {"Auto", "Sunny", "Cloudy", "Office", "Home"};
+    int wbMode = cameraStillWbMode();
+    if (wbMode >= 0 && wbMode <= 4) {
+      LOGI("白平衡模式: %d (%s)", wbMode, wbModeNames[wbMode]);
+    } else {
+      LOGI("白平衡模式: %d (自定义)", wbMode);
+    }
+    LOGI("提示: 如需调整质量，通过 /api/config 修改拍摄配置的quality (推荐范围: 8-12)");
+  }
+
+  // 初始化闪光灯引脚（默认关闭）
+  pinMode(LED_GPIO_NUM, OUTPUT);
+  digitalWrite(LED_GPIO_NUM, LOW);
+  
+  LOGI("相机初始化成功");
+  return true;
+}
+
+// 相机锁（RAII），离开作用域时自动释放
+// 持有期间禁止自动浅睡眠（浅睡眠会停掉相机的XCLK和DMA）
+esp_pm_lock_handle_t cameraPmLock = NULL;
+
+struct CameraLock {
+  CameraLock() {
+    if (cameraMutex != NULL) xSemaphoreTake(cameraMutex, portMAX_DELAY);
+    if (cameraPmLock != NULL) esp_pm_lock_acquire(cameraPmLock);
+  }
+  ~CameraLock() {
+    if (cameraPmLock != NULL) esp_pm_lock_release(cameraPmLock);
+    if (cameraMutex != NULL) xSemaphoreGive(cameraMutex);
+  }
+};
+
+// 丢弃分辨率切换前已经在缓冲区里的帧，直到拿到新分辨率的帧
+void cameraDrainFrames(framesize_t size) {
+  for (int i = 0; i < 4; i++) {
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (!fb) {
+      return;
+    }
+    bool ready = (fb->width == resolution[size].width);
+    esp_camera_fb_return(fb);
+    if (ready) {
+      return;
+    }
+  }
+}
+
+// 静态拍摄的白平衡模式：拍摄配置指定时优先，否则使用传感器参数配置中的值
+int8_t cameraStillWbMode() {
+  int8_t wbMode = captureProfile.wbMode;
+  return wbMode >= 0 ? wbMode : cameraProfiles[cameraProfileId].wbMode;
+}
+
+// 按参数表配置传感器（调用者需持有相机锁，或在相机初始化阶段调用）
+// 驱动在 s->status 中记录每项的当前值（初始化后是上电默认值），相同的项跳过，省掉SCCB写入
+// 返回写入的项数，传感器不可用时返回-1
+int cameraApplyProfile(uint8_t id) {
+  sensor_t* s = esp_camera_sensor_get();
+  if (s == NULL || id >= CAMERA_PROFILE_COUNT) {
+    return -1;
+  }
+  const CameraProfile& p = cameraProfiles[id];
+  int8_t wbMode = id == CAMERA_PROFILE_PREVIEW ? p.wbMode : cameraStillWbMode();
+  camera_status_t& cur = s->status;
+  bool force = CAMERA_PROFILE_FORCE_ALL != 0;
+  int written = 0;
+  // 顺序与原来逐项设置时相同：先开白平衡再选模式，先选曝光方式再给曝光值
+#define CAMERA_APPLY(field, value, setter) \
+  if (force || cur.field != (value)) { s->setter(s, value); written++; }
+  CAMERA_APPLY(brightness, p.brightness, set_brightness);
+  CAMERA_APPLY(contrast, p.contrast, set_contrast);
+  CAMERA_APPLY(saturation, p.saturation, set_saturation);
+  CAMERA_APPLY(special_effect, p.specialEffect, set_special_effect);
+  CAMERA_APPLY(awb, p.awb, set_whitebal);
+  CAMERA_APPLY(awb_gain, p.awbGain, set_awb_gain);
+  CAMERA_APPLY(wb_mode, wbMode, set_wb_mode);
+  CAMERA_APPLY(aec, p.aec, set_exposure_ctrl);
+  CAMERA_APPLY(aec2, p.aec2, set_aec2);
+  CAMERA_APPLY(ae_level, p.aeLevel, set_ae_level);
+  CAMERA_APPLY(aec_value, p.aecValue, set_aec_value);
+  CAMERA_APPLY(agc, p.agc, set_gain_ctrl);
+  CAMERA_APPLY(agc_gain, p.agcGain, set_agc_gain);
+  if (force || cur.gainceiling != p.gainceiling) {
+    s->set_gainceiling(s, (gainceiling_t)p.gainceiling);
+    written++;
+  }
+  CAMERA_APPLY(bpc, p.bpc, set_bpc);
+  CAMERA_APPLY(wpc, p.wpc, set_wpc);
+  CAMERA_APPLY(raw_gma, p.rawGma, set_raw_gma);
+  CAMERA_APPLY(lenc, p.lenc, set_lenc);
+  CAMERA_APPLY(dcw, p.dcw, set_dcw);
+  CAMERA_APPLY(hmirror, p.hmirror, set_hmirror);
+  CAMERA_APPLY(vflip, p.vflip, set_vflip);
+  CAMERA_APPLY(colorbar, p.colorbar, set_colorbar);
+#undef CAMERA_APPLY
+  LOGD("传感器配置 %s: 写入 %d 项", p.name, written);
+  return written;
+}
+
+// 切换到预览配置（调用者需持有相机锁）
+void cameraUsePreviewMode(framesize_t size) {
+  sensor_t* s = esp_camera_sensor_get();
+  if (s == NULL) {
+    return;
+  }
+  s->set_framesize(s, size);
+  s->set_quality(s, STREAM_JPEG_QUALITY);
+  cameraApplyProfile(CAMERA_PROFILE_PREVIEW);
+  cameraRoiId = ROI_FULL;
+  cameraDrainFrames(size);
+  cameraStillMode = false;
+}
+
+// 丢弃窗口切换前已经在缓冲区里的帧
+// 设置ROI窗口不会改变驱动记录的分辨率（帧的宽高不变），没法像 cameraDrainFrames() 那样按宽度判断，只能按缓冲区数量丢弃
+void cameraDiscardFrames(int count) {
+  for (int i = 0; i < count; i++) {
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (!fb) {
+      return;
+    }
+    esp_camera_fb_return(fb);
+  }
+}
+
+// 设置传感器输出窗口（调用者需持有相机锁，传感器处于静态拍摄配置）
+// 返回false表示该区域的输出超出帧缓冲区，传感器保持全幅
+bool cameraUseRoi(uint8_t id) {
+  sensor_t* s = esp_camera_sensor_get();
+  if (s == NULL || id >= ROI_COUNT || id == cameraRoiId) {
+    return s != NULL && id < ROI_COUNT;
+  }
+  int discard = psramFound() ? 2 : 1;  // 正在传输的一帧 + 双缓冲中排队的一帧
+  if (id == ROI_FULL) {
+    s->set_framesize(s, stillFrameSize);
+    cameraDiscardFrames(discard);
+    cameraRoiId = ROI_FULL;
+    return true;
+  }
+  const CameraRoi& roi = cameraRois[id];
+  uint16_t outW = roi.outW ? roi.outW : roi.w;
+  uint16_t outH = roi.outH ? roi.outH : roi.h;
+  if (outW > resolution[stillFrameSize].width || outH > resolution[stillFrameSize].height) {
+    LOGW("区域 %s 输出 %ux%u 超出帧缓冲区 (%ux%u)，改拍全幅", roi.name, outW, outH,
+         resolution[stillFrameSize].width, resolution[stillFrameSize].height);
+    cameraUseRoi(ROI_FULL);
+    return false;
+  }
+  // OV2640：startX为传感器模式（0=UXGA），offset/total为窗口，output为DSP缩放后的输出尺寸
+  s->set_res_raw(s, 0, 0, 0, 0, roi.x & ~7, roi.y & ~7, roi.w & ~7, roi.h & ~7, outW & ~15, outH & ~7, false, false);
+  cameraDiscardFrames(discard);
+  cameraRoiId = id;
+  return true;
+}
+
+// 切回静态拍摄配置（调用者需持有相机锁）
+// 只改传感器的输出窗口和JPEG质量，帧缓冲区按静态分辨率分配，所以不需要deinit/init
+void cameraUseStillMode() {
+  if (cameraStillMode) {
+    return;
+  }
+  sensor_t* s = esp_camera_sensor_get();
+  if (s == NULL) {
+    return;
+  }
+  unsigned long start = millis();
+  s->set_framesize(s, stillFrameSize);
+  s->set_quality(s, captureProfile.quality);
+  cameraApplyProfile(cameraProfileId);
+  cameraDrainFrames(stillFrameSize);
+  cameraStillMode = true;
+  LOGI("相机已切回静态拍摄配置，耗时 %lu ms", millis() - start);
+}
+
+bool initSDCard() {
+  LOGI("初始化SD卡...");
+  
+  // 尝试挂载SD卡，如果失败则重试一次
+  // 启用外部触发时使用1-bit模式，空出GPIO13
+  if (!SD_MMC.begin("/sdcard", TRIGGER_ENABLE != 0)) {
+    LOGI("SD卡挂载失败，尝试重新挂载...");
+    delay(500);
+    if (!SD_MMC.begin("/sdcard", TRIGGER_ENABLE != 0)) {
+      LOGE("SD卡挂载失败");
+      return false;
+    }
+  }
+  
+  delay(200);  // 等待SD卡稳定
+
+  uint8_t cardType = SD_MMC.cardType();
+  if (cardType == CARD_NONE) {
+    LOGE("未检测到SD卡");
+    return false;
+  }
+
+  const char* cardTypeName = "未知";
+  if (cardType == CARD_MMC) {
+    cardTypeName = "MMC";
+  } else if (cardType == CARD_SD) {
+    cardTypeName = "SDSC";
+  } else if (cardType == CARD_SDHC) {
+    cardTypeName = "SDHC";
+  }
+  LOGI("SD卡类型: %s", cardTypeName);
+
+  uint64_t cardSize = SD_MMC.cardSize() / (1024 * 1024);
+  LOGI("SD卡大小: %lluMB", cardSize);
+
+  sdReady = true;
+  uploadLoadState();
+  mqttLoadState();
+  syncLoadSeq();
+  journalRecover();
+  return true;
+}
+
+// 开始连接WiFi（不等待结果）
+void wifiBegin() {
+  LOGI("正在连接Wi-Fi: %s", wifi_ssid.c_str());
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(wifi_ssid.c_str(), wifi_password.c_str());
+}
+
+// 等待 wifiBegin() 发起的连接完成
+bool connectWiFi() {
+  if (wifi_ssid.length() == 0) {
+    LOGI("未配置WiFi");
+    return false;
+  }
+
+  int attempts = 0;
+  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
+    delay(500);
+    attempts++;
+    LOGD("等待Wi-Fi连接 (%d/20)...", attempts);
+  }
+
+  if (WiFi.status() == WL_CONNECTED) {
+    LOGI("Wi-Fi连接成功！");
+    LOGI("IP地址: %s", WiFi.localIP().toString().c_str());
+    return true;
+  } else {
+    LOGE("Wi-Fi连接失败");
+    return false;
+  }
+}
+
+// 配置模式：创建AP和Web服务器
+// 开启配置热点等待配置，timeoutMs后关闭热点并返回（保存配置后设备会重启）
+void startConfigMode(unsigned long timeoutMs) {
+  wifiConfigured = false;
+  wakePhaseBegin(WAKE_PHASE_CONFIG);
+  unsigned long start = millis();
+  
+  LOGI("启动配置模式...");
+  LOGI("AP SSID: %s", ap_ssid);
+  LOGI("AP Password: %s", ap_password);
+  
+  // 创建AP
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP(ap_ssid, ap_password);
+  
+  IPAddress IP = WiFi.softAPIP();
+  LOGI("AP IP地址: %s", IP.toString().c_str());
+  LOGI("请连接到WiFi网络并访问: http://192.168.4.1");
+
+  // 配置Web服务器路由
+  server.on("/", handleRoot);
+  server.on("/config", handleConfig);
+  server.on("/save", HTTP_POST, handleSave);
+  server.onNotFound(handleNotFound);
+  
+  server.begin();
+  LOGI("Web服务器已启动，等待配置...");
+  
+  // 在配置模式下等待配置（请求由服务器任务处理，保存后会重启）；超时后关闭热点，避免没人配置时一直耗电
+  wakeSetDeadline(timeoutMs + 30000);
+  while (millis() - start < timeoutMs) {
+    delay(1000);
+  }
+  server.stop();
+  WiFi.softAPdisconnect(true);
+  WiFi.mode(WIFI_OFF);
+  unsigned long elapsed = millis() - start;
+  portalTotalMs += elapsed;
+  LOGW("配置热点开启 %lu 秒无人配置，已关闭（累计 %lu 秒）", elapsed / 1000, portalTotalMs / 1000);
+  wakeSetDeadline(wakeDeadlineMs());  // 关闭热点后继续本次唤醒的其余流程
+}
+
+// HTML转义后的配置值（放进页面属性中；转义结果放在请求内存区，失败时返回空串）
+String htmlEscaped(const String& value) {
+  size_t cap = value.length() * 6 + 1;
+  char* buf = (char*)server.scratch(cap);
+  if (buf == NULL || htmlEscapeTo(value.c_str(), value.length(), buf, cap) < 0) {
+    return String("");
+  }
+  return String(buf);
+}
+
+// 根路径：显示配置页面
+void handleRoot() {
+  String html = "<!DOCTYPE html><html><head>";
+  html += "<meta charset='UTF-8'>";
+  html += "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
+  html += "<title>ESP32-CAM WiFi配置</title>";
+  html += "<style>";
+  html += "body { font-family: Arial, sans-serif; max-width: 500px; margin: 50px auto; padding: 20px; background: #f5f5f5; }";
+  html += "h1 { color: #333; text-align: center; }";
+  html += "form { background: white; padding: 30px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }";
+  html += "label { display: block; margin: 15px 0 5px; color: #555; font-weight: bold; }";
+  html += "input { width: 100%; padding: 12px; border: 2px solid #ddd; border-radius: 5px; font-size: 16px; box-sizing: border-box; }";
+  html += "input:focus { border-color: #4CAF50; outline: none; }";
+  html += "button { width: 100%; padding: 12px; background: #4CAF50; color: white; border: none; border-radius: 5px; font-size: 16px; cursor: pointer; margin-top: 20px; }";
+  html += "button:hover { background: #45a049; }";
+  html += ".info { background: #e3f2fd; padding: 15px; border-radius: 5px; margin-bottom: 20px; color: #1976d2; }";
+  html += "</style></head><body>";
+  html += "<h1>📷 ESP32-CAM WiFi配置</h1>";
+  html += "<div class='info'>";
+  html += "<strong>提示：</strong>请填写您的WiFi网络信息，配置后将自动保存并重启设备。";
+  html += "</div>";
+  html += "<form action='/save' method='POST'>";
+  html += "<label for='ssid'>WiFi名称 (SSID):</label>";
+  html += "<input type='text' id='ssid' name='ssid' required placeholder='请输入WiFi名称'>";
+  html += "<label for='password'>WiFi密码:</label>";
+  html += "<input type='password' id='password' name='password' required placeholder='请输入WiFi密码'>";
+  html += "<label for='upload_url'>上传地址 (可选):</label>";
+  html += "<input type='text' id='upload_url' name='upload_url' value='" + htmlEscaped(upload_url) + "' placeholder='http://192.168.1.10:9000/timelapse'>";
+  html += "<label for='mqtt_url'>MQTT服务器 (可选):</label>";
+  html += "<input type='text' id='mqtt_url' name='mqtt_url' value='" + htmlEscaped(mqtt_url) + "' placeholder='mqtt://192.168.1.10:1883/timelapse'>";
+  html += "<button type='submit'>保存配置</button>";
+  html += "</form>";
+  html += "</body></html>";
+  
+  server.send(200, "text/html; charset=UTF-8", html);
+}
+
+// 保存配置
+void handleSave() {
+  if (server.hasArg("ssid") && server.hasArg("password")) {
+    String new_ssid = server.arg("ssid");
+    String new_password = server.arg("password");
+    
+    // 保存到Preferences
+    preferences.putString("ssid", new_ssid);
+    preferences.putString("password", new_password);
+    if (server.hasArg("upload_url")) {
+      preferences.putString("upload_url", server.arg("upload_url"));
+    }
+    if (server.hasArg("mqtt_url")) {
+      preferences.putString("mqtt_url", server.arg("mqtt_url"));
+    }
+    preferences.end();
+    
+    LOGI("WiFi配置已保存: %s", new_ssid.c_str());
+    
+    // 返回成功页面
+    String html = "<!DOCTYPE html><html><head>";
+    html += "<meta charset='UTF-8'>";
+    html += "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
+    html += "<meta http-equiv='refresh' content='5;url=/'>";
+    html += "<title>配置成功</title>";
+    html += "<style>";
+    html += "body { font-family: Arial, sans-serif; max-width: 500px; margin: 50px auto; padding: 20px; text-align: center; background: #f5f5f5; }";
+    html += "h1 { color: #4CAF50; }";
+    html += ".success { background: #d4edda; padding: 20px; border-radius: 10px; color: #155724; margin: 20px 0; }";
+    html += "</style></head><body>";
+    html += "<h1>✅ 配置成功！</h1>";
+    html += "<div class='success'>";
+    html += "<p>WiFi配置已保存</p>";
+    html += "<p>设备将在5秒后重启并连接到新网络</p>";
+    html += "</div>";
+    html += "</body></html>";
+    
+    server.send(200, "text/html; charset=UTF-8", html);
+    
+    delay(2000);
+    logFlush(1000);
+    ESP.restart();
+  } else {
+    server.send(400, "text/plain", "参数错误");
+  }
+}
+
+// 配置页面（备用）
+void handleConfig() {
+  handleRoot();
+}
+
+// 状态页面（正常模式）
+void handleStatus() {
+  struct tm timeinfo;
+  String timeStr = "未同步";
+  if (getLocalTime(&timeinfo)) {
+    char buf[30];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
+    timeStr = String(buf);
+  }
+  
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/html; charset=UTF-8", "");
+  server.print("<!DOCTYPE html><html><head>");
+  server.print("<meta charset='UTF-8'>");
+  server.print("<meta name='viewport' content='width=device-width, initial-scale=1.0'>");
+  server.print("<title>ESP32-CAM 状态</title>");
+  server.print("<style>");
+  server.print("body { font-family: Arial, sans-serif; max-width: 600px; margin: 50px auto; padding: 20px; background: #f5f5f5; }");
+  server.print("h1 { color: #333; text-align: center; }");
+  server.print(".card { background: white; padding: 20px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); margin: 20px 0; }");
+  server.print(".info { margin: 10px 0; }");
+  server.print(".label { font-weight: bold; color: #555; }");
+  server.print(".value { color: #333; }");
+  server.print("a { display: inline-block; margin: 10px 5px; padding: 10px 20px; background: #4CAF50; color: white; text-decoration: none; border-radius: 5px; }");
+  server.print("a:hover { background: #45a049; }");
+  server.print(".warning { background: #fff3cd; padding: 15px; border-radius: 5px; margin: 20px 0; color: #856404; }");
+  server.print("</style></head><body>");
+  server.print("<h1>📷 ESP32-CAM 状态</h1>");
+  server.print("<div class='card'>");
+  server.print("<div class='info'><span class='label'>WiFi名称:</span> <span class='value'>" + htmlEscaped(wifi_ssid) + "</span></div>");
+  server.print("<div class='info'><span class='label'>IP地址:</span> <span class='value'>" + WiFi.localIP().toString() + "</span></div>");
+  server.print("<div class='info'><span class='label'>当前时间:</span> <span class='value'>" + timeStr + "</span></div>");
+  server.print("<div class='info'><span class='label'>信号强度:</span> <span class='value'>" + String(WiFi.RSSI()) + " dBm</span></div>");
+  server.print("<div class='info'><span class='label'>拍摄配置:</span> <span class='value'>" + String(captureProfile.name) + "（" + frameSizeName(captureProfile.frameSize) + "，质量 " + String(captureProfile.quality) + "，间隔 " + String(captureProfile.intervalS / 60) + " 分钟）</span></div>");
+  server.print("<div class='info'><span class='label'>上次唤醒:</span> <span class='value'>" + String(wakeState.lastMs / 1000.0, 1) + " 秒（最长 " + String(wakeState.maxMs / 1000.0, 1) + " 秒）</span></div>");
+  if (ENERGY_ENABLE) {
+    server.print("<div class='info'><span class='label'>电池:</span> <span class='value'>" + String(batteryMv) + " mV（" + energyLevelNames[energyLevel] + "），间隔 " + String(energyPolicy.intervalS / 60) + " 分钟，预计每日 " + String(energyDailyMah(energyPolicy, energyWakeMah), 0) + " mAh</span></div>");
+  }
+  if (TRIGGER_ENABLE) {
+    server.print("<div class='info'><span class='label'>外部触发:</span> <span class='value'>" + String(triggerEvents) + " 次，拍摄 " + String(triggerCaptures) + " 张，限流 " + String(triggerSuppressed) + " 次，并入定时 " + String(triggerMerged) + " 次</span></div>");
+  }
+  if (CONTACT_SHEET_ENABLE && sheetLastWriteMs > 0) {
+    server.print("<div class='info'><span class='label'>缩略图墙:</span> <span class='value'><a href='/contactsheet'>今天</a>，每张解码+缩放 " + String(sheetLastScaleMs) + " ms，写入 " + String(sheetLastWriteMs) + " ms</span></div>");
+  }
+  if (AVI_ENABLE && aviCurrentPath[0] != '\0') {
+    server.print("<div class='info'><span class='label'>延时视频:</span> <span class='value'><a href='/photo?file=" + String(aviCurrentPath) + "&download=1'>" + String(aviCurrentPath) + "</a>，" + String(aviFrames) + " 帧，追加 " + String(aviLastAppendMs) + " ms</span></div>");
+  }
+  for (int i = 0; i < ROI_COUNT; i++) {
+    if (roiLastBytes[i] > 0) {
+      server.print("<div class='info'><span class='label'>区域 " + String(cameraRois[i].name) + ":</span> <span class='value'>" + String(roiLastBytes[i] / 1024.0, 1) + " KB，拍摄 " + String(roiLastCaptureMs[i]) + " ms，写卡 " + String(roiLastWriteMs[i]) + " ms</span></div>");
+    }
+  }
+  if (webLastWindowMs > 0) {
+    server.print("<div class='info'><span class='label'>上次访问窗口:</span> <span class='value'>" + String(webLastWindowMs / 1000) + " 秒，请求 " + String(webLastRequests) + " 个，平均 " + String(webLastAvgLatencyUs / 1000.0, 1) + " ms，射频约 " + String(webLastRadioOnMs) + " ms</span></div>");
+  }
+  if (timeLastSyncUs != 0) {
+    uint32_t sinceSync = (timeNowUs() - timeLastSyncUs) / 60000000LL;
+    server.print("<div class='info'><span class='label'>时间同步:</span> <span class='value'>" + String(sinceSync) + " 分钟前，漂移 " + String(timeDriftPpm, 1) + " ppm</span></div>");
+  }
+  if (timeSkippedCaptures > 0) {
+    server.print("<div class='info'><span class='label'>时间无效跳过拍摄:</span> <span class='value'>" + String(timeSkippedCaptures) + " 次</span></div>");
+  }
+  if (offlineLastWakes > 0 || portalTotalMs > 0) {
+    server.print("<div class='info'><span class='label'>上次离线:</span> <span class='value'>" + String(offlineLastWakes) + " 次唤醒，期间拍摄 " + String(offlineLastFrames) + " 张，配置热点累计 " + String(portalTotalMs / 1000) + " 秒</span></div>");
+  }
+  if (wakeState.overruns > 0) {
+    server.print("<div class='info'><span class='label'>唤醒超时:</span> <span class='value'>" + String(wakeState.overruns) + " 次，最近: " + String(wakePhaseNames[wakeState.overrunPhase]) + "</span></div>");
+  }
+  server.print("<div class='info'><span class='label'>内存:</span> <span class='value'>内部 " +
+               String(heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 1024) + " KB 空闲，最大块 " +
+               String(heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL) / 1024) + " KB（<a href='/heap'>详情</a>）</span></div>");
+  if (upload_url.length() > 0) {
+    server.print("<div class='info'><span class='label'>待上传:</span> <span class='value'>" + String(uploadState.pending) + " 张</span></div>");
+  }
+  if (mqtt_url.length() > 0) {
+    server.print("<div class='info'><span class='label'>MQTT事件:</span> <span class='value'>待发布 " + String(mqttState.pending) +
+                 " 条，上次发布 " + String(mqttLastSent) + " 条（连接 " + String(mqttLastConnectMs) + " ms，发布 " +
+                 String(mqttLastPublishMs) + " ms，唤醒延长 " + String(mqttLastAwakeMs) + " ms）</span></div>");
+  }
+  server.print("</div>");
+  server.print("<div class='card'>");
+  server.print("<h2>操作</h2>");
+  server.print("<a href='/photos'>📷 浏览照片</a>");
+  server.print("<a href='/stream' target='_blank'>🎥 实时预览</a>");
+  server.print("<a href='/logs'>📄 查看日志</a>");
+  server.print("<a href='/config'>⚙️ 重新配置WiFi</a>");
+  server.print("<a href='/reset' onclick='return confirm(\"确定要清除WiFi配置并重启吗？\")'>🔄 清除配置并重启</a>");
+  server.print("</div>");
+  server.print("<div class='warning'>");
+  uint32_t interval = energyPolicy.intervalS;  // 本次唤醒实际采用的间隔（拍摄配置，电量低时延长）
+  String every = interval % 60 == 0 ? String(interval / 60) + "分钟" : String(interval) + "秒";
+  server.print("<strong>注意：</strong>设备每" + every + "自动拍摄一张照片并进入深度睡眠。");
+  server.print("</div>");
+  server.print("</body></html>");
+}
+
+// 重置配置
+void handleReset() {
+  preferences.clear();
+  preferences.end();
+  captureConfig.magic = 0;  // RTC中的拍摄配置副本在重启后仍然存在，一并作废
+  
+  String html = "<!DOCTYPE html><html><head>";
+  html += "<meta charset='UTF-8'>";
+  html += "<meta http-equiv='refresh' content='3;url=/'>";
+  html += "<title>配置已清除</title>";
+  html += "<style>body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }</style>";
+  html += "</head><body>";
+  html += "<h1>配置已清除</h1>";
+  html += "<p>设备将在3秒后重启...</p>";
+  html += "</body></html>";
+  
+  server.send(200, "text/html; charset=UTF-8", html);
+  delay(1000);
+  logFlush(1000);
+  ESP.restart();
+}
+
+// 照片列表页面
+// 输出照片列表的一行：路径编码和转义到定长缓冲区后分段输出，不拼接String；路径过长时跳过
+bool photosPrintRow(int index, const char* path, size_t len) {
+  char encoded[HTTP_PATH_MAX * 3];
+  char display[HTTP_PATH_MAX * 6];
+  if (len < 2 || urlEncodeTo(path, len, encoded, sizeof(encoded)) < 0 ||
+      htmlEscapeTo(path + 1, len - 1, display, sizeof(display)) < 0) {
+    LOGW("照片路径过长，不在列表中显示: %s", path);
+    return false;
+  }
+  char number[12];
+  snprintf(number, sizeof(number), "%d", index);
+  server.print("<tr><td>");
+  server.print(number);
+  server.print("</td><td class='photo-name'>");
+  server.print(display);
+  server.print("</td><td class='photo-actions'><a href='/photo?file=");
+  server.print(encoded);
+  server.print("' target='_blank'>查看</a><a href='/photo?file=");
+  server.print(encoded);
+  server.print("&download=1' class='download' download='");
+  server.print(display);
+  server.print("'>下载</a><a href='/delete?file=");
+  server.print(encoded);
+  server.print("' class='delete' onclick='return confirm(\"确定要删除照片 ");
+  server.print(display);
+  server.print(" 吗？此操作不可恢复！\")'>删除</a></td></tr>");
+  return true;
+}
+
+void handlePhotos() {
+  unsigned long listStart = millis();
+  uint32_t listLogBytes = logBytes;
+  uint32_t listLogMicros = logCallMicros;
+  // 照片多时页面很大，边扫描边分块发送
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/html; charset=UTF-8", "");
+  server.print("<!DOCTYPE html><html><head>");
+  server.print("<meta charset='UTF-8'>");
+  server.print("<meta name='viewport' content='width=device-width, initial-scale=1.0'>");
+  server.print("<title>照片浏览</title>");
+  server.print("<style>");
+  server.print("body { font-family: Arial, sans-serif; max-width: 1200px; margin: 20px auto; padding: 20px; background: #f5f5f5; }");
+  server.print("h1 { color: #333; text-align: center; }");
+  server.print(".nav { margin: 20px 0; text-align: center; }");
+  server.print(".nav a, .nav button { display: inline-block; margin: 5px 10px; padding: 10px 20px; background: #4CAF50; color: white; text-decoration: none; border: none; border-radius: 5px; cursor: pointer; }");
+  server.print(".nav a:hover, .nav button:hover { background: #45a049; }");
+  server.print(".photo-list { background: white; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); margin: 20px 0; overflow: hidden; }");
+  server.print("table { width: 100%; border-collapse: collapse; }");
+  server.print("th { background: #4CAF50; color: white; padding: 12px; text-align: left; font-weight: bold; }");
+  server.print("td { padding: 10px 12px; border-bottom: 1px solid #eee; }");
+  server.print("tr:hover { background: #f9f9f9; }");
+  server.print(".photo-name { font-family: monospace; color: #333; word-break: break-all; }");
+  server.print(".photo-actions { white-space: nowrap; }");
+  server.print(".photo-actions a { display: inline-block; margin: 0 5px; padding: 6px 12px; background: #2196F3; color: white; text-decoration: none; border-radius: 3px; font-size: 12px; }");
+  server.print(".photo-actions a:hover { background: #0b7dda; }");
+  server.print(".photo-actions a.download { background: #ff9800; }");
+  server.print(".photo-actions a.download:hover { background: #e68900; }");
+  server.print(".photo-actions a.delete { background: #f44336; }");
+  server.print(".photo-actions a.delete:hover { background: #d32f2f; }");
+  server.print(".empty { text-align: center; padding: 50px; color: #999; }");
+  server.print(".count { margin: 10px 0; padding: 10px; background: #e3f2fd; border-radius: 5px; color: #1976d2; }");
+  server.print("</style></head><body>");
+  server.print("<h1>📷 照片浏览</h1>");
+  server.print("<div class='nav'>");
+  server.print("<a href='/'>返回首页</a>");
+  server.print("<button onclick='location.reload()'>🔄 刷新</button>");
+  server.print("</div>");
+  
+  // 获取所有照片文件
+  int photoCount = 0;
+  
+  // 开始表格
+  server.print("<div class='photo-list'>");
+  server.print("<table>");
+  server.print("<thead><tr><th>序号</th><th>文件名</th><th>操作</th></tr></thead>");
+  server.print("<tbody>");
+  
+  // 扫描根目录
+  SdLock lock;
+  File root = SD_MMC.open("/");
+  if (root && root.isDirectory()) {
+    LOGD("开始扫描根目录...");
+    
+    File file = root.openNextFile();
+    while (file) {
+      String fileName = String(file.name());
+      bool isDir = file.isDirectory();
+      
+      LOGD("找到: %s (目录: %s)", fileName.c_str(), isDir ? "是" : "否");
+      
+      if (!isDir && fileName.endsWith(".jpg")) {
+        // 根目录中的JPG文件
+        String fullPath = fileName.startsWith("/") ? fileName : "/" + fileName;
+        if (photosPrintRow(photoCount + 1, fullPath.c_str(), fullPath.length())) {
+          photoCount++;
+        }
+        LOGD("添加根目录文件: %s", fullPath.c_str());
+      } else if (isDir) {
+        // 扫描所有目录（不仅仅是周目录）
+        // 确保路径格式正确
+        String dirPath = fileName;
+        if (!dirPath.startsWith("/")) {
+          dirPath = "/" + dirPath;
+        }
+        
+        LOGD("扫描目录: %s", dirPath.c_str());
+        
+        File dir = SD_MMC.open(dirPath.c_str());
+        if (dir && dir.isDirectory()) {
+          File photoFile = dir.openNextFile();
+          int dirPhotoCount = 0;
+          
+          while (photoFile) {
+            String photoName = String(photoFile.name());
+            bool photoIsDir = photoFile.isDirectory();
+            
+            LOGD("  目录项: %s (目录: %s)", photoName.c_str(), photoIsDir ? "是" : "否");
+            
+            if (!photoIsDir && photoName.endsWith(".jpg")) {
+              // 构建完整路径
+              String fullPath;
+              // file.name() 可能返回完整路径或相对路径
+              if (photoName.startsWith("/")) {
+                // 已经是完整路径
+                fullPath = photoName;
+              } else {
+                // 相对路径，需要拼接
+                fullPath = dirPath;
+                if (!fullPath.endsWith("/")) {
+                  fullPath += "/";
+                }
+                // 移除photoName中可能的前导斜杠
+                if (photoName.startsWith("/")) {
+                  photoName = photoName.substring(1);
+                }
+                fullPath += photoName;
+              }
+              
+              // 确保路径以 / 开头
+              if (!fullPath.startsWith("/")) {
+                fullPath = "/" + fullPath;
+              }
+              
+              if (photosPrintRow(photoCount + 1, fullPath.c_str(), fullPath.length())) {
+                photoCount++;
+                dirPhotoCount++;
+              }
+              LOGD("  添加目录文件: %s (完整路径: %s)", photoName.c_str(), fullPath.c_str());
+            }
+            photoFile.close();
+            photoFile = dir.openNextFile();
+          }
+          dir.close();
+          LOGD("目录 %s 中找到 %d 张照片", dirPath.c_str(), dirPhotoCount);
+        } else {
+          LOGW("警告: 无法打开目录 %s", dirPath.c_str());
+        }
+      }
+      file.close();
+      file = root.openNextFile();
+    }
+    root.close();
+    uint32_t listBytes = logBytes - listLogBytes;
+    LOGI("扫描完成，共找到 %d 张照片，耗时 %lu ms；期间日志 %lu 字节，调用耗时 %lu us（同步输出需等待 %lu us，按实测串口速率）",
+         photoCount, millis() - listStart, listBytes, logCallMicros - listLogMicros, logSerialCostUs(listBytes));
+    
+    // 结束表格
+    server.print("</tbody>");
+    server.print("</table>");
+    server.print("</div>");
+    
+    // 显示照片总数
+    if (photoCount > 0) {
+      server.print("<div class='count'>共找到 " + String(photoCount) + " 张照片</div>");
+    } else {
+      server.print("<div class='empty'><p>📷 还没有照片</p><p>设备会自动拍摄照片并保存</p></div>");
+    }
+  } else {
+    server.print("</tbody>");
+    server.print("</table>");
+    server.print("</div>");
+    server.print("<div class='empty'><p>❌ 无法访问SD卡</p></div>");
+  }
+  
+  server.print("</body></html>");
+}
+
+// 删除照片处理函数
+// 取出file参数中的照片路径并规范化到path（参数已由服务器解码，不能再解码一次）；无效时返回-1
+int photoPathArg(char* path, size_t cap) {
+  const char* value = server.argValue("file");
+  return value ? pathCanonicalize(value, strlen(value), path, cap) : -1;
+}
+
+// 删除结果页（2秒后返回照片列表），路径经过HTML转义
+void deleteSendPage(int code, bool ok, const char* message, const char* path, const char* note) {
+  char escaped[HTTP_PATH_MAX * 6];
+  if (htmlEscapeTo(path, strlen(path), escaped, sizeof(escaped)) < 0) {
+    escaped[0] = '\0';
+  }
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(code, "text/html; charset=UTF-8", "");
+  server.print("<!DOCTYPE html><html><head><meta charset='UTF-8'>");
+  server.print("<meta http-equiv='refresh' content='2;url=/photos'>");
+  server.print(ok ? "<title>删除成功</title>" : "<title>删除失败</title>");
+  server.print("<style>body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }");
+  server.print(".success { color: #4CAF50; } .error { color: #f44336; }</style></head><body>");
+  server.print(ok ? "<h1 class='success'>✅ 删除成功</h1>" : "<h1 class='error'>❌ 删除失败</h1>");
+  server.print("<p>");
+  server.print(message);
+  server.print(escaped);
+  server.print("</p>");
+  if (note != NULL) {
+    server.print("<p>");
+    server.print(note);
+    server.print("</p>");
+  }
+  server.print("<p>2秒后自动返回照片列表...</p>");
+  server.print("<a href='/photos'>立即返回</a>");
+  server.print("</body></html>");
+}
+
+void handleDelete() {
+  // 批量删除：整周目录或某日期之前的所有照片
+  if (server.hasArg("week") || server.hasArg("before")) {
+    handleDeleteBatch();
+    return;
+  }
+  
+  if (!server.hasArg("file")) {
+    server.send(400, "text/plain", "缺少file参数");
+    return;
+  }
+  
+  // 参数已由服务器解码，这里只做规范化（拒绝 .. 路径段等）
+  char path[HTTP_PATH_MAX];
+  int pathLen = photoPathArg(path, sizeof(path));
+  if (pathLen < 0 || !pathHasExtension(path, pathLen, ".jpg")) {
+    server.send(400, "text/plain", "无效的文件路径");
+    LOGE("删除失败：无效路径 %s", server.argValue("file"));
+    return;
+  }
+  
+  LOGD("尝试删除文件: %s", path);
+  SdLock lock;
+  
+  // 检查文件是否存在
+  File file = SD_MMC.open(path, FILE_READ);
+  if (!file) {
+    LOGE("错误: 文件不存在 %s", path);
+    deleteSendPage(404, false, "文件不存在: ", path, NULL);
+    return;
+  }
+  
+  // 确保不是目录
+  if (file.isDirectory()) {
+    file.close();
+    LOGE("错误: 路径是目录而不是文件: %s", path);
+    deleteSendPage(400, false, "不能删除目录: ", path, NULL);
+    return;
+  }
+  
+  file.close();
+  
+  // 删除文件
+  if (SD_MMC.remove(path)) {
+    syncRecordChange('-', path, 0);
+    summaryInvalidate(path);
+    LOGI("文件删除成功: %s", path);
+    deleteSendPage(200, true, "文件已删除: ", path, NULL);
+  } else {
+    LOGE("错误: 文件删除失败 %s", path);
+    deleteSendPage(500, false, "无法删除文件: ", path, "可能原因：文件被占用或SD卡错误");
+  }
+}
+
+// ==================== 自动清理 ====================
+
+// 是否是周目录名（YYYY_Wxx）
+bool isWeekDirName(const String& name) {
+  return name.length() == 8 && name.charAt(4) == '_' && name.charAt(5) == 'W' &&
+         isDigit(name.charAt(0)) && isDigit(name.charAt(6)) && isDigit(name.charAt(7));
+}
+
+// 剩余空间百分比（totalBytes/usedBytes只读FAT统计信息，开销很小）
+int sdFreePercent() {
+  uint64_t total = SD_MMC.totalBytes();
+  if (total == 0) {
+    return 100;
+  }
+  return (int)((total - SD_MMC.usedBytes()) * 100 / total);
+}
+
+// 是否是设备拍摄的照片文件名（YYYY_MM_DD_...jpg）；校验文件、日历汇总、小图和视频都不是
+bool isPhotoFileName(const String& name) {
+  struct tm t;
+  return name.length() > 14 && name.charAt(10) == '_' && name.endsWith(".jpg") && parseDay(name.substring(0, 10), t);
+}
+
+// 删除目录中的文件，返回删除数量
+// photosOnly为true时只删除照片（按日期删除时使用），否则删除目录中的所有文件（删除整个周目录时使用）；
+// before非空时只删除文件名（时间戳）小于before的照片；requireUploaded为true时跳过未上传的照片
+// 每批（最多32个）收集和删除时持有SD卡锁，批之间释放；超过deadline时停止，complete返回是否处理完整个目录
+uint32_t deleteFilesInDir(const String& dirPath, const String& before, bool photosOnly, bool requireUploaded, unsigned long deadline, bool& complete) {
+  const int batchSize = 32;
+  String batch[batchSize];
+  uint32_t deleted = 0;
+  complete = false;
+
+  // 边遍历边删除可能跳过目录项，所以每次先收集一批再删除
+  while (true) {
+    if ((long)(millis() - deadline) >= 0) {
+      return deleted;
+    }
+    int count = 0;
+    bool more = false;
+    SdLock lock;
+    File dir = SD_MMC.open(dirPath.c_str());
+    if (!dir || !dir.isDirectory()) {
+      if (dir) dir.close();
+      complete = true;
+      return deleted;
+    }
+    File file = dir.openNextFile();
+    while (file) {
+      String name = String(file.name());
+      name = name.substring(name.lastIndexOf('/') + 1);
+      bool isDir = file.isDirectory();
+      file.close();
+      bool match = !isDir && (!photosOnly || isPhotoFileName(name)) && (before.length() == 0 || name < before) &&
+                   (!requireUploaded || !name.endsWith(".jpg") || uploadIsDone(name));
+      if (match) {
+        if (count < batchSize) {
+          batch[count++] = (dirPath == "/" ? String("") : dirPath) + "/" + name;
+        } else {
+          more = true;
+          break;
+        }
+      }
+      file = dir.openNextFile();
+    }
+    dir.close();
+
+    for (int i = 0; i < count; i++) {
+      if (SD_MMC.remove(batch[i].c_str())) {
+        if (batch[i].endsWith(".jpg")) {
+          syncRecordChange('-', batch[i], 0);
+          summaryInvalidate(batch[i]);
+        }
+        deleted++;
+      } else {
+        LOGW("无法删除: %s", batch[i].c_str());
+        more = false;
+      }
+    }
+    if (!more || count == 0) {
+      complete = true;
+      return deleted;
+    }
+  }
+}
+
+// 列出所有周目录，按时间从旧到新排序
+int listWeekDirs(String* dirs, int maxDirs) {
+  int count = 0;
+  File root = SD_MMC.open("/");
+  if (!root || !root.isDirectory()) {
+    return 0;
+  }
+  File file = root.openNextFile();
+  while (file && count < maxDirs) {
+    String name = String(file.name());
+    name = name.substring(name.lastIndexOf('/') + 1);
+    if (file.isDirectory() && isWeekDirName(name)) {
+      dirs[count++] = "/" + name;
+    }
+    file.close();
+    file = root.openNextFile();
+  }
+  root.close();
+  std::sort(dirs, dirs + count);
+  return count;
+}
+
+// 删除整个周目录（含目录中的所有文件），返回删除的文件数
+uint32_t deleteWeekDir(const String& dirPath, bool requireUploaded, unsigned long deadline, bool& complete) {
+  uint32_t deleted = deleteFilesInDir(dirPath, "", false, requireUploaded, deadline, complete);
+  SdLock lock;
+  if (complete && !SD_MMC.rmdir(dirPath.c_str())) {
+    complete = false;  // 还有未上传的照片，目录保留
+  }
+  return deleted;
+}
+
+// 每次唤醒调用：空间不足时从最旧的周目录开始整目录删除；可选地删除超过保留天数的照片
+void retentionRun() {
+  if (!sdReady) {
+    return;
+  }
+  SdLock lock;
+  unsigned long start = millis();
+  unsigned long deadline = start + RETENTION_TIME_BUDGET_MS;
+  uint32_t deleted = 0;
+  int freePercent = sdFreePercent();
+  LOGI("SD卡剩余空间: %d%%", freePercent);
+
+  String* dirs = new String[RETENTION_MAX_WEEK_DIRS];
+  int dirCount = listWeekDirs(dirs, RETENTION_MAX_WEEK_DIRS);
+
+  // 按空间清理（最新的周目录永远保留）
+  if (freePercent < RETENTION_LOW_WATER_PERCENT) {
+    LOGW("剩余空间低于 %d%%，开始清理最旧的照片", RETENTION_LOW_WATER_PERCENT);
+    for (int i = 0; i < dirCount - 1 && freePercent < RETENTION_HIGH_WATER_PERCENT; i++) {
+      bool complete = false;
+      deleted += deleteWeekDir(dirs[i], true, deadline, complete);
+      if (!complete) {
+        break;  // 时间用完或遇到未上传的照片，更新的目录也不会满足条件
+      }
+      LOGI("已删除周目录: %s", dirs[i].c_str());
+      freePercent = sdFreePercent();
+    }
+    if (freePercent < RETENTION_HIGH_WATER_PERCENT) {
+      LOGW("清理后剩余空间仍为 %d%%（可能有照片未上传或已到时间预算）", freePercent);
+    }
+  }
+
+#if RETENTION_MAX_AGE_DAYS > 0
+  // 按时间清理：文件名是时间戳，直接与截止日期字符串比较
+  time_t now = time(NULL) - (time_t)RETENTION_MAX_AGE_DAYS * 86400;
+  struct tm cutoffTm;
+  localtime_r(&now, &cutoffTm);
+  if (cutoffTm.tm_year + 1900 >= 2020) {
+    char cutoff[16];
+    strftime(cutoff, sizeof(cutoff), "%Y_%m_%d", &cutoffTm);
+    for (int i = 0; i < dirCount - 1 && (long)(millis() - deadline) < 0; i++) {
+      bool complete = false;
+      deleted += deleteFilesInDir(dirs[i], String(cutoff), true, true, deadline, complete);
+      SD_MMC.rmdir(dirs[i].c_str());  // 目录为空时才会成功
+    }
+  }
+#endif
+
+  delete[] dirs;
+  unsigned long elapsed = millis() - start;
+  if (deleted > 0) {
+    LOGI("清理完成: 删除 %lu 个文件, 耗时 %lu ms, 每千个文件 %lu ms, 剩余空间 %d%%",
+         deleted, elapsed, elapsed * 1000 / deleted, sdFreePercent());
+  }
+}
+
+// 批量删除：/delete?week=2026_W03 删除整周，/delete?before=2026_01_15 删除该日期之前的照片
+// 手动删除不检查上传状态。与自动清理使用相同的时间预算，只在每批删除时持有SD卡锁，未完成时提示再次执行
+void handleDeleteBatch() {
+  unsigned long start = millis();
+  unsigned long deadline = start + RETENTION_TIME_BUDGET_MS;
+  uint32_t deleted = 0;
+  bool complete = true;
+  String target;
+
+  if (server.hasArg("week")) {
+    String week = server.arg("week");
+    if (!isWeekDirName(week)) {
+      server.send(400, "text/plain", "无效的周目录: " + week);
+      return;
+    }
+    target = "周目录 " + week;
+    deleted = deleteWeekDir("/" + week, false, deadline, complete);
+  } else {
+    // 只接受 YYYY_MM_DD：文件名按字符串与它比较，其他值（如 zzzz）会匹配所有文件
+    String before = server.arg("before");
+    struct tm beforeTm;
+    if (!parseDay(before, beforeTm)) {
+      server.send(400, "text/plain", "无效的日期（格式 YYYY_MM_DD）: " + before);
+      return;
+    }
+    target = before + " 之前的照片";
+    String* dirs = new String[RETENTION_MAX_WEEK_DIRS];
+    int dirCount;
+    {
+      SdLock lock;
+      dirCount = listWeekDirs(dirs, RETENTION_MAX_WEEK_DIRS);
+    }
+    for (int i = 0; i < dirCount && complete; i++) {
+      deleted += deleteFilesInDir(dirs[i], before, true, false, deadline, complete);
+      SdLock lock;
+      SD_MMC.rmdir(dirs[i].c_str());  // 目录为空时才会成功
+    }
+    delete[] dirs;
+    if (complete) {
+      deleted += deleteFilesInDir("/", before, true, false, deadline, complete);  // 根目录中的照片
+    }
+  }
+
+  unsigned long elapsed = millis() - start;
+  LOGI("批量删除 %s: %lu 个文件, 耗时 %lu ms", target.c_str(), deleted, elapsed);
+
+  String html = "<!DOCTYPE html><html><head>";
+  html += "<meta charset='UTF-8'>";
+  html += "<meta http-equiv='refresh' content='3;url=/photos'>";
+  html += "<title>批量删除</title>";
+  html += "<style>body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }";
+  html += ".success { color: #4CAF50; }</style></head><body>";
+  html += "<h1 class='success'>✅ 批量删除完成</h1>";
+  char escaped[HTTP_PATH_MAX * 6];
+  if (htmlEscapeTo(target.c_str(), target.length(), escaped, sizeof(escaped)) < 0) {
+    escaped[0] = '\0';
+  }
+  html += "<p>" + String(escaped) + ": 已删除 " + String(deleted) + " 个文件，耗时 " + String(elapsed) + " ms</p>";
+  if (!complete) {
+    html += "<p>未全部完成，请再次执行</p>";
+  }
+  html += "<p>3秒后自动返回照片列表...</p>";
+  html += "<a href='/photos'>立即返回</a>";
+  html += "</body></html>";
+  server.send(200, "text/html; charset=UTF-8", html);
+}
+
+// ==================== 增量同步 ====================
+// 备份主机通过 /api/changes?since=<序号> 获取之后新增和删除的照片，不需要遍历整张卡
+
+// 最新序号由记录文件大小直接算出（SD卡挂载后调用）
+void syncLoadSeq() {
+  SdLock lock;
+  File file = SD_MMC.open(SYNC_LOG_FILE, FILE_READ);
+  if (!file) {
+    syncSeedFromCard();
+    return;
+  }
+  syncSeq = file.size() / sizeof(ChangeRecord);
+  file.close();
+  LOGD("同步序号: %lu", syncSeq);
+}
+
+// 记录文件不存在时（首次使用此功能），把卡上已有的照片登记为新增，只执行一次
+void syncSeedFromCard() {
+  unsigned long start = millis();
+  String* dirs = new String[RETENTION_MAX_WEEK_DIRS + 1];
+  int dirCount = listWeekDirs(dirs, RETENTION_MAX_WEEK_DIRS);
+  dirs[dirCount++] = "/";
+  syncSeq = 0;
+  SD_MMC.mkdir(SYNC_DIR);
+  File log = SD_MMC.open(SYNC_LOG_FILE, FILE_WRITE);
+  if (!log) {
+    delete[] dirs;
+    return;
+  }
+  for (int i = 0; i < dirCount; i++) {
+    File dir = SD_MMC.open(dirs[i].c_str());
+    if (!dir || !dir.isDirectory()) {
+      if (dir) dir.close();
+      continue;
+    }
+    File file = dir.openNextFile();
+    while (file) {
+      String name = String(file.name());
+      name = name.substring(name.lastIndexOf('/') + 1);
+      if (!file.isDirectory() && name.endsWith(".jpg")) {
+        ChangeRecord record;
+        memset(&record, 0, sizeof(record));
+        record.seq = ++syncSeq;
+        record.size = file.size();
+        record.op = '+';
+        String path = (dirs[i] == "/" ? String("") : dirs[i]) + "/" + name;
+        strncpy(record.path, path.c_str(), sizeof(record.path) - 1);
+        log.write((const uint8_t*)&record, sizeof(record));
+      }
+      file.close();
+      file = dir.openNextFile();
+    }
+    dir.close();
+  }
+  log.close();
+  delete[] dirs;
+  LOGI("已登记卡上现有照片 %lu 张，耗时 %lu ms", syncSeq, millis() - start);
+}
+
+// 追加一条变更记录
+void syncRecordChange(char op, const String& path, uint32_t size) {
+  if (!sdReady) {
+    return;
+  }
+  ChangeRecord record;
+  memset(&record, 0, sizeof(record));
+  record.seq = syncSeq + 1;
+  record.size = size;
+  record.op = op;
+  strncpy(record.path, path.c_str(), sizeof(record.path) - 1);
+
+  SdLock lock;
+  File file = SD_MMC.open(SYNC_LOG_FILE, FILE_APPEND);
+  if (!file) {
+    SD_MMC.mkdir(SYNC_DIR);
+    file = SD_MMC.open(SYNC_LOG_FILE, FILE_APPEND);
+    if (!file) {
+      LOGE("无法写入变更记录: %s", path.c_str());
+      return;
+    }
+  }
+  // 文件以追加方式打开，写入位置即文件末尾；如果上次写入被截断，补齐到记录边界
+  size_t fileSize = file.size();
+  if (fileSize % sizeof(ChangeRecord) != 0) {
+    LOGW("变更记录文件长度异常，丢弃不完整的记录");
+    file.close();
+    file = SD_MMC.open(SYNC_LOG_FILE, "r+");
+    fileSize -= fileSize % sizeof(ChangeRecord);
+    if (!file || !file.seek(fileSize)) {
+      if (file) file.close();
+      return;
+    }
+    record.seq = fileSize / sizeof(ChangeRecord) + 1;
+  }
+  if (file.write((const uint8_t*)&record, sizeof(record)) == sizeof(record)) {
+    syncSeq = record.seq;
+  }
+  file.close();
+}
+
+// 最后一条变更记录是否是该路径的新增（写入日志恢复时判断是否已经登记过）
+bool syncLastPathIs(const String& path) {
+  File file = SD_MMC.open(SYNC_LOG_FILE, FILE_READ);
+  if (!file) {
+    return false;
+  }
+  size_t fileSize = file.size() - file.size() % sizeof(ChangeRecord);
+  ChangeRecord record;
+  bool found = fileSize >= sizeof(record) && file.seek(fileSize - sizeof(record)) &&
+               file.read((uint8_t*)&record, sizeof(record)) == sizeof(record) &&
+               record.op == '+' && strncmp(record.path, path.c_str(), sizeof(record.path)) == 0;
+  file.close();
+  return found;
+}
+
+// /api/changes?since=N[&limit=M]：返回序号大于N的变更（JSON）
+// {"seq":最新序号,"next":下次请求的since,"more":是否还有,"changes":[{"seq":1,"op":"+","path":"...","size":123},...]}
+void handleApiChanges() {
+  uint32_t since = server.hasArg("since") ? (uint32_t)server.arg("since").toInt() : 0;
+  uint32_t limit = SYNC_MAX_CHANGES_PER_REQUEST;
+  if (server.hasArg("limit")) {
+    limit = constrain((uint32_t)server.arg("limit").toInt(), (uint32_t)1, (uint32_t)SYNC_MAX_CHANGES_PER_REQUEST);
+  }
+  if (since > syncSeq) {
+    since = syncSeq;  // 设备记录被清空过时，从头开始
+  }
+  uint32_t count = min(limit, syncSeq - since);
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  char buf[160];
+  int len = snprintf(buf, sizeof(buf), "{\"seq\":%lu,\"next\":%lu,\"more\":%s,\"changes\":[",
+                     syncSeq, since + count, since + count < syncSeq ? "true" : "false");
+  server.sendContent(buf, len);
+
+  if (count > 0) {
+    SdLock lock;
+    File file = SD_MMC.open(SYNC_LOG_FILE, FILE_READ);
+    if (file && file.seek(since * sizeof(ChangeRecord))) {
+      ChangeRecord record;
+      for (uint32_t i = 0; i < count; i++) {
+        if (file.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) {
+          break;
+        }
+        record.path[sizeof(record.path) - 1] = '\0';
+        len = snprintf(buf, sizeof(buf), "%s{\"seq\":%lu,\"op\":\"%c\",\"path\":\"%s\",\"size\":%lu}",
+                       i > 0 ? "," : "", record.seq, record.op, record.path, record.size);
+        server.sendContent(buf, len);
+      }
+    }
+    if (file) file.close();
+  }
+  server.sendContent("]}", 2);
+  server.sendContent("", 0);
+}
+
+// 查看/下载单个照片
+void handlePhoto() {
+  if (!server.hasArg("file")) {
+    server.send(400, "text/plain", "缺少file参数");
+    return;
+  }
+  
+  // 参数已由服务器解码，这里只做规范化（照片和延时视频）
+  char path[HTTP_PATH_MAX];
+  int pathLen = photoPathArg(path, sizeof(path));
+  bool isVideo = pathLen > 0 && pathHasExtension(path, pathLen, ".avi");
+  if (pathLen < 0 || !(isVideo || pathHasExtension(path, pathLen, ".jpg"))) {
+    server.send(400, "text/plain", "无效的文件路径");
+    LOGE("无效文件路径: %s", server.argValue("file"));
+    return;
+  }
+  
+  LOGD("尝试打开文件: %s", path);
+  
+  // 尝试打开文件（只在访问SD卡时持有锁，发送由streamFile逐块加锁读取）
+  File file;
+  size_t fileSize = 0;
+  {
+    SdLock lock;
+    file = SD_MMC.open(path, FILE_READ);
+    if (!file) {
+      LOGE("错误: 无法打开文件 %s", path);
+      server.send(404, "text/plain", String("文件未找到: ") + path);
+      return;
+    }
+    if (file.isDirectory()) {
+      file.close();
+      LOGE("错误: 路径是目录而不是文件: %s", path);
+      server.send(400, "text/plain", String("路径是目录: ") + path);
+      return;
+    }
+    fileSize = file.size();
+  }
+  LOGD("文件大小: %zu 字节", fileSize);
+  
+  // 下载请求附带文件名，查看和缩略图请求允许浏览器缓存
+  // 不再发送 Connection: close，浏览器可以复用连接连续加载多张图片
+  bool isDownload = server.hasArg("download") && server.arg("download") == "1";
+  bool isThumb = server.hasArg("thumb") && server.arg("thumb") == "1";
+  if (isDownload) {
+    server.sendHeader("Content-Disposition", String("attachment; filename=\"") + (strrchr(path, '/') + 1) + "\"");
+  } else if (!isVideo) {
+    server.sendHeader("Cache-Control", "public, max-age=3600");  // 当天的视频还在增长，不缓存
+  }
+  
+  // 分块传输文件（每次4KB，ESP32-CAM内存有限）
+  size_t totalSent = server.streamFile(file, isVideo ? "video/x-msvideo" : "image/jpeg");
+  {
+    SdLock lock;
+    file.close();
+  }
+  
+  if (isDownload) {
+    LOGI("文件下载完成，已发送 %zu 字节", totalSent);
+  } else if (isThumb) {
+    LOGI("缩略图传输完成，已发送 %zu 字节", totalSent);
+  } else {
+    LOGI("照片传输完成，已发送 %zu 字节", totalSent);
+  }
+}
+
+// 日志查看页面：先把暂存日志写入SD卡，再依次输出旧日志和当前日志
+void handleLogs() {
+#if LOG_TO_SD
+  logPersist();
+  
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; charset=UTF-8", "");
+  
+  IoBuffer buffer;
+  if (!buffer) {
+    LOGE("错误: 内存分配失败");
+    server.sendContent("");
+    return;
+  }
+  
+  // 与 streamFile() 相同，只在打开和读每一块时持有SD卡锁，发送时释放
+  const char* files[] = {LOG_FILE_OLD, LOG_FILE};
+  bool clientGone = false;
+  for (int i = 0; i < 2 && !clientGone; i++) {
+    File file;
+    {
+      SdLock lock;
+      file = SD_MMC.open(files[i], FILE_READ);
+    }
+    if (!file) {
+      continue;
+    }
+    while (true) {
+      size_t bytesRead;
+      {
+        SdLock lock;
+        bytesRead = file.read(buffer.data(), buffer.size());
+      }
+      if (bytesRead == 0) {
+        break;
+      }
+      if (!server.sendContent((const char*)buffer.data(), bytesRead)) {
+        clientGone = true;
+        break;
+      }
+    }
+    SdLock lock;
+    file.close();
+  }
+  
+  server.sendContent("");
+#else
+  server.send(404, "text/plain", "未启用SD卡日志 (LOG_TO_SD=0)");
+#endif
+}
+
+// /heap：内部RAM和PSRAM的空闲/最大空闲块（当前值和访问窗口内的历史记录），以及缓冲池和请求内存区省掉的分配次数（JSON）
+// {"internal":{"free":F,"largest":L,"min":M},"psram":{...},"pool":{"hits":H,"misses":M,"free":N},
+//  "arena":{"allocs":A,"overflows":O,"peak":P},"streamedBytes":B,"samples":[[ms,iFree,iLargest,pFree,pLargest],...]}
+void handleHeap() {
+  heapSample(true);
+  char buf[400];
+  snprintf(buf, sizeof(buf),
+           "{\"internal\":{\"free\":%u,\"largest\":%u,\"min\":%u},\"psram\":{\"free\":%u,\"largest\":%u,\"min\":%u},"
+           "\"pool\":{\"hits\":%lu,\"misses\":%lu,\"free\":%d},\"arena\":{\"allocs\":%lu,\"overflows\":%lu,\"peak\":%lu},"
+           "\"eliminated\":%lu,\"streamedBytes\":%lu,\"samples\":[",
+           heap_caps_get_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+           heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+           heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM), heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM),
+           memStats.poolHits.load(), memStats.poolMisses.load(), __builtin_popcount(ioPoolFreeMask.load()),
+           memStats.arenaAllocs.load(), memStats.arenaOverflows.load(), memStats.arenaPeak.load(),
+           memStats.poolHits.load() + memStats.arenaAllocs.load(), memStats.streamedBytes.load());
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  server.print(buf);
+  uint32_t n = std::min(heapSampleCount, (uint32_t)HEAP_SAMPLE_COUNT);
+  for (uint32_t i = 0; i < n; i++) {
+    const HeapSample& h = heapSamples[(heapSampleCount - n + i) % HEAP_SAMPLE_COUNT];
+    snprintf(buf, sizeof(buf), "%s[%lu,%lu,%lu,%lu,%lu]", i > 0 ? "," : "", h.ms, h.internalFree, h.internalLargest,
+             h.psramFree, h.psramLargest);
+    server.print(buf);
+  }
+  server.print("]}");
+}
+
+// /profile[?name=day|night]：查看或切换静态拍摄的传感器参数配置（立即生效，并保存到当前拍摄配置）
+// {"profile":"day","written":N,"ms":T,"profiles":["day","night"]}
+void handleProfile() {
+  int written = 0;
+  unsigned long ms = 0;
+  if (server.hasArg("name")) {
+    String name = server.arg("name");
+    int id = -1;
+    for (int i = 0; i < CAMERA_PROFILE_COUNT; i++) {
+      if (i != CAMERA_PROFILE_PREVIEW && name == cameraProfiles[i].name) {
+        id = i;
+      }
+    }
+    if (id < 0) {
+      server.send(400, "text/plain", "Unknown profile");
+      return;
+    }
+    if (id != cameraProfileId) {
+      cameraProfileId = id;
+      captureProfile.sensor = id;
+      captureConfig.profiles[captureConfig.active].sensor = id;
+      captureConfigSave();
+      LOGI("传感器参数配置切换为 %s", cameraProfiles[cameraProfileId].name);
+    }
+    // 预览中不改传感器，切回静态拍摄时会应用新配置
+    CameraLock lock;
+    if (cameraStillMode) {
+      unsigned long start = millis();
+      written = cameraApplyProfile(cameraProfileId);
+      ms = millis() - start;
+    }
+  }
+  String json = "{\"profile\":\"" + String(cameraProfiles[cameraProfileId].name) + "\"";
+  json += ",\"written\":" + String(written) + ",\"ms\":" + String(ms) + ",\"profiles\":[";
+  for (int i = 0; i < CAMERA_PROFILE_COUNT; i++) {
+    if (i == CAMERA_PROFILE_PREVIEW) {
+      continue;
+    }
+    json += String(i > 0 ? "," : "") + "\"" + cameraProfiles[i].name + "\"";
+  }
+  json += "]}";
+  server.send(200, "application/json", json);
+}
+
+// 实时预览：/stream 跳转到预览流端口
+void handleStreamRedirect() {
+  String location = "http://" + WiFi.localIP().toString() + ":" + String(STREAM_PORT) + "/stream";
+  const char* res = server.argValue("res");
+  char encoded[32];
+  if (res != NULL && urlEncodeTo(res, strlen(res), encoded, sizeof(encoded)) > 0) {
+    location += "?res=";
+    location += encoded;
+  }
+  server.sendHeader("Location", location);
+  server.send(302, "text/plain", "");
+}
+
+// 实时预览流（multipart/x-mixed-replace），浏览器直接打开即可显示
+// 总是发送最新的一帧，客户端跟不上时中间的帧直接丢弃
+#define STREAM_BOUNDARY "123456789000000000000987654321"
+
+void handleStream() {
+  framesize_t size = STREAM_FRAME_SIZE;
+  if (streamServer.arg("res") == "svga") {
+    size = FRAMESIZE_SVGA;
+  } else if (streamServer.arg("res") == "vga") {
+    size = FRAMESIZE_VGA;
+  }
+  
+  streamServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  streamServer.send(200, "multipart/x-mixed-replace;boundary=" STREAM_BOUNDARY, "");
+  LOGI("预览流开始 (%ux%u)", resolution[size].width, resolution[size].height);
+  
+  unsigned long streamStart = millis();
+  unsigned long reportStart = streamStart;
+  uint32_t frames = 0;
+  uint32_t reportFrames = 0;
+  char part[96];
+  
+  while (!previewStopRequested) {
+    CameraLock lock;
+    if (cameraStillMode) {
+      cameraUsePreviewMode(size);
+    }
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (!fb) {
+      LOGE("预览取帧失败");
+      break;
+    }
+    int len = snprintf(part, sizeof(part), "\r\n--" STREAM_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n", fb->len);
+    bool ok = streamServer.sendContent(part, len) && streamServer.sendContent((const char*)fb->buf, fb->len);
+    esp_camera_fb_return(fb);
+    if (!ok) {
+      break;  // 客户端已断开
+    }
+    frames++;
+    reportFrames++;
+    
+    // 每5秒报告一次帧率
+    unsigned long now = millis();
+    if (now - reportStart >= 5000) {
+      LOGI("预览帧率: %.1f fps", reportFrames * 1000.0 / (now - reportStart));
+      reportStart = now;
+      reportFrames = 0;
+    }
+  }
+  
+  unsigned long duration = millis() - streamStart;
+  LOGI("预览流结束: %lu 帧, %lu ms, 平均 %.1f fps", frames, duration, duration > 0 ? frames * 1000.0 / duration : 0.0);
+}
+
+// 404处理
+void handleNotFound() {
+  server.send(404, "text/plain", "页面未找到");
+}
+
+// ==================== 拍摄配置 ====================
+// 配置整体以定长结构保存在Preferences中（带版本号），冷启动时读取一次到RTC内存，之后的唤醒不再读NVS。
+// /api/config 修改时同时写NVS和RTC副本，本次唤醒继续使用开始时取出的配置，下次唤醒生效。
+
+void captureConfigDefaults(CaptureConfig& c) {
+  memset(&c, 0, sizeof(c));
+  c.magic = CAPTURE_CONFIG_MAGIC;
+  c.version = CAPTURE_CONFIG_VERSION;
+  c.active = 0;
+  c.count = 1;
+  CaptureProfile& p = c.profiles[0];
+  strcpy(p.name, "default");
+  p.frameSize = FRAMESIZE_UXGA;
+  p.quality = JPEG_QUALITY;
+  p.wbMode = -1;
+  p.sensor = CAMERA_PROFILE_DAY;
+  p.flash = 1;
+  p.intervalS = (uint32_t)(SLEEP_DURATION_US / 1000000);
+  p.webWindowMs = 30000;
+}
+
+const char* frameSizeName(uint8_t size) {
+  for (size_t i = 0; i < sizeof(frameSizeNames) / sizeof(frameSizeNames[0]); i++) {
+    if (frameSizeNames[i].size == size) {
+      return frameSizeNames[i].name;
+    }
+  }
+  return NULL;
+}
+
+// 检查一个配置，返回错误说明，合法时返回NULL
+const char* captureProfileCheck(const CaptureProfile& p) {
+  size_t len = strnlen(p.name, sizeof(p.name));
+  if (len == 0 || len >= sizeof(p.name)) {
+    return "name must be 1-11 characters";
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (!isAlphaNumeric(p.name[i]) && p.name[i] != '-' && p.name[i] != '_') {
+      return "name may only contain letters, digits, '-' and '_'";
+    }
+  }
+  if (frameSizeName(p.frameSize) == NULL) {
+    return "invalid frameSize";
+  }
+  if (p.quality < 4 || p.quality > 63) {
+    return "quality must be 4-63";
+  }
+  if (p.wbMode < -1 || p.wbMode > 4) {
+    return "wbMode must be -1-4";
+  }
+  if (p.sensor >= CAMERA_PROFILE_COUNT || p.sensor == CAMERA_PROFILE_PREVIEW) {
+    return "invalid sensor";
+  }
+  if (p.flash > 1) {
+    return "invalid flash";
+  }
+  if (p.intervalS < CAPTURE_INTERVAL_MIN_S || p.intervalS > CAPTURE_INTERVAL_MAX_S) {
+    return "intervalS out of range";
+  }
+  if (p.webWindowMs > CAPTURE_WEB_WINDOW_MAX_MS) {
+    return "webWindowMs out of range";
+  }
+  return NULL;
+}
+
+const char* captureConfigCheck(const CaptureConfig& c) {
+  if (c.magic != CAPTURE_CONFIG_MAGIC) {
+    return "not saved";
+  }
+  if (c.version != CAPTURE_CONFIG_VERSION) {
+    return "unsupported version";
+  }
+  if (c.count == 0 || c.count > CAPTURE_PROFILE_MAX || c.active >= c.count) {
+    return "invalid profile count";
+  }
+  for (int i = 0; i < c.count; i++) {
+    const char* err = captureProfileCheck(c.profiles[i]);
+    if (err != NULL) {
+      return err;
+    }
+  }
+  return NULL;
+}
+
+// 每次唤醒最先调用：RTC副本有效时直接使用，否则从NVS读取（冷启动），都无效时使用默认配置
+void captureConfigLoad() {
+  if (captureConfigCheck(captureConfig) != NULL) {
+    CaptureConfig stored;
+    bool ok = false;
+    Preferences prefs;
+    if (prefs.begin("wifi-config", true)) {
+      ok = prefs.getBytesLength(CAPTURE_CONFIG_KEY) == sizeof(stored) &&
+           prefs.getBytes(CAPTURE_CONFIG_KEY, &stored, sizeof(stored)) == sizeof(stored);
+      prefs.end();
+    }
+    const char* err = ok ? captureConfigCheck(stored) : "not saved";
+    if (err == NULL) {
+      captureConfig = stored;
+      LOGI("已从NVS读取拍摄配置（%u 个）", captureConfig.count);
+    } else {
+      captureConfigDefaults(captureConfig);
+      LOGI("使用默认拍摄配置（%s）", err);
+    }
+  }
+  captureProfile = captureConfig.profiles[captureConfig.active];
+  energyPolicy = energyBasePolicy(captureProfile);
+  cameraProfileId = captureProfile.sensor;
+  LOGI("拍摄配置 %s: %s，质量 %u，间隔 %lu 秒，访问窗口 %lu 秒，闪光灯%s，传感器 %s",
+       captureProfile.name, frameSizeName(captureProfile.frameSize), captureProfile.quality,
+       captureProfile.intervalS, captureProfile.webWindowMs / 1000, captureProfile.flash ? "开" : "关",
+       cameraProfiles[captureProfile.sensor].name);
+}
+
+bool captureConfigSave() {
+  if (preferences.putBytes(CAPTURE_CONFIG_KEY, &captureConfig, sizeof(captureConfig)) != sizeof(captureConfig)) {
+    LOGE("拍摄配置保存失败");
+    return false;
+  }
+  return true;
+}
+
+// JSON字符串的结束引号位置（start是开始引号，跳过反斜杠转义）；不完整时返回-1
+int jsonStringEnd(const String& json, int start) {
+  int len = json.length();
+  for (int i = start + 1; i < len; i++) {
+    char c = json.charAt(i);
+    if (c == '\\') {
+      i++;
+    } else if (c == '"') {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// 从单层JSON对象中取出字段值：字符串去掉引号（不处理转义），其他类型原样返回；没有该字段时返回false。
+// 按键值对逐个扫描，只比较对象的键（"{"或","之后的字符串），字符串值中出现的同名文字不会被当作键
+bool jsonField(const String& json, const char* key, String& value) {
+  int len = json.length();
+  int keyLen = strlen(key);
+  int i = json.indexOf('{');
+  if (i < 0) {
+    return false;
+  }
+  while (true) {
+    for (i++; i < len && isSpace(json.charAt(i)); i++) {
+    }
+    if (i >= len || json.charAt(i) != '"') {
+      return false;
+    }
+    int keyEnd = jsonStringEnd(json, i);
+    if (keyEnd < 0) {
+      return false;
+    }
+    bool match = keyEnd - i - 1 == keyLen && strncmp(json.c_str() + i + 1, key, keyLen) == 0;
+    for (i = keyEnd + 1; i < len && isSpace(json.charAt(i)); i++) {
+    }
+    if (i >= len || json.charAt(i) != ':') {
+      return false;
+    }
+    for (i++; i < len && isSpace(json.charAt(i)); i++) {
+    }
+    int end;
+    if (i < len && json.charAt(i) == '"') {
+      end = jsonStringEnd(json, i);
+      if (end < 0) {
+        return false;
+      }
+      if (match) {
+        value = json.substring(i + 1, end);
+        return true;
+      }
+      end++;
+    } else {
+      end = i;
+      while (end < len && json.charAt(end) != ',' && json.charAt(end) != '}' && !isSpace(json.charAt(end))) {
+        end++;
+      }
+      if (match) {
+        value = json.substring(i, end);
+        return end > i;
+      }
+    }
+    for (i = end; i < len && isSpace(json.charAt(i)); i++) {
+    }
+    if (i >= len || json.charAt(i) != ',') {
+      return false;  // 对象结束（或格式错误）仍未找到
+    }
+  }
+}
+
+// 取整数或布尔字段：返回0表示没有该字段，1表示成功，-1表示格式错误
+int jsonNumber(const String& json, const char* key, long& value) {
+  String text;
+  if (!jsonField(json, key, text)) {
+    return 0;
+  }
+  if (text == "true" || text == "false") {
+    value = text == "true";
+    return 1;
+  }
+  char* end;
+  value = strtol(text.c_str(), &end, 10);
+  return (end != text.c_str() && *end == '\0') ? 1 : -1;
+}
+
+int captureProfileFind(const String& name) {
+  for (int i = 0; i < captureConfig.count; i++) {
+    if (name == captureConfig.profiles[i].name) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+String captureProfileJson(const CaptureProfile& p) {
+  char buf[224];
+  snprintf(buf, sizeof(buf),
+           "{\"name\":\"%s\",\"frameSize\":\"%s\",\"quality\":%u,\"wbMode\":%d,\"sensor\":\"%s\","
+           "\"flash\":%s,\"intervalS\":%lu,\"webWindowMs\":%lu}",
+           p.name, frameSizeName(p.frameSize), p.quality, p.wbMode, cameraProfiles[p.sensor].name,
+           p.flash ? "true" : "false", p.intervalS, p.webWindowMs);
+  return String(buf);
+}
+
+// /api/config：当前保存的拍摄配置和本次唤醒使用的配置（JSON）
+// {"version":1,"active":"default","current":{...},"profiles":[{...},...]}
+void handleApiConfig() {
+  String json = "{\"version\":" + String(CAPTURE_CONFIG_VERSION);
+  json += ",\"active\":\"" + String(captureConfig.profiles[captureConfig.active].name) + "\"";
+  json += ",\"current\":" + captureProfileJson(captureProfile) + ",\"profiles\":[";
+  for (int i = 0; i < captureConfig.count; i++) {
+    json += (i > 0 ? "," : "") + captureProfileJson(captureConfig.profiles[i]);
+  }
+  json += "]}";
+  server.send(200, "application/json", json);
+}
+
+void sendConfigError(const char* message) {
+  server.send(400, "application/json", "{\"error\":\"" + String(message) + "\"}");
+}
+
+// POST /api/config，请求体为单层JSON对象：
+//   {"name":"fast","frameSize":"svga","quality":12,"intervalS":300,"activate":true}  新建或修改配置（未给出的字段保持原值，新配置从当前配置复制）
+//   {"active":"fast"}  切换使用的配置
+//   {"delete":"fast"}  删除配置（不能删除正在使用的配置）
+// 校验通过后写入NVS，下次唤醒生效；返回与GET相同的内容
+void handleApiConfigPost() {
+  String body = server.arg("plain");
+  CaptureConfig next = captureConfig;
+  String text;
+
+  if (jsonField(body, "delete", text)) {
+    int index = captureProfileFind(text);
+    if (index < 0) {
+      sendConfigError("unknown profile");
+      return;
+    }
+    if (index == next.active) {
+      sendConfigError("cannot delete the active profile");
+      return;
+    }
+    for (int i = index; i + 1 < next.count; i++) {
+      next.profiles[i] = next.profiles[i + 1];
+    }
+    next.count--;
+    memset(&next.profiles[next.count], 0, sizeof(CaptureProfile));
+    if (next.active > index) {
+      next.active--;
+    }
+  } else if (jsonField(body, "name", text)) {
+    int index = captureProfileFind(text);
+    if (index < 0) {
+      if (next.count >= CAPTURE_PROFILE_MAX) {
+        sendConfigError("too many profiles");
+        return;
+      }
+      index = next.count++;
+      next.profiles[index] = next.profiles[next.active];
+      memset(next.profiles[index].name, 0, sizeof(next.profiles[index].name));
+      strncpy(next.profiles[index].name, text.c_str(), sizeof(next.profiles[index].name) - 1);
+      if (text.length() >= sizeof(next.profiles[index].name)) {
+        sendConfigError("name must be 1-11 characters");
+        return;
+      }
+    }
+    CaptureProfile& p = next.profiles[index];
+
+    if (jsonField(body, "frameSize", text)) {
+      p.frameSize = FRAMESIZE_INVALID;
+      for (size_t i = 0; i < sizeof(frameSizeNames) / sizeof(frameSizeNames[0]); i++) {
+        if (text == frameSizeNames[i].name) {
+          p.frameSize = frameSizeNames[i].size;
+        }
+      }
+    }
+    if (jsonField(body, "sensor", text)) {
+      p.sensor = CAMERA_PROFILE_COUNT;
+      for (int i = 0; i < CAMERA_PROFILE_COUNT; i++) {
+        if (i != CAMERA_PROFILE_PREVIEW && text == cameraProfiles[i].name) {
+          p.sensor = i;
+        }
+      }
+    }
+    // 数值先按long读取，范围由 captureProfileCheck() 统一检查（超出字段类型的值换成必然不合法的值）
+    const char* numericKeys[] = {"quality", "wbMode", "flash", "intervalS", "webWindowMs", "activate"};
+    long values[6];
+    bool present[6];
+    for (int i = 0; i < 6; i++) {
+      int found = jsonNumber(body, numericKeys[i], values[i]);
+      if (found < 0) {
+        sendConfigError((String("invalid ") + numericKeys[i]).c_str());
+        return;
+      }
+      present[i] = found > 0;
+    }
+    if (present[0]) p.quality = (values[0] >= 0 && values[0] <= 255) ? values[0] : 0;
+    if (present[1]) p.wbMode = (values[1] >= -1 && values[1] <= 4) ? values[1] : -2;
+    if (present[2]) p.flash = values[2] ? 1 : 0;
+    if (present[3]) p.intervalS = (values[3] >= 0 && values[3] <= CAPTURE_INTERVAL_MAX_S) ? values[3] : 0;
+    if (present[4]) p.webWindowMs = (values[4] >= 0 && values[4] <= CAPTURE_WEB_WINDOW_MAX_MS) ? values[4] : UINT32_MAX;
+    if (present[5] && values[5]) {
+      next.active = index;
+    }
+  } else if (jsonField(body, "active", text)) {
+    int index = captureProfileFind(text);
+    if (index < 0) {
+      sendConfigError("unknown profile");
+      return;
+    }
+    next.active = index;
+  } else {
+    sendConfigError("expected name, active or delete");
+    return;
+  }
+
+  const char* err = captureConfigCheck(next);
+  if (err != NULL) {
+    sendConfigError(err);
+    return;
+  }
+  captureConfig = next;
+  if (!captureConfigSave()) {
+    server.send(500, "application/json", "{\"error\":\"save failed\"}");
+    return;
+  }
+  LOGI("拍摄配置已更新，使用 %s，下次唤醒生效", captureConfig.profiles[captureConfig.active].name);
+  handleApiConfig();
+}
+
+// ==================== 时间同步 ====================
+// 后台任务等WiFi连上后同时向所有NTP服务器发送请求，采用最先返回的有效回复。
+// 每次同步测量本地时钟的偏移，据此估计漂移；之后每次唤醒按漂移校正，估计误差超过容差才重新同步。
+
+int64_t timeNowUs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// 调整系统时间：小的偏差平滑调整（时间不会倒退），大的直接设置
+void timeAdjust(int64_t deltaUs) {
+  if (llabs(deltaUs) < TIME_SLEW_MAX_US) {
+    struct timeval delta = {(time_t)(deltaUs / 1000000), (suseconds_t)(deltaUs % 1000000)};
+    adjtime(&delta, NULL);
+  } else {
+    int64_t t = timeNowUs() + deltaUs;
+    struct timeval tv = {(time_t)(t / 1000000), (suseconds_t)(t % 1000000)};
+    settimeofday(&tv, NULL);
+  }
+}
+
+// 按估计的漂移校正上次校正以来累积的误差（时间有效时每次唤醒调用）
+void timeApplyDriftCorrection() {
+  if (timeLastCorrectUs == 0 || timeDriftPpm == 0 || time(NULL) < TIME_VALID_AFTER) {
+    return;
+  }
+  int64_t now = timeNowUs();
+  int64_t correction = timeDriftCorrectionUs(timeDriftPpm, timeLastCorrectUs, now);
+  timeAdjust(correction);
+  timeLastCorrectUs = now + correction;
+  LOGD("按漂移 %.1f ppm 校正 %lld us", timeDriftPpm, correction);
+}
+
+// 是否需要同步：时间无效、从未同步、间隔过长或估计误差超过容差
+bool timeNeedsSync() {
+  int64_t now = timeNowUs();
+  if (now < (int64_t)TIME_VALID_AFTER * 1000000LL || timeLastSyncUs == 0) {
+    return true;
+  }
+  int64_t elapsed = now - timeLastSyncUs;
+  float errorMs = timeEstimatedErrorMs(timeResidualPpm, timeLastSyncUs, now);
+  if (elapsed < (int64_t)TIME_SYNC_MAX_INTERVAL_S * 1000000LL && errorMs < TIME_SYNC_TOLERANCE_MS) {
+    LOGI("估计时间误差 %.0f ms（容差 %d ms），本次不同步", errorMs, TIME_SYNC_TOLERANCE_MS);
+    return false;
+  }
+  return true;
+}
+
+// 向一个服务器发送请求，返回请求的发送时间戳
+uint64_t ntpSend(WiFiUDP& udp, IPAddress ip) {
+  uint8_t packet[NTP_PACKET_SIZE];
+  uint64_t sent = ntpBuildRequest(packet, timeNowUs());
+  udp.beginPacket(ip, 123);
+  udp.write(packet, sizeof(packet));
+  udp.endPacket();
+  return sent;
+}
+
+// 处理已到达的回复：收到有效回复时校正时间、更新漂移估计并返回true
+bool ntpPoll(WiFiUDP& udp, const IPAddress* ips, const uint64_t* sent) {
+  uint8_t packet[NTP_PACKET_SIZE];
+  while (udp.parsePacket() >= (int)sizeof(packet)) {
+    int64_t t4 = timeNowUs();
+    udp.read(packet, sizeof(packet));
+    int server = -1;
+    for (int i = 0; i < (int)NTP_SERVER_COUNT; i++) {
+      if ((uint32_t)ips[i] != 0 && (uint32_t)ips[i] == (uint32_t)udp.remoteIP()) {
+        server = i;
+      }
+    }
+    int64_t offset, rtt;
+    if (server < 0 || !ntpParseReply(packet, sizeof(packet), sent[server], t4, offset, rtt)) {
+      continue;
+    }
+    // 与上次同步相隔足够久时，用本次偏移更新漂移估计（偏移是按旧估计校正后的剩余误差）
+    timeDriftUpdate(timeDriftPpm, timeResidualPpm, timeLastSyncUs, ntpToUs(sent[server]), t4, offset,
+                    (int64_t)TIME_VALID_AFTER * 1000000LL);
+    timeAdjust(offset);
+    timeLastSyncUs = t4 + offset;
+    timeLastCorrectUs = timeLastSyncUs;
+    LOGI("时间同步成功: %s 偏移 %lld ms，往返 %lld ms，漂移 %.1f ppm，开机后 %lu ms 完成",
+         ntpServers[server], offset / 1000, rtt / 1000, timeDriftPpm, millis());
+    return true;
+  }
+  return false;
+}
+
+// 同时向所有服务器请求，用最先返回的有效回复校正时间并更新漂移估计。
+// 先向RTC内存中缓存的地址发送，不等DNS；没有缓存的服务器逐个解析，每解析出一个就立即发送并处理已到达的回复。
+// 第一轮没有有效回复时，之后各轮重新解析所有服务器（缓存的地址可能已失效）。
+bool timeSyncRace() {
+  IPAddress ips[NTP_SERVER_COUNT];
+  uint64_t sent[NTP_SERVER_COUNT] = {0};
+  WiFiUDP udp;
+  if (!udp.begin(0)) {
+    return false;
+  }
+  for (int i = 0; i < (int)NTP_SERVER_COUNT; i++) {
+    ips[i] = IPAddress(ntpServerIps[i]);
+  }
+
+  for (int round = 0; round < NTP_ROUNDS && !timeSyncCancel; round++) {
+    for (int i = 0; i < (int)NTP_SERVER_COUNT; i++) {
+      if ((uint32_t)ips[i] != 0) {
+        sent[i] = ntpSend(udp, ips[i]);
+      }
+    }
+    for (int i = 0; i < (int)NTP_SERVER_COUNT && !timeSyncCancel; i++) {
+      if (round == 0 && (uint32_t)ips[i] != 0) {
+        continue;
+      }
+      IPAddress ip;
+      unsigned long dnsStart = millis();
+      if (!WiFi.hostByName(ntpServers[i], ip) || (uint32_t)ip == 0) {
+        LOGW("无法解析NTP服务器 %s（%lu ms）", ntpServers[i], millis() - dnsStart);
+      } else if ((uint32_t)ip != (uint32_t)ips[i]) {
+        ips[i] = ip;
+        ntpServerIps[i] = (uint32_t)ip;
+        sent[i] = ntpSend(udp, ip);
+      }
+      if (ntpPoll(udp, ips, sent)) {
+        udp.stop();
+        return true;
+      }
+    }
+
+    unsigned long start = millis();
+    while (millis() - start < NTP_TIMEOUT_MS && !timeSyncCancel) {
+      if (ntpPoll(udp, ips, sent)) {
+        udp.stop();
+        return true;
+      }
+      delay(5);
+    }
+  }
+  udp.stop();
+  return false;
+}
+
+void timeSyncTask(void* param) {
+  unsigned long start = millis();
+  while (WiFi.status() != WL_CONNECTED && !timeSyncCancel && millis() - start < 15000) {
+    delay(50);
+  }
+  timeSyncOk = WiFi.status() == WL_CONNECTED && !timeSyncCancel && timeSyncRace();
+  timeSyncDone = true;
+  vTaskDelete(NULL);
+}
+
+// 启动后台同步（wifiBegin() 之后调用）
+void timeSyncStart() {
+  timeSyncStarted = true;
+  timeSyncDone = false;
+  timeSyncOk = false;
+  timeSyncCancel = false;
+  if (xTaskCreate(timeSyncTask, "timesync", 4096, NULL, 1, NULL) != pdPASS) {
+    LOGE("无法创建时间同步任务");
+    timeSyncDone = true;
+  }
+}
+
+// 等待后台同步结束；未启动同步（估计误差在容差内）时直接返回true
+bool timeSyncWait(unsigned long timeoutMs) {
+  unsigned long start = millis();
+  while (!timeSyncDone && millis() - start < timeoutMs) {
+    delay(10);
+  }
+  if (!timeSyncDone) {
+    timeSyncCancel = true;
+    return false;
+  }
+  if (timeSyncOk) {
+    char buf[30];
+    struct tm timeinfo;
+    if (getLocalTime(&timeinfo, 0)) {
+      strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
+      LOGI("当前时间: %s", buf);
+    }
+  }
+  return !timeSyncStarted || timeSyncOk;
+}
+
+// ==================== 离线模式 ====================
+// WiFi连接失败（例如路由器重启）时按计划继续拍照；重连失败后按唤醒次数指数退避，
+// 配置热点只在上电/按复位键时或离线期间每隔几次唤醒短暂开启。
+
+// 本次唤醒是否尝试连接WiFi（上电/按复位键时总是尝试）
+bool offlineShouldTryWiFi(esp_sleep_wakeup_cause_t wakeupReason) {
+  if (offlineSkipWakes == 0 || wakeupReason == ESP_SLEEP_WAKEUP_UNDEFINED) {
+    return true;
+  }
+  offlineSkipWakes--;
+  LOGI("WiFi重连退避中，本次不连接（还将跳过 %lu 次唤醒）", offlineSkipWakes);
+  return false;
+}
+
+// 连接失败：记录离线统计、设置退避，必要时开启配置热点
+void offlineBegin(esp_sleep_wakeup_cause_t wakeupReason) {
+  offlineWakes++;
+  if (offlineSkipWakes == 0) {
+    // 本次确实尝试过连接：失败次数加1，之后跳过 2^(n-1) 次唤醒
+    offlineFailStreak++;
+    offlineSkipWakes = min((uint32_t)OFFLINE_MAX_SKIP_WAKES, (uint32_t)1 << min(offlineFailStreak - 1, (uint32_t)5));
+  }
+  LOGW("WiFi不可用，进入离线模式（连续失败 %lu 次，之后跳过 %lu 次唤醒）", offlineFailStreak, offlineSkipWakes);
+
+  if (wakeupReason == ESP_SLEEP_WAKEUP_UNDEFINED) {
+    startConfigMode(CONFIG_PORTAL_TIMEOUT_MS);
+  } else if (offlineWakes % OFFLINE_PORTAL_EVERY_WAKES == 0) {
+    startConfigMode(OFFLINE_PORTAL_WINDOW_MS);
+  }
+}
+
+// 重新联网：报告离线期间的统计并清零
+void offlineEnd() {
+  if (offlineWakes > 0) {
+    LOGI("WiFi已恢复：离线 %lu 次唤醒，期间拍摄 %lu 张，配置热点累计开启 %lu 秒",
+         offlineWakes, offlineFrames, portalTotalMs / 1000);
+    offlineLastWakes = offlineWakes;
+    offlineLastFrames = offlineFrames;
+  }
+  offlineFailStreak = 0;
+  offlineSkipWakes = 0;
+  offlineWakes = 0;
+  offlineFrames = 0;
+}
+
+// 设置时区（深度睡眠后环境变量丢失，离线时不会调用configTime，需要单独设置）
+void timeApplyZone() {
+  char tz[16];
+  long offset = -(gmtOffset_sec + daylightOffset_sec);  // POSIX TZ 的符号与UTC偏移相反
+  snprintf(tz, sizeof(tz), "UTC%+ld:%02ld", offset / 3600, labs(offset % 3600) / 60);
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+// 触发拍摄的文件名带秒，避免与同一分钟的定时照片重名（按文件名排序仍是时间顺序）
+String getEventTimeString() {
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo, 0)) {
+    return "unknown";
+  }
+
+  char timeStr[24];
+  strftime(timeStr, sizeof(timeStr), "%Y_%m_%d_%H_%M_%S", &timeinfo);
+  return String(timeStr);
+}
+
+String getTimeString() {
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo)) {
+    return "unknown";
+  }
+
+  char timeStr[20];
+  strftime(timeStr, sizeof(timeStr), "%Y_%m_%d_%H_%M", &timeinfo);  // 使用下划线替代冒号
+  return String(timeStr);
+}
+
+// 获取ISO周数（1-53）
+// ISO 8601标准：每年第一周是包含1月4日的那一周
+int getWeekNumber(struct tm* timeinfo) {
+  int year = timeinfo->tm_year + 1900;
+  int month = timeinfo->tm_mon + 1;
+  int day = timeinfo->tm_mday;
+  
+  // 简化的周数计算：从1月1日开始的周数
+  // 更准确的方法需要计算1月1日是星期几，这里使用简化版本
+  int dayOfYear = timeinfo->tm_yday;
+  int week = (dayOfYear / 7) + 1;
+  
+  // 确保周数在合理范围内
+  if (week < 1) week = 1;
+  if (week > 53) week = 53;
+  
+  return week;
+}
+
+// 获取周目录名称，格式：YYYY_WXX
+String getWeekDirectory() {
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo)) {
+    return "/unknown";
+  }
+  return weekDirectoryFor(&timeinfo);
+}
+
+// 解析 YYYY_MM_DD（本地时间中午，同时得到 tm_yday），日期不存在时返回false
+bool parseDay(const String& day, struct tm& timeinfo) {
+  if (day.length() != 10 || day.charAt(4) != '_' || day.charAt(7) != '_') {
+    return false;
+  }
+  for (int i = 0; i < 10; i++) {
+    if (i != 4 && i != 7 && !isDigit(day.charAt(i))) {
+      return false;
+    }
+  }
+  int y = day.substring(0, 4).toInt();
+  int m = day.substring(5, 7).toInt();
+  int d = day.substring(8, 10).toInt();
+  memset(&timeinfo, 0, sizeof(timeinfo));
+  timeinfo.tm_year = y - 1900;
+  timeinfo.tm_mon = m - 1;
+  timeinfo.tm_mday = d;
+  timeinfo.tm_hour = 12;
+  timeinfo.tm_isdst = -1;
+  mktime(&timeinfo);
+  return timeinfo.tm_year == y - 1900 && timeinfo.tm_mon == m - 1 && timeinfo.tm_mday == d;
+}
+
+String weekDirectoryFor(struct tm* timeinfo) {
+  int year = timeinfo->tm_year + 1900;
+  int week = getWeekNumber(timeinfo);
+  
+  char dirName[20];
+  snprintf(dirName, sizeof(dirName), "/%d_W%02d", year, week);
+  return String(dirName);
+}
+
+// 确保目录存在，如果不存在则创建
+// 使用SD_MMC库的mkdir()方法直接创建目录
+bool ensureDirectoryExists(const char* dirPath) {
+  // 等待SD卡稳定
+  delay(200);
+  
+  // 先检查目录是否已存在
+  File dir = SD_MMC.open(dirPath);
+  if (dir && dir.isDirectory()) {
+    dir.close();
+    LOGD("目录已存在: %s", dirPath);
+    return true;
+  }
+  if (dir) dir.close();
+  
+  // 目录不存在，使用mkdir()创建目录
+  LOGD("正在创建目录: %s", dirPath);
+  
+  // 尝试创建目录（最多重试3次）
+  for (int i = 0; i < 3; i++) {
+    if (SD_MMC.mkdir(dirPath)) {
+      delay(200);  // 等待文件系统更新
+      
+      // 验证目录是否创建成功
+      File verify = SD_MMC.open(dirPath);
+      if (verify && verify.isDirectory()) {
+        verify.close();
+        LOGI("目录创建成功: %s", dirPath);
+        return true;
+      }
+      if (verify) verify.close();
+    }
+    
+    if (i < 2) {
+      LOGI("目录创建失败，重试中 (%d/3)...", i + 2);
+      delay(500);  // 重试前等待
+    }
+  }
+  
+  // 如果创建失败，返回false，让程序回退到根目录
+  LOGI("目录创建失败: %s，将使用根目录", dirPath);
+  return false;
+}
+
+bool captureAndSavePhoto() {
+  LOGI("正在拍摄照片...");
+  
+  // 预览流正在运行时让它退出，并把传感器切回静态拍摄配置（不需要重新初始化相机）
+  previewStopRequested = true;
+  CameraLock cameraLock;
+  previewStopRequested = false;
+  cameraUseStillMode();
+
+  // 获取周目录和时间字符串（所有区域使用同一个时间）
+  LOGD("正在获取周目录和时间...");
+  String weekDir = getWeekDirectory();
+  String timeString = getTimeString();
+  LOGI("周目录: %s, 时间: %s", weekDir.c_str(), timeString.c_str());
+
+  // 依次拍摄定时拍摄的各个区域，最后把传感器恢复为全幅
+  bool allSaved = true;
+  for (size_t i = 0; i < sizeof(timelapseRois) / sizeof(timelapseRois[0]); i++) {
+    uint8_t id = timelapseRois[i];
+    if (!cameraUseRoi(id) && i > 0) {
+      continue;  // 区域不可用时只有第一个改拍全幅，避免重复的全幅照片
+    }
+    String name = timeString;
+    if (cameraRoiId != ROI_FULL) {
+      name += "_" + String(cameraRois[cameraRoiId].tag);
+    }
+    if (!captureRoiFrame(weekDir, name)) {
+      allSaved = false;
+    }
+  }
+  cameraUseRoi(ROI_FULL);
+  
+  // 拍照写卡结束后顺便把暂存的日志落盘
+  logPersist();
+  return allSaved;
+}
+
+// 拍摄当前窗口的一帧并保存为 <weekDir>/<name>.jpg（调用者需持有相机锁）
+bool captureRoiFrame(const String& weekDir, const String& name) {
+  uint8_t roi = cameraRoiId;
+  unsigned long captureStart = millis();
+
+  // 打开闪光灯（电量低时不使用）
+  pinMode(LED_GPIO_NUM, OUTPUT);
+  if (energyPolicy.flash) {
+    digitalWrite(LED_GPIO_NUM, HIGH);
+    LOGD("闪光灯已打开");
+    delay(100);  // 等待闪光灯稳定
+  }
+  
+  // 拍照
+  camera_fb_t *fb = esp_camera_fb_get();
+  
+  // 关闭闪光灯
+  digitalWrite(LED_GPIO_NUM, LOW);
+  LOGD("闪光灯已关闭");
+  if (!fb) {
+    LOGE("拍照失败！");
+    mqttRecordCapture(false, 0, 0, 0, millis() - captureStart, 0, 0);
+    return false;
+  }
+  unsigned long captureMs = millis() - captureStart;
+
+  LOGI("照片大小: %zu 字节 (%.2f KB)", fb->len, fb->len / 1024.0);
+
+  // 将照片数据复制到PSRAM缓冲区（如果可用），避免相机和SD卡资源冲突
+  LOGD("正在复制照片数据...");
+  uint8_t* imageBuffer = NULL;
+  size_t imageSize = fb->len;
+  bool usePSRAM = false;
+  
+  LOGD("检查PSRAM...");
+  
+  // 简化策略：直接使用原始缓冲区，不复制到PSRAM
+  // 这样可以避免PSRAM分配可能导致的卡顿
+  // 在写入SD卡时，相机资源会被占用，但写入完成后会立即释放
+  LOGD("使用原始缓冲区（不复制到PSRAM）");
+  imageBuffer = fb->buf;
+  usePSRAM = false;
+  
+  // 注意：不在这里释放相机帧缓冲区，等写入完成后再释放
+  // 这样可以避免资源冲突
+
+  // 增加延迟，确保相机资源完全释放
+  LOGD("等待系统稳定...");
+  delay(1000);  // 增加延迟到1秒，让系统完全稳定
+
+  // 保存到SD卡（持有SD卡锁，Web请求此时会等待写入完成）
+  LOGD("开始写入SD卡...");
+  String filename;
+  bool writeSuccess = false;
+  uint32_t crc = 0;
+  int attempt;
+  unsigned long writeStart = millis();
+  unsigned long writeMs;
+  {
+    SdLock lock;
+
+    // 周目录创建失败时回退到根目录
+    if (ensureDirectoryExists(weekDir.c_str())) {
+      filename = weekDir + "/" + name + ".jpg";
+    } else {
+      filename = "/" + name + ".jpg";
+    }
+    LOGI("保存路径: %s", filename.c_str());
+
+    // 写临时文件、校验、重命名；断电时由下次唤醒的 journalRecover() 完成或回滚，不会留下截断的照片
+    for (attempt = 1; attempt <= 2; attempt++) {
+      writeSuccess = journalWriteFrame(filename, imageBuffer, imageSize, crc);
+      if (writeSuccess) {
+        break;
+      }
+      LOGW("照片写入失败 (第 %d/2 次)", attempt);
+    }
+    writeMs = millis() - writeStart;
+    if (writeSuccess) {
+      journalFinish(filename, imageSize, crc);
+    }
+  }
+  mqttRecordCapture(writeSuccess, imageSize, fb->width, fb->height, captureMs, writeMs, std::min(attempt, 2) - 1);
+  
+  if (writeSuccess) {
+    LOGI("照片保存成功！文件大小: %zu 字节，耗时 %lu ms", imageSize, writeMs);
+    roiRecord(roi, imageSize, captureMs, writeMs);
+    // 延时视频和缩略图墙在SD卡锁之外调用（各自只在写文件时加锁），解码和缩放时Web请求不用等待
+    if (roi == ROI_FULL && filename.startsWith(weekDir + "/")) {
+      aviAddFrame(weekDir, imageBuffer, imageSize, fb->width, fb->height);
+      sheetAddFrame(weekDir, imageBuffer, imageSize, fb->width, fb->height);
+    }
+  } else {
+    LOGE("错误：无法保存文件 %s", filename.c_str());
+    LOGE("可能的原因：SD卡空间不足或文件系统错误");
+  }
+  
+  // 释放相机帧缓冲区（写入完成后释放）
+  if (fb) {
+    esp_camera_fb_return(fb);
+    LOGD("相机帧缓冲区已释放");
+  }
+  return writeSuccess;
+}
+
+// 记录区域照片的大小和耗时，并与最近一次的全幅照片比较
+void roiRecord(uint8_t roi, uint32_t bytes, unsigned long captureMs, unsigned long writeMs) {
+  roiLastBytes[roi] = bytes;
+  roiLastCaptureMs[roi] = (uint16_t)std::min(captureMs, 65535UL);
+  roiLastWriteMs[roi] = (uint16_t)std::min(writeMs, 65535UL);
+  if (roi == ROI_FULL || roiLastBytes[ROI_FULL] == 0) {
+    LOGI("区域 %s: %lu 字节，拍摄 %lu ms，写卡 %lu ms", cameraRois[roi].name, bytes, captureMs, writeMs);
+    return;
+  }
+  LOGI("区域 %s: %lu 字节（全幅的 %lu%%），拍摄 %lu ms（全幅 %u ms），写卡 %lu ms（全幅 %u ms）",
+       cameraRois[roi].name, bytes, bytes * 100 / roiLastBytes[ROI_FULL],
+       captureMs, roiLastCaptureMs[ROI_FULL], writeMs, roiLastWriteMs[ROI_FULL]);
+}
+
+// ==================== 写入日志 ====================
+// 日志文件只有一条定长记录，原地覆盖；恢复时只读这一条记录，与卡上照片数量无关。
+
+// 覆盖写入日志记录（文件首次创建后以 r+ 打开原地改写，不会因截断留下空文件）
+bool journalSet(JournalState state, const String& path, uint32_t size, uint32_t crc, uint32_t seq) {
+  JournalRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = JOURNAL_MAGIC;
+  record.state = state;
+  record.size = size;
+  record.crc = crc;
+  record.seq = seq;
+  strncpy(record.path, path.c_str(), sizeof(record.path) - 1);
+
+  SdLock lock;
+  File file = SD_MMC.open(JOURNAL_FILE, "r+");
+  if (!file) {
+    SD_MMC.mkdir(JOURNAL_DIR);
+    file = SD_MMC.open(JOURNAL_FILE, FILE_WRITE);
+    if (!file) {
+      LOGE("无法写入照片写入日志");
+      return false;
+    }
+  }
+  bool ok = file.write((const uint8_t*)&record, sizeof(record)) == sizeof(record);
+  file.flush();
+  file.close();
+  return ok;
+}
+
+// 校验照片文件：大小一致且以JPEG起止标记开头/结尾（只读头尾4个字节）
+bool journalVerifyFile(const String& path, uint32_t size) {
+  File file = SD_MMC.open(path.c_str(), FILE_READ);
+  if (!file) {
+    return false;
+  }
+  uint8_t head[2] = {0, 0};
+  uint8_t tail[2] = {0, 0};
+  bool ok = file.size() == size && size >= 4 &&
+            file.read(head, 2) == 2 &&
+            file.seek(size - 2) && file.read(tail, 2) == 2 &&
+            head[0] == 0xFF && head[1] == 0xD8 && tail[0] == 0xFF && tail[1] == 0xD9;
+  file.close();
+  return ok;
+}
+
+// 故障注入：在指定步骤直接重启，模拟断电（JOURNAL_FAULT_STEP 为0时编译器会移除）
+void journalFaultPoint(int step) {
+  if (JOURNAL_FAULT_STEP == step) {
+    LOGW("故障注入：在第 %d 步模拟断电", step);
+    logFlush(500);
+    ESP.restart();
+  }
+}
+
+// 照片已提交：写入校验记录、加入上传队列、追加同步记录，然后清除日志
+void journalFinish(const String& path, uint32_t size, uint32_t crc) {
+  crcAppend(path, size, crc);
+  uploadEnqueue(path);
+  syncRecordChange('+', path, size);
+  summaryAdd(path, size);
+  journalSet(JOURNAL_IDLE, "", 0, 0, 0);
+}
+
+// journal.h 使用的SD卡文件操作（调用者持有SD卡锁）
+struct SdJournalFs {
+  File file;
+  uint32_t crcMicros = 0;
+
+  bool setRecord(JournalState state, const char* path, uint32_t size, uint32_t crc, uint32_t seq) {
+    return journalSet(state, String(path), size, crc, seq);
+  }
+  bool readRecord(JournalRecord& record) {
+    File f = SD_MMC.open(JOURNAL_FILE, FILE_READ);
+    if (!f) {
+      return false;
+    }
+    bool ok = f.read((uint8_t*)&record, sizeof(record)) == sizeof(record);
+    f.close();
+    return ok;
+  }
+  bool create(const char* path) {
+    file = SD_MMC.open(path, FILE_WRITE);
+    return (bool)file;
+  }
+  size_t write(const uint8_t* data, size_t len) {
+    size_t written = file.write(data, len);
+    if (written == 0) {
+      LOGW("写入中断，本块 %zu 字节", len);
+    }
+    return written;
+  }
+  void close() {
+    file.flush();
+    file.close();
+  }
+  bool remove(const char* path) { return SD_MMC.remove(path); }
+  bool exists(const char* path) { return SD_MMC.exists(path); }
+  bool rename(const char* from, const char* to) { return SD_MMC.rename(from, to); }
+  bool verify(const char* path, uint32_t size) { return journalVerifyFile(String(path), size); }
+  uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len) {
+    unsigned long start = micros();
+    crc = esp_rom_crc32_le(crc, data, len);
+    crcMicros += micros() - start;
+    return crc;
+  }
+  void faultPoint(int step) { journalFaultPoint(step); }
+  void invalidate(const char* path) { summaryInvalidate(String(path)); }
+  uint32_t changeSeq() { return syncSeq; }
+  bool isRegistered(const char* path, uint32_t seq) { return syncSeq > seq && syncLastPathIs(String(path)); }
+  void finish(const char* path, uint32_t size, uint32_t crc) { journalFinish(String(path), size, crc); }
+};
+
+// 写入一张照片：写临时文件 -> 校验 -> 重命名为最终路径（调用者持有SD卡锁）
+// 返回true后调用者需调用 journalFinish() 登记
+bool journalWriteFrame(const String& path, const uint8_t* data, size_t size, uint32_t& crc) {
+  SdJournalFs fs;
+  size_t written = 0;
+  JournalResult result = journalWriteFrameTo(fs, path.c_str(), data, size, crc, written);
+  switch (result) {
+    case JOURNAL_OK:
+      LOGD("CRC32: %08lx，计算耗时 %lu us (%.1f MB/s)", crc, fs.crcMicros,
+           fs.crcMicros > 0 ? (double)size / fs.crcMicros : 0.0);
+      return true;
+    case JOURNAL_ERR_RECORD:
+      return false;  // journalSet() 已记录错误
+    case JOURNAL_ERR_CREATE:
+      LOGE("无法创建文件 %s%s", path.c_str(), JOURNAL_TMP_SUFFIX);
+      return false;
+    case JOURNAL_ERR_VERIFY:
+      LOGW("照片校验失败！期望: %zu, 实际写入: %zu", size, written);
+      return false;
+    case JOURNAL_ERR_RENAME:
+      LOGE("无法重命名 %s%s", path.c_str(), JOURNAL_TMP_SUFFIX);
+      return false;
+  }
+  return false;
+}
+
+// 启动时恢复上次中断的写入（SD卡挂载、上传状态和同步序号加载之后调用）
+void journalRecover() {
+  SdLock lock;
+  SdJournalFs fs;
+  JournalRecord record;
+  unsigned long start = millis();
+  JournalRecovery recovery = journalRecoverWith(fs, record);
+  if (recovery == JOURNAL_RECOVERY_NONE) {
+    return;
+  }
+  LOGW("上次写入被中断，%s: %s（恢复耗时 %lu ms）", recovery == JOURNAL_RECOVERY_COMPLETED ? "已完成" : "已回滚",
+       record.path, millis() - start);
+}
+
+// ==================== 完整性校验 ====================
+// 每个目录的 crc.bin 按拍摄顺序记录照片的大小和CRC32；/scrub 从上次的位置继续读照片重算CRC，
+// 在时间预算内按目录顺序（根目录、各周目录从旧到新）推进，一轮结束后从头开始。
+
+// 追加校验记录到照片所在目录的 crc.bin
+void crcAppend(const String& path, uint32_t size, uint32_t crc) {
+  int slash = path.lastIndexOf('/');
+  String dir = slash > 0 ? path.substring(0, slash) : String("");
+  CrcRecord record;
+  memset(&record, 0, sizeof(record));
+  strncpy(record.name, path.c_str() + slash + 1, sizeof(record.name) - 1);
+  record.size = size;
+  record.crc = crc;
+
+  SdLock lock;
+  File file = SD_MMC.open((dir + "/" CRC_SIDECAR_NAME).c_str(), FILE_APPEND);
+  if (!file) {
+    LOGE("无法写入校验记录: %s", path.c_str());
+    return;
+  }
+  file.write((const uint8_t*)&record, sizeof(record));
+  file.close();
+}
+
+// 读文件重算CRC32，文件不存在返回false（已被删除的照片不算损坏）
+bool crcComputeFile(const String& path, uint8_t* buf, size_t bufSize, uint32_t& crc, uint32_t& size) {
+  SdLock lock;
+  File file = SD_MMC.open(path.c_str(), FILE_READ);
+  if (!file) {
+    return false;
+  }
+  crc = 0;
+  size = 0;
+  int n;
+  while ((n = file.read(buf, bufSize)) > 0) {
+    crc = esp_rom_crc32_le(crc, buf, n);
+    size += n;
+  }
+  file.close();
+  return true;
+}
+
+// 下一个要复核的目录："/" 之后是最旧的周目录，最后一个周目录之后返回空（一轮结束）
+String scrubNextDir(const String& current) {
+  String* dirs = new String[RETENTION_MAX_WEEK_DIRS];
+  int count = listWeekDirs(dirs, RETENTION_MAX_WEEK_DIRS);
+  String next = "";
+  for (int i = 0; i < count; i++) {
+    if (dirs[i] > current) {
+      next = dirs[i];
+      break;
+    }
+  }
+  delete[] dirs;
+  return next;
+}
+
+// /scrub[?ms=N]：在N毫秒内继续复核照片，返回本次结果（JSON）
+// {"checked":N,"corrupt":M,"bytes":B,"ms":T,"mbps":x,"passes":P,"totalCorrupt":C,"dir":"...","bad":["..."]}
+void handleScrub() {
+  uint32_t budget = server.hasArg("ms") ? (uint32_t)server.arg("ms").toInt() : SCRUB_TIME_BUDGET_MS;
+  budget = constrain(budget, (uint32_t)100, (uint32_t)30000);
+  unsigned long start = millis();
+
+  ScrubState state;
+  memset(&state, 0, sizeof(state));
+  {
+    SdLock lock;
+    File file = SD_MMC.open(SCRUB_STATE_FILE, FILE_READ);
+    if (!file || file.read((uint8_t*)&state, sizeof(state)) != sizeof(state)) {
+      memset(&state, 0, sizeof(state));
+    }
+    if (file) file.close();
+  }
+  if (state.dir[0] != '/') {
+    strcpy(state.dir, "/");
+    state.offset = 0;
+  }
+  state.dir[sizeof(state.dir) - 1] = '\0';
+
+  IoBuffer buf;
+  if (!buf) {
+    server.send(500, "text/plain", "内存不足");
+    return;
+  }
+  uint32_t checked = 0;
+  uint32_t corrupt = 0;
+  uint64_t bytes = 0;
+  String bad = "";
+
+  while ((long)(millis() - start) < (long)budget) {
+    String dir = String(state.dir);
+    String prefix = dir == "/" ? String("") : dir;
+    CrcRecord record;
+    bool haveRecord = false;
+    {
+      SdLock lock;
+      File file = SD_MMC.open((prefix + "/" CRC_SIDECAR_NAME).c_str(), FILE_READ);
+      haveRecord = file && file.seek(state.offset) &&
+                   file.read((uint8_t*)&record, sizeof(record)) == sizeof(record);
+      if (file) file.close();
+    }
+    if (!haveRecord) {
+      // 该目录复核完，进入下一个目录；全部完成后从根目录开始新一轮
+      String next = scrubNextDir(dir);
+      if (next.length() == 0) {
+        next = "/";
+        state.passes++;
+        LOGI("完整性复核完成第 %lu 轮，累计损坏 %lu 张", state.passes, state.corrupt);
+      }
+      strncpy(state.dir, next.c_str(), sizeof(state.dir) - 1);
+      state.offset = 0;
+      if (next == "/") {
+        break;  // 一轮结束后本次不再继续，避免卡上没有校验记录时空转
+      }
+      continue;
+    }
+    state.offset += sizeof(record);
+    record.name[sizeof(record.name) - 1] = '\0';
+    String path = prefix + "/" + record.name;
+    uint32_t crc, size;
+    if (!crcComputeFile(path, buf.data(), buf.size(), crc, size)) {
+      continue;
+    }
+    checked++;
+    bytes += size;
+    if (size != record.size || crc != record.crc) {
+      corrupt++;
+      state.corrupt++;
+      LOGE("照片损坏: %s（大小 %lu/%lu，CRC %08lx/%08lx）", path.c_str(), size, record.size, crc, record.crc);
+      SdLock lock;
+      File file = SD_MMC.open(SCRUB_CORRUPT_FILE, FILE_APPEND);
+      if (file) {
+        file.print(path + "\n");
+        file.close();
+      }
+      if (corrupt <= SCRUB_MAX_REPORTED) {
+        bad += (bad.length() > 0 ? ",\"" : "\"") + path + "\"";
+      }
+    }
+  }
+
+  {
+    SdLock lock;
+    SD_MMC.mkdir(JOURNAL_DIR);
+    File file = SD_MMC.open(SCRUB_STATE_FILE, FILE_WRITE);
+    if (file) {
+      file.write((const uint8_t*)&state, sizeof(state));
+      file.close();
+    }
+  }
+
+  unsigned long elapsed = millis() - start;
+  double mbps = elapsed > 0 ? (double)bytes / 1024.0 / 1024.0 / (elapsed / 1000.0) : 0.0;
+  LOGI("完整性复核: %lu 张, 损坏 %lu 张, %.2f MB/s, 耗时 %lu ms", checked, corrupt, mbps, elapsed);
+
+  char head[200];
+  snprintf(head, sizeof(head),
+           "{\"checked\":%lu,\"corrupt\":%lu,\"bytes\":%llu,\"ms\":%lu,\"mbps\":%.2f,"
+           "\"passes\":%lu,\"totalCorrupt\":%lu,\"dir\":\"%s\",\"bad\":[",
+           checked, corrupt, bytes, elapsed, mbps, state.passes, state.corrupt, state.dir);
+  server.send(200, "application/json", String(head) + bad + "]}");
+}
+
+// ==================== 延时视频 ====================
+// AVI文件结构：RIFF('AVI ' LIST('hdrl' ...) LIST('movi' '00dc'帧...) ['idx1'])
+// 追加一帧：在movi末尾（按文件头记录的长度，而不是文件实际长度）写入帧，在索引暂存文件的第N条写入索引，
+// 最后一次写入改写文件头中的各项长度和帧数。断电时文件头仍是上一帧的状态，多出来的数据会被下一帧覆盖。
+
+// 当前照片对应的AVI文件路径（时间无效时返回空）
+String aviPathFor(const String& weekDir, uint16_t width) {
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo, 0)) {
+    return "";
+  }
+  char stamp[16];
+  if (AVI_PERIOD_WEEKLY) {
+    strncpy(stamp, weekDir.c_str() + 1, sizeof(stamp) - 1);
+    stamp[sizeof(stamp) - 1] = '\0';
+  } else {
+    strftime(stamp, sizeof(stamp), "%Y_%m_%d", &timeinfo);
+  }
+  return weekDir + "/" + stamp + "_" + String(width) + ".avi";
+}
+
+void aviInitHeader(AviHeader& h, uint16_t width, uint16_t height) {
+  memset(&h, 0, sizeof(h));
+  memcpy(h.riff, "RIFF", 4);
+  h.riffSize = sizeof(AviHeader) - 8;
+  memcpy(h.aviType, "AVI ", 4);
+  memcpy(h.hdrlList, "LIST", 4);
+  h.hdrlSize = 192;
+  memcpy(h.hdrl, "hdrl", 4);
+  memcpy(h.avih, "avih", 4);
+  h.avihSize = 56;
+  h.usPerFrame = 1000000 / AVI_FPS;
+  h.streams = 1;
+  h.width = width;
+  h.height = height;
+  memcpy(h.strlList, "LIST", 4);
+  h.strlSize = 116;
+  memcpy(h.strl, "strl", 4);
+  memcpy(h.strh, "strh", 4);
+  h.strhSize = 56;
+  memcpy(h.fccType, "vids", 4);
+  memcpy(h.fccHandler, "MJPG", 4);
+  h.scale = 1;
+  h.rate = AVI_FPS;
+  h.quality = 0xFFFFFFFF;
+  h.frameRight = width;
+  h.frameBottom = height;
+  memcpy(h.strf, "strf", 4);
+  h.strfSize = 40;
+  h.biSize = 40;
+  h.biWidth = width;
+  h.biHeight = height;
+  h.biPlanes = 1;
+  h.biBitCount = 24;
+  memcpy(h.biCompression, "MJPG", 4);
+  h.biSizeImage = (uint32_t)width * height * 3;
+  memcpy(h.moviList, "LIST", 4);
+  h.moviSize = 4;
+  memcpy(h.movi, "movi", 4);
+}
+
+bool aviReadHeader(File& file, AviHeader& h) {
+  return file.seek(0) && file.read((uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+         memcmp(h.riff, "RIFF", 4) == 0 && memcmp(h.movi, "movi", 4) == 0 && h.moviSize >= 4;
+}
+
+// 改写文件头（提交点：224字节在第一个扇区内，一次写入）
+bool aviWriteHeader(File& file, const AviHeader& h) {
+  if (!file.seek(0) || file.write((const uint8_t*)&h, sizeof(h)) != sizeof(h)) {
+    return false;
+  }
+  file.flush();
+  return true;
+}
+
+// 在文件末尾写入idx1索引并标记为已收尾；索引暂存文件缺失时保留为无索引文件（播放器会扫描帧）
+bool aviFinalize(const String& path) {
+  SdLock lock;
+  File file = SD_MMC.open(path.c_str(), "r+");
+  if (!file) {
+    return true;  // 文件已被删除（例如被自动清理）
+  }
+  AviHeader h;
+  if (!aviReadHeader(file, h) || (h.flags & AVIF_HASINDEX)) {
+    file.close();
+    return true;
+  }
+  String indexPath = path + AVI_INDEX_SUFFIX;
+  File index = SD_MMC.open(indexPath.c_str(), FILE_READ);
+  uint32_t indexBytes = h.totalFrames * sizeof(AviIndexEntry);
+  bool ok = false;
+  if (index && index.size() >= indexBytes) {
+    uint32_t moviEnd = AVI_MOVI_OFFSET + h.moviSize;
+    uint32_t chunk[2];
+    memcpy(&chunk[0], "idx1", 4);
+    chunk[1] = indexBytes;
+    ok = file.seek(moviEnd) && file.write((const uint8_t*)chunk, sizeof(chunk)) == sizeof(chunk);
+    uint8_t buf[512];
+    for (uint32_t copied = 0; ok && copied < indexBytes; ) {
+      size_t n = index.read(buf, std::min((uint32_t)sizeof(buf), indexBytes - copied));
+      ok = n > 0 && file.write(buf, n) == n;
+      copied += n;
+    }
+    if (ok) {
+      file.flush();
+      h.flags |= AVIF_HASINDEX;
+      h.riffSize = moviEnd + sizeof(chunk) + indexBytes - 8;
+      ok = aviWriteHeader(file, h);
+    }
+  } else {
+    LOGW("AVI索引缺失，保留为无索引文件: %s", path.c_str());
+  }
+  if (index) index.close();
+  file.close();
+  SD_MMC.remove(indexPath.c_str());
+  LOGI("AVI收尾%s: %s（%lu 帧）", ok ? "完成" : "失败", path.c_str(), h.totalFrames);
+  return ok;
+}
+
+// 追加一帧JPEG（调用者需持有SD卡锁）
+bool aviAppend(const String& path, const uint8_t* data, uint32_t size, uint16_t width, uint16_t height) {
+  AviHeader h;
+  File file = SD_MMC.open(path.c_str(), "r+");
+  if (!file || !aviReadHeader(file, h)) {
+    if (file) file.close();
+    aviInitHeader(h, width, height);
+    file = SD_MMC.open(path.c_str(), FILE_WRITE);
+    if (!file || !aviWriteHeader(file, h)) {
+      if (file) file.close();
+      return false;
+    }
+    SD_MMC.remove((path + AVI_INDEX_SUFFIX).c_str());
+    LOGI("新建延时视频: %s (%ux%u, %d fps)", path.c_str(), width, height, AVI_FPS);
+  }
+  if ((h.flags & AVIF_HASINDEX) || h.width != width || h.height != height) {
+    file.close();
+    LOGW("AVI文件已收尾或分辨率不同，跳过: %s", path.c_str());
+    return false;
+  }
+
+  // 1. 帧数据（奇数长度补一个字节）
+  uint32_t chunkPos = AVI_MOVI_OFFSET + h.moviSize;
+  uint32_t padded = size + (size & 1);
+  uint32_t chunk[2];
+  memcpy(&chunk[0], "00dc", 4);
+  chunk[1] = size;
+  bool ok = file.seek(chunkPos) && file.write((const uint8_t*)chunk, sizeof(chunk)) == sizeof(chunk) &&
+            file.write(data, size) == size;
+  if (ok && padded != size) {
+    uint8_t zero = 0;
+    ok = file.write(&zero, 1) == 1;
+  }
+  if (ok) {
+    file.flush();
+  }
+
+  // 2. 索引条目（第N条，之前断电留下的多余条目直接覆盖）
+  if (ok) {
+    String indexPath = path + AVI_INDEX_SUFFIX;
+    File index = SD_MMC.open(indexPath.c_str(), "r+");
+    if (!index) {
+      index = SD_MMC.open(indexPath.c_str(), FILE_WRITE);
+    }
+    AviIndexEntry entry;
+    memcpy(entry.id, "00dc", 4);
+    entry.flags = AVIIF_KEYFRAME;
+    entry.offset = chunkPos - AVI_MOVI_OFFSET;
+    entry.size = size;
+    ok = index && index.seek(h.totalFrames * sizeof(entry)) &&
+         index.write((const uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+    if (index) index.close();
+  }
+
+  // 3. 文件头（提交）
+  if (ok) {
+    h.totalFrames++;
+    h.length = h.totalFrames;
+    h.moviSize += sizeof(chunk) + padded;
+    h.riffSize = AVI_MOVI_OFFSET + h.moviSize - 8;
+    h.suggestedBufferSize = std::max(h.suggestedBufferSize, size + 8);
+    h.strhSuggestedBufferSize = h.suggestedBufferSize;
+    h.maxBytesPerSec = h.suggestedBufferSize * AVI_FPS;
+    ok = aviWriteHeader(file, h);
+  }
+  file.close();
+  if (ok) {
+    aviFrames = h.totalFrames;
+  }
+  return ok;
+}
+
+// 拍照后调用：把全幅照片追加到当前时段的AVI文件，时段或分辨率改变时先为上一个文件收尾
+void aviAddFrame(const String& weekDir, const uint8_t* data, uint32_t size, uint16_t width, uint16_t height) {
+  if (!AVI_ENABLE) {
+    return;
+  }
+  String path = aviPathFor(weekDir, width);
+  if (path.length() == 0 || path.length() >= sizeof(aviCurrentPath)) {
+    return;
+  }
+  SdLock lock;
+  if (aviCurrentPath[0] != '\0' && path != aviCurrentPath) {
+    aviFinalize(String(aviCurrentPath));
+    aviFrames = 0;
+  }
+  strncpy(aviCurrentPath, path.c_str(), sizeof(aviCurrentPath) - 1);
+
+  unsigned long start = millis();
+  if (aviAppend(path, data, size, width, height)) {
+    aviLastAppendMs = millis() - start;
+    aviMaxAppendMs = std::max(aviMaxAppendMs, aviLastAppendMs);
+    LOGI("已追加到延时视频: %s 第 %lu 帧，耗时 %lu ms（最长 %lu ms）", path.c_str(), aviFrames, aviLastAppendMs, aviMaxAppendMs);
+  } else {
+    LOGE("追加延时视频失败: %s", path.c_str());
+  }
+}
+
+// ==================== 缩略图墙 ====================
+// 拍照时只解码一次（1/8比例，UXGA得到200x150）并缩成一个格子写入当天的 .sht 文件，每张照片只改写一个格子和文件头；
+// 请求 /contactsheet 时才把所有格子拼起来编码成JPEG。缩放（src/tile_scaler.h）由 tools/sheet/tile_scaler_test.cpp 在电脑上验证和计时。
+
+struct SheetDecodeInput {
+  const uint8_t* data;
+  size_t size;
+  TileScaler* scaler;
+};
+
+size_t sheetJpegRead(void* arg, size_t index, uint8_t* buf, size_t len) {
+  SheetDecodeInput* in = (SheetDecodeInput*)arg;
+  if (index >= in->size) {
+    return 0;
+  }
+  len = std::min(len, in->size - index);
+  if (buf) {
+    memcpy(buf, in->data + index, len);
+  }
+  return len;
+}
+
+bool sheetJpegWrite(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data) {
+  SheetDecodeInput* in = (SheetDecodeInput*)arg;
+  if (data == NULL) {
+    if (x == 0 && y == 0) {
+      tileScalerBegin(*in->scaler, w, h);  // 开始：w, h为缩放后的图像尺寸
+    }
+    return true;
+  }
+  tileScalerAdd(*in->scaler, x, y, w, h, data);
+  return true;
+}
+
+// 当天的 .sht 文件路径（day格式 YYYY_MM_DD）
+String sheetPathFor(const String& weekDir, const String& day) {
+  return weekDir + "/" + day + ".sht";
+}
+
+// 把一张全幅照片缩成小图写入当天的缩略图墙（解码和缩放不持有SD卡锁，只在写入格子时加锁）
+void sheetAddFrame(const String& weekDir, const uint8_t* data, size_t size, uint16_t width, uint16_t height) {
+  if (!CONTACT_SHEET_ENABLE) {
+    return;
+  }
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo, 0)) {
+    return;
+  }
+  unsigned long start = millis();
+
+  // 选择解码比例：缩小后仍不小于格子的最大比例（UXGA用1/8）
+  int shift = 3;
+  while (shift > 0 && ((width >> shift) < CONTACT_SHEET_TILE_W || (height >> shift) < CONTACT_SHEET_TILE_H)) {
+    shift--;
+  }
+  TileScaler* scaler = (TileScaler*)malloc(sizeof(TileScaler));
+  uint8_t* tile = (uint8_t*)malloc(CONTACT_SHEET_TILE_W * CONTACT_SHEET_TILE_H * 2);
+  if (scaler == NULL || tile == NULL) {
+    LOGW("内存不足，跳过缩略图");
+    free(scaler);
+    free(tile);
+    return;
+  }
+  scaler->srcW = 0;
+  scaler->srcH = 0;
+  SheetDecodeInput in = {data, size, scaler};
+  bool decoded = esp_jpg_decode(size, (jpg_scale_t)shift, sheetJpegRead, sheetJpegWrite, &in) == ESP_OK;
+  if (decoded) {
+    tileScalerFinish(*scaler, tile);
+  }
+  free(scaler);
+  sheetLastScaleMs = millis() - start;
+  if (!decoded) {
+    LOGW("缩略图解码失败");
+    free(tile);
+    return;
+  }
+
+  // 写入格子，再改写文件头中的已写入标记（提交）
+  unsigned long writeStart = millis();
+  char day[12];
+  strftime(day, sizeof(day), "%Y_%m_%d", &timeinfo);
+  String path = sheetPathFor(weekDir, String(day));
+  uint32_t slot = (uint32_t)(timeinfo.tm_hour * 60 + timeinfo.tm_min) * CONTACT_SHEET_SLOTS / 1440;
+  const uint32_t tileBytes = CONTACT_SHEET_TILE_W * CONTACT_SHEET_TILE_H * 2;
+
+  SdLock lock;
+  SheetHeader header;
+  File file = SD_MMC.open(path.c_str(), "r+");
+  if (!file || file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+      header.magic != CONTACT_SHEET_MAGIC || header.tileW != CONTACT_SHEET_TILE_W || header.tileH != CONTACT_SHEET_TILE_H ||
+      header.slots != CONTACT_SHEET_SLOTS) {
+    if (file) file.close();
+    memset(&header, 0, sizeof(header));
+    header.magic = CONTACT_SHEET_MAGIC;
+    header.tileW = CONTACT_SHEET_TILE_W;
+    header.tileH = CONTACT_SHEET_TILE_H;
+    header.slots = CONTACT_SHEET_SLOTS;
+    header.columns = CONTACT_SHEET_COLUMNS;
+    file = SD_MMC.open(path.c_str(), FILE_WRITE);
+  }
+  bool ok = file && file.seek(sizeof(header) + slot * tileBytes) && file.write(tile, tileBytes) == tileBytes;
+  if (ok) {
+    file.flush();
+    header.filled[slot / 8] |= 1 << (slot % 8);
+    ok = file.seek(0) && file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+  }
+  if (file) file.close();
+  free(tile);
+  sheetLastWriteMs = millis() - writeStart;
+  if (ok) {
+    LOGI("缩略图墙: 第 %lu 格，解码+缩放 %lu ms (1/%d)，写入 %lu ms", slot, sheetLastScaleMs, 1 << shift, sheetLastWriteMs);
+  } else {
+    LOGE("缩略图墙写入失败: %s", path.c_str());
+  }
+}
+
+size_t sheetSendChunk(void* arg, size_t index, const void* data, size_t len) {
+  return server.sendContent((const char*)data, len) ? len : 0;
+}
+
+// /contactsheet[?day=YYYY_MM_DD]：当天（或指定日期）的缩略图墙JPEG，按时间从左到右、从上到下排列
+void handleContactSheet() {
+  String day = server.arg("day");
+  struct tm timeinfo;
+  if (day.length() == 0) {
+    if (!getLocalTime(&timeinfo, 0)) {
+      server.send(503, "text/plain", "时间未同步");
+      return;
+    }
+    char buf[12];
+    strftime(buf, sizeof(buf), "%Y_%m_%d", &timeinfo);
+    day = buf;
+  } else if (!parseDay(day, timeinfo)) {
+    server.send(400, "text/plain", "无效的日期: " + day);
+    return;
+  }
+  if (!psramFound()) {
+    server.send(503, "text/plain", "生成缩略图墙需要PSRAM");
+    return;
+  }
+
+  const uint32_t rows = (CONTACT_SHEET_SLOTS + CONTACT_SHEET_COLUMNS - 1) / CONTACT_SHEET_COLUMNS;
+  const uint32_t width = CONTACT_SHEET_COLUMNS * CONTACT_SHEET_TILE_W;
+  const uint32_t height = rows * CONTACT_SHEET_TILE_H;
+  const uint32_t tileBytes = CONTACT_SHEET_TILE_W * CONTACT_SHEET_TILE_H * 2;
+  const uint32_t rowBytes = CONTACT_SHEET_TILE_W * 2;
+  uint8_t* canvas = (uint8_t*)ps_malloc(width * height * 2);
+  uint8_t* tile = (uint8_t*)server.scratch(tileBytes);
+  if (canvas == NULL || tile == NULL) {
+    free(canvas);
+    server.send(500, "text/plain", "内存不足");
+    return;
+  }
+  memset(canvas, 0, width * height * 2);
+
+  unsigned long start = millis();
+  uint32_t tiles = 0;
+  {
+    SdLock lock;
+    String path = sheetPathFor(weekDirectoryFor(&timeinfo), day);
+    File file = SD_MMC.open(path.c_str(), FILE_READ);
+    SheetHeader header;
+    if (!file || file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != CONTACT_SHEET_MAGIC ||
+        header.tileW != CONTACT_SHEET_TILE_W || header.tileH != CONTACT_SHEET_TILE_H || header.slots != CONTACT_SHEET_SLOTS) {
+      if (file) file.close();
+      free(canvas);
+      server.send(404, "text/plain", "没有该日期的缩略图墙: " + day);
+      return;
+    }
+    for (uint32_t slot = 0; slot < CONTACT_SHEET_SLOTS; slot++) {
+      if (!(header.filled[slot / 8] & (1 << (slot % 8)))) {
+        continue;
+      }
+      if (!file.seek(sizeof(header) + slot * tileBytes) || file.read(tile, tileBytes) != tileBytes) {
+        continue;
+      }
+      uint32_t x = (slot % CONTACT_SHEET_COLUMNS) * CONTACT_SHEET_TILE_W;
+      uint32_t y = (slot / CONTACT_SHEET_COLUMNS) * CONTACT_SHEET_TILE_H;
+      for (uint32_t j = 0; j < CONTACT_SHEET_TILE_H; j++) {
+        memcpy(canvas + ((y + j) * width + x) * 2, tile + j * rowBytes, rowBytes);
+      }
+      tiles++;
+    }
+    file.close();
+  }
+  unsigned long readMs = millis() - start;
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "image/jpeg", "");
+  bool ok = fmt2jpg_cb(canvas, width * height * 2, width, height, PIXFORMAT_RGB565, CONTACT_SHEET_QUALITY, sheetSendChunk, NULL);
+  server.sendContent("");
+  free(canvas);
+  LOGI("缩略图墙 %s: %lu 格，读取 %lu ms，编码发送 %lu ms%s", day.c_str(), tiles, readMs, millis() - start - readMs, ok ? "" : "（中断）");
+}
+
+// ==================== 周汇总 ====================
+// 每张照片提交后更新所在周目录的汇总记录（读-改-写一条定长记录）；记录缺失时由 /api/calendar 遍历该周目录重新生成。
+// /api/calendar 按天读取所需周的记录，耗时只与查询的周数有关，与照片总数无关。
+
+// 从照片文件名（YYYY_MM_DD_HH_MM...）得到周内第几天和小时；不是照片文件名时返回false
+bool summarySlotFor(const String& dirName, const String& name, int& dayIndex, int& hour) {
+  int y, m, d, h;
+  if (name.length() < 16 || sscanf(name.c_str(), "%4d_%2d_%2d_%2d", &y, &m, &d, &h) != 4 || h < 0 || h > 23) {
+    return false;
+  }
+  struct tm t;
+  if (!parseDay(name.substring(0, 10), t)) {
+    return false;
+  }
+  int week = dirName.substring(6, 8).toInt();
+  dayIndex = t.tm_yday - (week - 1) * 7;
+  hour = h;
+  return dayIndex >= 0 && dayIndex < 7;
+}
+
+// 照片种类：定时拍摄的全幅照片文件名正好是分钟时间戳，触发照片多了两位秒数，其他的是区域照片
+PhotoKind photoKindOf(const String& name) {
+  int len = name.length() - 4;  // 去掉 .jpg
+  if (len == 16) {
+    return PHOTO_TIMELAPSE;
+  }
+  if (len == 19 && name.charAt(16) == '_' && isDigit(name.charAt(17)) && isDigit(name.charAt(18))) {
+    return PHOTO_TRIGGER;
+  }
+  return PHOTO_ROI;
+}
+
+// 计入一张照片：区域和触发照片只计数和计入总字节数，热力图和大小范围只反映定时拍摄的全幅照片
+void summaryCount(WeekSummary& s, const String& dirName, const String& name, uint32_t size) {
+  s.bytes += size;
+  PhotoKind kind = photoKindOf(name);
+  if (kind == PHOTO_ROI) {
+    s.roiFrames++;
+    return;
+  }
+  if (kind == PHOTO_TRIGGER) {
+    s.triggerFrames++;
+    return;
+  }
+  s.frames++;
+  s.minSize = s.frames == 1 ? size : std::min(s.minSize, size);
+  s.maxSize = std::max(s.maxSize, size);
+  int dayIndex, hour;
+  if (summarySlotFor(dirName, name, dayIndex, hour) && s.hours[dayIndex][hour] < 65535) {
+    s.hours[dayIndex][hour]++;
+  }
+}
+
+String summaryPathFor(const String& weekDir) {
+  return weekDir + "/" SUMMARY_FILE_NAME;
+}
+
+// 照片被删除或可能重复计数时作废所在周目录的汇总
+void summaryInvalidate(const String& photoPath) {
+  int slash = photoPath.lastIndexOf('/');
+  if (slash > 0) {
+    SdLock lock;
+    SD_MMC.remove(summaryPathFor(photoPath.substring(0, slash)).c_str());
+  }
+}
+
+// 遍历周目录重新生成汇总
+bool summaryRebuild(const String& weekDir, WeekSummary& s) {
+  unsigned long start = millis();
+  memset(&s, 0, sizeof(s));
+  s.magic = SUMMARY_MAGIC;
+  s.version = SUMMARY_VERSION;
+  String dirName = weekDir.substring(1);
+
+  SdLock lock;
+  File dir = SD_MMC.open(weekDir.c_str());
+  if (!dir || !dir.isDirectory()) {
+    if (dir) dir.close();
+    return false;
+  }
+  File file = dir.openNextFile();
+  while (file) {
+    String name = String(file.name());
+    name = name.substring(name.lastIndexOf('/') + 1);
+    if (!file.isDirectory() && name.endsWith(".jpg")) {
+      summaryCount(s, dirName, name, file.size());
+    }
+    file.close();
+    file = dir.openNextFile();
+  }
+  dir.close();
+
+  File out = SD_MMC.open(summaryPathFor(weekDir).c_str(), FILE_WRITE);
+  bool ok = out && out.write((const uint8_t*)&s, sizeof(s)) == sizeof(s);
+  if (out) out.close();
+  LOGI("重建周汇总 %s: 定时 %lu 张，区域 %lu 张，触发 %lu 张，耗时 %lu ms", weekDir.c_str(), s.frames, s.roiFrames,
+       s.triggerFrames, millis() - start);
+  return ok;
+}
+
+// 读取周汇总；记录缺失或版本不符时，allowRebuild为true则重新生成，否则返回false
+bool summaryLoad(const String& weekDir, WeekSummary& s, bool allowRebuild) {
+  SdLock lock;
+  File file = SD_MMC.open(summaryPathFor(weekDir).c_str(), FILE_READ);
+  bool valid = file && file.read((uint8_t*)&s, sizeof(s)) == sizeof(s) &&
+               s.magic == SUMMARY_MAGIC && s.version == SUMMARY_VERSION;
+  if (file) file.close();
+  if (valid) {
+    return true;
   }
+  if (!allowRebuild || !SD_MMC.exists(weekDir.c_str())) {
+    memset(&s, 0, sizeof(s));
+    return false;
+  }
+  return summaryRebuild(weekDir, s);
 }
 
-// 根路径：显示配置页面
-void handleRoot() {
-  String html = "<!DOCTYPE html><html><head>";
-  html += "<meta charset='UTF-8'>";
-  html += "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
-  html += "<title>ESP32-CAM WiFi配置</title>";
-  html += "<style>";
-  html += "body { font-family: Arial, sans-serif; max-width: 500px; margin: 50px auto; padding: 20px; background: #f5f5f5; }";
-  html += "h1 { color: #333; text-align: center; }";
-  html += "form { background: white; padding: 30px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }";
-  html += "label { display: block; margin: 15px 0 5px; color: #555; font-weight: bold; }";
-  html += "input { width: 100%; padding: 12px; border: 2px solid #ddd; border-radius: 5px; font-size: 16px; box-sizing: border-box; }";
-  html += "input:focus { border-color: #4CAF50; outline: none; }";
-  html += "button { width: 100%; padding: 12px; background: #4CAF50; color: white; border: none; border-radius: 5px; font-size: 16px; cursor: pointer; margin-top: 20px; }";
-  html += "button:hover { background: #45a049; }";
-  html += ".info { background: #e3f2fd; padding: 15px; border-radius: 5px; margin-bottom: 20px; color: #1976d2; }";
-  html += "</style></head><body>";
-  html += "<h1>📷 ESP32-CAM WiFi配置</h1>";
-  html += "<div class='info'>";
-  html += "<strong>提示：</strong>请填写您的WiFi网络信息，配置后将自动保存并重启设备。";
-  html += "</div>";
-  html += "<form action='/save' method='POST'>";
-  html += "<label for='ssid'>WiFi名称 (SSID):</label>";
-  html += "<input type='text' id='ssid' name='ssid' required placeholder='请输入WiFi名称'>";
-  html += "<label for='password'>WiFi密码:</label>";
-  html += "<input type='password' id='password' name='password' required placeholder='请输入WiFi密码'>";
-  html += "<button type='submit'>保存配置</button>";
-  html += "</form>";
-  html += "</body></html>";
-  
-  server.send(200, "text/html; charset=UTF-8", html);
+// 照片提交后计入周汇总。记录缺失时保持缺失：在拍照路径上持有SD卡锁遍历整个周目录太慢，留给 /api/calendar 按需重建
+void summaryAdd(const String& path, uint32_t size) {
+  int slash = path.lastIndexOf('/');
+  String weekDir = path.substring(0, slash);
+  String dirName = weekDir.substring(1);
+  if (slash <= 0 || !isWeekDirName(dirName) || !path.endsWith(".jpg")) {
+    return;
+  }
+  SdLock lock;
+  WeekSummary s;
+  File file = SD_MMC.open(summaryPathFor(weekDir).c_str(), "r+");
+  if (!file || file.read((uint8_t*)&s, sizeof(s)) != sizeof(s) ||
+      s.magic != SUMMARY_MAGIC || s.version != SUMMARY_VERSION) {
+    if (file) file.close();
+    return;
+  }
+  summaryCount(s, dirName, path.substring(slash + 1), size);
+  if (!file.seek(0) || file.write((const uint8_t*)&s, sizeof(s)) != sizeof(s)) {
+    LOGW("周汇总更新失败: %s", weekDir.c_str());
+  }
+  file.close();
 }
 
-// 保存配置
-void handleSave() {
-  if (server.hasArg("ssid") && server.hasArg("password")) {
-    String new_ssid = server.arg("ssid");
-    String new_password = server.arg("password");
-    
-    // 保存到Preferences
-    preferences.putString("ssid", new_ssid);
-    preferences.putString("password", new_password);
-    preferences.end();
-    
-    Serial.printf("WiFi配置已保存: %s\n", new_ssid.c_str());
-    
-    // 返回成功页面
-    String html = "<!DOCTYPE html><html><head>";
-    html += "<meta charset='UTF-8'>";
-    html += "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
-    html += "<meta http-equiv='refresh' content='5;url=/'>";
-    html += "<title>配置成功</title>";
-    html += "<style>";
-    html += "body { font-family: Arial, sans-serif; max-width: 500px; margin: 50px auto; padding: 20px; text-align: center; background: #f5f5f5; }";
-    html += "h1 { color: #4CAF50; }";
-    html += ".success { background: #d4edda; padding: 20px; border-radius: 10px; color: #155724; margin: 20px 0; }";
-    html += "</style></head><body>";
-    html += "<h1>✅ 配置成功！</h1>";
-    html += "<div class='success'>";
-    html += "<p>WiFi配置已保存</p>";
-    html += "<p>设备将在5秒后重启并连接到新网络</p>";
-    html += "</div>";
-    html += "</body></html>";
-    
-    server.send(200, "text/html; charset=UTF-8", html);
-    
-    delay(2000);
-    ESP.restart();
+// /api/calendar[?from=YYYY_MM_DD&to=YYYY_MM_DD]：每天每小时的照片数（热力图）和每周的统计（JSON）
+// {"from":"...","to":"...","days":[{"day":"2024_01_15","frames":N,"hours":[24个数]},...],
+//  "weeks":[{"week":"2024_W03","frames":N,"roiFrames":R,"triggerFrames":T,"bytes":B,"minSize":x,"maxSize":y},...],
+//  "pending":["2024_W02"],"ms":T}
+// frames、hours和大小范围只统计定时拍摄的全幅照片；区域和触发照片在每周的roiFrames、triggerFrames中，bytes包含所有照片
+// pending中的周汇总已过期且本次没来得及重建（对应的天数据为0），再次请求即可
+void handleApiCalendar() {
+  unsigned long start = millis();
+  struct tm from, to;
+  if (server.hasArg("to")) {
+    if (!parseDay(server.arg("to"), to)) {
+      server.send(400, "text/plain", "无效的日期: " + server.arg("to"));
+      return;
+    }
   } else {
-    server.send(400, "text/plain", "参数错误");
+    if (!getLocalTime(&to, 0)) {
+      server.send(503, "text/plain", "时间未同步");
+      return;
+    }
+    to.tm_hour = 12;
+    to.tm_min = 0;
+    to.tm_sec = 0;
+  }
+  if (server.hasArg("from")) {
+    if (!parseDay(server.arg("from"), from)) {
+      server.send(400, "text/plain", "无效的日期: " + server.arg("from"));
+      return;
+    }
+  } else {
+    from = to;
+    from.tm_mday -= CALENDAR_DEFAULT_DAYS - 1;
+    mktime(&from);
+  }
+  time_t fromT = mktime(&from);
+  time_t toT = mktime(&to);
+  if (toT < fromT || (toT - fromT) / 86400 >= CALENDAR_MAX_DAYS) {
+    server.send(400, "text/plain", "日期范围无效（最多366天）");
+    return;
   }
-}
 
-// 配置页面（备用）
-void handleConfig() {
-  handleRoot();
+  char dayName[12];
+  char buf[200];
+  strftime(dayName, sizeof(dayName), "%Y_%m_%d", &from);
+  String head = "{\"from\":\"" + String(dayName) + "\"";
+  strftime(dayName, sizeof(dayName), "%Y_%m_%d", &to);
+  head += ",\"to\":\"" + String(dayName) + "\",\"days\":[";
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  server.sendContent(head);
+
+  String weeks = "";
+  String pending = "";
+  String currentWeek = "";
+  WeekSummary s;
+  bool haveSummary = false;
+  int weekNo = 0;
+  uint32_t weekCount = 0;
+  struct tm day = from;
+  for (int n = 0; mktime(&day) <= toT; n++) {
+    String weekDir = weekDirectoryFor(&day);
+    if (weekDir != currentWeek) {
+      currentWeek = weekDir;
+      weekNo = weekDir.substring(7, 9).toInt();
+      bool allowRebuild = (long)(millis() - start) < CALENDAR_REBUILD_BUDGET_MS;
+      haveSummary = summaryLoad(weekDir, s, allowRebuild);
+      if (haveSummary) {
+        snprintf(buf, sizeof(buf),
+                 "%s{\"week\":\"%s\",\"frames\":%lu,\"roiFrames\":%lu,\"triggerFrames\":%lu,\"bytes\":%llu,\"minSize\":%lu,\"maxSize\":%lu}",
+                 weekCount > 0 ? "," : "", weekDir.c_str() + 1, s.frames, s.roiFrames, s.triggerFrames, s.bytes, s.minSize,
+                 s.maxSize);
+        weeks += buf;
+        weekCount++;
+      } else if (!allowRebuild && SD_MMC.exists(weekDir.c_str())) {
+        pending += String(pending.length() > 0 ? "," : "") + "\"" + weekDir.substring(1) + "\"";
+      }
+    }
+    int dayIndex = day.tm_yday - (weekNo - 1) * 7;
+    uint32_t frames = 0;
+    String hours = "";
+    for (int h = 0; h < 24; h++) {
+      uint16_t c = (haveSummary && dayIndex >= 0 && dayIndex < 7) ? s.hours[dayIndex][h] : 0;
+      frames += c;
+      hours += String(h > 0 ? "," : "") + String(c);
+    }
+    strftime(dayName, sizeof(dayName), "%Y_%m_%d", &day);
+    server.sendContent(String(n > 0 ? "," : "") + "{\"day\":\"" + dayName + "\",\"frames\":" + String(frames) +
+                       ",\"hours\":[" + hours + "]}");
+    day.tm_mday++;
+  }
+  unsigned long ms = millis() - start;
+  server.sendContent("],\"weeks\":[" + weeks + "],\"pending\":[" + pending + "],\"ms\":" + String(ms) + "}");
+  server.sendContent("");
+  LOGI("日历查询 %s ~ %s: %lu 周，耗时 %lu ms", server.arg("from").c_str(), server.arg("to").c_str(), weekCount, ms);
 }
 
-// 状态页面（正常模式）
-void handleStatus() {
-  struct tm timeinfo;
-  String timeStr = "未同步";
-  if (getLocalTime(&timeinfo)) {
-    char buf[30];
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
-    timeStr = String(buf);
+// ==================== 拍摄参数测试 ====================
+// /bench/capture 按实际拍摄流程（闪光灯等待、取帧、写SD卡）测量每种参数组合，帮助在现场选择分辨率和画质。
+// 测试期间持有相机锁；定时拍摄要用相机时（previewStopRequested）立即停止，剩下的组合不再测试。
+
+// 解析逗号分隔的分辨率名称，返回个数
+int benchParseSizes(const String& text, uint8_t* sizes, int maxCount) {
+  int count = 0;
+  int start = 0;
+  while (start <= (int)text.length() && count < maxCount) {
+    int end = text.indexOf(',', start);
+    if (end < 0) end = text.length();
+    String name = text.substring(start, end);
+    name.trim();
+    for (size_t i = 0; i < sizeof(frameSizeNames) / sizeof(frameSizeNames[0]); i++) {
+      if (name == frameSizeNames[i].name) {
+        sizes[count++] = frameSizeNames[i].size;
+        break;
+      }
+    }
+    start = end + 1;
   }
-  
-  String html = "<!DOCTYPE html><html><head>";
-  html += "<meta charset='UTF-8'>";
-  html += "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
-  html += "<title>ESP32-CAM 状态</title>";
-  html += "<style>";
-  html += "body { font-family: Arial, sans-serif; max-width: 600px; margin: 50px auto; padding: 20px; background: #f5f5f5; }";
-  html += "h1 { color: #333; text-align: center; }";
-  html += ".card { background: white; padding: 20px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); margin: 20px 0; }";
-  html += ".info { margin: 10px 0; }";
-  html += ".label { font-weight: bold; color: #555; }";
-  html += ".value { color: #333; }";
-  html += "a { display: inline-block; margin: 10px 5px; padding: 10px 20px; background: #4CAF50; color: white; text-decoration: none; border-radius: 5px; }";
-  html += "a:hover { background: #45a049; }";
-  html += ".warning { background: #fff3cd; padding: 15px; border-radius: 5px; margin: 20px 0; color: #856404; }";
-  html += "</style></head><body>";
-  html += "<h1>📷 ESP32-CAM 状态</h1>";
-  html += "<div class='card'>";
-  html += "<div class='info'><span class='label'>WiFi名称:</span> <span class='value'>" + wifi_ssid + "</span></div>";
-  html += "<div class='info'><span class='label'>IP地址:</span> <span class='value'>" + WiFi.localIP().toString() + "</span></div>";
-  html += "<div class='info'><span class='label'>当前时间:</span> <span class='value'>" + timeStr + "</span></div>";
-  html += "<div class='info'><span class='label'>信号强度:</span> <span class='value'>" + String(WiFi.RSSI()) + " dBm</span></div>";
-  html += "</div>";
-  html += "<div class='card'>";
-  html += "<h2>操作</h2>";
-  html += "<a href='/photos'>📷 浏览照片</a>";
-  html += "<a href='/config'>⚙️ 重新配置WiFi</a>";
-  html += "<a href='/reset' onclick='return confirm(\"确定要清除WiFi配置并重启吗？\")'>🔄 清除配置并重启</a>";
-  html += "</div>";
-  html += "<div class='warning'>";
-  html += "<strong>注意：</strong>设备每10分钟自动拍摄一张照片并进入深度睡眠。";
-  html += "</div>";
-  html += "</body></html>";
-  
-  server.send(200, "text/html; charset=UTF-8", html);
+  return count;
 }
 
-// 重置配置
-void handleReset() {
-  preferences.clear();
-  preferences.end();
-  
-  String html = "<!DOCTYPE html><html><head>";
-  html += "<meta charset='UTF-8'>";
-  html += "<meta http-equiv='refresh' content='3;url=/'>";
-  html += "<title>配置已清除</title>";
-  html += "<style>body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }</style>";
-  html += "</head><body>";
-  html += "<h1>配置已清除</h1>";
-  html += "<p>设备将在3秒后重启...</p>";
-  html += "</body></html>";
-  
-  server.send(200, "text/html; charset=UTF-8", html);
-  delay(1000);
-  ESP.restart();
+// 解析逗号分隔的数字，超出[minValue, maxValue]的跳过，返回个数
+int benchParseNumbers(const String& text, uint8_t* values, int maxCount, int minValue, int maxValue) {
+  int count = 0;
+  int start = 0;
+  while (start <= (int)text.length() && count < maxCount) {
+    int end = text.indexOf(',', start);
+    if (end < 0) end = text.length();
+    String item = text.substring(start, end);
+    item.trim();
+    int v = item.toInt();
+    if (item.length() > 0 && v >= minValue && v <= maxValue) {
+      values[count++] = v;
+    }
+    start = end + 1;
+  }
+  return count;
 }
 
-// 照片列表页面
-void handlePhotos() {
-  String html = "<!DOCTYPE html><html><head>";
-  html += "<meta charset='UTF-8'>";
-  html += "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
-  html += "<title>照片浏览</title>";
-  html += "<style>";
-  html += "body { font-family: Arial, sans-serif; max-width: 1200px; margin: 20px auto; padding: 20px; background: #f5f5f5; }";
-  html += "h1 { color: #333; text-align: center; }";
-  html += ".nav { margin: 20px 0; text-align: center; }";
-  html += ".nav a, .nav button { display: inline-block; margin: 5px 10px; padding: 10px 20px; background: #4CAF50; color: white; text-decoration: none; border: none; border-radius: 5px; cursor: pointer; }";
-  html += ".nav a:hover, .nav button:hover { background: #45a049; }";
-  html += ".photo-list { background: white; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); margin: 20px 0; overflow: hidden; }";
-  html += "table { width: 100%; border-collapse: collapse; }";
-  html += "th { background: #4CAF50; color: white; padding: 12px; text-align: left; font-weight: bold; }";
-  html += "td { padding: 10px 12px; border-bottom: 1px solid #eee; }";
-  html += "tr:hover { background: #f9f9f9; }";
-  html += ".photo-name { font-family: monospace; color: #333; word-break: break-all; }";
-  html += ".photo-actions { white-space: nowrap; }";
-  html += ".photo-actions a { display: inline-block; margin: 0 5px; padding: 6px 12px; background: #2196F3; color: white; text-decoration: none; border-radius: 3px; font-size: 12px; }";
-  html += ".photo-actions a:hover { background: #0b7dda; }";
-  html += ".photo-actions a.download { background: #ff9800; }";
-  html += ".photo-actions a.download:hover { background: #e68900; }";
-  html += ".photo-actions a.delete { background: #f44336; }";
-  html += ".photo-actions a.delete:hover { background: #d32f2f; }";
-  html += ".empty { text-align: center; padding: 50px; color: #999; }";
-  html += ".count { margin: 10px 0; padding: 10px; background: #e3f2fd; border-radius: 5px; color: #1976d2; }";
-  html += "</style></head><body>";
-  html += "<h1>📷 照片浏览</h1>";
-  html += "<div class='nav'>";
-  html += "<a href='/'>返回首页</a>";
-  html += "<button onclick='location.reload()'>🔄 刷新</button>";
-  html += "</div>";
-  
-  // 获取所有照片文件
-  int photoCount = 0;
-  
-  // 开始表格
-  html += "<div class='photo-list'>";
-  html += "<table>";
-  html += "<thead><tr><th>序号</th><th>文件名</th><th>操作</th></tr></thead>";
-  html += "<tbody>";
-  
-  // 扫描根目录
-  File root = SD_MMC.open("/");
-  if (root && root.isDirectory()) {
-    Serial.println("开始扫描根目录...");
-    Serial.flush();
-    
-    File file = root.openNextFile();
-    while (file) {
-      String fileName = String(file.name());
-      bool isDir = file.isDirectory();
-      
-      Serial.printf("找到: %s (目录: %s)\n", fileName.c_str(), isDir ? "是" : "否");
-      Serial.flush();
-      
-      if (!isDir && fileName.endsWith(".jpg")) {
-        // 根目录中的JPG文件
-        String displayName = fileName;
-        if (displayName.startsWith("/")) {
-          displayName = displayName.substring(1);
-        }
-        
-        // URL编码文件路径
-        String encodedPath = urlEncode(fileName);
-        
-        html += "<tr>";
-        html += "<td>" + String(photoCount + 1) + "</td>";
-        html += "<td class='photo-name'>" + displayName + "</td>";
-        html += "<td class='photo-actions'>";
-        html += "<a href='/photo?file=" + encodedPath + "' target='_blank'>查看</a>";
-        html += "<a href='/photo?file=" + encodedPath + "&download=1' class='download' download='" + displayName + "'>下载</a>";
-        html += "<a href='/delete?file=" + encodedPath + "' class='delete' onclick='return confirm(\"确定要删除照片 " + displayName + " 吗？此操作不可恢复！\")'>删除</a>";
-        html += "</td>";
-        html += "</tr>";
-        photoCount++;
-        Serial.printf("添加根目录文件: %s\n", displayName.c_str());
-        Serial.flush();
-      } else if (isDir) {
-        // 扫描所有目录（不仅仅是周目录）
-        // 确保路径格式正确
-        String dirPath = fileName;
-        if (!dirPath.startsWith("/")) {
-          dirPath = "/" + dirPath;
-        }
-        
-        Serial.printf("扫描目录: %s\n", dirPath.c_str());
-        Serial.flush();
-        
-        File dir = SD_MMC.open(dirPath.c_str());
-        if (dir && dir.isDirectory()) {
-          File photoFile = dir.openNextFile();
-          int dirPhotoCount = 0;
-          
-          while (photoFile) {
-            String photoName = String(photoFile.name());
-            bool photoIsDir = photoFile.isDirectory();
-            
-            Serial.printf("  目录项: %s (目录: %s)\n", photoName.c_str(), photoIsDir ? "是" : "否");
-            Serial.flush();
-            
-            if (!photoIsDir && photoName.endsWith(".jpg")) {
-              // 构建完整路径
-              String fullPath;
-              // file.name() 可能返回完整路径或相对路径
-              if (photoName.startsWith("/")) {
-                // 已经是完整路径
-                fullPath = photoName;
-              } else {
-                // 相对路径，需要拼接
-                fullPath = dirPath;
-                if (!fullPath.endsWith("/")) {
-                  fullPath += "/";
-                }
-                // 移除photoName中可能的前导斜杠
-                if (photoName.startsWith("/")) {
-                  photoName = photoName.substring(1);
-                }
-                fullPath += photoName;
-              }
-              
-              // 确保路径以 / 开头
-              if (!fullPath.startsWith("/")) {
-                fullPath = "/" + fullPath;
-              }
-              
-              String displayName = fullPath.substring(1);
-              
-              // URL编码文件路径
-              String encodedPath = urlEncode(fullPath);
-              
-              html += "<tr>";
-              html += "<td>" + String(photoCount + 1) + "</td>";
-              html += "<td class='photo-name'>" + displayName + "</td>";
-              html += "<td class='photo-actions'>";
-              html += "<a href='/photo?file=" + encodedPath + "' target='_blank'>查看</a>";
-              html += "<a href='/photo?file=" + encodedPath + "&download=1' class='download' download='" + displayName + "'>下载</a>";
-              html += "<a href='/delete?file=" + encodedPath + "' class='delete' onclick='return confirm(\"确定要删除照片 " + displayName + " 吗？此操作不可恢复！\")'>删除</a>";
-              html += "</td>";
-              html += "</tr>";
-              photoCount++;
-              dirPhotoCount++;
-              Serial.printf("  添加目录文件: %s (完整路径: %s)\n", photoName.c_str(), fullPath.c_str());
-              Serial.flush();
-            }
-            photoFile.close();
-            photoFile = dir.openNextFile();
-          }
-          dir.close();
-          Serial.printf("目录 %s 中找到 %d 张照片\n", dirPath.c_str(), dirPhotoCount);
-          Serial.flush();
-        } else {
-          Serial.printf("警告: 无法打开目录 %s\n", dirPath.c_str());
-          Serial.flush();
-        }
+// 测量一种组合：切换分辨率和画质后按 captureRoiFrame() 的流程拍摄并写卡（调用者需持有相机锁）
+bool benchMeasureCell(BenchCell& cell, int frames, const String& tmpPath, File& csv, size_t baseInternal, size_t basePsram) {
+  sensor_t* s = esp_camera_sensor_get();
+  if (s == NULL) {
+    return false;
+  }
+  size_t lowInternal = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  size_t lowPsram = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+  s->set_framesize(s, (framesize_t)cell.frameSize);
+  s->set_quality(s, cell.quality);
+  cameraDrainFrames((framesize_t)cell.frameSize);
+  cameraDiscardFrames(psramFound() ? 2 : 1);  // 画质改变前已经开始压缩的帧
+  cameraStillMode = false;                      // 测试结束时由 cameraUseStillMode() 恢复
+
+  pinMode(LED_GPIO_NUM, OUTPUT);
+  for (int i = 0; i < frames && !previewStopRequested; i++) {
+    unsigned long captureStart = millis();
+    if (cell.flash) {
+      digitalWrite(LED_GPIO_NUM, HIGH);
+      delay(100);  // 与定时拍摄相同的闪光灯稳定时间
+    }
+    camera_fb_t* fb = esp_camera_fb_get();
+    digitalWrite(LED_GPIO_NUM, LOW);
+    if (!fb) {
+      LOGE("测试取帧失败");
+      return false;
+    }
+    uint32_t captureMs = millis() - captureStart;
+
+    unsigned long writeStart = millis();
+    bool written = false;
+    {
+      SdLock lock;
+      File file = SD_MMC.open(tmpPath.c_str(), FILE_WRITE);
+      if (file) {
+        written = file.write(fb->buf, fb->len) == fb->len;
+        file.close();  // 包括关闭时写回的目录项和FAT，与保存照片的实际开销一致
       }
-      file.close();
-      file = root.openNextFile();
     }
-    root.close();
-    Serial.printf("扫描完成，共找到 %d 张照片\n", photoCount);
-    Serial.flush();
-    
-    // 结束表格
-    html += "</tbody>";
-    html += "</table>";
-    html += "</div>";
-    
-    // 显示照片总数
-    if (photoCount > 0) {
-      html += "<div class='count'>共找到 " + String(photoCount) + " 张照片</div>";
+    uint32_t writeMs = millis() - writeStart;
+    size_t internalFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t psramFree = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    uint32_t bytes = fb->len;
+    esp_camera_fb_return(fb);
+    if (!written) {
+      LOGE("测试写入失败: %s", tmpPath.c_str());
+      return false;
+    }
+
+    cell.frames++;
+    cell.totalBytes += bytes;
+    cell.minBytes = cell.frames == 1 ? bytes : std::min(cell.minBytes, bytes);
+    cell.maxBytes = std::max(cell.maxBytes, bytes);
+    cell.totalCaptureMs += captureMs;
+    cell.maxCaptureMs = std::max(cell.maxCaptureMs, captureMs);
+    cell.totalWriteMs += writeMs;
+    cell.maxWriteMs = std::max(cell.maxWriteMs, writeMs);
+    cell.internalUsed = std::max(cell.internalUsed, baseInternal > internalFree ? (uint32_t)(baseInternal - internalFree) : 0);
+    cell.psramUsed = std::max(cell.psramUsed, basePsram > psramFree ? (uint32_t)(basePsram - psramFree) : 0);
+
+    // 逐行写入结果文件，不在内存中拼接整个CSV
+    char row[96];
+    int len = snprintf(row, sizeof(row), "%s,%u,%u,%d,%lu,%lu,%lu,%u,%u\n", frameSizeName(cell.frameSize), cell.quality,
+                       cell.flash ? 1 : 0, i + 1, bytes, captureMs, writeMs, internalFree, psramFree);
+    if (csv) {
+      SdLock lock;
+      csv.write((const uint8_t*)row, std::min(len, (int)sizeof(row) - 1));
+    }
+  }
+  cell.internalMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  cell.psramMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+  cell.newLow = cell.internalMinFree < lowInternal || cell.psramMinFree < lowPsram;
+  return true;
+}
+
+// /bench/capture[?sizes=svga,xga&q=10,12&flash=0,1&k=3&ms=30000]
+// 每种组合拍k张，逐张结果保存为 /bench/capture_<时间>.csv，返回每种组合的汇总（JSON）：
+// {"csv":"...","complete":true,"ms":T,"cells":[{"size":"xga","quality":10,"flash":false,"frames":3,
+//   "avgBytes":B,"minBytes":x,"maxBytes":y,"avgCaptureMs":c,"maxCaptureMs":c,"avgWriteMs":w,"maxWriteMs":w,
+//   "internalUsed":i,"psramUsed":p,"internalMinFree":a,"psramMinFree":b,"newLow":true},...],"skipped":["uxga"]}
+// 大于静态拍摄分辨率的尺寸放不进帧缓冲区，列在skipped中。
+// internalUsed/psramUsed 是每张照片写卡后采样的占用；驱动内部的瞬时峰值只能从开机以来的最低空闲内存看出，
+// 它不能清零，所以只有 newLow 为true的组合，internalMinFree/psramMinFree 才反映该组合的峰值
+void handleBenchCapture() {
+  uint8_t sizes[8], qualities[8], flashes[2];
+  int sizeCount = benchParseSizes(server.hasArg("sizes") ? server.arg("sizes") : String(BENCH_DEFAULT_SIZES), sizes, 8);
+  int qualityCount = benchParseNumbers(server.hasArg("q") ? server.arg("q") : String(BENCH_DEFAULT_QUALITIES), qualities, 8, 4, 63);
+  int flashCount = benchParseNumbers(server.hasArg("flash") ? server.arg("flash") : String("0,1"), flashes, 2, 0, 1);
+  int frames = server.hasArg("k") ? constrain(server.arg("k").toInt(), 1, BENCH_MAX_FRAMES) : BENCH_DEFAULT_FRAMES;
+  uint32_t budget = server.hasArg("ms") ? constrain(server.arg("ms").toInt(), 1000, BENCH_MAX_BUDGET_MS) : BENCH_DEFAULT_BUDGET_MS;
+  if (sizeCount == 0 || qualityCount == 0 || flashCount == 0 || sizeCount * qualityCount * flashCount > BENCH_MAX_CELLS) {
+    server.send(400, "text/plain", "参数无效（sizes/q/flash 为逗号分隔的列表，最多64种组合）");
+    return;
+  }
+
+  BenchCell* cells = (BenchCell*)server.scratch(sizeof(BenchCell) * BENCH_MAX_CELLS);
+  if (cells == NULL) {
+    server.send(500, "text/plain", "内存不足");
+    return;
+  }
+  String skipped = "";
+  int cellCount = 0;
+  for (int a = 0; a < sizeCount; a++) {
+    if (sizes[a] > stillFrameSize) {
+      skipped += String(skipped.length() > 0 ? ",\"" : "\"") + frameSizeName(sizes[a]) + "\"";
+      continue;
+    }
+    for (int b = 0; b < qualityCount; b++) {
+      for (int c = 0; c < flashCount; c++) {
+        BenchCell& cell = cells[cellCount++];
+        memset(&cell, 0, sizeof(cell));
+        cell.frameSize = sizes[a];
+        cell.quality = qualities[b];
+        cell.flash = flashes[c] != 0;
+      }
+    }
+  }
+
+  String csvPath = String(BENCH_DIR "/capture_") + getTimeString() + ".csv";
+  String tmpPath = BENCH_DIR "/frame.tmp";
+  File csv;
+  {
+    SdLock lock;
+    SD_MMC.mkdir(BENCH_DIR);
+    csv = SD_MMC.open(csvPath.c_str(), FILE_WRITE);
+    if (csv) {
+      csv.print("size,quality,flash,frame,bytes,capture_ms,write_ms,internal_free,psram_free\n");
     } else {
-      html += "<div class='empty'><p>📷 还没有照片</p><p>设备会自动拍摄照片并保存</p></div>";
+      LOGW("无法创建测试结果文件: %s", csvPath.c_str());
+      csvPath = "";
     }
-  } else {
-    html += "</tbody>";
-    html += "</table>";
-    html += "</div>";
-    html += "<div class='empty'><p>❌ 无法访问SD卡</p></div>";
   }
-  
-  html += "</body></html>";
-  server.send(200, "text/html; charset=UTF-8", html);
-}
 
-// 删除照片处理函数
-void handleDelete() {
-  if (!server.hasArg("file")) {
-    server.send(400, "text/plain", "缺少file参数");
-    return;
+  LOGI("拍摄参数测试: %d 种组合，每种 %d 张，时间上限 %lu ms", cellCount, frames, budget);
+  unsigned long start = millis();
+  int done = 0;
+  bool ok = true;
+  {
+    previewStopRequested = true;  // 结束正在运行的预览流
+    CameraLock cameraLock;
+    previewStopRequested = false;
+    cameraUseStillMode();
+    cameraUseRoi(ROI_FULL);
+    size_t baseInternal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t basePsram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    while (done < cellCount && ok && !previewStopRequested && millis() - start < budget) {
+      ok = benchMeasureCell(cells[done], frames, tmpPath, csv, baseInternal, basePsram);
+      if (cells[done].frames > 0) {
+        done++;
+      }
+    }
+    cameraUseStillMode();
   }
-  
-  // URL解码文件路径
-  String filePath = urlDecode(server.arg("file"));
-  
-  // 确保路径以 / 开头
-  if (!filePath.startsWith("/")) {
-    filePath = "/" + filePath;
+  unsigned long ms = millis() - start;
+  {
+    SdLock lock;
+    SD_MMC.remove(tmpPath.c_str());
+    if (csv) csv.close();
   }
-  
-  // 安全检查：防止目录遍历攻击
-  if (filePath.indexOf("..") >= 0 || !filePath.endsWith(".jpg")) {
-    server.send(400, "text/plain", "无效的文件路径: " + filePath);
-    Serial.printf("删除失败：无效路径 %s\n", filePath.c_str());
-    Serial.flush();
-    return;
+  LOGI("拍摄参数测试完成: %d/%d 种组合，耗时 %lu ms，结果 %s", done, cellCount, ms, csvPath.c_str());
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  char buf[512];
+  snprintf(buf, sizeof(buf), "{\"csv\":\"%s\",\"complete\":%s,\"ms\":%lu,\"cells\":[", csvPath.c_str(),
+           done == cellCount ? "true" : "false", ms);
+  server.print(buf);
+  for (int i = 0; i < done; i++) {
+    const BenchCell& c = cells[i];
+    snprintf(buf, sizeof(buf),
+             "%s{\"size\":\"%s\",\"quality\":%u,\"flash\":%s,\"frames\":%u,\"avgBytes\":%lu,\"minBytes\":%lu,\"maxBytes\":%lu,"
+             "\"avgCaptureMs\":%lu,\"maxCaptureMs\":%lu,\"avgWriteMs\":%lu,\"maxWriteMs\":%lu,\"internalUsed\":%lu,\"psramUsed\":%lu,"
+             "\"internalMinFree\":%lu,\"psramMinFree\":%lu,\"newLow\":%s}",
+             i > 0 ? "," : "", frameSizeName(c.frameSize), c.quality, c.flash ? "true" : "false", c.frames,
+             (uint32_t)(c.totalBytes / c.frames), c.minBytes, c.maxBytes, c.totalCaptureMs / c.frames, c.maxCaptureMs,
+             c.totalWriteMs / c.frames, c.maxWriteMs, c.internalUsed, c.psramUsed, c.internalMinFree, c.psramMinFree,
+             c.newLow ? "true" : "false");
+    server.print(buf);
   }
-  
-  Serial.printf("尝试删除文件: %s\n", filePath.c_str());
-  Serial.flush();
-  
-  // 检查文件是否存在
-  File file = SD_MMC.open(filePath.c_str(), FILE_READ);
+  server.print("],\"skipped\":[" + skipped + "]}");
+}
+
+// ==================== 上传队列 ====================
+// 拍照成功后把路径追加到队列文件；唤醒窗口内通过一个keep-alive连接逐张PUT到上传地址。
+// 上传地址格式：http://主机[:端口]/路径前缀，照片以 前缀/周目录/文件名 上传（需要允许匿名PUT的存储桶或HTTP收集服务）。
+// 中断的照片下次整张重新PUT：write()成功只说明数据进了本地发送缓冲区，设备无法知道服务器实际收到多少，
+// 而且PUT不支持用 Content-Range 追加，续传会让服务器用后半段覆盖整个文件。
+
+// 读取上传状态（SD卡挂载后调用一次）
+void uploadLoadState() {
+  SdLock lock;
+  File file = SD_MMC.open(UPLOAD_STATE_FILE, FILE_READ);
+  if (file && file.size() == sizeof(UploadState)) {
+    file.read((uint8_t*)&uploadState, sizeof(UploadState));
+  }
+  if (file) file.close();
+}
+
+void uploadSaveState() {
+  SdLock lock;
+  File file = SD_MMC.open(UPLOAD_STATE_FILE, FILE_WRITE);
   if (!file) {
-    Serial.printf("错误: 文件不存在 %s\n", filePath.c_str());
-    Serial.flush();
-    String html = "<!DOCTYPE html><html><head>";
-    html += "<meta charset='UTF-8'>";
-    html += "<meta http-equiv='refresh' content='2;url=/photos'>";
-    html += "<title>删除失败</title>";
-    html += "<style>body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }";
-    html += ".error { color: #f44336; }</style></head><body>";
-    html += "<h1 class='error'>❌ 删除失败</h1>";
-    html += "<p>文件不存在: " + filePath + "</p>";
-    html += "<p>2秒后自动返回照片列表...</p>";
-    html += "<a href='/photos'>立即返回</a>";
-    html += "</body></html>";
-    server.send(404, "text/html; charset=UTF-8", html);
-    return;
+    SD_MMC.mkdir(UPLOAD_DIR);
+    file = SD_MMC.open(UPLOAD_STATE_FILE, FILE_WRITE);
+    if (!file) {
+      LOGE("无法保存上传状态");
+      return;
+    }
   }
-  
-  // 确保不是目录
-  if (file.isDirectory()) {
-    file.close();
-    Serial.printf("错误: 路径是目录而不是文件: %s\n", filePath.c_str());
-    Serial.flush();
-    String html = "<!DOCTYPE html><html><head>";
-    html += "<meta charset='UTF-8'>";
-    html += "<meta http-equiv='refresh' content='2;url=/photos'>";
-    html += "<title>删除失败</title>";
-    html += "<style>body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }";
-    html += ".error { color: #f44336; }</style></head><body>";
-    html += "<h1 class='error'>❌ 删除失败</h1>";
-    html += "<p>不能删除目录: " + filePath + "</p>";
-    html += "<p>2秒后自动返回照片列表...</p>";
-    html += "<a href='/photos'>立即返回</a>";
-    html += "</body></html>";
-    server.send(400, "text/html; charset=UTF-8", html);
+  file.write((const uint8_t*)&uploadState, sizeof(UploadState));
+  file.close();
+}
+
+// 加入上传队列
+void uploadEnqueue(const String& path) {
+  if (upload_url.length() == 0) {
     return;
   }
-  
+  SdLock lock;
+  File file = SD_MMC.open(UPLOAD_QUEUE_FILE, FILE_APPEND);
+  if (!file) {
+    SD_MMC.mkdir(UPLOAD_DIR);
+    file = SD_MMC.open(UPLOAD_QUEUE_FILE, FILE_APPEND);
+    if (!file) {
+      LOGE("无法写入上传队列: %s", path.c_str());
+      return;
+    }
+  }
+  file.print(path + "\n");
   file.close();
-  
-  // 删除文件
-  if (SD_MMC.remove(filePath.c_str())) {
-    Serial.printf("文件删除成功: %s\n", filePath.c_str());
-    Serial.flush();
-    
-    String html = "<!DOCTYPE html><html><head>";
-    html += "<meta charset='UTF-8'>";
-    html += "<meta http-equiv='refresh' content='2;url=/photos'>";
-    html += "<title>删除成功</title>";
-    html += "<style>body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }";
-    html += ".success { color: #4CAF50; }</style></head><body>";
-    html += "<h1 class='success'>✅ 删除成功</h1>";
-    html += "<p>文件已删除: " + filePath + "</p>";
-    html += "<p>2秒后自动返回照片列表...</p>";
-    html += "<a href='/photos'>立即返回</a>";
-    html += "</body></html>";
-    server.send(200, "text/html; charset=UTF-8", html);
-  } else {
-    Serial.printf("错误: 文件删除失败 %s\n", filePath.c_str());
-    Serial.flush();
-    
-    String html = "<!DOCTYPE html><html><head>";
-    html += "<meta charset='UTF-8'>";
-    html += "<meta http-equiv='refresh' content='2;url=/photos'>";
-    html += "<title>删除失败</title>";
-    html += "<style>body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }";
-    html += ".error { color: #f44336; }</style></head><body>";
-    html += "<h1 class='error'>❌ 删除失败</h1>";
-    html += "<p>无法删除文件: " + filePath + "</p>";
-    html += "<p>可能原因：文件被占用或SD卡错误</p>";
-    html += "<p>2秒后自动返回照片列表...</p>";
-    html += "<a href='/photos'>立即返回</a>";
-    html += "</body></html>";
-    server.send(500, "text/html; charset=UTF-8", html);
-  }
-}
-
-// URL编码函数
-String urlEncode(String str) {
-  String encoded = "";
-  char c;
-  for (int i = 0; i < str.length(); i++) {
-    c = str.charAt(i);
-    if (c == ' ') {
-      encoded += "%20";
-    } else if (c == '+') {
-      encoded += "%2B";
-    } else if (c == '/') {
-      encoded += "%2F";
-    } else if (c == '?') {
-      encoded += "%3F";
-    } else if (c == '%') {
-      encoded += "%25";
-    } else if (c == '#') {
-      encoded += "%23";
-    } else if (c == '&') {
-      encoded += "%26";
-    } else if (c == '=') {
-      encoded += "%3D";
-    } else {
-      encoded += c;
-    }
-  }
-  return encoded;
-}
-
-// URL解码函数
-String urlDecode(String str) {
-  String decoded = "";
-  char c;
-  char code0, code1;
-  for (int i = 0; i < str.length(); i++) {
-    c = str.charAt(i);
-    if (c == '+') {
-      decoded += ' ';
-    } else if (c == '%') {
-      if (i + 2 < str.length()) {
-        code0 = str.charAt(i + 1);
-        code1 = str.charAt(i + 2);
-        if (isDigit(code0) && isDigit(code1)) {
-          c = (code0 - '0') * 16 + (code1 - '0');
-          decoded += c;
-          i += 2;
-        } else {
-          decoded += c;
-        }
-      } else {
-        decoded += c;
-      }
-    } else {
-      decoded += c;
+  uploadState.pending++;
+  uploadSaveState();
+}
+
+// 照片是否已经上传（未配置上传地址时所有照片都视为已处理，可被自动清理）
+bool uploadIsDone(const String& path) {
+  if (upload_url.length() == 0) {
+    return true;
+  }
+  // 按文件名（时间戳）比较，与所在目录无关
+  String name = path.substring(path.lastIndexOf('/') + 1);
+  String last = String(uploadState.lastUploaded);
+  last = last.substring(last.lastIndexOf('/') + 1);
+  return last.length() > 0 && name <= last;
+}
+
+// 解析上传地址 http://host[:port]/prefix
+bool uploadParseUrl(String& host, uint16_t& port, String& prefix) {
+  if (!upload_url.startsWith("http://")) {
+    LOGE("上传地址只支持http://: %s", upload_url.c_str());
+    return false;
+  }
+  String rest = upload_url.substring(7);
+  int slash = rest.indexOf('/');
+  String hostPort = slash >= 0 ? rest.substring(0, slash) : rest;
+  prefix = slash >= 0 ? rest.substring(slash) : String("");
+  while (prefix.endsWith("/")) {
+    prefix = prefix.substring(0, prefix.length() - 1);
+  }
+  int colon = hostPort.indexOf(':');
+  host = colon >= 0 ? hostPort.substring(0, colon) : hostPort;
+  port = colon >= 0 ? hostPort.substring(colon + 1).toInt() : 80;
+  return host.length() > 0 && port > 0;
+}
+
+// 读取HTTP响应，返回状态码（失败返回-1）；读完响应体以便复用连接
+int uploadReadResponse(WiFiClient& client, bool& keepAlive) {
+  client.setTimeout(5000);
+  String status = client.readStringUntil('\n');
+  if (!status.startsWith("HTTP/1.")) {
+    return -1;
+  }
+  int code = status.substring(9, 12).toInt();
+  size_t contentLength = 0;
+  keepAlive = status.startsWith("HTTP/1.1");
+  while (true) {
+    String line = client.readStringUntil('\n');
+    line.trim();
+    if (line.length() == 0) {
+      break;
+    }
+    line.toLowerCase();
+    if (line.startsWith("content-length:")) {
+      contentLength = line.substring(15).toInt();
+    } else if (line.startsWith("connection:") && line.indexOf("close") >= 0) {
+      keepAlive = false;
     }
   }
-  return decoded;
+  while (contentLength > 0 && client.connected()) {
+    if (client.read() < 0) {
+      delay(1);
+      continue;
+    }
+    contentLength--;
+  }
+  return code;
 }
 
-// 查看/下载单个照片
-void handlePhoto() {
-  if (!server.hasArg("file")) {
-    server.send(400, "text/plain", "缺少file参数");
-    return;
+// PUT一张完整的照片；返回是否成功，sent返回本次发送的字节数
+bool uploadPutFile(WiFiClient& client, const String& host, uint16_t port, const String& prefix,
+                   const String& path, size_t& sent) {
+  sent = 0;
+  File file;
+  {
+    SdLock lock;
+    file = SD_MMC.open(path.c_str(), FILE_READ);
   }
-  
-  // URL解码文件路径
-  String filePath = urlDecode(server.arg("file"));
-  
-  // 确保路径以 / 开头
-  if (!filePath.startsWith("/")) {
-    filePath = "/" + filePath;
+  if (!file) {
+    LOGW("上传队列中的照片已不存在，跳过: %s", path.c_str());
+    return true;
   }
-  
-  // 安全检查
-  if (filePath.indexOf("..") >= 0 || !filePath.endsWith(".jpg")) {
-    server.send(400, "text/plain", "无效的文件路径: " + filePath);
-    Serial.printf("无效文件路径: %s\n", filePath.c_str());
+  size_t fileSize = file.size();
+
+  if (!client.connected()) {
+    client.stop();
+    if (!client.connect(host.c_str(), port)) {
+      LOGW("无法连接上传服务器 %s:%u", host.c_str(), port);
+      SdLock lock;
+      file.close();
+      return false;
+    }
+    client.setNoDelay(true);
+  }
+
+  String header = "PUT " + prefix + path + " HTTP/1.1\r\n";
+  header += "Host: " + host + "\r\n";
+  header += "Content-Type: image/jpeg\r\n";
+  header += "Content-Length: " + String(fileSize) + "\r\n";
+  header += "Connection: keep-alive\r\n\r\n";
+  client.print(header);
+
+  // 只在读每一块时持有SD卡锁（上传在访问窗口内进行，服务器任务可能同时在删除、写日志或清理）
+  uint8_t buffer[1460];
+  while (true) {
+    size_t bytesRead;
+    {
+      SdLock lock;
+      bytesRead = file.read(buffer, sizeof(buffer));
+    }
+    if (bytesRead == 0 || client.write(buffer, bytesRead) != bytesRead) {
+      break;
+    }
+    sent += bytesRead;
+  }
+  {
+    SdLock lock;
+    file.close();
+  }
+
+  if (sent < fileSize) {
+    // 发送中断，断开连接让服务器丢弃不完整的请求，下次整张重传
+    client.stop();
+    return false;
+  }
+
+  bool keepAlive = false;
+  int code = uploadReadResponse(client, keepAlive);
+  if (!keepAlive) {
+    client.stop();
+  }
+  if (code < 200 || code >= 300) {
+    LOGW("上传失败 %s: HTTP %d", path.c_str(), code);
+    return false;
+  }
+  return true;
+}
+
+// 在时间预算内上传队列中的照片
+void uploadPending(unsigned long budgetMs) {
+  struct PowerSaveOff {
+    PowerSaveOff() { webPowerSave(false); }
+    ~PowerSaveOff() { webPowerSave(true); }
+  } powerSaveOff;  // 上传期间射频全速
+  if (upload_url.length() == 0 || !sdReady || WiFi.status() != WL_CONNECTED) {
     return;
   }
-  
-  Serial.printf("尝试打开文件: %s\n", filePath.c_str());
-  Serial.flush();
-  
-  // 尝试打开文件
-  File file = SD_MMC.open(filePath.c_str(), FILE_READ);
-  if (!file) {
-    Serial.printf("错误: 无法打开文件 %s\n", filePath.c_str());
-    Serial.flush();
-    server.send(404, "text/plain", "文件未找到: " + filePath);
+  if (uploadSkipWakes > 0) {
+    uploadSkipWakes--;
+    LOGI("上传退避中，本次唤醒跳过（剩余 %lu 次）", uploadSkipWakes);
     return;
   }
-  
-  if (file.isDirectory()) {
-    file.close();
-    Serial.printf("错误: 路径是目录而不是文件: %s\n", filePath.c_str());
-    Serial.flush();
-    server.send(400, "text/plain", "路径是目录: " + filePath);
+  String host, prefix;
+  uint16_t port;
+  if (!uploadParseUrl(host, port, prefix)) {
     return;
   }
-  
-  size_t fileSize = file.size();
-  Serial.printf("文件大小: %zu 字节\n", fileSize);
-  Serial.flush();
-  
-  // 检查是否是下载请求
-  if (server.hasArg("download") && server.arg("download") == "1") {
-    String fileName = filePath.substring(filePath.lastIndexOf("/") + 1);
-    
-    // 设置响应头
-    server.setContentLength(fileSize);
-    server.sendHeader("Content-Type", "image/jpeg", true);
-    server.sendHeader("Content-Disposition", "attachment; filename=\"" + fileName + "\"", true);
-    server.sendHeader("Connection", "close", true);
-    server.send(200, "image/jpeg", "");
-    
-    // 分块传输文件（每次4KB，ESP32-CAM内存有限）
-    const size_t chunkSize = 4096;
-    uint8_t* buffer = (uint8_t*)malloc(chunkSize);
-    if (!buffer) {
-      file.close();
-      Serial.println("错误: 内存分配失败");
-      Serial.flush();
-      return;
-    }
-    
-    size_t remaining = fileSize;
-    size_t totalSent = 0;
-    
-    while (remaining > 0 && file.available()) {
-      size_t toRead = (remaining > chunkSize) ? chunkSize : remaining;
-      size_t bytesRead = file.read(buffer, toRead);
-      
-      if (bytesRead > 0) {
-        size_t bytesSent = server.client().write(buffer, bytesRead);
-        if (bytesSent != bytesRead) {
-          Serial.printf("警告: 只发送了 %zu/%zu 字节\n", bytesSent, bytesRead);
-          Serial.flush();
-        }
-        totalSent += bytesSent;
-        remaining -= bytesRead;
-      } else {
-        Serial.println("错误: 无法从文件读取数据");
-        Serial.flush();
+
+  unsigned long start = millis();
+  size_t totalBytes = 0;
+  uint32_t uploaded = 0;
+  int retries = 0;
+  bool failed = false;
+  WiFiClient client;
+
+  while (uploadState.pending > 0 && millis() - start < budgetMs && totalBytes < UPLOAD_MAX_BYTES_PER_WAKE) {
+    // 读取队列中的下一条记录
+    String path;
+    {
+      SdLock lock;
+      File queue = SD_MMC.open(UPLOAD_QUEUE_FILE, FILE_READ);
+      if (!queue || !queue.seek(uploadState.queueOffset)) {
+        if (queue) queue.close();
+        uploadState.pending = 0;
         break;
       }
-      
-      // 每传输一定数据后刷新
-      if (totalSent % (chunkSize * 4) == 0) {
-        server.client().flush();
-        delay(10);
-      }
+      path = queue.readStringUntil('\n');
+      queue.close();
     }
-    
-    free(buffer);
-    file.close();
-    server.client().flush();
-    Serial.printf("文件下载完成，已发送 %zu 字节\n", totalSent);
-    Serial.flush();
+    path.trim();
+    if (path.length() == 0) {
+      uploadState.pending = 0;
+      break;
+    }
+
+    size_t sent = 0;
+    bool ok = uploadPutFile(client, host, port, prefix, path, sent);
+    totalBytes += sent;
+    if (ok) {
+      uploadState.queueOffset += path.length() + 1;
+      uploadState.pending--;
+      strncpy(uploadState.lastUploaded, path.c_str(), sizeof(uploadState.lastUploaded) - 1);
+      uploadState.lastUploaded[sizeof(uploadState.lastUploaded) - 1] = '\0';
+      uploaded++;
+      retries = 0;
+    } else if (++retries >= UPLOAD_MAX_RETRIES) {
+      failed = true;
+      break;
+    } else {
+      delay(500 << retries);  // 本次唤醒内的重试退避：1s、2s
+    }
+    uploadSaveState();
+  }
+  client.stop();
+
+  // 队列已全部上传时清空队列文件，避免无限增长
+  if (uploadState.pending == 0 && uploadState.queueOffset > 0) {
+    SdLock lock;
+    SD_MMC.remove(UPLOAD_QUEUE_FILE);
+    uploadState.queueOffset = 0;
+  }
+  uploadSaveState();
+
+  if (failed) {
+    uploadFailStreak++;
+    uploadSkipWakes = min((uint32_t)UPLOAD_MAX_SKIP_WAKES, (uint32_t)1 << min(uploadFailStreak, (uint32_t)5));
+    LOGW("上传连续失败，接下来 %lu 次唤醒跳过上传", uploadSkipWakes);
+  } else {
+    uploadFailStreak = 0;
+  }
+
+  unsigned long elapsed = millis() - start;
+  LOGI("上传完成: %lu 张, %u 字节, 耗时 %lu ms, 吞吐 %.1f KB/s, 队列剩余 %lu 张",
+       uploaded, totalBytes, elapsed, elapsed > 0 ? totalBytes / 1.024 / elapsed : 0.0, uploadState.pending);
+}
+
+// ==================== MQTT事件 ====================
+// 进入睡眠前把本次唤醒的结果（拍摄时间、大小、画质、写卡耗时、重试、剩余空间、信号、电压、唤醒原因）
+// 组成一行JSON追加到SD卡上的事件队列；WiFi已连接时用一个MQTT 3.1.1会话把队列中的事件以QoS 1
+// 分批发布到 主题前缀/设备ID/event，收到PUBACK才推进队列读取位置。离线或发布失败的事件下次联网时补发，
+// 可能重复发布，订阅方按seq去重。服务器地址格式：mqtt://主机[:端口]/主题前缀（不支持用户名密码和TLS）。
+
+// 读取事件队列状态（SD卡挂载后调用一次）
+void mqttLoadState() {
+  SdLock lock;
+  File file = SD_MMC.open(MQTT_STATE_FILE, FILE_READ);
+  if (file && file.size() == sizeof(MqttState)) {
+    file.read((uint8_t*)&mqttState, sizeof(MqttState));
+  }
+  if (file) file.close();
+  mqttSeq = std::max(mqttSeq, mqttState.seq);
+}
+
+void mqttSaveState() {
+  mqttState.seq = mqttSeq;
+  SdLock lock;
+  File file = SD_MMC.open(MQTT_STATE_FILE, FILE_WRITE);
+  if (!file) {
+    SD_MMC.mkdir(MQTT_DIR);
+    file = SD_MMC.open(MQTT_STATE_FILE, FILE_WRITE);
+    if (!file) {
+      LOGE("无法保存MQTT事件状态");
+      return;
+    }
+  }
+  file.write((const uint8_t*)&mqttState, sizeof(MqttState));
+  file.close();
+}
+
+// 记录本次唤醒的拍摄结果（定时拍摄有多个区域时只记录第一张）
+void mqttRecordCapture(bool ok, uint32_t bytes, uint16_t width, uint16_t height, unsigned long captureMs, unsigned long writeMs, uint8_t retries) {
+  if (mqttCapture.attempted) {
     return;
   }
-  
-  // 检查是否是缩略图请求
-  if (server.hasArg("thumb") && server.arg("thumb") == "1") {
-    // 设置响应头
-    server.setContentLength(fileSize);
-    server.sendHeader("Content-Type", "image/jpeg", true);
-    server.sendHeader("Cache-Control", "public, max-age=3600", true);
-    server.sendHeader("Connection", "close", true);
-    server.send(200, "image/jpeg", "");
-    
-    // 分块传输文件（每次4KB）
-    const size_t chunkSize = 4096;
-    uint8_t* buffer = (uint8_t*)malloc(chunkSize);
-    if (!buffer) {
-      file.close();
-      Serial.println("错误: 内存分配失败");
-      Serial.flush();
+  sensor_t* s = esp_camera_sensor_get();
+  mqttCapture.attempted = true;
+  mqttCapture.ok = ok;
+  mqttCapture.bytes = bytes;
+  mqttCapture.width = width;
+  mqttCapture.height = height;
+  mqttCapture.quality = s ? s->status.quality : 0;
+  mqttCapture.retries = retries;
+  mqttCapture.captureMs = (uint16_t)std::min(captureMs, 65535UL);
+  mqttCapture.writeMs = (uint16_t)std::min(writeMs, 65535UL);
+}
+
+// 唤醒原因
+const char* mqttWakeReason() {
+  switch (esp_sleep_get_wakeup_cause()) {
+    case ESP_SLEEP_WAKEUP_UNDEFINED: return "boot";
+    case ESP_SLEEP_WAKEUP_TIMER: return "timer";
+    case ESP_SLEEP_WAKEUP_EXT0: return "trigger";
+    default: return "other";
+  }
+}
+
+// 生成本次唤醒的事件（一行JSON，不含换行）
+String mqttBuildEvent() {
+  char json[320];
+  int n = snprintf(json, sizeof(json), "{\"seq\":%lu,\"t\":%ld,\"reason\":\"%s\",\"awake_ms\":%lu",
+                   (unsigned long)mqttSeq, (long)time(NULL), mqttWakeReason(), millis());
+  if (mqttCapture.attempted) {
+    n += snprintf(json + n, sizeof(json) - n,
+                  ",\"ok\":%s,\"bytes\":%lu,\"w\":%u,\"h\":%u,\"q\":%u,\"capture_ms\":%u,\"write_ms\":%u,\"retries\":%u",
+                  mqttCapture.ok ? "true" : "false", (unsigned long)mqttCapture.bytes, mqttCapture.width,
+                  mqttCapture.height, mqttCapture.quality, mqttCapture.captureMs, mqttCapture.writeMs,
+                  mqttCapture.retries);
+  }
+  if (sdReady) {
+    n += snprintf(json + n, sizeof(json) - n, ",\"free_mb\":%lu",
+                  (unsigned long)((SD_MMC.totalBytes() - SD_MMC.usedBytes()) / (1024 * 1024)));
+  }
+  if (WiFi.status() == WL_CONNECTED) {
+    n += snprintf(json + n, sizeof(json) - n, ",\"rssi\":%d", WiFi.RSSI());
+  }
+  if (batteryMv > 0) {
+    n += snprintf(json + n, sizeof(json) - n, ",\"batt_mv\":%lu", (unsigned long)batteryMv);
+  }
+  snprintf(json + n, sizeof(json) - n, "}");
+  mqttSeq++;
+  return String(json);
+}
+
+// 加入事件队列
+void mqttEnqueue(const String& event) {
+  SdLock lock;
+  File file = SD_MMC.open(MQTT_QUEUE_FILE, FILE_APPEND);
+  if (!file) {
+    SD_MMC.mkdir(MQTT_DIR);
+    file = SD_MMC.open(MQTT_QUEUE_FILE, FILE_APPEND);
+    if (!file) {
+      LOGE("无法写入MQTT事件队列");
       return;
     }
-    
-    size_t remaining = fileSize;
-    size_t totalSent = 0;
-    
-    while (remaining > 0 && file.available()) {
-      size_t toRead = (remaining > chunkSize) ? chunkSize : remaining;
-      size_t bytesRead = file.read(buffer, toRead);
-      
-      if (bytesRead > 0) {
-        size_t bytesSent = server.client().write(buffer, bytesRead);
-        if (bytesSent != bytesRead) {
-          Serial.printf("警告: 只发送了 %zu/%zu 字节\n", bytesSent, bytesRead);
-          Serial.flush();
-        }
-        totalSent += bytesSent;
-        remaining -= bytesRead;
-      } else {
-        Serial.println("错误: 无法从文件读取数据");
-        Serial.flush();
-        break;
-      }
-      
-      // 每传输一定数据后刷新
-      if (totalSent % (chunkSize * 4) == 0) {
-        server.client().flush();
-        delay(10);
-      }
+  }
+  file.print(event + "\n");
+  file.close();
+  mqttState.pending++;
+  mqttSaveState();
+}
+
+// 解析服务器地址 mqtt://host[:port]/prefix
+bool mqttParseUrl(String& host, uint16_t& port, String& prefix) {
+  if (!mqtt_url.startsWith("mqtt://")) {
+    LOGE("MQTT服务器地址只支持mqtt://: %s", mqtt_url.c_str());
+    return false;
+  }
+  String rest = mqtt_url.substring(7);
+  int slash = rest.indexOf('/');
+  String hostPort = slash >= 0 ? rest.substring(0, slash) : rest;
+  prefix = slash >= 0 ? rest.substring(slash + 1) : String("");
+  while (prefix.endsWith("/")) {
+    prefix = prefix.substring(0, prefix.length() - 1);
+  }
+  int colon = hostPort.indexOf(':');
+  host = colon >= 0 ? hostPort.substring(0, colon) : hostPort;
+  port = colon >= 0 ? hostPort.substring(colon + 1).toInt() : MQTT_DEFAULT_PORT;
+  return host.length() > 0 && port > 0;
+}
+
+// mqtt_util.h 使用的网络操作
+struct WiFiMqttIo {
+  WiFiClient& client;
+  size_t write(const uint8_t* data, size_t len) { return client.write(data, len); }
+  int read() { return client.read(); }
+  bool connected() { return client.connected(); }
+  unsigned long ms() { return millis(); }
+  void idle() { delay(1); }
+  void warn(const char* msg) { LOGW("%s", msg); }
+};
+
+// 连接服务器并完成CONNECT/CONNACK（clean session，事件的重发由SD卡上的队列负责）
+bool mqttConnect(WiFiClient& client, const String& host, uint16_t port, const String& clientId) {
+  if (!client.connect(host.c_str(), port, MQTT_TIMEOUT_MS)) {
+    LOGW("无法连接MQTT服务器 %s:%u", host.c_str(), port);
+    return false;
+  }
+  client.setNoDelay(true);  // 每批报文一次写出，不等Nagle合并
+
+  WiFiMqttIo io = {client};
+  int code = mqttHandshake(io, clientId.c_str(), MQTT_KEEPALIVE_S, MQTT_TIMEOUT_MS);
+  if (code != 0) {
+    LOGW("MQTT连接失败（%s）", code > 0 ? ("服务器拒绝，返回码 " + String(code)).c_str() : "没有收到CONNACK");
+    return false;
+  }
+  return true;
+}
+
+// 把一批事件以QoS 1连续发布，再等齐PUBACK；返回按顺序确认的条数（之后的下次重发）
+uint32_t mqttPublishBatch(WiFiClient& client, const String& topic, const String* events, uint32_t count, uint16_t& packetId) {
+  IoBuffer out;
+  if (!out.data()) {
+    return 0;
+  }
+  WiFiMqttIo io = {client};
+  uint16_t firstId = packetId;
+  count = mqttSendBatch(io, out.data(), out.size(), topic.c_str(), events, count, packetId);
+  out.release();  // 等待确认期间不占用发送缓冲区
+  return count > 0 ? mqttAwaitAcks(io, firstId, count, MQTT_TIMEOUT_MS) : 0;
+}
+
+// 唤醒结束前调用：生成本次唤醒的事件，联网时发布队列中的事件（在断开WiFi之前）
+void mqttWakeEnd() {
+  if (mqtt_url.length() == 0) {
+    return;
+  }
+  unsigned long start = millis();
+  String event = mqttBuildEvent();
+  if (sdReady) {
+    mqttEnqueue(event);
+  }
+  bool online = WiFi.status() == WL_CONNECTED;
+  String host, prefix;
+  uint16_t port;
+  if (!online || !mqttParseUrl(host, port, prefix)) {
+    mqttLastAwakeMs = millis() - start;
+    if (sdReady) {
+      LOGI("MQTT事件已加入队列，待发布 %lu 条", mqttState.pending);
     }
-    
-    free(buffer);
-    file.close();
-    server.client().flush();
-    Serial.printf("缩略图传输完成，已发送 %zu 字节\n", totalSent);
-    Serial.flush();
     return;
   }
-  
-  // 查看照片页面（返回完整图片，而不是HTML页面）
-  // 设置响应头
-  server.setContentLength(fileSize);
-  server.sendHeader("Content-Type", "image/jpeg", true);
-  server.sendHeader("Cache-Control", "public, max-age=3600", true);
-  server.sendHeader("Connection", "close", true);
-  server.send(200, "image/jpeg", "");
-  
-  // 分块传输文件（每次4KB）
-  const size_t chunkSize = 4096;
-  uint8_t* buffer = (uint8_t*)malloc(chunkSize);
-  if (!buffer) {
-    file.close();
-    Serial.println("错误: 内存分配失败");
-    Serial.flush();
+  esp_wifi_set_ps(WIFI_PS_NONE);  // 马上就要关闭射频，发布期间不再省电，减少等待PUBACK的延迟
+
+  String deviceId = WiFi.macAddress();
+  deviceId.replace(":", "");
+  deviceId.toLowerCase();
+  String topic = (prefix.length() > 0 ? prefix + "/" : String("")) + deviceId + "/event";
+
+  WiFiClient client;
+  unsigned long connectStart = millis();
+  if (!mqttConnect(client, host, port, "esp32cam-" + deviceId)) {
+    client.stop();
+    mqttLastAwakeMs = millis() - start;
     return;
   }
-  
-  size_t remaining = fileSize;
-  size_t totalSent = 0;
-  
-  while (remaining > 0 && file.available()) {
-    size_t toRead = (remaining > chunkSize) ? chunkSize : remaining;
-    size_t bytesRead = file.read(buffer, toRead);
-    
-    if (bytesRead > 0) {
-      size_t bytesSent = server.client().write(buffer, bytesRead);
-      if (bytesSent != bytesRead) {
-        Serial.printf("警告: 只发送了 %zu/%zu 字节\n", bytesSent, bytesRead);
-        Serial.flush();
+  mqttLastConnectMs = millis() - connectStart;
+
+  unsigned long publishStart = millis();
+  uint16_t packetId = 1;
+  uint32_t sent = 0;
+  if (!sdReady) {
+    // SD卡不可用：只能直接发布本次的事件
+    sent = mqttPublishBatch(client, topic, &event, 1, packetId);
+  }
+  while (sdReady && mqttState.pending > 0 && millis() - publishStart < MQTT_BUDGET_MS) {
+    // 读取队列中的下一批事件
+    String batch[MQTT_BATCH];
+    uint32_t lineBytes[MQTT_BATCH];
+    uint32_t count = 0;
+    {
+      SdLock lock;
+      File queue = SD_MMC.open(MQTT_QUEUE_FILE, FILE_READ);
+      if (!queue || !queue.seek(mqttState.queueOffset)) {
+        if (queue) queue.close();
+        mqttState.pending = 0;
+        break;
       }
-      totalSent += bytesSent;
-      remaining -= bytesRead;
-    } else {
-      Serial.println("错误: 无法从文件读取数据");
-      Serial.flush();
+      while (count < MQTT_BATCH && count < mqttState.pending) {
+        String line = queue.readStringUntil('\n');
+        lineBytes[count] = line.length() + 1;
+        line.trim();
+        if (line.length() == 0) {
+          break;
+        }
+        batch[count++] = line;
+      }
+      queue.close();
+    }
+    if (count == 0) {
+      mqttState.pending = 0;
       break;
     }
-    
-    // 每传输一定数据后刷新
-    if (totalSent % (chunkSize * 4) == 0) {
-      server.client().flush();
-      delay(10);
+
+    uint32_t acked = mqttPublishBatch(client, topic, batch, count, packetId);
+    for (uint32_t i = 0; i < acked; i++) {
+      mqttState.queueOffset += lineBytes[i];
+    }
+    mqttState.pending -= acked;
+    sent += acked;
+    if (acked < count) {
+      LOGW("MQTT发布中断：本批 %lu 条只确认了 %lu 条", count, acked);
+      break;
     }
   }
-  
-  free(buffer);
-  file.close();
-  server.client().flush();
-  Serial.printf("照片传输完成，已发送 %zu 字节\n", totalSent);
-  Serial.flush();
-}
+  mqttLastPublishMs = millis() - publishStart;
 
-// 404处理
-void handleNotFound() {
-  server.send(404, "text/plain", "页面未找到");
-}
+  const uint8_t disconnect[] = {0xE0, 0x00};
+  client.write(disconnect, sizeof(disconnect));
+  client.stop();
 
-bool syncTime() {
-  Serial.println("正在同步NTP时间...");
-  configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
-  
-  struct tm timeinfo;
-  int attempts = 0;
-  while (!getLocalTime(&timeinfo) && attempts < 10) {
-    Serial.println("等待时间同步...");
-    delay(1000);
-    attempts++;
+  if (sdReady) {
+    // 队列已全部发布时清空队列文件，避免无限增长
+    if (mqttState.pending == 0 && mqttState.queueOffset > 0) {
+      SdLock lock;
+      SD_MMC.remove(MQTT_QUEUE_FILE);
+      mqttState.queueOffset = 0;
+    }
+    mqttSaveState();
   }
 
-  if (getLocalTime(&timeinfo)) {
-    Serial.println("时间同步成功");
-    Serial.print("当前时间: ");
-    Serial.println(&timeinfo, "%Y-%m-%d %H:%M:%S");
-    return true;
+  mqttLastSent = sent;
+  mqttLastAwakeMs = millis() - start;
+  LOGI("MQTT: 发布 %lu 条事件，连接 %lu ms，发布 %lu ms，唤醒延长 %lu ms，队列剩余 %lu 条",
+       sent, mqttLastConnectMs, mqttLastPublishMs, mqttLastAwakeMs, mqttState.pending);
+}
+
+// ==================== Web窗口省电 ====================
+// 访问窗口内Web服务器在独立任务中等待请求，主任务只是等待：射频用DTIM省电模式，
+// CPU空闲时自动浅睡眠，收到数据包时由WiFi唤醒。上传时关闭射频省电以保证吞吐。
+
+bool webPmConfigured = false;
+unsigned long webWindowStart = 0;
+unsigned long webPsOffStart = 0;   // 射频省电关闭的起始时间（0表示当前处于省电模式）
+unsigned long webPsOffMs = 0;      // 窗口内关闭射频省电的总时间
+
+// 开启自动浅睡眠（只需调用一次；固件未启用电源管理时只使用射频省电）
+void webPmInit() {
+  if (webPmConfigured) {
+    return;
+  }
+  webPmConfigured = true;
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "camera", &cameraPmLock);
+  esp_pm_config_esp32_t pm;
+  pm.max_freq_mhz = getCpuFrequencyMhz();
+  pm.min_freq_mhz = WEB_WINDOW_CPU_MIN_MHZ;
+  pm.light_sleep_enable = true;
+  esp_err_t err = esp_pm_configure(&pm);
+  if (err == ESP_OK) {
+    LOGI("已开启自动浅睡眠（%d-%d MHz）", pm.min_freq_mhz, pm.max_freq_mhz);
   } else {
-    Serial.println("时间同步失败");
-    return false;
+    LOGI("固件不支持自动浅睡眠（%s），只使用射频省电", esp_err_to_name(err));
   }
 }
 
-String getTimeString() {
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) {
-    return "unknown";
+// 切换射频省电（上传等需要吞吐量的操作前关闭）
+void webPowerSave(bool enable) {
+  if (enable && webPsOffStart != 0) {
+    webPsOffMs += millis() - webPsOffStart;
+    webPsOffStart = 0;
+  } else if (!enable && webPsOffStart == 0) {
+    webPsOffStart = millis();
   }
+  esp_wifi_set_ps(enable ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE);
+}
 
-  char timeStr[20];
-  strftime(timeStr, sizeof(timeStr), "%Y_%m_%d_%H_%M", &timeinfo);  // 使用下划线替代冒号
-  return String(timeStr);
+void webWindowBegin() {
+  webPmInit();
+  heapSample(true);
+  server.resetStats();
+  streamServer.resetStats();
+  webWindowStart = millis();
+  webPsOffStart = 0;
+  webPsOffMs = 0;
+  webPowerSave(true);
 }
 
-// 获取ISO周数（1-53）
-// ISO 8601标准：每年第一周是包含1月4日的那一周
-int getWeekNumber(struct tm* timeinfo) {
-  int year = timeinfo->tm_year + 1900;
-  int month = timeinfo->tm_mon + 1;
-  int day = timeinfo->tm_mday;
-  
-  // 简化的周数计算：从1月1日开始的周数
-  // 更准确的方法需要计算1月1日是星期几，这里使用简化版本
-  int dayOfYear = timeinfo->tm_yday;
-  int week = (dayOfYear / 7) + 1;
-  
-  // 确保周数在合理范围内
-  if (week < 1) week = 1;
-  if (week > 53) week = 53;
-  
-  return week;
+// 窗口结束：报告请求数、处理延迟和射频开启时间估计
+// 射频开启时间 = 处理请求和关闭省电的时间 + 其余空闲时间 × 省电模式下的估计占空比
+void webWindowEnd(const char* name) {
+  webPowerSave(true);
+  uint32_t windowMs = millis() - webWindowStart;
+  HttpServer::Stats a = server.stats();
+  HttpServer::Stats b = streamServer.stats();
+  uint32_t requests = a.requests + b.requests;
+  uint32_t busyMs = (a.busyUs + b.busyUs) / 1000 + webPsOffMs;
+  uint32_t idleMs = windowMs > busyMs ? windowMs - busyMs : 0;
+  uint32_t radioOnMs = std::min(windowMs, busyMs + idleMs * WIFI_PS_IDLE_DUTY_PERCENT / 100);
+
+  webLastWindowMs = windowMs;
+  webLastRequests = requests;
+  webLastAvgLatencyUs = requests > 0 ? (a.busyUs + b.busyUs) / requests : 0;
+  webLastMaxLatencyUs = std::max(a.maxUs, b.maxUs);
+  webLastRadioOnMs = radioOnMs;
+  LOGI("访问窗口[%s] %lu ms：请求 %lu 个，平均处理 %.1f ms，最长 %.1f ms，估计射频开启 %lu ms（%.0f%%）",
+       name, windowMs, requests, webLastAvgLatencyUs / 1000.0, webLastMaxLatencyUs / 1000.0,
+       radioOnMs, windowMs > 0 ? radioOnMs * 100.0 / windowMs : 0.0);
 }
 
-// 获取周目录名称，格式：YYYY_WXX
-String getWeekDirectory() {
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) {
-    return "/unknown";
+// ==================== 外部触发 ====================
+// PIR/门磁触发的唤醒只做一件事：尽快拍一张照片存到SD卡，然后按原定的定时节奏睡眠。
+// 照片照常加入上传队列和同步记录，下次联网的定时唤醒再上传。
+
+// 处理触发唤醒；返回false表示临近定时拍摄，由调用者继续正常流程
+bool triggerWakeRun() {
+  triggerEvents++;
+  triggerWakeActive = true;
+  int64_t now = timeNowUs();
+
+  if (triggerLastUs != 0 && now - triggerLastUs < (int64_t)TRIGGER_MIN_INTERVAL_S * 1000000LL) {
+    triggerSuppressed++;
+    LOGI("触发间隔不足 %d 秒，本次不拍摄（累计 %lu 次）", TRIGGER_MIN_INTERVAL_S, triggerSuppressed);
+    goToSleep();
+    return true;
+  }
+  if (timelapseNextUs != 0 && timelapseNextUs - now < (int64_t)TRIGGER_MERGE_WINDOW_S * 1000000LL) {
+    triggerMerged++;
+    triggerWakeActive = false;
+    LOGI("触发临近定时拍摄，并入本次定时拍摄");
+    return false;
   }
 
-  int year = timeinfo.tm_year + 1900;
-  int week = getWeekNumber(&timeinfo);
-  
-  char dirName[20];
-  snprintf(dirName, sizeof(dirName), "/%d_W%02d", year, week);
-  return String(dirName);
-}
+  // 相机最先初始化，拿到第一帧后再处理时间和SD卡
+  wakePhaseBegin(WAKE_PHASE_CAMERA);
+  unsigned long cameraStart = millis();
+  if (!initCamera()) {
+    LOGE("相机初始化失败！");
+    goToSleep();
+    return true;
+  }
+  wakePhaseBegin(WAKE_PHASE_CAPTURE);
+  camera_fb_t* fb;
+  uint8_t roi;
+  unsigned long grabStart;
+  {
+    CameraLock cameraLock;
+    cameraUseRoi(TRIGGER_ROI);
+    roi = cameraRoiId;
+    grabStart = millis();
+    fb = esp_camera_fb_get();
+  }
+  unsigned long frameMs = millis();
+  if (!fb) {
+    LOGE("触发拍摄失败！");
+    mqttRecordCapture(false, 0, 0, 0, frameMs - grabStart, 0, 0);
+    goToSleep();
+    return true;
+  }
+  triggerLastUs = now;
+  // millis() 从应用启动开始计时，不含芯片唤醒和引导程序的时间（约200ms）
+  LOGI("触发拍摄：唤醒后 %lu ms 获得第一帧（相机初始化 %lu ms），%zu 字节",
+       frameMs, frameMs - cameraStart, fb->len);
 
-// 确保目录存在，如果不存在则创建
-// 使用SD_MMC库的mkdir()方法直接创建目录
-bool ensureDirectoryExists(const char* dirPath) {
-  // 等待SD卡稳定
-  delay(200);
-  
-  // 先检查目录是否已存在
-  File dir = SD_MMC.open(dirPath);
-  if (dir && dir.isDirectory()) {
-    dir.close();
-    Serial.printf("目录已存在: %s\n", dirPath);
+  timeApplyZone();
+  timeApplyDriftCorrection();
+  if (time(NULL) < TIME_VALID_AFTER) {
+    timeSkippedCaptures++;
+    LOGE("RTC时间无效，触发照片无法命名，已丢弃");
+    esp_camera_fb_return(fb);
+    goToSleep();
     return true;
   }
-  if (dir) dir.close();
-  
-  // 目录不存在，使用mkdir()创建目录
-  Serial.printf("正在创建目录: %s\n", dirPath);
-  Serial.flush();
-  
-  // 尝试创建目录（最多重试3次）
-  for (int i = 0; i < 3; i++) {
-    if (SD_MMC.mkdir(dirPath)) {
-      delay(200);  // 等待文件系统更新
-      
-      // 验证目录是否创建成功
-      File verify = SD_MMC.open(dirPath);
-      if (verify && verify.isDirectory()) {
-        verify.close();
-        Serial.printf("目录创建成功: %s\n", dirPath);
-        return true;
-      }
-      if (verify) verify.close();
-    }
-    
-    if (i < 2) {
-      Serial.printf("目录创建失败，重试中 (%d/3)...\n", i + 2);
-      Serial.flush();
-      delay(500);  // 重试前等待
+
+  wakePhaseBegin(WAKE_PHASE_SD);
+  if (initSDCard()) {
+    SdLock lock;
+    String weekDir = getWeekDirectory();
+    String filename = (ensureDirectoryExists(weekDir.c_str()) ? weekDir : String("")) + "/" + getEventTimeString() + ".jpg";
+    uint32_t crc = 0;
+    unsigned long writeStart = millis();
+    bool saved = journalWriteFrame(filename, fb->buf, fb->len, crc);
+    mqttRecordCapture(saved, fb->len, fb->width, fb->height, frameMs - grabStart, millis() - writeStart, 0);
+    if (saved) {
+      journalFinish(filename, fb->len, crc);
+      roiRecord(roi, fb->len, frameMs - grabStart, millis() - writeStart);
+      triggerCaptures++;
+      LOGI("触发照片已保存: %s（唤醒后 %lu ms，累计 %lu 张）", filename.c_str(), millis(), triggerCaptures);
+    } else {
+      LOGE("触发照片保存失败: %s", filename.c_str());
     }
   }
-  
-  // 如果创建失败，返回false，让程序回退到根目录
-  Serial.printf("目录创建失败: %s，将使用根目录\n", dirPath);
-  return false;
+  esp_camera_fb_return(fb);
+  goToSleep();
+  return true;
 }
 
-void captureAndSavePhoto() {
-  Serial.println("正在拍摄照片...");
-  Serial.flush();
-  
-  // 打开闪光灯
-  pinMode(LED_GPIO_NUM, OUTPUT);
-  digitalWrite(LED_GPIO_NUM, HIGH);
-  Serial.println("闪光灯已打开");
-  delay(100);  // 等待闪光灯稳定
-  
-  // 拍照
-  camera_fb_t *fb = esp_camera_fb_get();
-  
-  // 关闭闪光灯
-  digitalWrite(LED_GPIO_NUM, LOW);
-  Serial.println("闪光灯已关闭");
-  if (!fb) {
-    Serial.println("拍照失败！");
-    Serial.flush();
+// 睡眠前启用触发唤醒（触发输入仍处于有效电平时不启用，否则会立即再次唤醒）
+void triggerArm() {
+  if (!TRIGGER_ENABLE) {
+    return;
+  }
+  pinMode(TRIGGER_GPIO_NUM, INPUT);
+  if (digitalRead(TRIGGER_GPIO_NUM) == TRIGGER_ACTIVE_LEVEL) {
+    LOGI("触发输入仍有效，本次睡眠只使用定时唤醒");
     return;
   }
+  if (TRIGGER_ACTIVE_LEVEL) {
+    rtc_gpio_pullup_dis(TRIGGER_GPIO_NUM);
+    rtc_gpio_pulldown_en(TRIGGER_GPIO_NUM);
+  } else {
+    rtc_gpio_pulldown_dis(TRIGGER_GPIO_NUM);
+    rtc_gpio_pullup_en(TRIGGER_GPIO_NUM);
+  }
+  esp_sleep_enable_ext0_wakeup(TRIGGER_GPIO_NUM, TRIGGER_ACTIVE_LEVEL);
+}
 
-  Serial.printf("照片大小: %zu 字节 (%.2f KB)\n", fb->len, fb->len / 1024.0);
-  Serial.flush();
+// ==================== 能量管理 ====================
+// 每次唤醒的耗电 = Σ 阶段实测用时 × 阶段估计电流；按指数滑动平均得到定时唤醒的平均耗电，
+// 再结合电池电压等级决定本次唤醒的策略。决策 energyDecide() 在 src/energy_util.h 中，tools/energy/energy_sim.cpp 用模拟的电池电压测试它。
 
-  // 获取周目录和时间字符串（在释放相机资源前获取，避免时间变化）
-  Serial.println("正在获取周目录和时间...");
-  Serial.flush();
-  String weekDir = getWeekDirectory();
-  String timeString = getTimeString();
-  Serial.printf("周目录: %s, 时间: %s\n", weekDir.c_str(), timeString.c_str());
-  Serial.flush();
+// 电量正常时的策略，即拍摄配置本身
+EnergyPolicy energyBasePolicy(const CaptureProfile& c) {
+  EnergyPolicy p = {ENERGY_NORMAL, c.intervalS, c.webWindowMs, c.flash != 0, true, c.frameSize};
+  return p;
+}
 
-  // 将照片数据复制到PSRAM缓冲区（如果可用），避免相机和SD卡资源冲突
-  Serial.println("正在复制照片数据...");
-  Serial.flush();
-  uint8_t* imageBuffer = NULL;
-  size_t imageSize = fb->len;
-  bool usePSRAM = false;
-  
-  Serial.println("检查PSRAM...");
-  Serial.flush();
-  
-  // 简化策略：直接使用原始缓冲区，不复制到PSRAM
-  // 这样可以避免PSRAM分配可能导致的卡顿
-  // 在写入SD卡时，相机资源会被占用，但写入完成后会立即释放
-  Serial.println("使用原始缓冲区（不复制到PSRAM）");
-  Serial.flush();
-  imageBuffer = fb->buf;
-  usePSRAM = false;
-  
-  // 注意：不在这里释放相机帧缓冲区，等写入完成后再释放
-  // 这样可以避免资源冲突
+// 测量电池电压（取多次平均）并决定本次唤醒的策略
+void energyUpdate() {
+  if (!ENERGY_ENABLE) {
+    return;
+  }
+  uint32_t sum = 0;
+  for (int i = 0; i < 16; i++) {
+    sum += analogReadMilliVolts(BATTERY_ADC_GPIO_NUM);
+  }
+  batteryMv = (uint32_t)(sum / 16 * BATTERY_DIVIDER_RATIO);
 
-  // 增加延迟，确保相机资源完全释放
-  Serial.println("等待系统稳定...");
-  Serial.flush();
-  delay(1000);  // 增加延迟到1秒，让系统完全稳定
+  energyPolicy = energyDecide(energyBasePolicy(captureProfile), batteryMv, energyLevel, energyWakeMah);
+  if (energyPolicy.level != energyLevel) {
+    LOGW("电量等级: %s -> %s", energyLevelNames[energyLevel], energyLevelNames[energyPolicy.level]);
+  }
+  energyLevel = energyPolicy.level;
+  LOGI("电池 %lu mV（%s），间隔 %lu 秒，访问窗口 %lu 秒，闪光灯%s，预计每日 %.0f/%d mAh",
+       batteryMv, energyLevelNames[energyLevel], energyPolicy.intervalS, energyPolicy.webWindowMs / 1000,
+       energyPolicy.flash ? "开" : "关", energyDailyMah(energyPolicy, energyWakeMah), ENERGY_DAILY_BUDGET_MAH);
+}
 
-  // 保存到SD卡
-  Serial.println("开始写入SD卡...");
-  Serial.flush();
-  
-  // 尝试重新初始化SD卡连接，避免资源冲突
-  Serial.println("重新初始化SD卡连接...");
-  Serial.flush();
-  SD_MMC.end();
-  delay(500);
-  if (!SD_MMC.begin()) {
-    Serial.println("警告：SD卡重新初始化失败，继续尝试写入...");
-    Serial.flush();
+// 睡眠前累计本次唤醒的耗电（触发唤醒不计入定时唤醒的平均值）
+void energyRecordWake() {
+  float mah = 0;
+  for (int i = 0; i < WAKE_PHASE_COUNT; i++) {
+    mah += wakePhaseMs[i] * wakePhaseCurrentMa[i] / 3600000.0f;
   }
-  delay(1000);  // 等待SD卡完全准备好
-  
-  // 尝试创建周目录
-  Serial.printf("尝试创建周目录: %s\n", weekDir.c_str());
-  Serial.flush();
-  bool dirCreated = ensureDirectoryExists(weekDir.c_str());
-  
-  // 根据目录创建结果决定使用哪个路径
-  String filename;
-  if (dirCreated) {
-    filename = weekDir + "/" + timeString + ".jpg";
-    Serial.printf("使用周目录路径: %s\n", filename.c_str());
-  } else {
-    filename = "/" + timeString + ".jpg";
-    Serial.printf("目录创建失败，使用根目录路径: %s\n", filename.c_str());
+  if (!triggerWakeActive) {
+    energyWakeMah = energyWakeMah > 0 ? energyWakeMah * 0.8f + mah * 0.2f : mah;
   }
-  Serial.flush();
-  
-  // 重试机制：最多尝试3次
-  bool writeSuccess = false;
-  size_t totalWritten = 0;
-  int retryCount = 0;
-  const int maxRetries = 3;
-  const size_t chunkSize = 4096;  // 每次写入4KB，避免一次性写入大文件
-  
-  bool fallbackToRoot = false;  // 标记是否已回退到根目录
-  
-  while (!writeSuccess && retryCount < maxRetries) {
-    if (retryCount > 0) {
-      Serial.printf("重试写入 (第 %d 次)...\n", retryCount);
-      delay(1000);  // 重试前等待更长时间
-    }
-    
-    Serial.printf("尝试打开文件进行写入 (尝试 %d/%d)...\n", retryCount + 1, maxRetries);
-    Serial.flush();
-    delay(200);  // 打开文件前短暂延迟
-    
-    File file = SD_MMC.open(filename.c_str(), FILE_WRITE);
-    if (!file) {
-      // 如果使用周目录失败，且是第一次尝试，回退到根目录
-      if (retryCount == 0 && !fallbackToRoot && filename.startsWith("/2026_W")) {
-        Serial.printf("周目录路径写入失败（目录可能不存在或FAT32不支持自动创建）\n");
-        Serial.printf("自动回退到根目录...\n");
-        Serial.flush();
-        filename = "/" + timeString + ".jpg";
-        Serial.printf("新路径: %s\n", filename.c_str());
-        Serial.flush();
-        fallbackToRoot = true;
-        delay(500);
-        continue;  // 重试使用根目录，不增加retryCount
-      }
-      
-      Serial.printf("错误：无法创建文件 %s\n", filename.c_str());
-      retryCount++;
-      if (retryCount >= maxRetries) {
-        Serial.println("可能的原因：");
-        Serial.println("1. 文件名包含非法字符");
-        Serial.println("2. SD卡空间不足");
-        Serial.println("3. SD卡文件系统错误");
-        Serial.flush();
-        // 释放资源
-        if (fb) {
-          esp_camera_fb_return(fb);
-        }
-        return;
-      }
-      delay(2000);  // 重试前等待更长时间
-      continue;
-    }
+  LOGI("本次唤醒估计耗电 %.2f mAh（定时唤醒平均 %.2f mAh）", mah, energyWakeMah);
+}
 
-    // 分块写入数据，避免一次性写入大文件
-    totalWritten = 0;
-    size_t remaining = imageSize;
-    
-    while (remaining > 0) {
-      size_t toWrite = (remaining > chunkSize) ? chunkSize : remaining;
-      size_t written = file.write(imageBuffer + totalWritten, toWrite);
-      
-      if (written == 0) {
-        Serial.printf("写入中断在位置: %zu\n", totalWritten);
-        break;
-      }
-      
-      totalWritten += written;
-      remaining -= written;
-      
-      // 每写入一块后刷新，确保数据及时写入
-      if (totalWritten % (chunkSize * 4) == 0) {
-        file.flush();
-        delay(10);  // 短暂延迟，让SD卡处理
-      }
-    }
-    
-    // 最终刷新
-    file.flush();
-    delay(50);  // 等待刷新完成
-    
-    // 检查是否写入完整
-    if (totalWritten == imageSize) {
-      writeSuccess = true;
-    }
-    
-    file.close();
-    delay(100);  // 关闭文件后等待
-    
-    if (writeSuccess) {
-      Serial.printf("照片保存成功！文件大小: %zu 字节\n", totalWritten);
-      break;
-    } else {
-      Serial.printf("警告：写入不完整！期望: %zu, 实际: %zu\n", imageSize, totalWritten);
-      retryCount++;
+// ==================== 唤醒监督 ====================
+// 每个阶段开始时调用 wakePhaseBegin()，结束时与预算比较并记录；整次唤醒的截止时间交给任务看门狗，
+// 主任务在截止时间内没有进入睡眠就会被复位，复位后 wakeSupervisorRecover() 记录卡住的阶段并直接睡眠。
+
+// 唤醒统计的校验和（RTC内存中的内容是否是本程序写入的）
+uint32_t wakeStateChecksum() {
+  return esp_rom_crc32_le(0, (const uint8_t*)&wakeState, offsetof(WakeState, checksum));
+}
+
+// 修改唤醒统计后调用
+void wakeStateSave() {
+  wakeState.magic = WAKE_STATE_MAGIC;
+  wakeState.checksum = wakeStateChecksum();
+}
+
+// 启动时检查唤醒统计，上电（内容随机）或被破坏时清零
+void wakeStateLoad() {
+  if (wakeState.magic != WAKE_STATE_MAGIC || wakeState.checksum != wakeStateChecksum() ||
+      wakeState.phase >= WAKE_PHASE_COUNT || wakeState.overrunPhase >= WAKE_PHASE_COUNT) {
+    memset(&wakeState, 0, sizeof(wakeState));
+    wakeStateSave();
+  }
+}
+
+// 阶段的时间预算：Web窗口包括访问窗口本身（另加闪光灯、启动服务器和睡眠前窗口），上传在访问窗口内进行，最长接近整个窗口
+uint32_t wakePhaseBudget(uint8_t phase) {
+  if (phase == WAKE_PHASE_WEB) {
+    return wakePhaseBudgetMs[phase] + energyPolicy.webWindowMs;
+  }
+  if (phase == WAKE_PHASE_UPLOAD) {
+    return std::max(wakePhaseBudgetMs[phase], energyPolicy.webWindowMs);
+  }
+  return wakePhaseBudgetMs[phase];
+}
+
+// 定时唤醒的截止时间：各阶段预算之和（上传与访问窗口重叠，配置模式和首次访问窗口另设截止时间，都不计入）加余量
+uint32_t wakeDeadlineMs() {
+  uint32_t ms = WAKE_DEADLINE_MARGIN_MS;
+  for (int i = WAKE_PHASE_BOOT; i < WAKE_PHASE_COUNT; i++) {
+    if (i != WAKE_PHASE_UPLOAD && i != WAKE_PHASE_CONFIG && i != WAKE_PHASE_FIRST_WINDOW) {
+      ms += wakePhaseBudget(i);
     }
   }
-  
-  if (!writeSuccess) {
-    Serial.println("错误：多次尝试后仍无法保存文件！");
+  return ms;
+}
+
+// 设置（或延长）整次唤醒的截止时间：看门狗超时后复位
+void wakeSetDeadline(uint32_t deadlineMs) {
+  esp_task_wdt_init((deadlineMs + 999) / 1000, true);
+  esp_task_wdt_reset();
+}
+
+void wakeSupervisorBegin(uint32_t deadlineMs) {
+  wakeSetDeadline(deadlineMs);
+  esp_task_wdt_add(NULL);  // 只监视主任务，主任务从不喂狗，超时即整次唤醒超时
+  if (wakeState.overrunPhase != WAKE_PHASE_NONE) {
+    LOGI("上次唤醒 %lu ms（最长 %lu ms），超预算 %lu 次，最近超预算阶段: %s，看门狗复位 %lu 次",
+         wakeState.lastMs, wakeState.maxMs, wakeState.overruns, wakePhaseNames[wakeState.overrunPhase],
+         wakeState.watchdogResets);
   }
-  
-  // 释放相机帧缓冲区（写入完成后释放）
-  if (fb) {
-    esp_camera_fb_return(fb);
-    Serial.println("相机帧缓冲区已释放");
+  wakeState.phase = WAKE_PHASE_BOOT;
+  wakeStateSave();
+  wakePhaseStart = millis();
+}
+
+// 结束当前阶段（检查是否超预算）并开始下一个阶段
+void wakePhaseBegin(WakePhase phase) {
+  unsigned long now = millis();
+  uint8_t current = wakeState.phase;
+  if (current < WAKE_PHASE_COUNT) {
+    wakePhaseMs[current] += now - wakePhaseStart;
   }
-  
-  Serial.flush();
+  if (current < WAKE_PHASE_COUNT && wakePhaseBudgetMs[current] > 0) {
+    uint32_t elapsed = now - wakePhaseStart;
+    uint32_t budget = wakePhaseBudget(current);
+    if (elapsed > budget) {
+      LOGW("唤醒阶段超预算: %s 用时 %lu ms（预算 %lu ms）", wakePhaseNames[current], elapsed, budget);
+      wakeState.overrunPhase = current;
+      wakeState.overruns++;
+    }
+  }
+  wakeState.phase = phase;
+  wakeStateSave();
+  wakePhaseStart = now;
+}
+
+// 进入深度睡眠前调用：记录本次唤醒时长
+void wakeSupervisorEnd() {
+  wakePhaseBegin(WAKE_PHASE_NONE);
+  wakeState.lastMs = millis();
+  wakeState.maxMs = std::max(wakeState.maxMs, wakeState.lastMs);
+  wakeStateSave();
+  LOGI("本次唤醒 %lu ms", wakeState.lastMs);
+  energyRecordWake();
+}
+
+// 启动时检查上次唤醒是否被看门狗复位（或崩溃）；是则记录卡住的阶段，返回true表示应直接睡眠
+bool wakeSupervisorRecover() {
+  wakeStateLoad();
+  esp_reset_reason_t reason = esp_reset_reason();
+  if ((reason != ESP_RST_TASK_WDT && reason != ESP_RST_PANIC) || wakeState.phase == WAKE_PHASE_NONE) {
+    return false;
+  }
+  uint8_t phase = wakeState.phase;
+  LOGE("上次唤醒在阶段 \"%s\" %s，跳过本次拍摄直接睡眠",
+       wakePhaseNames[phase], reason == ESP_RST_TASK_WDT ? "超过截止时间被看门狗复位" : "崩溃");
+  wakeState.overrunPhase = phase;
+  wakeState.overruns++;
+  wakeState.watchdogResets++;
+  wakeState.phase = WAKE_PHASE_SLEEP;
+  wakeStateSave();
+  wakePhaseStart = millis();
+  return true;
 }
 
 // 闪光灯闪烁函数
@@ -1471,37 +6080,47 @@ void flashLED(int times, int duration) {
       delay(duration);
     }
   }
-  Serial.printf("闪光灯闪烁 %d 次完成\n", times);
-  Serial.flush();
+  LOGD("闪光灯闪烁 %d 次完成", times);
 }
 
 void goToSleep() {
-  Serial.println("准备进入深度睡眠...");
-  Serial.flush();
+  LOGI("准备进入深度睡眠...");
+
+  // 断开WiFi前发布本次唤醒的事件（离线时只加入队列）
+  wakePhaseBegin(WAKE_PHASE_MQTT);
+  mqttWakeEnd();
+  wakePhaseBegin(WAKE_PHASE_SLEEP);
   
   // 断开Wi-Fi以节省功耗
   WiFi.disconnect(true);
   WiFi.mode(WIFI_OFF);
-  Serial.println("WiFi已断开");
-  Serial.flush();
-  
-  // 关闭SD卡
-  SD_MMC.end();
-  Serial.println("SD卡已关闭");
-  Serial.flush();
+  LOGD("WiFi已断开");
   
-  // 关闭相机
+  // 关闭相机（先让预览流退出）
+  previewStopRequested = true;
+  CameraLock cameraLock;
   esp_camera_deinit();
-  Serial.println("相机已关闭");
-  Serial.flush();
+  LOGD("相机已关闭");
   
-  delay(200);
-  Serial.println("进入深度睡眠10分钟，10分钟后自动唤醒...");
-  Serial.flush();
-  delay(500);  // 确保所有输出都发送完毕
+  LOGI("进入深度睡眠10分钟，10分钟后自动唤醒...");
+  logPrintStats();
+  wakeSupervisorEnd();
+  
+  // 等待日志队列输出完毕，并把剩余日志写入SD卡后再关闭SD卡
+  logFlush(2000);
+  logPersist();
+  sdReady = false;
+  SD_MMC.end();
   
-  // 进入深度睡眠
-  esp_sleep_enable_timer_wakeup(SLEEP_DURATION_US);
+  // 进入深度睡眠：定时唤醒保持原有节奏（触发拍摄的唤醒不改变下次定时拍摄的时间）
+  int64_t now = timeNowUs();
+  int64_t intervalUs = (int64_t)energyPolicy.intervalS * 1000000LL;
+  if (!triggerWakeActive || timelapseNextUs == 0 || timelapseNextUs - now > intervalUs) {
+    timelapseNextUs = now + intervalUs;
+  }
+  uint64_t sleepUs = std::max(timelapseNextUs - now, (int64_t)1000000);
+  esp_sleep_enable_timer_wakeup(sleepUs);
+  triggerArm();
   esp_deep_sleep_start();
 }
 
@@ -0,0 +1,162 @@
+// MQTT 3.1.1 报文的编码和收发：CONNECT/CONNACK、QoS 1的PUBLISH批量发送和PUBACK确认（固件和电脑上的MQTT测试共用）
+//
+// 不依赖Arduino。网络操作由模板参数 io 提供（固件中是WiFiClient，测试中是本机的TCP连接），io 需要提供：
+//   size_t write(const uint8_t* data, size_t len)   发送，返回发送的字节数
+//   int read()                                      读一个字节，暂时没有数据时返回-1
+//   bool connected()                                连接是否仍然有效
+//   unsigned long ms()                              毫秒时钟（millis()）
+//   void idle()                                     等待数据时让出CPU（delay(1)）
+//   void warn(const char* msg)                      记录警告
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define MQTT_CLIENT_ID_MAX 23  // MQTT 3.1.1 服务器必须接受的最长客户端ID
+
+// 写入MQTT剩余长度（变长编码），返回字节数
+inline size_t mqttPutLength(uint8_t* p, size_t length) {
+  size_t n = 0;
+  do {
+    uint8_t b = length & 0x7F;
+    length >>= 7;
+    p[n++] = length > 0 ? (b | 0x80) : b;
+  } while (length > 0);
+  return n;
+}
+
+// 下一个报文ID（跳过0，0不是有效的报文ID）
+inline uint16_t mqttNextPacketId(uint16_t id) {
+  return id == 0xFFFF ? 1 : id + 1;
+}
+
+// 读取一个报文（只用于CONNACK/PUBACK这样的短报文，超过cap的部分丢弃），返回报文类型，超时或连接断开返回-1
+template <class Io>
+int mqttReadPacketFrom(Io& io, uint8_t* body, size_t cap, size_t& len, unsigned long deadline) {
+  auto readByte = [&]() -> int {
+    while ((long)(io.ms() - deadline) < 0) {
+      int c = io.read();
+      if (c >= 0) {
+        return c;
+      }
+      if (!io.connected()) {
+        return -1;
+      }
+      io.idle();
+    }
+    return -1;
+  };
+  int header = readByte();
+  if (header < 0) {
+    return -1;
+  }
+  size_t remaining = 0;
+  for (int shift = 0; ; shift += 7) {
+    int c = readByte();
+    if (c < 0 || shift > 21) {
+      return -1;
+    }
+    remaining |= (size_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      break;
+    }
+  }
+  len = 0;
+  for (size_t i = 0; i < remaining; i++) {
+    int c = readByte();
+    if (c < 0) {
+      return -1;
+    }
+    if (len < cap) {
+      body[len++] = c;
+    }
+  }
+  return header >> 4;
+}
+
+// 发送CONNECT（clean session，没有用户名密码）并等待CONNACK；返回CONNACK的返回码（0=接受），没有收到CONNACK时返回-1
+template <class Io>
+int mqttHandshake(Io& io, const char* clientId, uint16_t keepAliveS, unsigned long timeoutMs) {
+  uint8_t packet[16 + MQTT_CLIENT_ID_MAX];
+  size_t idLen = strlen(clientId);
+  idLen = idLen < MQTT_CLIENT_ID_MAX ? idLen : MQTT_CLIENT_ID_MAX;
+  const uint8_t header[] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, (uint8_t)(keepAliveS >> 8), (uint8_t)keepAliveS};
+  size_t n = 0;
+  packet[n++] = 0x10;
+  n += mqttPutLength(packet + n, sizeof(header) + 2 + idLen);
+  memcpy(packet + n, header, sizeof(header));
+  n += sizeof(header);
+  packet[n++] = idLen >> 8;
+  packet[n++] = idLen & 0xFF;
+  memcpy(packet + n, clientId, idLen);
+  n += idLen;
+  if (io.write(packet, n) != n) {
+    return -1;
+  }
+
+  uint8_t body[4];
+  size_t len = 0;
+  int type = mqttReadPacketFrom(io, body, sizeof(body), len, io.ms() + timeoutMs);
+  return type == 2 && len >= 2 ? body[1] : -1;
+}
+
+// 把一批事件（需要有 c_str() 和 length()）以QoS 1连续发布：在buf中拼好报文，写满一次发送一次。
+// 报文ID从packetId开始（返回时已推进到下一个）；返回发送的条数，写入失败时返回0。过长放不进buf的事件及之后的不发送
+template <class Io, class Str>
+uint32_t mqttSendBatch(Io& io, uint8_t* buf, size_t bufSize, const char* topic, const Str* events, uint32_t count,
+                       uint16_t& packetId) {
+  size_t topicLen = strlen(topic);
+  size_t used = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    size_t remaining = 2 + topicLen + 2 + events[i].length();
+    if (remaining + 5 > bufSize) {
+      io.warn("MQTT事件过长，跳过");
+      count = i;
+      break;
+    }
+    if (used + remaining + 5 > bufSize) {
+      if (io.write(buf, used) != used) {
+        return 0;
+      }
+      used = 0;
+    }
+    uint8_t* p = buf + used;
+    size_t n = 0;
+    p[n++] = 0x32;  // PUBLISH，QoS 1
+    n += mqttPutLength(p + n, remaining);
+    p[n++] = topicLen >> 8;
+    p[n++] = topicLen & 0xFF;
+    memcpy(p + n, topic, topicLen);
+    n += topicLen;
+    p[n++] = packetId >> 8;
+    p[n++] = packetId & 0xFF;
+    memcpy(p + n, events[i].c_str(), events[i].length());
+    n += events[i].length();
+    used += n;
+    packetId = mqttNextPacketId(packetId);
+  }
+  if (used > 0 && io.write(buf, used) != used) {
+    return 0;
+  }
+  return count;
+}
+
+// 等待从firstId开始的count条PUBACK。服务器按发送顺序确认；出现乱序或超时时只认之前已确认的部分，返回按顺序确认的条数
+template <class Io>
+uint32_t mqttAwaitAcks(Io& io, uint16_t firstId, uint32_t count, unsigned long timeoutMs) {
+  uint16_t expected = firstId;
+  unsigned long deadline = io.ms() + timeoutMs;
+  uint32_t acked = 0;
+  while (acked < count) {
+    uint8_t body[2];
+    size_t len = 0;
+    int type = mqttReadPacketFrom(io, body, sizeof(body), len, deadline);
+    if (type != 4 || len < 2 || (uint16_t)((body[0] << 8) | body[1]) != expected) {
+      break;
+    }
+    acked++;
+    expected = mqttNextPacketId(expected);
+  }
+  return acked;
+}
@@ -0,0 +1,89 @@
+// NTP报文的构造和校验、偏移计算和时钟漂移估计（固件的时间同步和电脑上的NTP测试共用）
+//
+// 时间都以Unix纪元以来的微秒表示；不依赖Arduino，也不访问网络和系统时钟。
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define NTP_PACKET_SIZE 48
+#define NTP_UNIX_EPOCH 2208988800ULL  // 1900年到1970年的秒数（NTP时间从1900年开始）
+
+inline uint64_t ntpFromUs(int64_t us) {
+  uint64_t sec = (uint64_t)(us / 1000000) + NTP_UNIX_EPOCH;
+  uint64_t frac = ((uint64_t)(us % 1000000) << 32) / 1000000;
+  return (sec << 32) | frac;
+}
+
+inline int64_t ntpToUs(uint64_t ntp) {
+  int64_t sec = (int64_t)(ntp >> 32) - (int64_t)NTP_UNIX_EPOCH;
+  return sec * 1000000LL + (int64_t)(((ntp & 0xFFFFFFFFULL) * 1000000) >> 32);
+}
+
+inline uint64_t ntpRead(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+inline void ntpWrite(uint8_t* p, uint64_t v) {
+  for (int i = 7; i >= 0; i--) {
+    p[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+// 构造客户端请求（packet为NTP_PACKET_SIZE字节），返回写入的发送时间戳，用于匹配回复
+inline uint64_t ntpBuildRequest(uint8_t* packet, int64_t nowUs) {
+  memset(packet, 0, NTP_PACKET_SIZE);
+  packet[0] = 0x23;  // LI=0, VN=4, Mode=3（客户端）
+  uint64_t sent = ntpFromUs(nowUs);
+  ntpWrite(packet + 40, sent);
+  return sent;
+}
+
+// 校验回复并计算时钟偏移和往返时间：只接受服务器模式、已同步（层级1-15）且回应的正是发送时间为sent的请求。
+// t4是收到回复时的本地时间；offsetUs为正表示本地时钟偏慢
+inline bool ntpParseReply(const uint8_t* packet, size_t len, uint64_t sent, int64_t t4, int64_t& offsetUs,
+                          int64_t& rttUs) {
+  if (len < NTP_PACKET_SIZE || (packet[0] & 0x07) != 4 || packet[1] == 0 || packet[1] > 15 ||
+      sent == 0 || ntpRead(packet + 24) != sent) {
+    return false;
+  }
+  int64_t t1 = ntpToUs(sent);
+  int64_t t2 = ntpToUs(ntpRead(packet + 32));
+  int64_t t3 = ntpToUs(ntpRead(packet + 40));
+  offsetUs = ((t2 - t1) + (t3 - t4)) / 2;
+  rttUs = (t4 - t1) - (t3 - t2);
+  return true;
+}
+
+// 同步成功后更新漂移估计：offsetUs是按旧估计校正后的剩余误差，与上次同步相隔足够久（1分钟）时才更新。
+// t1是发送请求时的本地时间，lastSyncUs为0或t1早于validAfterUs（时钟未设置）时不更新
+inline void timeDriftUpdate(float& driftPpm, float& residualPpm, int64_t lastSyncUs, int64_t t1, int64_t t4,
+                            int64_t offsetUs, int64_t validAfterUs) {
+  int64_t interval = t4 - lastSyncUs;
+  if (lastSyncUs == 0 || t1 < validAfterUs || interval <= 60 * 1000000LL) {
+    return;
+  }
+  float residual = offsetUs * 1e6f / interval;
+  driftPpm = fminf(fmaxf(driftPpm + residual, -100000.0f), 100000.0f);
+  residualPpm = fmaxf(fabsf(residual), 1.0f);
+}
+
+// 上次按漂移校正以来应补偿的时间（微秒）
+inline int64_t timeDriftCorrectionUs(float driftPpm, int64_t lastCorrectUs, int64_t nowUs) {
+  if (lastCorrectUs == 0 || driftPpm == 0) {
+    return 0;
+  }
+  return (int64_t)(driftPpm * (nowUs - lastCorrectUs) / 1e6);
+}
+
+// 按剩余误差估计的当前时间误差（毫秒）
+inline float timeEstimatedErrorMs(float residualPpm, int64_t lastSyncUs, int64_t nowUs) {
+  return residualPpm * (nowUs - lastSyncUs) / 1e9f;
+}
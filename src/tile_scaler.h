@@ -0,0 +1,68 @@
+// 缩略图墙的格子缩放：JPEG解码器按块送来的RGB888像素累加到格子中对应的目标像素，最后取平均输出RGB565
+// （固件和电脑上的缩放测试共用）
+//
+// 只处理内存中的像素，不依赖Arduino和解码器；内存与照片分辨率无关（约35KB）。
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#define CONTACT_SHEET_TILE_W 80
+#define CONTACT_SHEET_TILE_H 60
+
+// 每个目标像素最多累加255个源像素（uint16_t的和不会溢出），更多的源像素被忽略；1/8比例解码时每格约6个
+struct TileScaler {
+  uint16_t srcW, srcH;
+  uint16_t sum[CONTACT_SHEET_TILE_W * CONTACT_SHEET_TILE_H * 3];
+  uint8_t count[CONTACT_SHEET_TILE_W * CONTACT_SHEET_TILE_H];
+};
+
+// 开始缩放一张srcW x srcH的图像（解码后的尺寸）
+inline void tileScalerBegin(TileScaler& t, uint16_t srcW, uint16_t srcH) {
+  t.srcW = srcW;
+  t.srcH = srcH;
+  memset(t.sum, 0, sizeof(t.sum));
+  memset(t.count, 0, sizeof(t.count));
+}
+
+// 累加一块RGB888像素（x, y为块在解码图像中的位置）
+inline void tileScalerAdd(TileScaler& t, uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t* rgb) {
+  if (t.srcW == 0 || t.srcH == 0) {
+    return;
+  }
+  for (uint16_t j = 0; j < h; j++) {
+    uint32_t ty = (uint32_t)(y + j) * CONTACT_SHEET_TILE_H / t.srcH;
+    if (ty >= CONTACT_SHEET_TILE_H) {
+      break;
+    }
+    for (uint16_t i = 0; i < w; i++) {
+      uint32_t tx = (uint32_t)(x + i) * CONTACT_SHEET_TILE_W / t.srcW;
+      if (tx >= CONTACT_SHEET_TILE_W) {
+        break;
+      }
+      uint32_t d = ty * CONTACT_SHEET_TILE_W + tx;
+      if (t.count[d] == 255) {
+        continue;
+      }
+      const uint8_t* p = rgb + ((uint32_t)j * w + i) * 3;
+      t.sum[d * 3] += p[0];
+      t.sum[d * 3 + 1] += p[1];
+      t.sum[d * 3 + 2] += p[2];
+      t.count[d]++;
+    }
+  }
+}
+
+// 取平均并输出大端RGB565（与相机RGB565帧的字节顺序相同）
+inline void tileScalerFinish(const TileScaler& t, uint8_t* out) {
+  for (uint32_t d = 0; d < CONTACT_SHEET_TILE_W * CONTACT_SHEET_TILE_H; d++) {
+    uint8_t r = 0, g = 0, b = 0;
+    if (t.count[d] > 0) {
+      r = t.sum[d * 3] / t.count[d];
+      g = t.sum[d * 3 + 1] / t.count[d];
+      b = t.sum[d * 3 + 2] / t.count[d];
+    }
+    out[d * 2] = (r & 0xF8) | (g >> 5);
+    out[d * 2 + 1] = ((g << 3) & 0xE0) | (b >> 3);
+  }
+}
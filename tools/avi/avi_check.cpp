@@ -0,0 +1,177 @@
+// ESP32-CAM 延时视频（MJPEG AVI）校验工具
+//
+// 检查设备生成的AVI文件结构：RIFF/LIST长度、帧数与movi中的帧是否一致、
+// 每帧是否是完整的JPEG（FFD8开头、FFD9结尾）、idx1索引（如果已收尾）是否指向正确的帧。
+// 未收尾的文件（当天还在追加）没有idx1，只要文件头与帧数据一致就是有效的。
+//
+// 用法: avi_check <文件.avi> [...]
+// 全部有效时返回0
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static uint32_t le32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool fourcc(const uint8_t* p, const char* id) {
+  return memcmp(p, id, 4) == 0;
+}
+
+struct Frame {
+  uint64_t offset;  // 帧数据块（'00dc'）在文件中的位置
+  uint32_t size;
+};
+
+// 校验一个文件，打印结果；有效时返回true
+static bool checkFile(const std::string& path) {
+  std::vector<std::string> errors;
+  auto fail = [&](const std::string& msg) {
+    printf("%s: 无效 - %s\n", path.c_str(), msg.c_str());
+    return false;
+  };
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return fail("无法打开文件");
+  }
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+  if (data.size() < 224 || !fourcc(&data[0], "RIFF") || !fourcc(&data[8], "AVI ")) {
+    return fail("不是AVI文件");
+  }
+  // 位置用64位计算：长度字段可能是任意的32位值（损坏的文件），与位置相加不能溢出
+  uint64_t riffEnd = (uint64_t)le32(&data[4]) + 8;
+  if (riffEnd > data.size()) {
+    return fail("RIFF长度超出文件大小");
+  }
+  if (!fourcc(&data[12], "LIST") || !fourcc(&data[20], "hdrl") || !fourcc(&data[24], "avih")) {
+    return fail("缺少hdrl/avih");
+  }
+  const uint8_t* avih = &data[32];
+  uint32_t usPerFrame = le32(avih);
+  uint32_t flags = le32(avih + 12);
+  uint32_t totalFrames = le32(avih + 16);
+  uint32_t width = le32(avih + 32);
+  uint32_t height = le32(avih + 36);
+  uint64_t hdrlEnd = 20 + (uint64_t)le32(&data[16]);
+  if (hdrlEnd + 12 > riffEnd) {
+    return fail("hdrl长度错误");
+  }
+
+  // strh中的帧数（流长度）
+  uint32_t strhLength = 0;
+  bool haveStrh = false;
+  for (uint64_t p = 88; p + 8 <= hdrlEnd; ) {
+    if (fourcc(&data[p], "LIST")) {
+      p += 12;
+      continue;
+    }
+    uint32_t size = le32(&data[p + 4]);
+    if (size > hdrlEnd - p - 8) {
+      errors.push_back("hdrl中的块超出hdrl");
+      break;
+    }
+    if (fourcc(&data[p], "strh") && p + 8 + 36 <= data.size()) {
+      if (!fourcc(&data[p + 8], "vids") || !fourcc(&data[p + 12], "MJPG")) {
+        errors.push_back("视频流不是MJPG");
+      }
+      strhLength = le32(&data[p + 8 + 32]);
+      haveStrh = true;
+    }
+    p += 8 + size + (size & 1);
+  }
+  if (!haveStrh) {
+    errors.push_back("缺少strh");
+  }
+
+  if (!fourcc(&data[hdrlEnd], "LIST") || !fourcc(&data[hdrlEnd + 8], "movi")) {
+    return fail("缺少movi");
+  }
+  uint64_t moviStart = hdrlEnd + 8;  // 'movi' 标记的位置，idx1偏移的基准
+  uint64_t moviEnd = moviStart + le32(&data[hdrlEnd + 4]);
+  if (moviEnd > riffEnd) {
+    return fail("movi长度超出RIFF");
+  }
+
+  std::vector<Frame> frames;
+  for (uint64_t p = moviStart + 4; p < moviEnd; ) {
+    if (p + 8 > moviEnd) {
+      errors.push_back("movi末尾有不完整的块");
+      break;
+    }
+    uint32_t size = le32(&data[p + 4]);
+    if (size > moviEnd - p - 8) {
+      errors.push_back("第 " + std::to_string(frames.size() + 1) + " 帧超出movi");
+      break;
+    }
+    if (fourcc(&data[p], "00dc")) {
+      const uint8_t* jpeg = &data[p + 8];
+      if (size < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8 || jpeg[size - 2] != 0xFF || jpeg[size - 1] != 0xD9) {
+        errors.push_back("第 " + std::to_string(frames.size() + 1) + " 帧不是完整的JPEG");
+      }
+      frames.push_back({p, size});
+    }
+    p += 8 + size + (size & 1);
+  }
+  if (frames.size() != totalFrames) {
+    errors.push_back("avih帧数 " + std::to_string(totalFrames) + " 与实际帧数 " + std::to_string(frames.size()) + " 不一致");
+  }
+  if (haveStrh && strhLength != totalFrames) {
+    errors.push_back("strh长度 " + std::to_string(strhLength) + " 与帧数不一致");
+  }
+
+  // idx1（已收尾的文件）
+  bool indexed = false;
+  if (moviEnd + 8 <= riffEnd && fourcc(&data[moviEnd], "idx1")) {
+    indexed = true;
+    uint32_t size = le32(&data[moviEnd + 4]);
+    uint32_t count = size / 16;
+    if (size > riffEnd - moviEnd - 8 || count != frames.size()) {
+      errors.push_back("idx1条目数 " + std::to_string(count) + " 与帧数不一致");
+    } else {
+      for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* e = &data[moviEnd + 8 + i * 16];
+        uint32_t offset = le32(e + 8);
+        if (!fourcc(e, "00dc") || moviStart + offset != frames[i].offset || le32(e + 12) != frames[i].size) {
+          errors.push_back("idx1第 " + std::to_string(i + 1) + " 条与帧位置不符");
+          break;
+        }
+      }
+    }
+    if (!(flags & 0x10)) {
+      errors.push_back("有idx1但avih未设置AVIF_HASINDEX");
+    }
+  } else if (flags & 0x10) {
+    errors.push_back("avih设置了AVIF_HASINDEX但没有idx1");
+  }
+
+  if (!errors.empty()) {
+    for (const std::string& e : errors) {
+      printf("%s: 无效 - %s\n", path.c_str(), e.c_str());
+    }
+    return false;
+  }
+  uint64_t bytes = 0;
+  for (const Frame& f : frames) bytes += f.size;
+  printf("%s: 有效，%ux%u，%zu 帧，%.1f fps，平均每帧 %.1f KB，%s%s\n", path.c_str(), width, height, frames.size(),
+         usPerFrame ? 1e6 / usPerFrame : 0.0, frames.empty() ? 0.0 : bytes / 1024.0 / frames.size(),
+         indexed ? "已收尾（有idx1）" : "未收尾（无idx1）",
+         riffEnd < data.size() ? "，RIFF之后有未提交的数据" : "");
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "用法: %s <文件.avi> [...]\n", argv[0]);
+    return 2;
+  }
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    ok = checkFile(argv[i]) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+// 设备 /api/changes 接口的变更记录和解析（同步工具和多设备采集共用）
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace timelapse {
+
+struct Change {
+  uint32_t seq = 0;
+  char op = 0;
+  std::string path;
+  uint64_t size = 0;
+};
+
+// 从JSON片段中读取 "key":值（只处理设备返回的简单格式）
+inline bool jsonField(const std::string& s, size_t from, size_t to, const char* key, std::string& value) {
+  std::string pattern = std::string("\"") + key + "\":";
+  size_t p = s.find(pattern, from);
+  if (p == std::string::npos || p >= to) return false;
+  p += pattern.size();
+  if (s[p] == '"') {
+    size_t end = s.find('"', p + 1);
+    if (end == std::string::npos) return false;
+    value = s.substr(p + 1, end - p - 1);
+  } else {
+    size_t end = s.find_first_of(",}]", p);
+    value = s.substr(p, end - p);
+  }
+  return true;
+}
+
+// 解析 /api/changes 的响应
+inline bool parseChanges(const std::string& body, std::vector<Change>& changes, uint32_t& next, bool& more) {
+  std::string v;
+  if (!jsonField(body, 0, body.size(), "next", v)) return false;
+  next = (uint32_t)strtoul(v.c_str(), nullptr, 10);
+  more = jsonField(body, 0, body.size(), "more", v) && v == "true";
+  size_t pos = body.find("\"changes\":[");
+  if (pos == std::string::npos) return false;
+  while ((pos = body.find('{', pos)) != std::string::npos) {
+    size_t end = body.find('}', pos);
+    if (end == std::string::npos) break;
+    Change c;
+    if (jsonField(body, pos, end, "seq", v)) c.seq = (uint32_t)strtoul(v.c_str(), nullptr, 10);
+    if (jsonField(body, pos, end, "op", v) && !v.empty()) c.op = v[0];
+    if (jsonField(body, pos, end, "path", v)) c.path = v;
+    if (jsonField(body, pos, end, "size", v)) c.size = strtoull(v.c_str(), nullptr, 10);
+    if (c.seq > 0 && !c.path.empty() && c.path.find("..") == std::string::npos) {
+      changes.push_back(c);
+    }
+    pos = end + 1;
+  }
+  return true;
+}
+
+}  // namespace timelapse
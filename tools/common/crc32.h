@@ -0,0 +1,59 @@
+// CRC-32（IEEE 802.3，与zlib和固件中 esp_rom_crc32_le 相同），用于核对设备记录在 crc.bin 中的校验值
+//   crc32Update(0, data, len) 得到整段数据的CRC；分块计算时把上一块的结果作为下一块的crc传入
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace timelapse {
+
+// 8张256项的表：tables[0]是逐字节查表用的表（ESP32 ROM中的实现也是这一张），其余用于每次处理8字节
+struct Crc32Tables {
+  uint32_t t[8][256];
+  Crc32Tables() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0xEDB88320u & (0u - (c & 1)));
+      t[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int k = 1; k < 8; k++) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+    }
+  }
+};
+
+inline const Crc32Tables& crc32Tables() {
+  static const Crc32Tables tables;
+  return tables;
+}
+
+// 逐字节查表（与设备ROM实现的算法相同，用于估计设备上的相对开销）
+inline uint32_t crc32UpdateBytewise(uint32_t crc, const void* data, size_t len) {
+  const uint32_t* t = crc32Tables().t[0];
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len--) crc = (crc >> 8) ^ t[(crc ^ *p++) & 0xFF];
+  return ~crc;
+}
+
+// 每次处理8字节（slicing-by-8，小端机器）
+inline uint32_t crc32Update(uint32_t crc, const void* data, size_t len) {
+  const Crc32Tables& tb = crc32Tables();
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len >= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = tb.t[7][lo & 0xFF] ^ tb.t[6][(lo >> 8) & 0xFF] ^ tb.t[5][(lo >> 16) & 0xFF] ^ tb.t[4][lo >> 24] ^
+          tb.t[3][hi & 0xFF] ^ tb.t[2][(hi >> 8) & 0xFF] ^ tb.t[1][(hi >> 16) & 0xFF] ^ tb.t[0][hi >> 24];
+    p += 8;
+    len -= 8;
+  }
+  while (len--) crc = (crc >> 8) ^ tb.t[0][(crc ^ *p++) & 0xFF];
+  return ~crc;
+}
+
+}  // namespace timelapse
@@ -0,0 +1,269 @@
+// 主机端工具共用的最小HTTP/1.1客户端（阻塞式，支持keep-alive和分块传输编码）
+// 只用于访问局域网内的ESP32-CAM，不支持HTTPS和重定向
+// 响应解析器是增量式的，也可以单独用于非阻塞连接（收到多少数据就喂多少）
+#pragma once
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+
+namespace timelapse {
+
+struct HttpResponse {
+  int status = 0;
+  std::string body;
+};
+
+// 增量解析HTTP/1.x响应：feed()返回消耗的字节数，done()之后剩余的数据属于下一个响应
+class HttpResponseParser {
+ public:
+  void reset() {
+    state_ = STATUS;
+    line_.clear();
+    resp_ = HttpResponse();
+    keepAlive_ = true;
+    chunked_ = false;
+    remaining_ = 0;
+  }
+
+  size_t feed(const char* data, size_t len) {
+    size_t pos = 0;
+    while (pos < len && state_ != DONE && state_ != ERROR) {
+      if (state_ == BODY || state_ == CHUNK_DATA) {
+        size_t n = std::min(len - pos, remaining_);
+        resp_.body.append(data + pos, n);
+        pos += n;
+        remaining_ -= n;
+        if (remaining_ == 0) state_ = state_ == BODY ? DONE : CHUNK_END;
+      } else if (state_ == UNTIL_CLOSE) {
+        resp_.body.append(data + pos, len - pos);
+        pos = len;
+      } else {
+        char c = data[pos++];
+        if (c != '\n') {
+          line_ += c;
+          if (line_.size() > 8192) state_ = ERROR;
+          continue;
+        }
+        if (!line_.empty() && line_.back() == '\r') line_.pop_back();
+        onLine();
+        line_.clear();
+      }
+    }
+    return pos;
+  }
+
+  // 连接已关闭：没有长度信息的响应到此结束，其他状态说明响应不完整
+  void finish() {
+    state_ = state_ == UNTIL_CLOSE ? DONE : ERROR;
+    keepAlive_ = false;
+  }
+
+  bool done() const { return state_ == DONE; }
+  bool error() const { return state_ == ERROR; }
+  bool keepAlive() const { return keepAlive_; }
+  HttpResponse& response() { return resp_; }
+
+ private:
+  enum State { STATUS, HEADERS, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER, UNTIL_CLOSE, DONE, ERROR };
+
+  void onLine() {
+    switch (state_) {
+      case STATUS:
+        if (line_.compare(0, 7, "HTTP/1.") != 0 || line_.size() < 12) {
+          state_ = ERROR;
+          return;
+        }
+        resp_.status = atoi(line_.c_str() + 9);
+        keepAlive_ = line_.compare(0, 8, "HTTP/1.1") == 0;
+        contentLength_ = -1;
+        state_ = HEADERS;
+        break;
+      case HEADERS:
+        if (!line_.empty()) {
+          std::string lower = line_;
+          for (char& c : lower) c = (char)tolower((unsigned char)c);
+          if (lower.compare(0, 15, "content-length:") == 0) {
+            contentLength_ = atol(lower.c_str() + 15);
+          } else if (lower.compare(0, 18, "transfer-encoding:") == 0 && lower.find("chunked") != std::string::npos) {
+            chunked_ = true;
+          } else if (lower.compare(0, 11, "connection:") == 0 && lower.find("close") != std::string::npos) {
+            keepAlive_ = false;
+          }
+        } else if (chunked_) {
+          state_ = CHUNK_SIZE;
+        } else if (contentLength_ >= 0 || resp_.status == 204 || resp_.status == 304) {
+          remaining_ = contentLength_ > 0 ? (size_t)contentLength_ : 0;
+          state_ = remaining_ > 0 ? BODY : DONE;
+        } else {
+          state_ = UNTIL_CLOSE;  // 没有长度信息，读到连接关闭为止
+          keepAlive_ = false;
+        }
+        break;
+      case CHUNK_SIZE:
+        remaining_ = strtoul(line_.c_str(), nullptr, 16);
+        state_ = remaining_ > 0 ? CHUNK_DATA : TRAILER;
+        break;
+      case CHUNK_END:
+        state_ = CHUNK_SIZE;  // 块数据后的空行
+        break;
+      case TRAILER:
+        if (line_.empty()) state_ = DONE;
+        break;
+      default:
+        break;
+    }
+  }
+
+  State state_ = STATUS;
+  std::string line_;
+  HttpResponse resp_;
+  bool keepAlive_ = true;
+  bool chunked_ = false;
+  long contentLength_ = -1;
+  size_t remaining_ = 0;
+};
+
+class HttpClient {
+ public:
+  HttpClient(std::string host, std::string port, int timeoutSec = 10)
+      : host_(std::move(host)), port_(std::move(port)), timeoutSec_(timeoutSec) {}
+  ~HttpClient() { close(); }
+
+  HttpClient(const HttpClient&) = delete;
+  HttpClient& operator=(const HttpClient&) = delete;
+
+  void close() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+    rbufLen_ = rbufPos_ = 0;
+  }
+
+  // 发送GET请求；连接被服务器关闭时自动重连一次
+  bool get(const std::string& path, HttpResponse& resp) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+      if (fd_ < 0 && !connect()) {
+        return false;
+      }
+      std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + host_ + "\r\nConnection: keep-alive\r\n\r\n";
+      if (sendAll(req.data(), req.size()) && readResponse(resp)) {
+        return true;
+      }
+      close();
+    }
+    return false;
+  }
+
+  static std::string urlEncode(const std::string& s) {
+    static const char* hex = "0123456789ABCDEF";
+    std::string out;
+    for (unsigned char c : s) {
+      if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+        out += (char)c;
+      } else {
+        out += '%';
+        out += hex[c >> 4];
+        out += hex[c & 15];
+      }
+    }
+    return out;
+  }
+
+ private:
+  bool connect() {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &res) != 0) {
+      return false;
+    }
+    for (addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+      int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0) continue;
+      timeval tv{timeoutSec_, 0};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        fd_ = fd;
+        break;
+      }
+      ::close(fd);
+    }
+    freeaddrinfo(res);
+    return fd_ >= 0;
+  }
+
+  bool sendAll(const char* data, size_t len) {
+    while (len > 0) {
+      ssize_t n = ::send(fd_, data, len, MSG_NOSIGNAL);
+      if (n <= 0) return false;
+      data += n;
+      len -= (size_t)n;
+    }
+    return true;
+  }
+
+  bool fill() {
+    if (rbufPos_ < rbufLen_) return true;
+    ssize_t n = ::recv(fd_, rbuf_, sizeof(rbuf_), 0);
+    if (n <= 0) return false;
+    rbufLen_ = (size_t)n;
+    rbufPos_ = 0;
+    return true;
+  }
+
+  bool readResponse(HttpResponse& resp) {
+    parser_.reset();
+    while (!parser_.done()) {
+      if (!fill()) {
+        parser_.finish();  // 连接关闭或超时
+        if (!parser_.done()) return false;
+        break;
+      }
+      rbufPos_ += parser_.feed(rbuf_ + rbufPos_, rbufLen_ - rbufPos_);
+      if (parser_.error()) return false;
+    }
+    resp = std::move(parser_.response());
+    if (!parser_.keepAlive()) close();
+    return true;
+  }
+
+  std::string host_;
+  std::string port_;
+  int timeoutSec_;
+  int fd_ = -1;
+  HttpResponseParser parser_;
+  char rbuf_[16384];
+  size_t rbufLen_ = 0;
+  size_t rbufPos_ = 0;
+};
+
+// 解析 "host[:port]"
+inline void splitHostPort(const std::string& s, std::string& host, std::string& port) {
+  size_t colon = s.rfind(':');
+  if (colon == std::string::npos) {
+    host = s;
+    port = "80";
+  } else {
+    host = s.substr(0, colon);
+    port = s.substr(colon + 1);
+  }
+}
+
+}  // namespace timelapse
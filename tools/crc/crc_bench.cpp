@@ -0,0 +1,132 @@
+// CRC-32实现的正确性检查和性能测试（MB/s）
+//
+// 设备写照片时每写一个4KB块就用 esp_rom_crc32_le 更新一次CRC（ROM中的逐字节查表实现），
+// 这里按同样的分块方式比较：逐位计算（没有表）、逐字节查表（与ROM相同的算法）、每次8字节查表，以及zlib（如果有）。
+// 先用标准测试向量和随机分块检查所有实现结果一致，再对150KB的照片大小数据测吞吐量。
+// 主机上的绝对速度比ESP32快得多，逐字节查表一行的相对位置可以用来估计设备上的开销（设备的实测值在DEBUG日志中）。
+//
+// 用法: crc_bench [每种实现的测试时长毫秒，默认500]
+// 检查全部通过时返回0
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "../common/crc32.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace timelapse;
+
+// 逐位计算（参考实现）
+static uint32_t crc32Bitwise(uint32_t crc, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+  }
+  return ~crc;
+}
+
+#ifdef HAVE_ZLIB
+static uint32_t crc32Zlib(uint32_t crc, const void* data, size_t len) {
+  return (uint32_t)crc32(crc, (const Bytef*)data, (uInt)len);
+}
+#endif
+
+struct Impl {
+  const char* name;
+  uint32_t (*fn)(uint32_t, const void*, size_t);
+};
+
+static const Impl impls[] = {
+    {"逐位计算（无表）", crc32Bitwise},
+    {"逐字节查表（与ESP32 ROM相同）", crc32UpdateBytewise},
+    {"每次8字节查表", crc32Update},
+#ifdef HAVE_ZLIB
+    {"zlib crc32()", crc32Zlib},
+#endif
+};
+
+// 按设备的写入方式分4KB块计算
+static uint32_t crcChunked(const Impl& impl, const std::vector<uint8_t>& data, size_t chunk) {
+  uint32_t crc = 0;
+  for (size_t pos = 0; pos < data.size(); pos += chunk) {
+    crc = impl.fn(crc, data.data() + pos, std::min(chunk, data.size() - pos));
+  }
+  return crc;
+}
+
+int main(int argc, char** argv) {
+  int benchMs = argc > 1 ? std::max(10, atoi(argv[1])) : 500;
+  int failures = 0;
+
+  // 标准测试向量
+  for (const Impl& impl : impls) {
+    uint32_t check = impl.fn(0, "123456789", 9);
+    if (check != 0xCBF43926u) {
+      printf("失败: %s 的测试向量结果 %08x，应为 cbf43926\n", impl.name, check);
+      failures++;
+    }
+  }
+
+  // 随机长度、随机分块、不同对齐：所有实现与逐位计算一致
+  std::mt19937 rng(12345);
+  for (int round = 0; round < 2000; round++) {
+    std::vector<uint8_t> data(rng() % 5000 + 1);
+    for (uint8_t& b : data) b = (uint8_t)rng();
+    size_t offset = rng() % 8;
+    size_t len = data.size() > offset ? data.size() - offset : 0;
+    uint32_t expected = crc32Bitwise(0, data.data() + offset, len);
+    for (const Impl& impl : impls) {
+      uint32_t crc = 0;
+      size_t pos = offset;
+      while (pos < data.size()) {
+        size_t n = std::min<size_t>(rng() % 600 + 1, data.size() - pos);
+        crc = impl.fn(crc, data.data() + pos, n);
+        pos += n;
+      }
+      if (crc != expected) {
+        if (failures < 10) printf("失败: %s 分块计算结果 %08x，应为 %08x（长度 %zu）\n", impl.name, crc, expected, len);
+        failures++;
+      }
+    }
+  }
+
+  // 吞吐量：150KB（UXGA照片的典型大小），4KB一块
+  std::vector<uint8_t> frame(150 * 1024);
+  for (uint8_t& b : frame) b = (uint8_t)rng();
+  printf("数据 %zu 字节，每块 %d 字节，每种实现测试 %d ms\n", frame.size(), 4096, benchMs);
+  printf("%10s  %14s  %s\n", "MB/s", "每张照片(us)", "实现");
+  uint32_t reference = crcChunked(impls[0], frame, 4096);
+  for (const Impl& impl : impls) {
+    uint32_t crc = 0;
+    uint64_t frames = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do {
+      crc = crcChunked(impl, frame, 4096);
+      frames++;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed * 1000 < benchMs);
+    if (crc != reference) {
+      printf("失败: %s 的结果 %08x 与参考实现 %08x 不同\n", impl.name, crc, reference);
+      failures++;
+    }
+    double mbps = (double)frame.size() * frames / elapsed / 1e6;
+    printf("%10.1f  %14.1f  %s\n", mbps, elapsed * 1e6 / frames, impl.name);
+  }
+
+  if (failures > 0) {
+    printf("共 %d 项检查失败\n", failures);
+    return 1;
+  }
+  printf("所有实现结果一致\n");
+  return 0;
+}
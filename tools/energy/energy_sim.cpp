@@ -0,0 +1,173 @@
+// 能量管理模拟：用模拟的电池和太阳能板产生电压序列，每次唤醒调用固件的 energyDecide()（直接编译 src/energy_util.h），
+// 检查策略的约束并统计各电量等级的时间、等级切换次数、每日拍摄张数、最低电量，以及电池是否耗尽。
+//
+// 电池按锂电池的开路电压曲线由剩余电量得到电压，再加上ADC读数噪声；每次唤醒的耗电按策略估算
+// （访问窗口、WiFi、闪光灯），并像固件一样做指数滑动平均后交给 energyDecide()。
+// 场景：晴天、连续阴天、没有充电、电压停在阈值附近（只有噪声，检查滞回）、电压缓慢下降后回升。
+//
+// 用法: energy_sim [天数，默认14] [电池容量mAh，默认2000] [太阳能板峰值电流mA，默认250]
+// 检查全部通过时返回0
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+
+#include "energy_util.h"
+
+static const char* const levelNames[] = {"正常", "省电", "极低"};
+
+// 锂电池开路电压曲线（剩余电量% -> mV）
+static const float socPoints[][2] = {{0, 3300},  {5, 3500},  {10, 3600}, {20, 3700},
+                                     {40, 3780}, {60, 3870}, {80, 4000}, {100, 4180}};
+
+static float batteryVoltage(float soc) {
+  const int n = sizeof(socPoints) / sizeof(socPoints[0]);
+  soc = std::min(100.0f, std::max(0.0f, soc));
+  for (int i = 1; i < n; i++) {
+    if (soc <= socPoints[i][0]) {
+      float t = (soc - socPoints[i - 1][0]) / (socPoints[i][0] - socPoints[i - 1][0]);
+      return socPoints[i - 1][1] + t * (socPoints[i][1] - socPoints[i - 1][1]);
+    }
+  }
+  return socPoints[n - 1][1];
+}
+
+// 按策略估计一次唤醒的耗电（mAh）：相机和SD卡约3秒，WiFi连接和同步约2秒，访问窗口，闪光灯
+static float wakeMahFor(const EnergyPolicy& p) {
+  float mah = 3.0f * 120 / 3600;
+  if (p.wifi) mah += 2.0f * 160 / 3600 + p.webWindowMs / 1000.0f * 90 / 3600;
+  if (p.flash) mah += 0.3f * 300 / 3600;
+  return mah;
+}
+
+struct Scenario {
+  const char* name;
+  float startSoc;
+  std::function<float(double hour)> solarMa;     // 充电电流（mA），按从模拟开始的小时数
+  std::function<float(double hour)> voltageMv;   // 非空时直接使用这条电压序列（不模拟电池）
+  float noiseMv;
+  uint32_t maxSwitches;  // 允许的等级切换次数上限（0=不检查）
+  bool mustSurvive;      // 电池不允许耗尽
+};
+
+struct Stats {
+  double levelHours[3] = {0, 0, 0};
+  uint32_t switches = 0, wakes = 0, violations = 0;
+  float minSoc = 100, minMv = 10000;
+  double depletedHour = -1;
+};
+
+static uint32_t checkPolicy(const EnergyPolicy& base, const EnergyPolicy& p, uint32_t mv, uint8_t prev, float wakeMah) {
+  uint32_t bad = 0;
+  auto fail = [&](const char* what) {
+    if (bad++ == 0) printf("    违反约束: %s（电压 %u mV，上次等级 %s，每次唤醒 %.3f mAh）\n", what, mv, levelNames[prev], wakeMah);
+  };
+  if (p.intervalS < base.intervalS) fail("拍摄间隔比配置的短");
+  if (p.intervalS > ENERGY_MAX_INTERVAL_S) fail("拍摄间隔超过上限");
+  if (p.level == ENERGY_CRITICAL && (p.wifi || p.webWindowMs != 0 || p.flash)) fail("极低电量时仍开启WiFi/访问窗口/闪光灯");
+  if (p.level == ENERGY_SAVE && (p.flash || p.frameSize > ENERGY_SAVE_FRAMESIZE)) fail("省电等级仍开闪光灯或分辨率超过上限");
+  if (p.level > prev && mv >= BATTERY_SAVE_MV + BATTERY_HYSTERESIS_MV) fail("电压高于阈值+滞回仍降级");
+  if (p.level < prev && mv < (p.level == ENERGY_NORMAL ? BATTERY_SAVE_MV : BATTERY_CRITICAL_MV)) fail("电压低于阈值仍升级");
+  if (wakeMah > 0 && p.intervalS < ENERGY_MAX_INTERVAL_S && energyDailyMah(p, wakeMah) > ENERGY_DAILY_BUDGET_MAH * 1.01f) {
+    fail("预计每日用电超过预算");
+  }
+  return bad;
+}
+
+static bool run(const Scenario& sc, int days, float capacityMah, std::mt19937& rng) {
+  const EnergyPolicy base = {ENERGY_NORMAL, 600, 30000, true, true, 13};  // 10分钟、30秒窗口、闪光灯、UXGA
+  std::normal_distribution<float> noise(0, sc.noiseMv / 2);
+  Stats st;
+  float soc = sc.startSoc;
+  uint8_t level = ENERGY_NORMAL;
+  float wakeAvgMah = 0;
+  double hour = 0, end = days * 24.0;
+  while (hour < end) {
+    float mv = sc.voltageMv ? sc.voltageMv(hour) : batteryVoltage(soc);
+    mv += std::max(-sc.noiseMv, std::min(sc.noiseMv, noise(rng)));
+    uint32_t measured = (uint32_t)std::max(0.0f, mv);
+    EnergyPolicy p = energyDecide(base, measured, level, wakeAvgMah);
+    st.violations += checkPolicy(base, p, measured, level, wakeAvgMah);
+    if (p.level != level) st.switches++;
+    level = p.level;
+    st.wakes++;
+
+    float mah = wakeMahFor(p);
+    wakeAvgMah = wakeAvgMah > 0 ? wakeAvgMah * 0.8f + mah * 0.2f : mah;
+    double dt = p.intervalS / 3600.0;
+    if (!sc.voltageMv) {
+      float chargeMah = 0;
+      for (int i = 0; i < 10; i++) chargeMah += sc.solarMa(hour + dt * (i + 0.5) / 10) * dt / 10;
+      soc += (chargeMah - mah - ENERGY_SLEEP_CURRENT_MA * dt) / capacityMah * 100;
+      soc = std::min(100.0f, soc);
+      st.minSoc = std::min(st.minSoc, soc);
+      if (soc <= 0 && st.depletedHour < 0) {
+        st.depletedHour = hour;
+        st.levelHours[level] += dt;
+        break;
+      }
+    }
+    st.minMv = std::min(st.minMv, mv);
+    st.levelHours[level] += dt;
+    hour += dt;
+  }
+
+  double total = st.levelHours[0] + st.levelHours[1] + st.levelHours[2];
+  printf("  时间占比 正常 %.0f%% 省电 %.0f%% 极低 %.0f%%；等级切换 %u 次；平均每天拍摄 %.0f 张；最低电压 %.0f mV",
+         st.levelHours[0] / total * 100, st.levelHours[1] / total * 100, st.levelHours[2] / total * 100, st.switches,
+         st.wakes / (total / 24), st.minMv);
+  if (!sc.voltageMv) printf("；最低电量 %.1f%%", std::max(0.0f, st.minSoc));
+  printf("\n");
+  bool ok = st.violations == 0;
+  if (st.depletedHour >= 0) {
+    printf("  电池在第 %.1f 天耗尽\n", st.depletedHour / 24);
+    if (sc.mustSurvive) ok = false;
+  }
+  if (sc.maxSwitches > 0 && st.switches > sc.maxSwitches) {
+    printf("  等级切换次数超过 %u 次（滞回不起作用）\n", sc.maxSwitches);
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  int days = argc > 1 ? std::max(1, atoi(argv[1])) : 14;
+  float capacity = argc > 2 ? std::max(100.0f, (float)atof(argv[2])) : 2000;
+  float solarPeak = argc > 3 ? std::max(0.0f, (float)atof(argv[3])) : 250;
+  std::mt19937 rng(2024);
+
+  // 白天6点到18点按正弦变化，阴天只有5%
+  auto sun = [solarPeak](double hour, float factor) {
+    double h = fmod(hour, 24.0);
+    return h < 6 || h > 18 ? 0.0f : (float)(solarPeak * factor * sin((h - 6) / 12 * M_PI));
+  };
+  Scenario scenarios[] = {
+      {"晴天", 60, [&](double h) { return sun(h, 1.0f); }, nullptr, 20, 0, true},
+      {"连续阴天（前3天晴）", 80, [&](double h) { return sun(h, h < 72 ? 1.0f : 0.05f); }, nullptr, 20, 0, false},
+      {"没有充电", 100, [](double) { return 0.0f; }, nullptr, 20, 0, false},
+      {"电压停在省电阈值附近", 0, nullptr, [](double) { return (float)BATTERY_SAVE_MV; },
+       BATTERY_HYSTERESIS_MV * 0.8f, 1, false},
+      {"电压停在极低阈值附近", 0, nullptr, [](double) { return (float)BATTERY_CRITICAL_MV; },
+       BATTERY_HYSTERESIS_MV * 0.8f, 2, false},
+      {"电压下降后回升", 0, nullptr,
+       [days](double h) { return (float)(4000 - 700 * sin(std::min(1.0, h / (days * 24.0)) * M_PI)); }, 30, 4, false},
+  };
+
+  printf("能量预算 %d mAh/天，睡眠电流 %.1f mA，电池 %.0f mAh，太阳能板峰值 %.0f mA，模拟 %d 天\n",
+         ENERGY_DAILY_BUDGET_MAH, ENERGY_SLEEP_CURRENT_MA, capacity, solarPeak, days);
+  int failures = 0;
+  for (const Scenario& sc : scenarios) {
+    printf("\n%s\n", sc.name);
+    if (!run(sc, days, capacity, rng)) failures++;
+  }
+  if (failures > 0) {
+    printf("\n%d 个场景失败\n", failures);
+    return 1;
+  }
+  printf("\n通过: 策略满足所有约束\n");
+  return 0;
+}
@@ -0,0 +1,309 @@
+// 模拟多台ESP32-CAM的测试服务器（用于在电脑上测试 fleet_ingest，不需要真实设备）
+//
+// 每台模拟设备监听一个端口，按固件的节奏工作：唤醒后开放访问窗口，窗口结束时拍摄新照片并"睡眠"
+// （关闭监听端口，连接被拒绝），各设备的唤醒时刻错开。实现的接口与固件一致：
+//   /api/changes?since=N[&limit=M]   变更记录（每次最多500条）
+//   /photo?file=<路径>&download=1     照片内容（分块传输，每块4KB）
+// 照片内容由设备号和序号确定性生成（FFD8开头、FFD9结尾），下载结果可以重复校验。
+//
+// 用法: fake_camera <起始端口> <设备数> [--awake 秒] [--period 秒] [--initial 张] [--per-wake 张]
+//                   [--frame-kb KB] [--kbps 每台设备的发送速度KB/s，0=不限]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Options {
+  int awakeS = 30;
+  int periodS = 120;
+  int initial = 20;
+  int perWake = 1;
+  int frameKb = 150;
+  int kbps = 0;
+};
+
+struct Frame {
+  uint32_t seq;
+  std::string path;
+  uint32_t size;
+};
+
+struct Device {
+  int index = 0;
+  int port = 0;
+  std::mutex mutex;
+  std::vector<Frame> frames;
+  std::atomic<bool> awake{false};
+  std::atomic<int> connections{0};
+  uint32_t windows = 0;
+};
+
+static Options opts;
+static std::atomic<bool> stopping(false);
+
+static uint64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// 照片内容：FFD8 + 伪随机数据 + FFD9（设备号和序号相同则内容相同）
+static std::string frameData(int device, const Frame& f) {
+  std::string data(f.size, '\0');
+  uint32_t x = (uint32_t)device * 2654435761u + f.seq * 40503u + 1;
+  for (size_t i = 0; i < data.size(); i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    data[i] = (char)x;
+  }
+  data[0] = (char)0xFF;
+  data[1] = (char)0xD8;
+  data[f.size - 2] = (char)0xFF;
+  data[f.size - 1] = (char)0xD9;
+  return data;
+}
+
+static void addFrame(Device& d, time_t when) {
+  std::lock_guard<std::mutex> lock(d.mutex);
+  struct tm t;
+  localtime_r(&when, &t);
+  char path[64];
+  uint32_t seq = (uint32_t)d.frames.size() + 1;
+  int week = t.tm_yday / 7 + 1;
+  snprintf(path, sizeof(path), "/%04d_W%02d/%04d_%02d_%02d_%02d_%02d_%u.jpg", t.tm_year + 1900, week, t.tm_year + 1900,
+           t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, seq);
+  uint32_t size = (uint32_t)opts.frameKb * 1024 + (seq * 7919u) % 4096;
+  d.frames.push_back({seq, path, size});
+}
+
+static std::string queryArg(const std::string& target, const char* name) {
+  std::string key = std::string(name) + "=";
+  size_t q = target.find('?');
+  while (q != std::string::npos) {
+    size_t start = q + 1;
+    if (target.compare(start, key.size(), key) == 0) {
+      size_t end = target.find('&', start);
+      std::string v = target.substr(start + key.size(), end == std::string::npos ? std::string::npos : end - start - key.size());
+      std::string out;
+      for (size_t i = 0; i < v.size(); i++) {
+        if (v[i] == '%' && i + 2 < v.size()) {
+          out += (char)strtol(v.substr(i + 1, 2).c_str(), nullptr, 16);
+          i += 2;
+        } else {
+          out += v[i] == '+' ? ' ' : v[i];
+        }
+      }
+      return out;
+    }
+    q = target.find('&', start);
+  }
+  return "";
+}
+
+static bool sendAll(int fd, const char* data, size_t len, const Device& d) {
+  while (len > 0) {
+    if (!d.awake || stopping) return false;  // 设备"睡眠"时连接立即中断
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    data += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+static bool sendResponse(int fd, Device& d, int status, const char* type, const std::string& body, bool chunked) {
+  std::string head = "HTTP/1.1 " + std::to_string(status) + (status == 200 ? " OK" : " Not Found") +
+                     "\r\nContent-Type: " + type + "\r\n";
+  if (!chunked) {
+    head += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    return sendAll(fd, head.data(), head.size(), d) && sendAll(fd, body.data(), body.size(), d);
+  }
+  head += "Transfer-Encoding: chunked\r\n\r\n";
+  if (!sendAll(fd, head.data(), head.size(), d)) return false;
+  for (size_t pos = 0; pos < body.size(); pos += 4096) {
+    size_t n = std::min((size_t)4096, body.size() - pos);
+    char size[16];
+    int len = snprintf(size, sizeof(size), "%zx\r\n", n);
+    if (!sendAll(fd, size, len, d) || !sendAll(fd, body.data() + pos, n, d) || !sendAll(fd, "\r\n", 2, d)) {
+      return false;
+    }
+    if (opts.kbps > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(n * 1000000 / (opts.kbps * 1024)));
+    }
+  }
+  return sendAll(fd, "0\r\n\r\n", 5, d);
+}
+
+static bool handleRequest(int fd, Device& d, const std::string& target) {
+  if (target.compare(0, 13, "/api/changes?") == 0 || target == "/api/changes") {
+    uint32_t since = (uint32_t)strtoul(queryArg(target, "since").c_str(), nullptr, 10);
+    std::string limitArg = queryArg(target, "limit");
+    uint32_t limit = limitArg.empty() ? 500 : std::max(1u, std::min(500u, (uint32_t)atoi(limitArg.c_str())));
+    std::lock_guard<std::mutex> lock(d.mutex);
+    uint32_t seq = (uint32_t)d.frames.size();
+    since = std::min(since, seq);
+    uint32_t count = std::min(limit, seq - since);
+    std::string body = "{\"seq\":" + std::to_string(seq) + ",\"next\":" + std::to_string(since + count) +
+                       ",\"more\":" + (since + count < seq ? "true" : "false") + ",\"changes\":[";
+    for (uint32_t i = 0; i < count; i++) {
+      const Frame& f = d.frames[since + i];
+      body += (i > 0 ? ",{\"seq\":" : "{\"seq\":") + std::to_string(f.seq) + ",\"op\":\"+\",\"path\":\"" + f.path +
+              "\",\"size\":" + std::to_string(f.size) + "}";
+    }
+    body += "]}";
+    return sendResponse(fd, d, 200, "application/json", body, true);
+  }
+  if (target.compare(0, 7, "/photo?") == 0) {
+    std::string path = queryArg(target, "file");
+    Frame frame{0, "", 0};
+    {
+      std::lock_guard<std::mutex> lock(d.mutex);
+      for (const Frame& f : d.frames) {
+        if (f.path == path) frame = f;
+      }
+    }
+    if (frame.seq == 0) {
+      return sendResponse(fd, d, 404, "text/plain", "文件未找到: " + path, false);
+    }
+    return sendResponse(fd, d, 200, "image/jpeg", frameData(d.index, frame), true);
+  }
+  return sendResponse(fd, d, 404, "text/plain", "Not found", false);
+}
+
+// 一个keep-alive连接：逐个处理请求，设备睡眠时关闭
+static void serveConnection(int fd, Device* d) {
+  d->connections++;
+  std::string buf;
+  char tmp[4096];
+  while (d->awake && !stopping) {
+    size_t end = buf.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      pollfd p{fd, POLLIN, 0};
+      if (poll(&p, 1, 100) <= 0) continue;
+      ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+      if (n <= 0) break;
+      buf.append(tmp, (size_t)n);
+      continue;
+    }
+    std::string line = buf.substr(0, buf.find("\r\n"));
+    buf.erase(0, end + 4);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos || !handleRequest(fd, *d, line.substr(sp1 + 1, sp2 - sp1 - 1))) {
+      break;
+    }
+  }
+  close(fd);
+  d->connections--;
+}
+
+static int listenOn(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// 设备主循环：等到自己的唤醒时刻 -> 开放窗口 -> 拍照 -> 睡眠
+static void runDevice(Device* d, int count) {
+  uint64_t offsetMs = (uint64_t)opts.periodS * 1000 * d->index / count;
+  uint64_t start = nowMs();
+  for (uint64_t cycle = 0; !stopping; cycle++) {
+    uint64_t wakeAt = start + offsetMs + cycle * opts.periodS * 1000ULL;
+    while (!stopping && nowMs() < wakeAt) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int lfd = listenOn(d->port);
+    if (lfd < 0) {
+      fprintf(stderr, "设备 %d: 无法监听端口 %d\n", d->index, d->port);
+      return;
+    }
+    d->awake = true;
+    d->windows++;
+    uint64_t sleepAt = nowMs() + opts.awakeS * 1000ULL;
+    while (!stopping && nowMs() < sleepAt) {
+      pollfd p{lfd, POLLIN, 0};
+      if (poll(&p, 1, 100) > 0) {
+        int fd = accept(lfd, nullptr, nullptr);
+        if (fd >= 0) {
+          int one = 1;
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // 分块结尾的小包不等延迟确认
+          std::thread(serveConnection, fd, d).detach();
+        }
+      }
+    }
+    close(lfd);
+    d->awake = false;
+    for (int i = 0; i < opts.perWake; i++) addFrame(*d, time(nullptr));
+    while (d->connections > 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+static void onSignal(int) { stopping = true; }
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "用法: %s <起始端口> <设备数> [--awake 秒] [--period 秒] [--initial 张] [--per-wake 张] [--frame-kb KB] "
+            "[--kbps KB/s]\n",
+            argv[0]);
+    return 2;
+  }
+  int basePort = atoi(argv[1]);
+  int count = std::max(1, atoi(argv[2]));
+  for (int i = 3; i + 1 < argc; i++) {
+    std::string a = argv[i];
+    int v = atoi(argv[++i]);
+    if (a == "--awake") opts.awakeS = std::max(1, v);
+    else if (a == "--period") opts.periodS = std::max(1, v);
+    else if (a == "--initial") opts.initial = std::max(0, v);
+    else if (a == "--per-wake") opts.perWake = std::max(0, v);
+    else if (a == "--frame-kb") opts.frameKb = std::max(1, v);
+    else if (a == "--kbps") opts.kbps = std::max(0, v);
+  }
+  opts.periodS = std::max(opts.periodS, opts.awakeS + 1);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  std::vector<Device> devices(count);
+  std::vector<std::thread> threads;
+  time_t t0 = time(nullptr) - opts.initial * 600;
+  for (int i = 0; i < count; i++) {
+    devices[i].index = i;
+    devices[i].port = basePort + i;
+    for (int n = 0; n < opts.initial; n++) addFrame(devices[i], t0 + n * 600);
+    threads.emplace_back(runDevice, &devices[i], count);
+  }
+  printf("模拟 %d 台设备: 端口 %d-%d，每 %d 秒唤醒 %d 秒，初始 %d 张，每次唤醒新增 %d 张\n", count, basePort,
+         basePort + count - 1, opts.periodS, opts.awakeS, opts.initial, opts.perWake);
+  fflush(stdout);
+  for (auto& t : threads) t.join();
+  uint32_t frames = 0, windows = 0;
+  for (Device& d : devices) {
+    frames += (uint32_t)d.frames.size();
+    windows += d.windows;
+  }
+  printf("模拟结束: %u 个访问窗口，设备上共 %u 张照片\n", windows, frames);
+  return 0;
+}
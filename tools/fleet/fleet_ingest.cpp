@@ -0,0 +1,562 @@
+// ESP32-CAM 多设备照片采集守护进程
+//
+// 设备大部分时间在深度睡眠，每次唤醒只开放约30秒的访问窗口。本工具定期探测设备列表中的每台设备：
+// 连接成功说明窗口已开启，立即通过 /api/changes 取得新照片列表并下载（与 timelapse_sync 相同的接口）。
+// 所有设备的连接在一个poll()事件循环中用非阻塞socket处理；下载总并发数有上限，名额优先分给
+// 窗口开启最早（即最快结束）的设备，探测和取列表不占名额。
+//
+// 照片按内容寻址保存：<存储目录>/objects/<sha256前2位>/<sha256>.jpg，相同内容只存一份。
+// 每台设备的 <存储目录>/devices/<名称>/index.tsv 记录 序号、设备上的路径、sha256、大小，
+// seq 文件记录同步进度（窗口结束时保存，只推进到第一张未完成的照片之前，下个窗口继续）。
+// 窗口结束时还有照片没下载完记为一次"错过"。
+//
+// 用法: fleet_ingest <设备列表> <存储目录> [-j 下载总并发] [-c 每台设备连接数] [--probe 秒]
+//                    [--rest 秒] [--report 秒] [--duration 秒]
+// 设备列表每行 "名称 地址[:端口]"，#开头为注释。可以用 fake_camera 模拟多台设备测试。
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../common/changes.h"
+#include "../common/http_client.h"
+#include "../common/sha256.h"
+
+using timelapse::Change;
+using timelapse::HttpClient;
+using timelapse::HttpResponseParser;
+
+struct Options {
+  int jobs = 8;              // 所有设备同时下载的连接数
+  int perDevice = 2;         // 每台设备最多的连接数（固件最多7个连接，还要留给浏览器）
+  int probeS = 3;            // 设备睡眠时的探测间隔
+  int restS = 60;            // 一个窗口同步完成后多久再开始探测（设备拍完照就睡眠，下次唤醒才有新照片）
+  int reportS = 10;          // 打印统计的间隔
+  int durationS = 0;         // 运行时长（0=一直运行）
+  int connectTimeoutMs = 2000;
+  int ioTimeoutMs = 10000;
+};
+
+enum class ConnState { CONNECTING, SENDING, RECEIVING, IDLE };
+
+struct Device;
+
+struct Conn {
+  int fd = -1;
+  Device* dev = nullptr;
+  ConnState state = ConnState::CONNECTING;
+  bool listing = false;      // 当前请求是 /api/changes
+  Change item;               // 当前下载的照片
+  std::string out;
+  size_t outPos = 0;
+  HttpResponseParser parser;
+  uint64_t deadline = 0;
+  bool closed = false;
+};
+
+struct Device {
+  std::string name;
+  std::string host, port;
+  std::string dir;
+  sockaddr_storage addr{};
+  socklen_t addrLen = 0;
+
+  uint32_t seq = 0;          // 已保存的进度
+  uint32_t listedSeq = 0;    // 本窗口已取得的变更序号
+  bool listing = false;
+  bool windowOpen = false;
+  uint64_t windowStart = 0;
+  uint64_t nextProbe = 0;
+  std::deque<Change> queue;  // 待下载
+  std::map<uint32_t, Change> inflight;
+  uint32_t failedSeq = UINT32_MAX;  // 本窗口下载失败的最小序号（进度不越过它）
+  std::set<std::string> have;       // 已保存的 "路径|大小"
+  int conns = 0;
+
+  uint64_t frames = 0, bytes = 0;
+  uint32_t windows = 0, missed = 0, missedFrames = 0, errors = 0;
+};
+
+static Options opts;
+static std::vector<std::unique_ptr<Device>> devices;
+static std::vector<std::unique_ptr<Conn>> conns;
+static std::string store;
+static int activeDownloads = 0;
+static uint64_t totalFrames = 0, totalBytes = 0, dedupFrames = 0;
+static uint64_t activeMs = 0;  // 至少有一个下载进行中的时间
+static std::atomic<bool> stopping(false);
+
+static uint64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void makeDirs(const std::string& path) {
+  for (size_t p = path.find('/', 1); p != std::string::npos; p = path.find('/', p + 1)) {
+    mkdir(path.substr(0, p).c_str(), 0755);
+  }
+}
+
+static void saveSeq(Device& d) {
+  std::string file = d.dir + "/seq";
+  std::string tmp = file + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    out << d.seq << "\n";
+  }
+  rename(tmp.c_str(), file.c_str());
+}
+
+static bool resolve(Device& d) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  if (getaddrinfo(d.host.c_str(), d.port.c_str(), &hints, &res) != 0 || res == nullptr) {
+    return false;
+  }
+  memcpy(&d.addr, res->ai_addr, res->ai_addrlen);
+  d.addrLen = res->ai_addrlen;
+  freeaddrinfo(res);
+  return true;
+}
+
+static bool loadDevices(const std::string& file) {
+  std::ifstream in(file);
+  if (!in) return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    std::string name, address;
+    if (!(ls >> name >> address) || name[0] == '#') continue;
+    auto d = std::make_unique<Device>();
+    d->name = name;
+    timelapse::splitHostPort(address, d->host, d->port);
+    d->dir = store + "/devices/" + name;
+    makeDirs(d->dir + "/");
+    std::ifstream seqIn(d->dir + "/seq");
+    seqIn >> d->seq;
+    d->listedSeq = d->seq;
+    std::ifstream index(d->dir + "/index.tsv");
+    std::string entry;
+    while (std::getline(index, entry)) {
+      std::istringstream es(entry);
+      std::string seq, path, hash, size;
+      if (es >> seq >> path >> hash >> size) d->have.insert(path + "|" + size);
+    }
+    if (!resolve(*d)) fprintf(stderr, "%s: 无法解析地址 %s，探测时重试\n", name.c_str(), address.c_str());
+    devices.push_back(std::move(d));
+  }
+  return !devices.empty();
+}
+
+// 保存照片：对象按sha256寻址，已存在时只登记索引
+static void storeFrame(Device& d, const Change& c, const std::string& body) {
+  std::string hash = timelapse::Sha256::hex(body.data(), body.size());
+  std::string object = store + "/objects/" + hash.substr(0, 2) + "/" + hash + ".jpg";
+  struct stat st;
+  if (stat(object.c_str(), &st) == 0 && (uint64_t)st.st_size == body.size()) {
+    dedupFrames++;
+  } else {
+    makeDirs(object);
+    std::string tmp = object + ".part";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(body.data(), (std::streamsize)body.size());
+    out.close();
+    if (!out.good() || rename(tmp.c_str(), object.c_str()) != 0) {
+      fprintf(stderr, "%s: 写入失败 %s\n", d.name.c_str(), object.c_str());
+      d.errors++;
+      d.failedSeq = std::min(d.failedSeq, c.seq);
+      return;
+    }
+  }
+  std::ofstream index(d.dir + "/index.tsv", std::ios::app);
+  index << c.seq << "\t" << c.path << "\t" << hash << "\t" << body.size() << "\n";
+  d.have.insert(c.path + "|" + std::to_string(body.size()));
+  d.frames++;
+  d.bytes += body.size();
+  totalFrames++;
+  totalBytes += body.size();
+}
+
+static void closeConn(Conn& c) {
+  if (c.closed) return;
+  if (c.fd >= 0) ::close(c.fd);
+  c.fd = -1;
+  c.closed = true;
+  c.dev->conns--;
+  if (!c.listing && c.item.seq != 0) activeDownloads--;
+}
+
+// 窗口结束的原因
+enum class WindowEnd {
+  COMPLETE,  // 同步完成
+  LOST,      // 设备睡眠导致连接失败（还有照片未下载时计为错过）
+  SHUTDOWN,  // 程序退出（窗口还开着，不算错过，下次运行继续）
+};
+
+// 窗口结束：保存进度，未完成的照片下个窗口重新列出
+static void endWindow(Device& d, WindowEnd reason) {
+  uint64_t now = nowMs();
+  for (auto& c : conns) {
+    if (c->dev == &d) closeConn(*c);
+  }
+  uint32_t commit = d.listedSeq;
+  for (const Change& c : d.queue) commit = std::min(commit, c.seq - 1);
+  for (auto& kv : d.inflight) commit = std::min(commit, kv.first - 1);
+  if (d.failedSeq != UINT32_MAX) commit = std::min(commit, d.failedSeq - 1);
+  if (d.windowOpen) {
+    size_t left = d.queue.size() + d.inflight.size();
+    if (reason == WindowEnd::LOST && (left > 0 || d.listing)) {
+      d.missed++;
+      d.missedFrames += (uint32_t)left;
+      printf("%s: 窗口结束（%.1f 秒），还有 %zu 张未下载\n", d.name.c_str(), (now - d.windowStart) / 1000.0, left);
+    } else if (reason == WindowEnd::SHUTDOWN && (left > 0 || d.listing)) {
+      printf("%s: 退出时窗口仍开着，还有 %zu 张未下载（下次运行继续）\n", d.name.c_str(), left);
+    }
+  }
+  if (commit != d.seq && commit >= d.seq) {
+    d.seq = commit;
+    saveSeq(d);
+  }
+  d.listedSeq = d.seq;
+  d.queue.clear();
+  d.inflight.clear();
+  d.failedSeq = UINT32_MAX;
+  d.listing = false;
+  d.nextProbe = now + (uint64_t)(reason == WindowEnd::COMPLETE ? opts.restS : opts.probeS) * 1000;
+  d.windowOpen = false;
+}
+
+static void sendRequest(Conn& c, const std::string& target) {
+  c.out = "GET " + target + " HTTP/1.1\r\nHost: " + c.dev->host + "\r\nConnection: keep-alive\r\n\r\n";
+  c.outPos = 0;
+  c.parser.reset();
+  c.deadline = nowMs() + opts.ioTimeoutMs;
+  if (c.state != ConnState::CONNECTING) c.state = ConnState::SENDING;
+}
+
+static void requestChanges(Conn& c) {
+  c.listing = true;
+  c.item = Change();
+  c.dev->listing = true;
+  sendRequest(c, "/api/changes?since=" + std::to_string(c.dev->listedSeq));
+}
+
+// 在连接上开始下一张照片的下载（占用一个下载名额）
+static void startDownload(Conn& c) {
+  Device& d = *c.dev;
+  c.listing = false;
+  c.item = d.queue.front();
+  d.queue.pop_front();
+  d.inflight[c.item.seq] = c.item;
+  activeDownloads++;
+  sendRequest(c, "/photo?file=" + HttpClient::urlEncode(c.item.path) + "&download=1");
+}
+
+static Conn* openConn(Device& d) {
+  if (d.addrLen == 0 && !resolve(d)) return nullptr;
+  int fd = socket(d.addr.ss_family, SOCK_STREAM, 0);
+  if (fd < 0) return nullptr;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (::connect(fd, (sockaddr*)&d.addr, d.addrLen) != 0 && errno != EINPROGRESS) {
+    ::close(fd);
+    return nullptr;
+  }
+  auto c = std::make_unique<Conn>();
+  c->fd = fd;
+  c->dev = &d;
+  c->state = ConnState::CONNECTING;
+  c->deadline = nowMs() + opts.connectTimeoutMs;
+  d.conns++;
+  conns.push_back(std::move(c));
+  return conns.back().get();
+}
+
+// 连接失败：窗口已开启时结束窗口，否则只是这次探测没有连上
+static void connFailed(Conn& c) {
+  Device& d = *c.dev;
+  if (d.windowOpen) {
+    endWindow(d, WindowEnd::LOST);
+  } else {
+    closeConn(c);
+    d.listing = false;
+    d.nextProbe = nowMs() + opts.probeS * 1000ULL;
+  }
+}
+
+// 一个请求完成：处理结果，然后决定这个连接接下来做什么
+static void onResponse(Conn& c) {
+  Device& d = *c.dev;
+  timelapse::HttpResponse& resp = c.parser.response();
+  if (c.listing) {
+    std::vector<Change> changes;
+    uint32_t next = d.listedSeq;
+    bool more = false;
+    if (resp.status != 200 || !timelapse::parseChanges(resp.body, changes, next, more)) {
+      fprintf(stderr, "%s: 获取变更失败 (HTTP %d)\n", d.name.c_str(), resp.status);
+      d.errors++;
+      connFailed(c);
+      return;
+    }
+    if (next < d.listedSeq) {
+      printf("%s: 设备序号小于本地记录，从头同步\n", d.name.c_str());
+      d.seq = d.listedSeq = 0;
+      d.queue.clear();
+      requestChanges(c);
+      return;
+    }
+    for (const Change& ch : changes) {
+      // 同一路径只看最后一次操作
+      d.queue.erase(std::remove_if(d.queue.begin(), d.queue.end(), [&](const Change& q) { return q.path == ch.path; }),
+                    d.queue.end());
+      if (ch.op == '+' && d.have.count(ch.path + "|" + std::to_string(ch.size)) == 0) d.queue.push_back(ch);
+    }
+    d.listedSeq = next;
+    if (more) {
+      requestChanges(c);
+      return;
+    }
+    d.listing = false;
+    c.listing = false;
+  } else {
+    d.inflight.erase(c.item.seq);
+    activeDownloads--;
+    if (resp.status == 200 && (c.item.size == 0 || resp.body.size() == c.item.size)) {
+      storeFrame(d, c.item, resp.body);
+    } else if (resp.status == 404) {
+      // 列出之后又被删除了，跳过
+    } else {
+      fprintf(stderr, "%s: 下载失败 %s (HTTP %d, %zu/%llu 字节)\n", d.name.c_str(), c.item.path.c_str(), resp.status,
+              resp.body.size(), (unsigned long long)c.item.size);
+      d.errors++;
+      d.failedSeq = std::min(d.failedSeq, c.item.seq);
+    }
+    c.item = Change();
+  }
+  if (!c.parser.keepAlive()) {
+    closeConn(c);
+  } else {
+    c.state = ConnState::IDLE;
+    c.deadline = nowMs() + opts.ioTimeoutMs;
+  }
+  if (d.queue.empty() && d.inflight.empty() && !d.listing) {
+    endWindow(d, WindowEnd::COMPLETE);
+  }
+}
+
+// 分配探测和下载名额
+static void schedule() {
+  uint64_t now = nowMs();
+  for (auto& dp : devices) {
+    Device& d = *dp;
+    if (!d.windowOpen && !d.listing && d.conns == 0 && now >= d.nextProbe) {
+      Conn* c = openConn(d);
+      if (c == nullptr) {
+        d.nextProbe = now + opts.probeS * 1000ULL;
+        continue;
+      }
+      requestChanges(*c);
+    }
+  }
+  // 下载名额：窗口开启越早（越快结束）的设备越优先
+  std::vector<Device*> ready;
+  for (auto& dp : devices) {
+    if (dp->windowOpen && !dp->queue.empty()) ready.push_back(dp.get());
+  }
+  std::sort(ready.begin(), ready.end(), [](Device* a, Device* b) { return a->windowStart < b->windowStart; });
+  for (Device* d : ready) {
+    for (auto& c : conns) {
+      if (activeDownloads >= opts.jobs || d->queue.empty()) break;
+      if (!c->closed && c->dev == d && c->state == ConnState::IDLE) startDownload(*c);
+    }
+    while (activeDownloads < opts.jobs && !d->queue.empty() && d->conns < opts.perDevice) {
+      Conn* c = openConn(*d);
+      if (c == nullptr) break;
+      startDownload(*c);
+    }
+    if (activeDownloads >= opts.jobs) break;
+  }
+}
+
+static void onReady(Conn& c, short events) {
+  if (c.state == ConnState::CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0 || (events & (POLLERR | POLLHUP))) {
+      connFailed(c);
+      return;
+    }
+    Device& d = *c.dev;
+    if (!d.windowOpen) {
+      d.windowOpen = true;
+      d.windowStart = nowMs();
+      d.windows++;
+    }
+    c.state = ConnState::SENDING;
+  }
+  if (c.state == ConnState::SENDING) {
+    ssize_t n = ::send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+    if (n <= 0 && errno != EAGAIN) {
+      connFailed(c);
+      return;
+    }
+    if (n > 0) c.outPos += (size_t)n;
+    if (c.outPos == c.out.size()) c.state = ConnState::RECEIVING;
+    return;
+  }
+  char buf[65536];
+  ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+  if (n < 0 && errno == EAGAIN) return;
+  if (n <= 0) {
+    // 对方关闭：空闲连接只是被设备回收，请求中则视为失败（没有长度信息的响应到此结束）
+    if (c.state == ConnState::IDLE) {
+      closeConn(c);
+      return;
+    }
+    c.parser.finish();
+    if (c.parser.done()) {
+      onResponse(c);
+    } else {
+      connFailed(c);
+    }
+    return;
+  }
+  if (c.state == ConnState::IDLE) return;  // 不应收到数据
+  c.deadline = nowMs() + opts.ioTimeoutMs;
+  c.parser.feed(buf, (size_t)n);
+  if (c.parser.error()) {
+    connFailed(c);
+  } else if (c.parser.done()) {
+    onResponse(c);
+  }
+}
+
+static void report(uint64_t start, uint64_t& lastMs, uint64_t& lastFrames) {
+  uint64_t now = nowMs();
+  double secs = (now - lastMs) / 1000.0;
+  int awake = 0;
+  uint32_t missed = 0, windows = 0;
+  size_t pending = 0;
+  for (auto& d : devices) {
+    awake += d->windowOpen ? 1 : 0;
+    missed += d->missed;
+    windows += d->windows;
+    pending += d->queue.size() + d->inflight.size();
+  }
+  printf("[%5.0f s] 照片 %llu (+%llu, %.2f 张/秒), %.2f MB, 窗口中 %d/%zu 台, 待下载 %zu, 窗口 %u, 错过 %u\n",
+         (now - start) / 1000.0, (unsigned long long)totalFrames, (unsigned long long)(totalFrames - lastFrames),
+         secs > 0 ? (totalFrames - lastFrames) / secs : 0.0, totalBytes / 1048576.0, awake, devices.size(), pending,
+         windows, missed);
+  fflush(stdout);
+  lastMs = now;
+  lastFrames = totalFrames;
+}
+
+static void onSignal(int) { stopping = true; }
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "用法: %s <设备列表> <存储目录> [-j 下载总并发] [-c 每台设备连接数] [--probe 秒] [--rest 秒] "
+            "[--report 秒] [--duration 秒]\n",
+            argv[0]);
+    return 2;
+  }
+  store = argv[2];
+  while (!store.empty() && store.back() == '/') store.pop_back();
+  for (int i = 3; i + 1 < argc; i++) {
+    std::string a = argv[i];
+    int v = atoi(argv[++i]);
+    if (a == "-j") opts.jobs = std::max(1, v);
+    else if (a == "-c") opts.perDevice = std::max(1, v);
+    else if (a == "--probe") opts.probeS = std::max(1, v);
+    else if (a == "--rest") opts.restS = std::max(0, v);
+    else if (a == "--report") opts.reportS = std::max(1, v);
+    else if (a == "--duration") opts.durationS = std::max(0, v);
+  }
+  makeDirs(store + "/objects/");
+  if (!loadDevices(argv[1])) {
+    fprintf(stderr, "无法读取设备列表: %s\n", argv[1]);
+    return 2;
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+  printf("采集 %zu 台设备 -> %s（下载并发 %d，每台 %d 个连接，探测间隔 %d 秒）\n", devices.size(), store.c_str(),
+         opts.jobs, opts.perDevice, opts.probeS);
+
+  uint64_t start = nowMs();
+  uint64_t lastReport = start, lastFrames = 0, lastLoop = start;
+  std::vector<pollfd> fds;
+  std::vector<Conn*> polled;
+  while (!stopping && (opts.durationS == 0 || nowMs() - start < opts.durationS * 1000ULL)) {
+    schedule();
+    fds.clear();
+    polled.clear();
+    for (auto& c : conns) {
+      if (c->closed) continue;
+      short events = (c->state == ConnState::CONNECTING || c->state == ConnState::SENDING) ? POLLOUT : POLLIN;
+      fds.push_back({c->fd, events, 0});
+      polled.push_back(c.get());
+    }
+    poll(fds.data(), fds.size(), 100);
+    for (size_t i = 0; i < fds.size(); i++) {
+      if (fds[i].revents != 0 && !polled[i]->closed) onReady(*polled[i], fds[i].revents);
+    }
+    uint64_t now = nowMs();
+    for (Conn* c : polled) {
+      if (c->closed || now < c->deadline) continue;
+      if (c->state == ConnState::IDLE) {
+        closeConn(*c);  // 空闲连接超时，设备端也会回收
+      } else {
+        connFailed(*c);
+      }
+    }
+    conns.erase(std::remove_if(conns.begin(), conns.end(), [](const std::unique_ptr<Conn>& c) { return c->closed; }),
+                conns.end());
+    if (activeDownloads > 0) activeMs += now - lastLoop;
+    lastLoop = now;
+    if (now - lastReport >= opts.reportS * 1000ULL) report(start, lastReport, lastFrames);
+  }
+
+  // 退出前保存各设备已完成的进度
+  for (auto& d : devices) {
+    if (d->windowOpen) endWindow(*d, WindowEnd::SHUTDOWN);
+  }
+  double secs = (nowMs() - start) / 1000.0;
+  uint32_t windows = 0, missed = 0, missedFrames = 0, errors = 0;
+  printf("\n%-12s %8s %10s %6s %6s %8s %6s %8s\n", "设备", "照片", "MB", "窗口", "错过", "错过张数", "错误", "进度");
+  for (auto& d : devices) {
+    printf("%-12s %8llu %10.2f %6u %6u %8u %6u %8u\n", d->name.c_str(), (unsigned long long)d->frames,
+           d->bytes / 1048576.0, d->windows, d->missed, d->missedFrames, d->errors, d->seq);
+    windows += d->windows;
+    missed += d->missed;
+    missedFrames += d->missedFrames;
+    errors += d->errors;
+  }
+  printf("共 %llu 张（内容重复 %llu 张）, %.2f MB, 运行 %.1f 秒, 平均 %.2f 张/秒, 下载期间 %.2f 张/秒 %.2f MB/s, "
+         "窗口 %u 个, 错过 %u 个（%u 张）, 错误 %u\n",
+         (unsigned long long)totalFrames, (unsigned long long)dedupFrames, totalBytes / 1048576.0, secs,
+         secs > 0 ? totalFrames / secs : 0.0, activeMs > 0 ? totalFrames * 1000.0 / activeMs : 0.0,
+         activeMs > 0 ? totalBytes / 1048576.0 * 1000.0 / activeMs : 0.0, windows, missed, missedFrames, errors);
+  return 0;
+}
@@ -0,0 +1,151 @@
+// Web服务器压力测试：多个连接并发下载照片，统计每秒请求数和延迟分布
+//
+// 不指定路径时先从 /api/changes 取最近的照片（最多50张，相当于打开一页缩略图墙），各连接轮流下载。
+// 默认每个连接使用keep-alive；--close 每个请求后断开重连，用于和以前每张图片一个连接的做法比较。
+//
+// 用法: http_load <设备IP[:端口]> [--conns 连接数] [--seconds 秒] [--path /photo?file=...] [--close]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/http_client.h"
+
+using timelapse::HttpClient;
+using timelapse::HttpResponse;
+
+struct Options {
+  int conns = 4;
+  int seconds = 10;
+  bool close = false;
+};
+
+struct WorkerResult {
+  std::vector<uint32_t> latencyUs;
+  uint64_t bytes = 0;
+  uint32_t errors = 0;
+  uint32_t connects = 0;
+};
+
+static uint64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// 从变更记录中取出照片路径（只认 "path":"..." 字段，设备生成的路径不含引号和反斜杠）
+static std::vector<std::string> listPhotos(HttpClient& client) {
+  std::vector<std::string> targets;
+  HttpResponse resp;
+  if (!client.get("/api/changes?since=0&limit=500", resp) || resp.status != 200) {
+    return targets;
+  }
+  const std::string key = "\"path\":\"";
+  for (size_t pos = resp.body.find(key); pos != std::string::npos; pos = resp.body.find(key, pos)) {
+    pos += key.size();
+    size_t end = resp.body.find('"', pos);
+    if (end == std::string::npos) break;
+    std::string path = resp.body.substr(pos, end - pos);
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".jpg") == 0) {
+      targets.push_back("/photo?file=" + HttpClient::urlEncode(path) + "&thumb=1");
+    }
+  }
+  if (targets.size() > 50) {
+    targets.erase(targets.begin(), targets.end() - 50);  // 最近的50张
+  }
+  return targets;
+}
+
+static void runWorker(const std::string& host, const std::string& port, const std::vector<std::string>& targets,
+                      int index, const Options& opts, uint64_t deadlineUs, WorkerResult* out) {
+  HttpClient client(host, port, 10);
+  size_t next = (size_t)index;
+  bool connected = false;
+  while (nowUs() < deadlineUs) {
+    const std::string& target = targets[next++ % targets.size()];
+    if (!connected) out->connects++;
+    HttpResponse resp;
+    uint64_t start = nowUs();
+    bool ok = client.get(target, resp) && resp.status == 200;
+    uint64_t elapsed = nowUs() - start;
+    if (!ok) {
+      out->errors++;
+      client.close();
+      connected = false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    out->latencyUs.push_back((uint32_t)std::min<uint64_t>(elapsed, UINT32_MAX));
+    out->bytes += resp.body.size();
+    connected = !opts.close;
+    if (opts.close) client.close();
+  }
+}
+
+static double percentileMs(const std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t i = (size_t)(p / 100.0 * (double)(sorted.size() - 1) + 0.5);
+  return sorted[std::min(i, sorted.size() - 1)] / 1000.0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "用法: %s <设备IP[:端口]> [--conns 连接数] [--seconds 秒] [--path /photo?file=...] [--close]\n",
+            argv[0]);
+    return 2;
+  }
+  std::string host, port;
+  timelapse::splitHostPort(argv[1], host, port);
+  Options opts;
+  std::vector<std::string> targets;
+  for (int i = 2; i < argc; i++) {
+    std::string a = argv[i];
+    if (a == "--close") opts.close = true;
+    else if (a == "--conns" && i + 1 < argc) opts.conns = std::max(1, atoi(argv[++i]));
+    else if (a == "--seconds" && i + 1 < argc) opts.seconds = std::max(1, atoi(argv[++i]));
+    else if (a == "--path" && i + 1 < argc) targets.push_back(argv[++i]);
+  }
+
+  if (targets.empty()) {
+    HttpClient client(host, port, 10);
+    targets = listPhotos(client);
+    if (targets.empty()) {
+      fprintf(stderr, "无法从 %s 获取照片列表，请用 --path 指定请求路径\n", argv[1]);
+      return 1;
+    }
+  }
+  printf("%d 个连接，%d 秒，%zu 个请求路径，%s\n", opts.conns, opts.seconds, targets.size(),
+         opts.close ? "每个请求新建连接" : "keep-alive");
+  fflush(stdout);
+
+  std::vector<WorkerResult> results(opts.conns);
+  std::vector<std::thread> threads;
+  uint64_t start = nowUs();
+  uint64_t deadline = start + (uint64_t)opts.seconds * 1000000;
+  for (int i = 0; i < opts.conns; i++) {
+    threads.emplace_back(runWorker, host, port, std::cref(targets), i, std::cref(opts), deadline, &results[i]);
+  }
+  for (auto& t : threads) t.join();
+  double elapsedS = (nowUs() - start) / 1e6;
+
+  std::vector<uint32_t> all;
+  uint64_t bytes = 0;
+  uint32_t errors = 0, connects = 0;
+  for (const WorkerResult& r : results) {
+    all.insert(all.end(), r.latencyUs.begin(), r.latencyUs.end());
+    bytes += r.bytes;
+    errors += r.errors;
+    connects += r.connects;
+  }
+  std::sort(all.begin(), all.end());
+  printf("请求: %zu 成功, %u 失败, %u 次建立连接\n", all.size(), errors, connects);
+  printf("吞吐: %.1f 请求/秒, %.1f KB/s\n", all.size() / elapsedS, bytes / 1024.0 / elapsedS);
+  printf("延迟: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, 最大 %.1f ms\n", percentileMs(all, 50), percentileMs(all, 90),
+         percentileMs(all, 99), all.empty() ? 0.0 : all.back() / 1000.0);
+  return all.empty() ? 1 : 0;
+}
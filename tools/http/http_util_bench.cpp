@@ -0,0 +1,428 @@
+// 固件请求解析模块（src/http_util.h）的模糊测试和性能测试
+//
+// 模糊测试：随机生成查询字符串和路径（偏重 % + / . & = NUL 等字符），与简单直接的参考实现逐一比较，
+// 并检查输出不越界（缓冲区后的哨兵字节不被改写）、原地解码与复制解码一致、编码/转义可以还原、
+// 规范化路径不含 . 和 .. 路径段且结果幂等。
+// 性能测试：按 /photo、/delete 和照片列表的典型请求，比较原来基于String的做法（参数解码成字符串、
+// urlDecode()再解码一次、indexOf/endsWith检查、urlEncode()拼接）和现在的定长缓冲区做法，
+// 输出每个请求的耗时（ns）和堆分配次数。原来的做法在这里用std::string模拟，短字符串不分配内存，
+// 比设备上每次都分配的Arduino String乐观。
+//
+// 用法: http_util_bench [模糊测试次数，默认200000] [随机种子]
+// 模糊测试全部通过时返回0
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http_util.h"
+
+// 统计堆分配次数
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// ---------------- 原来的String做法（固件中被替换的代码，按原逻辑移植） ----------------
+
+static int legacyHexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// HttpServer::decode()
+static std::string legacyServerDecode(const char* str, size_t len) {
+  std::string out;
+  out.reserve(len);
+  for (size_t i = 0; i < len; i++) {
+    char c = str[i];
+    if (c == '+') {
+      out += ' ';
+    } else if (c == '%' && i + 2 < len && legacyHexValue(str[i + 1]) >= 0 && legacyHexValue(str[i + 2]) >= 0) {
+      out += (char)(legacyHexValue(str[i + 1]) * 16 + legacyHexValue(str[i + 2]));
+      i += 2;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+// HttpServer::parseArgs()
+static void legacyParseArgs(const char* str, size_t len, std::vector<std::pair<std::string, std::string>>& args) {
+  size_t pos = 0;
+  while (pos < len) {
+    size_t end = pos;
+    while (end < len && str[end] != '&') end++;
+    size_t eq = pos;
+    while (eq < end && str[eq] != '=') eq++;
+    if (eq > pos) {
+      args.emplace_back(legacyServerDecode(str + pos, eq - pos),
+                        eq < end ? legacyServerDecode(str + eq + 1, end - eq - 1) : std::string());
+    }
+    pos = end + 1;
+  }
+}
+
+// urlDecode()：只有两位都是0-9时才解码
+static std::string legacyUrlDecode(const std::string& str) {
+  std::string decoded = "";
+  for (size_t i = 0; i < str.length(); i++) {
+    char c = str[i];
+    if (c == '+') {
+      decoded += ' ';
+    } else if (c == '%' && i + 2 < str.length() && isdigit((unsigned char)str[i + 1]) &&
+               isdigit((unsigned char)str[i + 2])) {
+      decoded += (char)((str[i + 1] - '0') * 16 + (str[i + 2] - '0'));
+      i += 2;
+    } else {
+      decoded += c;
+    }
+  }
+  return decoded;
+}
+
+// urlEncode()
+static std::string legacyUrlEncode(const std::string& str) {
+  std::string encoded = "";
+  for (char c : str) {
+    switch (c) {
+      case ' ': encoded += "%20"; break;
+      case '+': encoded += "%2B"; break;
+      case '/': encoded += "%2F"; break;
+      case '?': encoded += "%3F"; break;
+      case '%': encoded += "%25"; break;
+      case '#': encoded += "%23"; break;
+      case '&': encoded += "%26"; break;
+      case '=': encoded += "%3D"; break;
+      default: encoded += c;
+    }
+  }
+  return encoded;
+}
+
+static bool endsWith(const std::string& s, const char* suffix) {
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// ---------------- 参考实现（只求直观正确，不考虑性能） ----------------
+
+// 解码；解码出NUL时返回false
+static bool refDecode(const std::string& s, std::string& out) {
+  out.clear();
+  for (size_t i = 0; i < s.size(); i++) {
+    char c = s[i];
+    if (c == '+') {
+      c = ' ';
+    } else if (c == '%' && i + 2 < s.size() && isxdigit((unsigned char)s[i + 1]) && isxdigit((unsigned char)s[i + 2])) {
+      c = (char)std::stoi(s.substr(i + 1, 2), nullptr, 16);
+      i += 2;
+      if (c == 0) return false;
+    } else if (c == 0) {
+      return false;
+    }
+    out += c;
+  }
+  return true;
+}
+
+static std::vector<std::pair<std::string, std::string>> refParse(const std::string& q) {
+  std::vector<std::pair<std::string, std::string>> args;
+  size_t pos = 0;
+  while (pos < q.size()) {
+    size_t end = q.find('&', pos);
+    if (end == std::string::npos) end = q.size();
+    std::string pair = q.substr(pos, end - pos);
+    pos = end + 1;
+    size_t eq = pair.find('=');
+    std::string name, value;
+    if (eq == 0 || !refDecode(pair.substr(0, eq), name) || name.empty()) continue;
+    if (eq != std::string::npos && !refDecode(pair.substr(eq + 1), value)) continue;
+    args.emplace_back(name, value);
+  }
+  return args;
+}
+
+// 规范化；无效时返回false
+static bool refCanonical(const std::string& p, std::string& out) {
+  out.clear();
+  if (p.empty() || p.back() == '/') return false;
+  std::vector<std::string> segments;
+  std::string seg;
+  for (size_t i = 0; i <= p.size(); i++) {
+    if (i == p.size() || p[i] == '/') {
+      if (!seg.empty()) segments.push_back(seg);
+      seg.clear();
+    } else {
+      seg += p[i];
+    }
+  }
+  if (segments.empty()) return false;
+  for (const std::string& s : segments) {
+    if (s == "." || s == "..") return false;
+    for (unsigned char c : s) {
+      if (c < 0x20 || c == 0x7F || c == '\\') return false;
+    }
+    out += "/" + s;
+  }
+  return true;
+}
+
+// ---------------- 模糊测试 ----------------
+
+static int failures = 0;
+
+static void fail(const char* what, const std::string& input) {
+  if (failures++ < 20) {
+    printf("失败: %s，输入: \"", what);
+    for (unsigned char c : input) {
+      if (c >= 0x20 && c < 0x7F) putchar(c);
+      else printf("\\x%02X", c);
+    }
+    printf("\"\n");
+  }
+}
+
+static std::string randomInput(std::mt19937& rng) {
+  static const char alphabet[] = "%%%++//..&&==\\aAfF09_-:<>\"'~ \x01\x7F";
+  std::uniform_int_distribution<int> lenDist(0, 48);
+  std::uniform_int_distribution<int> kind(0, 9);
+  std::uniform_int_distribution<int> pick(0, sizeof(alphabet) - 2);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::string s;
+  int len = lenDist(rng);
+  for (int i = 0; i < len; i++) {
+    int k = kind(rng);
+    if (k == 0) {
+      s += (char)byte(rng);
+    } else if (k == 1) {
+      const char* pieces[] = {"%2F", "%2f", "%2e", "%2E%2E", "%00", "%0", "%", "..", "/./", "%25", "%3A"};
+      s += pieces[byte(rng) % (sizeof(pieces) / sizeof(pieces[0]))];
+    } else {
+      s += alphabet[pick(rng)];
+    }
+  }
+  return s;
+}
+
+static const char SENTINEL = (char)0xA5;
+
+static void fuzzOne(const std::string& in) {
+  char buf[2048];
+  char buf2[2048];
+
+  // 解码：与参考实现一致，恰好够用的缓冲区成功，小一个字节失败，都不越界
+  std::string expected;
+  bool ok = refDecode(in, expected);
+  memset(buf, SENTINEL, sizeof(buf));
+  int n = urlDecodeTo(in.data(), in.size(), buf, expected.size() + 1);
+  if (ok != (n >= 0) || (ok && (std::string(buf, n) != expected || buf[n] != 0))) fail("解码结果与参考实现不一致", in);
+  if (buf[expected.size() + 1] != SENTINEL) fail("解码越界", in);
+  if (ok && urlDecodeTo(in.data(), in.size(), buf, expected.size()) >= 0) fail("解码缓冲区不够时没有失败", in);
+  if (ok) {
+    memcpy(buf2, in.data(), in.size());
+    int m = urlDecodeTo(buf2, in.size(), buf2, in.size() + 1);
+    if (m != n || memcmp(buf2, expected.data(), m) != 0) fail("原地解码与复制解码不一致", in);
+  }
+
+  // 编码后解码还原（原始字节中有NUL时解码会拒绝）
+  memset(buf, SENTINEL, sizeof(buf));
+  int e = urlEncodeTo(in.data(), in.size(), buf, in.size() * 3 + 1);
+  if (e < 0 || buf[in.size() * 3 + 1] != SENTINEL) fail("编码失败或越界", in);
+  for (int i = 0; i < e; i++) {
+    if (!(isalnum((unsigned char)buf[i]) || strchr("-_.~%", buf[i]))) fail("编码结果含有未编码的字符", in);
+  }
+  bool hasNul = in.find('\0') != std::string::npos;
+  int d = urlDecodeTo(buf, e, buf2, sizeof(buf2));
+  if (hasNul ? d >= 0 : (d != (int)in.size() || memcmp(buf2, in.data(), in.size()) != 0)) fail("编码后解码不能还原", in);
+
+  // HTML转义：结果不含 < > " '，反转义后还原
+  memset(buf, SENTINEL, sizeof(buf));
+  int h = htmlEscapeTo(in.data(), in.size(), buf, in.size() * 6 + 1);
+  if (h < 0 || buf[in.size() * 6 + 1] != SENTINEL) fail("转义失败或越界", in);
+  std::string escaped(buf, h > 0 ? h : 0);
+  if (escaped.find_first_of("<>\"'") != std::string::npos) fail("转义结果含有特殊字符", in);
+  std::string unescaped;
+  for (size_t i = 0; i < escaped.size(); i++) {
+    const char* names[] = {"&amp;", "&lt;", "&gt;", "&quot;", "&#39;"};
+    const char chars[] = {'&', '<', '>', '"', '\''};
+    bool matched = false;
+    for (int k = 0; k < 5 && !matched; k++) {
+      if (escaped.compare(i, strlen(names[k]), names[k]) == 0) {
+        unescaped += chars[k];
+        i += strlen(names[k]) - 1;
+        matched = true;
+      }
+    }
+    if (!matched) {
+      if (escaped[i] == '&') fail("转义结果含有单独的&", in);
+      unescaped += escaped[i];
+    }
+  }
+  if (unescaped != in) fail("反转义不能还原", in);
+
+  // 参数解析：与参考实现一致，只写到str[len]为止
+  memset(buf, SENTINEL, sizeof(buf));
+  memcpy(buf, in.data(), in.size());
+  buf[in.size()] = 0;
+  std::vector<std::pair<std::string, std::string>> args;
+  size_t pos = 0;
+  const char* name;
+  const char* value;
+  while (queryNext(buf, in.size(), pos, name, value)) {
+    args.emplace_back(name, value);
+  }
+  if (args != refParse(in)) fail("参数解析与参考实现不一致", in);
+  if (buf[in.size() + 1] != SENTINEL) fail("参数解析越界", in);
+
+  // 路径规范化：与参考实现一致，结果幂等
+  std::string canonical;
+  ok = refCanonical(in, canonical);
+  memset(buf, SENTINEL, sizeof(buf));
+  n = pathCanonicalize(in.data(), in.size(), buf, canonical.size() + 1);
+  if (ok != (n >= 0) || (ok && std::string(buf, n) != canonical)) fail("路径规范化与参考实现不一致", in);
+  if (buf[canonical.size() + 1] != SENTINEL) fail("路径规范化越界", in);
+  if (ok) {
+    int again = pathCanonicalize(buf, n, buf2, sizeof(buf2));
+    if (again != n || memcmp(buf, buf2, n) != 0) fail("规范化结果不是幂等的", in);
+    if (pathCanonicalize(buf, n, buf2, n) >= 0) fail("规范化缓冲区不够时没有失败", in);
+  }
+}
+
+// 已知的问题输入：原来的 urlDecode() 不解码 %2F 这样的十六进制转义，路径检查只查找 ".."
+static void fixedCases() {
+  struct Case {
+    const char* query;
+    const char* canonical;  // NULL=应被拒绝
+  } cases[] = {
+    {"file=%2F2026_W03%2F2026_01_15_10%3A20.jpg", "/2026_W03/2026_01_15_10:20.jpg"},
+    {"file=2026_W03/2026_01_15_10:20.jpg", "/2026_W03/2026_01_15_10:20.jpg"},
+    {"file=%2F%2F2026_W03%2F%2Fa.jpg", "/2026_W03/a.jpg"},
+    {"file=%2F2026_W03%2F..%2Fa.jpg", NULL},
+    {"file=%2e%2e%2Fa.jpg", NULL},
+    {"file=a.jpg%00.txt", NULL},
+    {"file=%2F2026_W03%2F", NULL},
+    {"file=..%5Ca.jpg", NULL},
+  };
+  for (const Case& c : cases) {
+    char query[128];
+    snprintf(query, sizeof(query), "%s", c.query);
+    size_t pos = 0;
+    const char* name;
+    const char* value = NULL;
+    bool found = false;
+    while (queryNext(query, strlen(query), pos, name, value)) {
+      if (strcmp(name, "file") == 0) {
+        found = true;
+        break;
+      }
+    }
+    char path[HTTP_PATH_MAX];
+    int n = found ? pathCanonicalize(value, strlen(value), path, sizeof(path)) : -1;
+    bool pass = c.canonical ? (n >= 0 && strcmp(path, c.canonical) == 0) : n < 0;
+    if (!pass) {
+      fail("固定用例", c.query);
+    }
+  }
+  if (legacyUrlDecode("%2F2026_W03") != "%2F2026_W03") {
+    fail("原来的urlDecode()行为与预期不同", "%2F2026_W03");
+  }
+}
+
+// ---------------- 性能测试 ----------------
+
+static volatile size_t sink;
+
+template <typename F>
+static void bench(const char* label, int iterations, F f) {
+  for (int i = 0; i < iterations / 10; i++) f();  // 预热
+  uint64_t allocBefore = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) f();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  printf("  %8.1f ns/请求  %5.1f 次分配/请求  %s\n", (double)ns / iterations,
+         (double)(allocations - allocBefore) / iterations, label);
+}
+
+static void runBench() {
+  const char* query = "file=%2F2026_W03%2F2026_01_15_10%3A20.jpg&download=1";
+  const size_t queryLen = strlen(query);
+  const std::string listPath = "/2026_W03/2026_01_15_10:20.jpg";
+  const int iterations = 1000000;
+
+  printf("性能测试（%d 次）:\n", iterations);
+  printf("/photo、/delete 请求（解析参数并校验路径）:\n");
+  bench("原来（String）", iterations, [&]() {
+    std::vector<std::pair<std::string, std::string>> args;
+    legacyParseArgs(query, queryLen, args);
+    std::string file;
+    for (auto& a : args) {
+      if (a.first == "file") file = a.second;
+    }
+    std::string path = legacyUrlDecode(file);
+    if (path.empty() || path[0] != '/') path = "/" + path;
+    bool valid = path.find("..") == std::string::npos && endsWith(path, ".jpg");
+    sink = valid ? path.size() : 0;
+  });
+  bench("现在（定长缓冲区）", iterations, [&]() {
+    char buf[128];
+    memcpy(buf, query, queryLen + 1);
+    size_t pos = 0;
+    const char* name;
+    const char* value;
+    const char* file = NULL;
+    while (queryNext(buf, queryLen, pos, name, value)) {
+      if (strcmp(name, "file") == 0) file = value;
+    }
+    char path[HTTP_PATH_MAX];
+    int n = file ? pathCanonicalize(file, strlen(file), path, sizeof(path)) : -1;
+    sink = n >= 0 && pathHasExtension(path, n, ".jpg") ? n : 0;
+  });
+
+  printf("照片列表的一行（编码链接、显示文件名）:\n");
+  bench("原来（String）", iterations, [&]() {
+    std::string encoded = legacyUrlEncode(listPath);
+    std::string display = listPath.substr(1);
+    std::string row = "<a href='/photo?file=" + encoded + "'>" + display + "</a>";
+    sink = row.size();
+  });
+  bench("现在（定长缓冲区）", iterations, [&]() {
+    char encoded[HTTP_PATH_MAX * 3];
+    char display[HTTP_PATH_MAX * 6];
+    int e = urlEncodeTo(listPath.data(), listPath.size(), encoded, sizeof(encoded));
+    int d = htmlEscapeTo(listPath.data() + 1, listPath.size() - 1, display, sizeof(display));
+    sink = e + d;
+  });
+}
+
+int main(int argc, char** argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 200000;
+  unsigned seed = argc > 2 ? (unsigned)strtoul(argv[2], nullptr, 10) : std::random_device{}();
+
+  fixedCases();
+  std::mt19937 rng(seed);
+  for (int i = 0; i < count; i++) {
+    fuzzOne(randomInput(rng));
+  }
+  printf("模糊测试: %d 个输入（种子 %u），%d 处失败\n", count, seed, failures);
+
+  runBench();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+// 照片写入日志的故障注入测试：直接编译固件中的 src/journal.h，在写入过程的每一个文件操作处模拟断电，
+// 然后像下次唤醒一样调用恢复流程，检查卡上是否留下损坏（截断）的照片、照片是否正好登记一次、恢复用了多少操作。
+//
+// 内存文件系统的假设与FAT上的实际行为一致：写入日志记录只改写一个扇区（要么是旧记录要么是新记录）；
+// 删除和重命名是原子的；写数据块时断电，只有前面一部分（随机长度）落盘。
+// 作为对照，同样的断电点也用于以前直接写最终路径的做法。
+//
+// 用法: journal_fault_test [每个断电点的随机种子数，默认20]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../common/crc32.h"
+#include "journal.h"
+
+struct PowerCut {};
+
+// 可以在第N个写操作处断电的内存文件系统
+struct MemFs {
+  std::map<std::string, std::vector<uint8_t>> files;
+  JournalRecord record{};
+  bool hasRecord = false;
+  std::vector<std::string> registered;  // 同步记录（登记过的照片）
+  std::string open;
+  long cutAt = -1;   // 第几个写操作时断电（-1=不断电）
+  long ops = 0;      // 已执行的写操作数
+  long reads = 0;    // 恢复时的读操作数（检查恢复与照片数量无关）
+  std::mt19937 rng{1};
+
+  // 每个改变卡上内容的操作之前调用；到达断电点时抛出PowerCut
+  void tick() {
+    if (ops++ == cutAt) throw PowerCut();
+  }
+
+  bool setRecord(JournalState state, const char* path, uint32_t size, uint32_t crc, uint32_t seq) {
+    tick();
+    memset(&record, 0, sizeof(record));
+    record.magic = JOURNAL_MAGIC;
+    record.state = state;
+    record.size = size;
+    record.crc = crc;
+    record.seq = seq;
+    strncpy(record.path, path, sizeof(record.path) - 1);
+    hasRecord = true;
+    return true;
+  }
+  bool readRecord(JournalRecord& r) {
+    reads++;
+    r = record;
+    return hasRecord;
+  }
+  bool create(const char* path) {
+    tick();
+    files[path].clear();
+    open = path;
+    return true;
+  }
+  size_t write(const uint8_t* data, size_t len) {
+    std::vector<uint8_t>& f = files[open];
+    if (cutAt >= 0 && ops == cutAt) {
+      size_t torn = std::uniform_int_distribution<size_t>(0, len)(rng);  // 断电时只写入了一部分
+      f.insert(f.end(), data, data + torn);
+    }
+    tick();
+    f.insert(f.end(), data, data + len);
+    return len;
+  }
+  void close() { open.clear(); }
+  bool remove(const char* path) {
+    tick();
+    return files.erase(path) > 0;
+  }
+  bool exists(const char* path) {
+    reads++;
+    return files.count(path) > 0;
+  }
+  bool rename(const char* from, const char* to) {
+    tick();
+    auto it = files.find(from);
+    if (it == files.end() || files.count(to)) return false;
+    files[to] = std::move(it->second);
+    files.erase(from);
+    return true;
+  }
+  bool verify(const char* path, uint32_t size) {
+    reads++;
+    auto it = files.find(path);
+    if (it == files.end()) return false;
+    const std::vector<uint8_t>& f = it->second;
+    return f.size() == size && size >= 4 && f[0] == 0xFF && f[1] == 0xD8 && f[size - 2] == 0xFF &&
+           f[size - 1] == 0xD9;
+  }
+  uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len) { return timelapse::crc32Update(crc, data, len); }
+  void faultPoint(int) { tick(); }  // 固件的三个故障注入点也是断电点
+  void invalidate(const char*) {}
+  uint32_t changeSeq() { return (uint32_t)registered.size(); }
+  bool isRegistered(const char* path, uint32_t seq) {
+    reads++;
+    return registered.size() > seq && registered.back() == path;
+  }
+  void finish(const char* path, uint32_t, uint32_t) {
+    tick();
+    registered.push_back(path);  // 校验记录、上传队列、同步记录（最后一步是同步记录）
+    setRecord(JOURNAL_IDLE, "", 0, 0, 0);
+  }
+};
+
+static std::vector<uint8_t> makeFrame(uint32_t seed, size_t size) {
+  std::vector<uint8_t> data(size);
+  uint32_t x = seed * 2654435761u + 1;
+  for (uint8_t& b : data) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    b = (uint8_t)x;
+  }
+  data[0] = 0xFF;
+  data[1] = 0xD8;
+  data[size - 2] = 0xFF;
+  data[size - 1] = 0xD9;
+  return data;
+}
+
+struct Tally {
+  long cuts = 0;
+  long completed = 0;    // 恢复时完成提交
+  long rolledBack = 0;   // 恢复时回滚
+  long intact = 0;       // 断电前已完整提交（恢复时无事可做）
+  long corrupted = 0;    // 最终路径上的照片既不是旧内容也不是新内容
+  long lost = 0;         // 覆盖同名照片时新旧照片都不在了
+  long unregistered = 0; // 新照片在卡上但没有登记
+  long duplicate = 0;    // 同一张照片登记了两次
+  long phantom = 0;      // 登记了但卡上没有新照片
+  long leftovers = 0;    // 恢复后残留的临时文件
+  long maxRecoverOps = 0;
+  double maxRecoverUs = 0;
+};
+
+static const char* kPath = "/2026_W03/2026_01_15_10_20.jpg";
+
+// 以前的做法：直接写最终路径，写完登记
+static void directWrite(MemFs& fs, const std::vector<uint8_t>& frame) {
+  fs.tick();
+  fs.files[kPath].clear();
+  fs.open = kPath;
+  for (size_t pos = 0; pos < frame.size(); pos += 4096) {
+    fs.write(frame.data() + pos, std::min((size_t)4096, frame.size() - pos));
+  }
+  fs.close();
+  fs.finish(kPath, (uint32_t)frame.size(), fs.crc32(0, frame.data(), frame.size()));
+}
+
+// 写一张照片，在第cut个写操作处断电，然后恢复并检查结果；direct=true时按以前的做法直接写最终路径
+static void runCut(long cut, uint32_t seed, bool overwrite, bool direct, int otherPhotos, Tally& t) {
+  MemFs fs;
+  fs.rng.seed(seed * 7919u + (uint32_t)cut);
+  for (int i = 0; i < otherPhotos; i++) {
+    char name[48];
+    snprintf(name, sizeof(name), "/2026_W03/2026_01_14_%02d_%02d.jpg", i / 60, i % 60);
+    fs.files[name] = makeFrame(1000 + i, 2048);
+    fs.registered.push_back(name);
+  }
+  std::vector<uint8_t> oldFrame = makeFrame(seed + 500, 30000);
+  if (overwrite) {
+    fs.files[kPath] = oldFrame;
+    fs.registered.push_back(kPath);
+  }
+  size_t registeredBefore = fs.registered.size();
+  std::vector<uint8_t> frame = makeFrame(seed, 150 * 1024 + seed % 4096);
+
+  fs.cutAt = cut;
+  bool cutHappened = false;
+  try {
+    if (direct) {
+      directWrite(fs, frame);
+    } else {
+      uint32_t crc = 0;
+      size_t written = 0;
+      if (journalWriteFrameTo(fs, kPath, frame.data(), frame.size(), crc, written) == JOURNAL_OK) {
+        fs.finish(kPath, (uint32_t)frame.size(), crc);
+      }
+    }
+  } catch (const PowerCut&) {
+    cutHappened = true;
+  }
+  if (!cutHappened) return;
+  t.cuts++;
+
+  // 下次唤醒：恢复（不再断电）
+  fs.cutAt = -1;
+  fs.ops = 0;
+  fs.reads = 0;
+  auto start = std::chrono::steady_clock::now();
+  JournalRecord record;
+  JournalRecovery r = direct ? JOURNAL_RECOVERY_NONE : journalRecoverWith(fs, record);
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  t.maxRecoverUs = std::max(t.maxRecoverUs, us);
+  t.maxRecoverOps = std::max(t.maxRecoverOps, fs.ops + fs.reads);
+  if (r == JOURNAL_RECOVERY_COMPLETED) t.completed++;
+  else if (r == JOURNAL_RECOVERY_ROLLED_BACK) t.rolledBack++;
+  else t.intact++;
+
+  // 检查卡上所有照片
+  bool hasNew = false;
+  for (auto& f : fs.files) {
+    const std::string& name = f.first;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+      t.leftovers++;
+      continue;
+    }
+    if (name != kPath) continue;
+    if (f.second == frame) hasNew = true;
+    else if (!(overwrite && f.second == oldFrame)) t.corrupted++;
+  }
+  if (overwrite && !fs.files.count(kPath)) t.lost++;
+  long newRegs = (long)(fs.registered.size() - registeredBefore);
+  if (hasNew && newRegs == 0) t.unregistered++;
+  if (newRegs > 1) t.duplicate++;
+  if (!hasNew && newRegs > 0) t.phantom++;
+}
+
+// 不断电时一次写入用多少个写操作（断电点的范围）
+static long countOps(bool overwrite, bool direct) {
+  MemFs fs;
+  std::vector<uint8_t> frame = makeFrame(1, 150 * 1024 + 1);
+  if (overwrite) fs.files[kPath] = makeFrame(2, 1000);
+  if (direct) {
+    directWrite(fs, frame);
+  } else {
+    uint32_t crc = 0;
+    size_t written = 0;
+    journalWriteFrameTo(fs, kPath, frame.data(), frame.size(), crc, written);
+    fs.finish(kPath, (uint32_t)frame.size(), crc);
+  }
+  return fs.ops;
+}
+
+int main(int argc, char** argv) {
+  int seeds = argc > 1 ? std::max(1, atoi(argv[1])) : 20;
+  struct Scenario {
+    const char* name;
+    bool overwrite;
+    bool direct;
+  } scenarios[] = {
+      {"写入日志: 新照片", false, false},
+      {"写入日志: 覆盖同名照片", true, false},
+      {"直接写最终路径（以前的做法）", false, true},
+  };
+  bool failed = false;
+  printf("断电点  完成  回滚  无需恢复  损坏  丢失  未登记  重复登记  多余登记  残留临时文件  恢复操作数  恢复耗时us  场景\n");
+  for (const Scenario& sc : scenarios) {
+    Tally t;
+    long total = countOps(sc.overwrite, sc.direct);
+    for (uint32_t seed = 1; seed <= (uint32_t)seeds; seed++) {
+      for (long cut = 0; cut < total; cut++) {
+        runCut(cut, seed, sc.overwrite, sc.direct, seed == 1 ? 500 : 5, t);
+      }
+    }
+    printf("%6ld  %4ld  %4ld  %8ld  %4ld  %4ld  %6ld  %8ld  %8ld  %12ld  %10ld  %10.1f  %s\n", t.cuts, t.completed,
+           t.rolledBack, t.intact, t.corrupted, t.lost, t.unregistered, t.duplicate, t.phantom, t.leftovers,
+           t.maxRecoverOps, t.maxRecoverUs, sc.name);
+    if (!sc.direct && (t.corrupted || t.lost || t.unregistered || t.duplicate || t.phantom || t.leftovers)) {
+      failed = true;
+    }
+  }
+  printf("（恢复操作数和恢复耗时为最大值；卡上另有5或500张照片，恢复操作数不随照片数量变化）\n");
+  if (failed) {
+    printf("失败: 写入日志在某个断电点留下了损坏、丢失或登记错误的照片\n");
+    return 1;
+  }
+  printf("通过: 写入日志在所有断电点之后都没有损坏的照片\n");
+  return 0;
+}
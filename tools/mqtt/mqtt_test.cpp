@@ -0,0 +1,455 @@
+// MQTT事件发布测试：在本机启动一个替身MQTT服务器，用固件的报文编码和收发（直接编译 src/mqtt_util.h）
+// 按固件的做法（每批MQTT_BATCH条连续发送、等齐PUBACK、只按顺序确认的部分推进队列）发布事件，检查：
+//   - CONNECT报文（协议名、版本、clean session、keepalive、客户端ID截断到23字节），服务器拒绝和不回应CONNACK的处理
+//   - 报文ID从65535回绕到1（不使用0），确认的ID与发送的一致
+//   - 服务器在一批中途断开：只推进已确认的部分，重连后从第一条未确认的事件重发，不丢事件，重复的只有未确认的那几条
+//   - PUBACK乱序时停在乱序之前
+// 并报告连接、发布的耗时，以及网络延迟不同时按批发布和逐条等待确认的吞吐量。
+//
+// 用法: mqtt_test [事件数，默认200]
+// 检查全部通过时返回0
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mqtt_util.h"
+
+#define MQTT_BATCH 16  // 与固件相同
+#define MQTT_TIMEOUT_MS 2000
+#define MQTT_KEEPALIVE_S 30
+
+static uint64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// ==================== 替身服务器 ====================
+
+struct BrokerConfig {
+  int connackCode = 0;      // CONNACK返回码，-1=不回应
+  int latencyMs = 0;        // 网络延迟：收到一串PUBLISH后等这么久再发出它们的PUBACK（模拟往返时间）
+  int dropAfter = -1;       // 本连接收到第N条PUBLISH后（不确认它）断开，-1=不断开
+  int swapAcksAt = -1;      // 把第N条和第N+1条的PUBACK对调，-1=不对调
+};
+
+struct Broker {
+  int listenFd = -1;
+  uint16_t port = 0;
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+  std::mutex mu;
+  BrokerConfig config;
+  // 记录
+  std::vector<std::string> connects;     // 每个CONNECT的客户端ID
+  std::vector<std::string> connectErrors;
+  std::vector<uint16_t> packetIds;       // 收到的PUBLISH的报文ID
+  std::vector<long> seqs;                // 收到的事件序号
+  std::string topic;
+  uint32_t acks = 0, disconnects = 0, badPublishes = 0;
+
+  void setConfig(const BrokerConfig& c) {
+    std::lock_guard<std::mutex> lock(mu);
+    config = c;
+  }
+  void clear() {
+    std::lock_guard<std::mutex> lock(mu);
+    connects.clear();
+    connectErrors.clear();
+    packetIds.clear();
+    seqs.clear();
+    acks = disconnects = badPublishes = 0;
+  }
+};
+
+static bool readFull(int fd, uint8_t* p, size_t n) {
+  while (n > 0) {
+    ssize_t r = recv(fd, p, n, 0);
+    if (r <= 0) return false;
+    p += r;
+    n -= r;
+  }
+  return true;
+}
+
+static bool readPacket(int fd, uint8_t& header, std::vector<uint8_t>& body) {
+  if (!readFull(fd, &header, 1)) return false;
+  size_t remaining = 0;
+  for (int shift = 0; shift <= 21; shift += 7) {
+    uint8_t c;
+    if (!readFull(fd, &c, 1)) return false;
+    remaining |= (size_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) break;
+  }
+  body.resize(remaining);
+  return remaining == 0 || readFull(fd, body.data(), remaining);
+}
+
+static void serveConnection(Broker& b, int fd) {
+  BrokerConfig cfg;
+  {
+    std::lock_guard<std::mutex> lock(b.mu);
+    cfg = b.config;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  uint8_t header;
+  std::vector<uint8_t> body;
+  int publishes = 0;
+  std::vector<uint8_t> acks;  // 待发出的PUBACK（连续收到的PUBLISH处理完后一起发出）
+  while (readPacket(fd, header, body)) {
+    int type = header >> 4;
+    std::unique_lock<std::mutex> lock(b.mu);
+    if (type == 1) {
+      // 10字节可变报头：协议名"MQTT"、级别4、标志（只有clean session）、keepalive
+      static const uint8_t expect[] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02};
+      size_t idLen = body.size() >= 12 ? (body[10] << 8 | body[11]) : 0;
+      if (body.size() < 12 || memcmp(body.data(), expect, sizeof(expect)) != 0 || body.size() != 12 + idLen) {
+        b.connectErrors.push_back("CONNECT报文格式错误");
+      } else if ((body[8] << 8 | body[9]) != MQTT_KEEPALIVE_S) {
+        b.connectErrors.push_back("keepalive错误");
+      } else if (idLen == 0 || idLen > MQTT_CLIENT_ID_MAX) {
+        b.connectErrors.push_back("客户端ID长度 " + std::to_string(idLen));
+      }
+      b.connects.push_back(std::string(body.begin() + std::min<size_t>(12, body.size()), body.end()));
+      if (cfg.connackCode >= 0) {
+        uint8_t connack[] = {0x20, 0x02, 0x00, (uint8_t)cfg.connackCode};
+        send(fd, connack, sizeof(connack), 0);
+      }
+    } else if (type == 3) {
+      size_t topicLen = body.size() >= 2 ? (body[0] << 8 | body[1]) : 0;
+      if ((header & 0x06) != 0x02 || body.size() < 4 + topicLen) {
+        b.badPublishes++;
+        continue;
+      }
+      b.topic.assign(body.begin() + 2, body.begin() + 2 + topicLen);
+      uint16_t id = body[2 + topicLen] << 8 | body[3 + topicLen];
+      std::string payload(body.begin() + 4 + topicLen, body.end());
+      size_t pos = payload.find("\"seq\":");
+      b.packetIds.push_back(id);
+      b.seqs.push_back(pos == std::string::npos ? -1 : atol(payload.c_str() + pos + 6));
+      if (id == 0) b.badPublishes++;
+      publishes++;
+      if (publishes == cfg.dropAfter) {
+        send(fd, acks.data(), acks.size(), 0);  // 之前的都确认，只有这一条没有确认
+        b.acks += acks.size() / 4;
+        b.disconnects++;
+        break;
+      }
+      const uint8_t ack[] = {0x40, 0x02, (uint8_t)(id >> 8), (uint8_t)id};
+      if (publishes == cfg.swapAcksAt + 1 && acks.size() >= 4) {
+        acks.insert(acks.end() - 4, ack, ack + 4);  // 插到上一条的PUBACK之前
+      } else {
+        acks.insert(acks.end(), ack, ack + 4);
+      }
+      pollfd p{fd, POLLIN, 0};
+      if (publishes == cfg.swapAcksAt || poll(&p, 1, 0) > 0) {
+        continue;  // 后面还有数据（或要与下一条对调），继续读完这一串
+      }
+      lock.unlock();
+      if (cfg.latencyMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(cfg.latencyMs));
+      send(fd, acks.data(), acks.size(), 0);
+      lock.lock();
+      b.acks += acks.size() / 4;
+      acks.clear();
+    } else if (type == 14) {
+      break;  // DISCONNECT
+    }
+  }
+  close(fd);
+}
+
+static void brokerLoop(Broker* b) {
+  while (!b->stopping) {
+    pollfd p{b->listenFd, POLLIN, 0};
+    if (poll(&p, 1, 50) <= 0) continue;
+    int fd = accept(b->listenFd, nullptr, nullptr);
+    if (fd >= 0) serveConnection(*b, fd);  // 一次只服务一个连接，与一台设备的会话相同
+  }
+}
+
+static bool startBroker(Broker& b) {
+  b.listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (b.listenFd < 0 || bind(b.listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(b.listenFd, 4) != 0 ||
+      getsockname(b.listenFd, (sockaddr*)&addr, &len) != 0) {
+    return false;
+  }
+  b.port = ntohs(addr.sin_port);
+  b.thread = std::thread(brokerLoop, &b);
+  return true;
+}
+
+// ==================== 设备端 ====================
+
+// mqtt_util.h 使用的网络操作（非阻塞TCP连接）
+struct SocketIo {
+  int fd = -1;
+  bool closed = false;
+  uint32_t warnings = 0;
+  size_t write(const uint8_t* data, size_t len) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    return n < 0 ? 0 : (size_t)n;
+  }
+  int read() {
+    uint8_t c;
+    ssize_t r = recv(fd, &c, 1, 0);
+    if (r == 1) return c;
+    if (r == 0) closed = true;
+    return -1;
+  }
+  bool connected() { return !closed; }
+  unsigned long ms() { return (unsigned long)nowMs(); }
+  void idle() {
+    pollfd p{fd, POLLIN, 0};
+    poll(&p, 1, 1);
+  }
+  void warn(const char* msg) {
+    warnings++;
+    printf("  警告: %s\n", msg);
+  }
+};
+
+static bool connectSocket(SocketIo& io, uint16_t port) {
+  io.fd = socket(AF_INET, SOCK_STREAM, 0);
+  io.closed = false;
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(port);
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(io.fd, (sockaddr*)&a, sizeof(a)) != 0) return false;
+  int one = 1;
+  setsockopt(io.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  fcntl(io.fd, F_SETFL, O_NONBLOCK);
+  return true;
+}
+
+static void disconnectSocket(SocketIo& io) {
+  const uint8_t d[] = {0xE0, 0x00};
+  io.write(d, sizeof(d));
+  close(io.fd);
+  io.fd = -1;
+}
+
+static std::string eventJson(long seq) {
+  return "{\"seq\":" + std::to_string(seq) +
+         ",\"t\":1790000000,\"reason\":\"timer\",\"awake_ms\":6120,\"ok\":true,\"bytes\":183421,\"w\":1600,\"h\":1200,"
+         "\"q\":10,\"capture_ms\":212,\"write_ms\":380,\"retries\":0,\"free_mb\":28712,\"rssi\":-61,\"batt_mv\":3950}";
+}
+
+struct Session {
+  uint32_t sent = 0;
+  uint64_t connectMs = 0, publishMs = 0;
+  bool connected = false;
+};
+
+// 固件 mqttWakeEnd() 的流程：连接，按批发布队列中的事件，只按确认的条数推进队列（queue是队列中的事件，offset是读取位置）
+static Session publishQueue(SocketIo& io, uint16_t port, const std::vector<std::string>& queue, size_t& offset,
+                            uint16_t& packetId, const char* clientId, const char* topic) {
+  Session s;
+  uint64_t start = nowMs();
+  if (!connectSocket(io, port) || mqttHandshake(io, clientId, MQTT_KEEPALIVE_S, MQTT_TIMEOUT_MS) != 0) {
+    close(io.fd);
+    return s;
+  }
+  s.connected = true;
+  s.connectMs = nowMs() - start;
+  start = nowMs();
+  std::vector<uint8_t> buf(4096);  // 固件的IoBuffer大小
+  while (offset < queue.size()) {
+    uint32_t count = (uint32_t)std::min<size_t>(MQTT_BATCH, queue.size() - offset);
+    uint16_t firstId = packetId;
+    count = mqttSendBatch(io, buf.data(), buf.size(), topic, &queue[offset], count, packetId);
+    uint32_t acked = count > 0 ? mqttAwaitAcks(io, firstId, count, MQTT_TIMEOUT_MS) : 0;
+    offset += acked;
+    s.sent += acked;
+    if (acked < count || count == 0) break;
+  }
+  s.publishMs = nowMs() - start;
+  disconnectSocket(io);
+  return s;
+}
+
+int main(int argc, char** argv) {
+  int total = argc > 1 ? std::max(MQTT_BATCH * 2, atoi(argv[1])) : 200;
+  Broker broker;
+  if (!startBroker(broker)) {
+    fprintf(stderr, "无法启动替身MQTT服务器\n");
+    return 1;
+  }
+  int failures = 0;
+  auto check = [&](bool ok, const std::string& what) {
+    if (!ok) {
+      printf("  失败: %s\n", what.c_str());
+      failures++;
+    }
+  };
+  const char* topic = "timelapse/246f28aabbcc/event";
+  std::vector<std::string> queue;
+  for (int i = 0; i < total; i++) queue.push_back(eventJson(i));
+
+  // 1. CONNECT：客户端ID超过23字节时截断；服务器拒绝；不回应CONNACK
+  printf("CONNECT\n");
+  {
+    SocketIo io;
+    connectSocket(io, broker.port);
+    int code = mqttHandshake(io, "esp32cam-246f28aabbcc-extra-long-id", MQTT_KEEPALIVE_S, MQTT_TIMEOUT_MS);
+    disconnectSocket(io);
+    BrokerConfig reject;
+    reject.connackCode = 5;
+    broker.setConfig(reject);
+    connectSocket(io, broker.port);
+    int rejected = mqttHandshake(io, "esp32cam-246f28aabbcc", MQTT_KEEPALIVE_S, MQTT_TIMEOUT_MS);
+    disconnectSocket(io);
+    BrokerConfig silent;
+    silent.connackCode = -1;
+    broker.setConfig(silent);
+    connectSocket(io, broker.port);
+    uint64_t t0 = nowMs();
+    int none = mqttHandshake(io, "esp32cam-246f28aabbcc", MQTT_KEEPALIVE_S, 300);
+    uint64_t waited = nowMs() - t0;
+    disconnectSocket(io);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock(broker.mu);
+    check(code == 0, "正常连接返回码 " + std::to_string(code));
+    check(rejected == 5, "服务器拒绝时返回码 " + std::to_string(rejected) + "，应为5");
+    check(none == -1 && waited >= 300 && waited < 1000, "没有CONNACK时应在超时后返回-1");
+    check(broker.connectErrors.empty(), broker.connectErrors.empty() ? "" : broker.connectErrors[0]);
+    check(!broker.connects.empty() && broker.connects[0] == std::string("esp32cam-246f28aabbcc-extra-long-id").substr(0, 23),
+          "客户端ID没有截断到23字节");
+    printf("  接受/拒绝/无回应: %d/%d/%d，客户端ID \"%s\"\n", code, rejected, none,
+           broker.connects.empty() ? "" : broker.connects[0].c_str());
+  }
+
+  // 2. 报文ID回绕：从65530开始发布所有事件
+  printf("报文ID回绕\n");
+  {
+    broker.setConfig(BrokerConfig());
+    broker.clear();
+    SocketIo io;
+    size_t offset = 0;
+    uint16_t packetId = 65530;
+    Session s = publishQueue(io, broker.port, queue, offset, packetId, "esp32cam-246f28aabbcc", topic);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock(broker.mu);
+    bool idsOk = broker.packetIds.size() == (size_t)total;
+    uint16_t expect = 65530;
+    for (size_t i = 0; idsOk && i < broker.packetIds.size(); i++) {
+      idsOk = broker.packetIds[i] == expect;
+      expect = mqttNextPacketId(expect);
+    }
+    check(s.sent == (uint32_t)total && offset == queue.size(), "没有全部确认: " + std::to_string(s.sent));
+    check(idsOk, "报文ID序列不是 65530..65535,1,2...");
+    check(broker.badPublishes == 0, "有报文ID为0或格式错误的PUBLISH");
+    check(packetId == expect, "发布后的下一个报文ID不对");
+    check(broker.topic == topic, "主题不对: " + broker.topic);
+    printf("  发布 %u 条，报文ID %u..%u，连接 %llu ms，发布 %llu ms\n", s.sent, 65530,
+           broker.packetIds.empty() ? 0 : broker.packetIds.back(), (unsigned long long)s.connectMs,
+           (unsigned long long)s.publishMs);
+  }
+
+  // 3. 一批中途断开：第 MQTT_BATCH+4 条收到后断开（未确认），重连后补发
+  printf("一批中途断开\n");
+  {
+    int dropAt = MQTT_BATCH + 4;
+    BrokerConfig drop;
+    drop.dropAfter = dropAt;
+    broker.setConfig(drop);
+    broker.clear();
+    SocketIo io;
+    size_t offset = 0;
+    uint16_t packetId = 1;
+    Session first = publishQueue(io, broker.port, queue, offset, packetId, "esp32cam-246f28aabbcc", topic);
+    size_t afterDrop = offset;
+    broker.setConfig(BrokerConfig());
+    Session second = publishQueue(io, broker.port, queue, offset, packetId, "esp32cam-246f28aabbcc", topic);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock(broker.mu);
+    std::map<long, int> seen;
+    for (long seq : broker.seqs) seen[seq]++;
+    int missing = 0, duplicates = 0;
+    for (int i = 0; i < total; i++) {
+      if (seen[i] == 0) missing++;
+      if (seen[i] > 1) duplicates += seen[i] - 1;
+    }
+    check(afterDrop == (size_t)dropAt - 1, "断开后队列位置 " + std::to_string(afterDrop) + "，应为 " +
+                                               std::to_string(dropAt - 1) + "（只推进已确认的部分）");
+    check(offset == queue.size(), "重连后没有发完");
+    check(missing == 0, "丢失 " + std::to_string(missing) + " 条事件");
+    check(duplicates <= MQTT_BATCH, "重复 " + std::to_string(duplicates) + " 条，超过一批");
+    printf("  第一次确认 %u 条后断开，重连后确认 %u 条；服务器收到 %zu 条，丢失 %d 条，重复 %d 条（未确认后重发的）\n",
+           first.sent, second.sent, broker.seqs.size(), missing, duplicates);
+  }
+
+  // 4. PUBACK乱序：只认乱序之前的部分
+  printf("PUBACK乱序\n");
+  {
+    BrokerConfig swap;
+    swap.swapAcksAt = 5;
+    broker.setConfig(swap);
+    broker.clear();
+    SocketIo io;
+    size_t offset = 0;
+    uint16_t packetId = 1;
+    Session s = publishQueue(io, broker.port, queue, offset, packetId, "esp32cam-246f28aabbcc", topic);
+    check(s.sent == 4 && offset == 4, "乱序时确认了 " + std::to_string(s.sent) + " 条，应为4");
+    printf("  第5、6条的PUBACK对调，确认 %u 条\n", s.sent);
+  }
+
+  // 吞吐量：网络延迟不同时，按批发布与逐条等待确认的对比
+  printf("\n%10s  %10s  %10s\n", "网络延迟", "每批条数", "条/秒");
+  const int delays[] = {0, 2, 10};
+  for (int delay : delays) {
+    for (int batch : {MQTT_BATCH, 1}) {
+      BrokerConfig cfg;
+      cfg.latencyMs = delay;
+      broker.setConfig(cfg);
+      SocketIo io;
+      connectSocket(io, broker.port);
+      mqttHandshake(io, "esp32cam-bench", MQTT_KEEPALIVE_S, MQTT_TIMEOUT_MS);
+      std::vector<uint8_t> buf(4096);
+      uint16_t packetId = 1;
+      int n = delay > 0 ? 64 : total;
+      uint64_t start = nowMs();
+      uint32_t sent = 0;
+      for (int i = 0; i < n; i += batch) {
+        uint16_t firstId = packetId;
+        uint32_t count = mqttSendBatch(io, buf.data(), buf.size(), topic, &queue[i], (uint32_t)std::min(batch, n - i), packetId);
+        sent += mqttAwaitAcks(io, firstId, count, MQTT_TIMEOUT_MS);
+      }
+      double secs = std::max<uint64_t>(1, nowMs() - start) / 1000.0;
+      disconnectSocket(io);
+      check(sent == (uint32_t)n, "吞吐量测试没有全部确认");
+      printf("%8d ms  %10d  %10.0f\n", delay, batch, sent / secs);
+    }
+  }
+
+  broker.stopping = true;
+  broker.thread.join();
+  close(broker.listenFd);
+  if (failures > 0) {
+    printf("\n共 %d 项检查失败\n", failures);
+    return 1;
+  }
+  printf("\n所有检查通过\n");
+  return 0;
+}
@@ -0,0 +1,272 @@
+// 时间同步测试：在本机启动几个替身NTP服务器，按固件的做法（src/ntp_util.h，同时请求、采用最先返回的有效回复、
+// 按漂移校正、估计误差超过容差才重新同步）模拟设备多次唤醒，统计每次同步的耗时、同步次数、时间误差和跳过的拍摄。
+//
+// 替身服务器可以设置回复延迟、自身时钟偏差，以及不回复、未同步（层级0）、回应错误的请求等异常，用来检查这些回复不会被采用。
+// 设备的睡眠用模拟时间推进（不真的等待），设备时钟按设定的漂移走时；网络往返是真实的UDP。
+//
+// 用法: ntp_race_test [唤醒次数，默认300] [时钟漂移ppm，默认80] [睡眠间隔秒，默认600]
+// 检查全部通过时返回0
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ntp_util.h"
+
+#define TIME_VALID_AFTER_US (1700000000LL * 1000000LL)
+#define TIME_SYNC_TOLERANCE_MS 2000       // 与固件相同
+#define TIME_SYNC_MAX_INTERVAL_S (24 * 3600)
+#define TIME_DEFAULT_DRIFT_PPM 1000
+#define NTP_TIMEOUT_MS 1500
+#define NTP_ROUNDS 2
+
+static std::atomic<int64_t> simulatedUs{0};  // 模拟睡眠累计推进的时间（服务器和设备都要加上）
+static std::atomic<bool> stopping{false};
+
+static int64_t realUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// 真实时间（替身服务器的参考时钟）
+static int64_t trueUs() { return realUs() + simulatedUs; }
+
+enum ServerMode { SERVER_GOOD, SERVER_SILENT, SERVER_UNSYNCED, SERVER_WRONG_ORIGIN, SERVER_CLIENT_MODE };
+
+struct StandInServer {
+  const char* name;
+  ServerMode mode;
+  int delayMs;
+  int64_t clockErrorUs;  // 服务器自身的时钟偏差
+  int fd = -1;
+  uint16_t port = 0;
+  std::atomic<uint32_t> requests{0};
+  std::thread thread{};
+};
+
+static void serve(StandInServer* s) {
+  uint8_t packet[NTP_PACKET_SIZE];
+  while (!stopping) {
+    pollfd p{s->fd, POLLIN, 0};
+    if (poll(&p, 1, 50) <= 0) continue;
+    sockaddr_in from{};
+    socklen_t fromLen = sizeof(from);
+    ssize_t n = recvfrom(s->fd, packet, sizeof(packet), 0, (sockaddr*)&from, &fromLen);
+    if (n < NTP_PACKET_SIZE) continue;
+    s->requests++;
+    if (s->mode == SERVER_SILENT) continue;
+    int64_t t2 = trueUs() + s->clockErrorUs;
+    std::this_thread::sleep_for(std::chrono::milliseconds(s->delayMs));
+    uint64_t origin = ntpRead(packet + 40);
+    uint8_t reply[NTP_PACKET_SIZE] = {0};
+    reply[0] = s->mode == SERVER_CLIENT_MODE ? 0x23 : 0x24;  // VN=4, Mode=4（服务器）
+    reply[1] = s->mode == SERVER_UNSYNCED ? 0 : 2;            // 层级
+    ntpWrite(reply + 24, s->mode == SERVER_WRONG_ORIGIN ? origin + 12345 : origin);
+    ntpWrite(reply + 32, ntpFromUs(t2));
+    ntpWrite(reply + 40, ntpFromUs(trueUs() + s->clockErrorUs));
+    sendto(s->fd, reply, sizeof(reply), 0, (sockaddr*)&from, fromLen);
+  }
+}
+
+static bool startServer(StandInServer& s) {
+  s.fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (s.fd < 0 || bind(s.fd, (sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(s.fd, (sockaddr*)&addr, &len) != 0) {
+    return false;
+  }
+  s.port = ntohs(addr.sin_port);
+  s.thread = std::thread(serve, &s);
+  return true;
+}
+
+// 模拟的设备时钟：真实时间加上设备误差，误差随模拟睡眠按漂移增长；RTC变量与固件一一对应
+struct Device {
+  int64_t errorUs;         // 设备时钟 - 真实时间
+  bool clockSet = false;   // 上电后时钟未设置（相当于早于TIME_VALID_AFTER）
+  int64_t lastSyncUs = 0;
+  int64_t lastCorrectUs = 0;
+  float driftPpm = 0;
+  float residualPpm = TIME_DEFAULT_DRIFT_PPM;
+  uint32_t skippedCaptures = 0;
+
+  int64_t nowUs() const { return clockSet ? trueUs() + errorUs : realUs() % 1000000000LL; }
+  void adjust(int64_t deltaUs) {
+    if (clockSet) {
+      errorUs += deltaUs;
+    } else {
+      errorUs = nowUs() + deltaUs - trueUs();  // 首次设置时钟
+      clockSet = true;
+    }
+  }
+};
+
+// 固件 timeSyncRace() 的流程：向所有服务器发送请求，处理到达的回复，采用第一个有效回复
+static bool syncRace(Device& d, const std::vector<StandInServer*>& servers, int& winner, double& elapsedMs) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  std::vector<uint64_t> sent(servers.size(), 0);
+  auto start = std::chrono::steady_clock::now();
+  winner = -1;
+  for (int round = 0; round < NTP_ROUNDS && winner < 0; round++) {
+    for (size_t i = 0; i < servers.size(); i++) {
+      uint8_t packet[NTP_PACKET_SIZE];
+      sent[i] = ntpBuildRequest(packet, d.nowUs());
+      sockaddr_in to{};
+      to.sin_family = AF_INET;
+      to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      to.sin_port = htons(servers[i]->port);
+      sendto(fd, packet, sizeof(packet), 0, (sockaddr*)&to, sizeof(to));
+    }
+    auto roundStart = std::chrono::steady_clock::now();
+    while (winner < 0 && std::chrono::steady_clock::now() - roundStart < std::chrono::milliseconds(NTP_TIMEOUT_MS)) {
+      pollfd p{fd, POLLIN, 0};
+      if (poll(&p, 1, 5) <= 0) continue;
+      uint8_t packet[NTP_PACKET_SIZE];
+      sockaddr_in from{};
+      socklen_t fromLen = sizeof(from);
+      ssize_t n = recvfrom(fd, packet, sizeof(packet), 0, (sockaddr*)&from, &fromLen);
+      int64_t t4 = d.nowUs();
+      int server = -1;
+      for (size_t i = 0; i < servers.size(); i++) {
+        if (servers[i]->port == ntohs(from.sin_port)) server = (int)i;
+      }
+      int64_t offset, rtt;
+      if (server < 0 || n < 0 || !ntpParseReply(packet, (size_t)n, sent[server], t4, offset, rtt)) {
+        continue;
+      }
+      timeDriftUpdate(d.driftPpm, d.residualPpm, d.lastSyncUs, ntpToUs(sent[server]), t4, offset,
+                      d.clockSet ? TIME_VALID_AFTER_US : INT64_MAX);
+      d.adjust(offset);
+      d.lastSyncUs = t4 + offset;
+      d.lastCorrectUs = d.lastSyncUs;
+      winner = server;
+    }
+  }
+  elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  close(fd);
+  return winner >= 0;
+}
+
+// 固件 timeNeedsSync()
+static bool needsSync(const Device& d) {
+  if (!d.clockSet || d.lastSyncUs == 0) return true;
+  int64_t now = d.nowUs();
+  return now - d.lastSyncUs >= (int64_t)TIME_SYNC_MAX_INTERVAL_S * 1000000LL ||
+         timeEstimatedErrorMs(d.residualPpm, d.lastSyncUs, now) >= TIME_SYNC_TOLERANCE_MS;
+}
+
+struct Result {
+  uint32_t wakes = 0, syncs = 0, failures = 0, badWinners = 0;
+  double maxSyncMs = 0, totalSyncMs = 0;
+  double maxErrorMs = 0;      // 拍摄时刻（同步或校正之后）的真实时间误差
+  uint32_t overTolerance = 0; // 拍摄时误差超过容差的次数
+};
+
+// 模拟wakes次唤醒：每次先按漂移校正，需要时同步，然后"拍摄"并记录误差，再睡眠sleepS秒
+static Result simulate(const std::vector<StandInServer*>& servers, int wakes, double driftPpm, int sleepS,
+                       int deadWakes) {
+  Device d;
+  d.errorUs = 0;
+  Result r;
+  for (int w = 0; w < wakes; w++) {
+    r.wakes++;
+    if (d.clockSet) {
+      int64_t now = d.nowUs();
+      int64_t c = timeDriftCorrectionUs(d.driftPpm, d.lastCorrectUs, now);
+      d.adjust(c);
+      if (d.lastCorrectUs != 0) d.lastCorrectUs = now + c;
+    }
+    if (needsSync(d)) {
+      int winner = -1;
+      double ms = 0;
+      bool ok = w >= deadWakes && syncRace(d, servers, winner, ms);  // 前deadWakes次唤醒网络不通
+      if (ok) {
+        r.syncs++;
+        r.totalSyncMs += ms;
+        r.maxSyncMs = std::max(r.maxSyncMs, ms);
+        if (servers[winner]->mode != SERVER_GOOD) r.badWinners++;
+      } else {
+        r.failures++;
+      }
+    }
+    if (!d.clockSet) {
+      d.skippedCaptures++;  // 时钟从未设置，文件名无法确定，跳过拍摄
+    } else {
+      double errMs = std::abs((double)d.errorUs) / 1000.0;
+      r.maxErrorMs = std::max(r.maxErrorMs, errMs);
+      if (errMs > TIME_SYNC_TOLERANCE_MS) r.overTolerance++;
+    }
+    // 睡眠：真实时间前进sleepS秒，设备时钟按漂移多走（或少走）
+    int64_t sleepUs = (int64_t)sleepS * 1000000LL;
+    simulatedUs += sleepUs;
+    if (d.clockSet) d.errorUs -= (int64_t)(sleepUs * driftPpm / 1e6);  // 正漂移表示本地时钟偏慢
+  }
+  printf("  唤醒 %u 次，同步 %u 次（失败 %u 次），跳过拍摄 %u 次\n", r.wakes, r.syncs, r.failures, d.skippedCaptures);
+  printf("  同步耗时 平均 %.1f ms，最长 %.1f ms；拍摄时最大时间误差 %.1f ms，超过容差 %u 次；估计漂移 %.1f ppm（实际 %.1f）\n",
+         r.syncs ? r.totalSyncMs / r.syncs : 0.0, r.maxSyncMs, r.maxErrorMs, r.overTolerance, d.driftPpm, driftPpm);
+  return r;
+}
+
+int main(int argc, char** argv) {
+  int wakes = argc > 1 ? std::max(1, atoi(argv[1])) : 300;
+  double driftPpm = argc > 2 ? atof(argv[2]) : 80;
+  int sleepS = argc > 3 ? std::max(1, atoi(argv[3])) : 600;
+
+  // 异常的服务器回复得比正常的快，检查它们不会被采用
+  StandInServer all[] = {
+      {"未同步(层级0)", SERVER_UNSYNCED, 1, 3600000000LL},
+      {"回应错误的请求", SERVER_WRONG_ORIGIN, 2, -3600000000LL},
+      {"客户端模式", SERVER_CLIENT_MODE, 3, 7200000000LL},
+      {"不回复", SERVER_SILENT, 0, 0},
+      {"正常(慢)", SERVER_GOOD, 60, 0},
+      {"正常(快)", SERVER_GOOD, 15, 0},
+  };
+  std::vector<StandInServer*> servers;
+  for (StandInServer& s : all) {
+    if (!startServer(s)) {
+      fprintf(stderr, "无法启动替身NTP服务器\n");
+      return 1;
+    }
+    servers.push_back(&s);
+  }
+
+  bool failed = false;
+  printf("替身NTP服务器:");
+  for (StandInServer* s : servers) printf(" %s@%u", s->name, s->port);
+  printf("\n\n场景1: 时钟漂移 %.0f ppm，每 %d 秒唤醒一次\n", driftPpm, sleepS);
+  Result r1 = simulate(servers, wakes, driftPpm, sleepS, 0);
+  failed |= r1.badWinners > 0 || r1.overTolerance > 0 || r1.failures > 0;
+
+  printf("\n场景2: 上电后前3次唤醒网络不通\n");
+  Result r2 = simulate(servers, 20, driftPpm, sleepS, 3);
+  failed |= r2.badWinners > 0 || r2.syncs == 0;
+
+  printf("\n场景3: 只有异常服务器（不应同步成功）\n");
+  std::vector<StandInServer*> bad(servers.begin(), servers.begin() + 4);
+  Result r3 = simulate(bad, 2, driftPpm, sleepS, 0);
+  failed |= r3.syncs > 0;
+
+  stopping = true;
+  printf("\n各服务器收到的请求:");
+  for (StandInServer* s : servers) {
+    s->thread.join();
+    close(s->fd);
+    printf(" %s %u", s->name, s->requests.load());
+  }
+  printf("\n%s\n", failed ? "失败" : "通过: 没有采用异常回复，拍摄时的时间误差都在容差内");
+  return failed ? 1 : 0;
+}
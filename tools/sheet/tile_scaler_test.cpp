@@ -0,0 +1,168 @@
+// 缩略图墙缩放测试：直接编译固件中的 src/tile_scaler.h，检查缩放结果并测量每个格子的耗时（ms/格）
+//
+// 检查：纯色图像每个格子像素都是该颜色的RGB565（含大端字节顺序）；随机图像与逐个目标像素直接求平均的参考实现一致；
+// 解码器按不同大小的块、不同顺序送来像素时结果相同；全分辨率解码（每个目标像素的源像素超过255个）时不会溢出；
+// 尺寸为0时不访问内存。
+// 计时：按设备上的解码方式（UXGA按1/8比例解码为200x150，解码器每次送来一个MCU大小的块）缩放，报告每格毫秒数。
+// 2x1、2x2两行是设备上的情况（1/8解码时每个MCU只送来几个像素），和"整张图像"一行相比可以看出每次回调的固定开销
+// 占了多少，用来判断是否值得先把小块攒成整行再缩放。
+//
+// 用法: tile_scaler_test [每种情况的测试时长毫秒，默认300]
+// 检查全部通过时返回0
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "tile_scaler.h"
+
+static const uint32_t TILE_PIXELS = CONTACT_SHEET_TILE_W * CONTACT_SHEET_TILE_H;
+
+struct Image {
+  uint16_t w, h;
+  std::vector<uint8_t> rgb;
+};
+
+// 按bw x bh的块（先行后列，或反过来）送入缩放器，每块复制成连续的缓冲区，与解码器回调相同
+static void scale(TileScaler& t, const Image& img, int bw, int bh, bool columnsFirst, std::vector<uint8_t>& out) {
+  tileScalerBegin(t, img.w, img.h);
+  std::vector<uint8_t> block((size_t)std::min<int>(bw, img.w) * std::min<int>(bh, img.h) * 3);
+  auto add = [&](int x, int y) {
+    int w = std::min(bw, img.w - x), h = std::min(bh, img.h - y);
+    for (int j = 0; j < h; j++) {
+      memcpy(&block[(size_t)j * w * 3], &img.rgb[((size_t)(y + j) * img.w + x) * 3], (size_t)w * 3);
+    }
+    tileScalerAdd(t, x, y, w, h, block.data());
+  };
+  if (columnsFirst) {
+    for (int x = 0; x < img.w; x += bw)
+      for (int y = 0; y < img.h; y += bh) add(x, y);
+  } else {
+    for (int y = 0; y < img.h; y += bh)
+      for (int x = 0; x < img.w; x += bw) add(x, y);
+  }
+  out.resize(TILE_PIXELS * 2);
+  tileScalerFinish(t, out.data());
+}
+
+// 参考实现：每个目标像素直接对映射到它的源像素求平均（与固件相同的映射和取整）
+static std::vector<uint8_t> reference(const Image& img) {
+  std::vector<uint32_t> sum(TILE_PIXELS * 3, 0), count(TILE_PIXELS, 0);
+  for (uint32_t y = 0; y < img.h; y++) {
+    for (uint32_t x = 0; x < img.w; x++) {
+      uint32_t d = (y * CONTACT_SHEET_TILE_H / img.h) * CONTACT_SHEET_TILE_W + x * CONTACT_SHEET_TILE_W / img.w;
+      for (int c = 0; c < 3; c++) sum[d * 3 + c] += img.rgb[((size_t)y * img.w + x) * 3 + c];
+      count[d]++;
+    }
+  }
+  std::vector<uint8_t> out(TILE_PIXELS * 2);
+  for (uint32_t d = 0; d < TILE_PIXELS; d++) {
+    uint8_t r = 0, g = 0, b = 0;
+    if (count[d] > 0) {
+      r = sum[d * 3] / count[d];
+      g = sum[d * 3 + 1] / count[d];
+      b = sum[d * 3 + 2] / count[d];
+    }
+    out[d * 2] = (r & 0xF8) | (g >> 5);
+    out[d * 2 + 1] = ((g << 3) & 0xE0) | (b >> 3);
+  }
+  return out;
+}
+
+static Image randomImage(uint16_t w, uint16_t h, std::mt19937& rng) {
+  Image img{w, h, std::vector<uint8_t>((size_t)w * h * 3)};
+  for (uint8_t& v : img.rgb) v = (uint8_t)rng();
+  return img;
+}
+
+static Image solidImage(uint16_t w, uint16_t h, uint8_t r, uint8_t g, uint8_t b) {
+  Image img{w, h, std::vector<uint8_t>((size_t)w * h * 3)};
+  for (size_t i = 0; i < img.rgb.size(); i += 3) {
+    img.rgb[i] = r;
+    img.rgb[i + 1] = g;
+    img.rgb[i + 2] = b;
+  }
+  return img;
+}
+
+int main(int argc, char** argv) {
+  int benchMs = argc > 1 ? std::max(10, atoi(argv[1])) : 300;
+  int failures = 0;
+  auto check = [&](bool ok, const char* what, int w, int h) {
+    if (!ok) {
+      printf("失败: %s（源图像 %dx%d）\n", what, w, h);
+      failures++;
+    }
+  };
+  TileScaler* t = new TileScaler;
+  std::vector<uint8_t> out, out2;
+  std::mt19937 rng(4242);
+
+  // 纯色：每个格子像素都是该颜色的大端RGB565；包括全分辨率（每个目标像素400个源像素，超过255个的部分被忽略）
+  const uint16_t sizes[][2] = {{200, 150}, {100, 75}, {80, 60}, {160, 120}, {800, 600}, {1600, 1200}, {203, 151}};
+  for (const auto& s : sizes) {
+    scale(*t, solidImage(s[0], s[1], 255, 0, 0), 16, 8, false, out);
+    check(out[0] == 0xF8 && out[1] == 0x00 && out[TILE_PIXELS * 2 - 2] == 0xF8, "纯红色不是F800", s[0], s[1]);
+    scale(*t, solidImage(s[0], s[1], 0x12, 0x9A, 0xEF), 16, 8, false, out);
+    uint8_t hi = (0x12 & 0xF8) | (0x9A >> 5), lo = ((0x9A << 3) & 0xE0) | (0xEF >> 3);
+    bool all = true;
+    for (uint32_t d = 0; d < TILE_PIXELS; d++) all &= out[d * 2] == hi && out[d * 2 + 1] == lo;
+    check(all, "纯色图像的格子颜色不一致（累加溢出？）", s[0], s[1]);
+  }
+
+  // 随机图像：与参考实现一致，且与块大小、送入顺序无关（每个目标像素不超过255个源像素时）
+  const uint16_t randomSizes[][2] = {{200, 150}, {100, 75}, {80, 60}, {203, 151}, {400, 300}, {97, 61}};
+  const int blocks[][2] = {{2, 1}, {2, 2}, {8, 8}, {16, 8}, {16, 16}, {37, 5}, {4096, 4096}};
+  for (const auto& s : randomSizes) {
+    Image img = randomImage(s[0], s[1], rng);
+    std::vector<uint8_t> ref = reference(img);
+    for (const auto& b : blocks) {
+      scale(*t, img, b[0], b[1], false, out);
+      scale(*t, img, b[0], b[1], true, out2);
+      check(out == ref, "与参考实现不一致", s[0], s[1]);
+      check(out2 == ref, "按列送入时结果不同", s[0], s[1]);
+    }
+  }
+
+  // 尺寸为0（解码器没有送来开始回调）：不累加，输出全黑
+  tileScalerBegin(*t, 0, 0);
+  uint8_t pixel[3] = {255, 255, 255};
+  tileScalerAdd(*t, 0, 0, 1, 1, pixel);
+  tileScalerFinish(*t, out.data());
+  check(std::all_of(out.begin(), out.end(), [](uint8_t v) { return v == 0; }), "尺寸为0时输出不是黑色", 0, 0);
+
+  // 计时：每种块大小缩放200x150（UXGA 1/8）和100x75（SVGA 1/8）
+  printf("格子 %dx%d，每种情况测试 %d ms\n", CONTACT_SHEET_TILE_W, CONTACT_SHEET_TILE_H, benchMs);
+  printf("%10s  %10s  %12s  %s\n", "ms/格", "MPixel/s", "源图像", "解码器每次送来的块");
+  const int benchBlocks[][2] = {{2, 1}, {2, 2}, {16, 8}, {16, 16}, {4096, 4096}};
+  const char* const blockNames[] = {"2x1（16x8 MCU的1/8）", "2x2（16x16 MCU的1/8）", "16x8", "16x16", "整张图像"};
+  const uint16_t benchSizes[][2] = {{200, 150}, {100, 75}};
+  for (const auto& s : benchSizes) {
+    Image img = randomImage(s[0], s[1], rng);
+    for (int b = 0; b < 5; b++) {
+      uint64_t tiles = 0;
+      double elapsed = 0;
+      auto start = std::chrono::steady_clock::now();
+      do {
+        scale(*t, img, benchBlocks[b][0], benchBlocks[b][1], false, out);
+        tiles++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      } while (elapsed * 1000 < benchMs);
+      printf("%10.4f  %10.1f  %5dx%-6d  %s\n", elapsed * 1000 / tiles, (double)img.w * img.h * tiles / elapsed / 1e6, img.w,
+             img.h, blockNames[b]);
+    }
+  }
+  delete t;
+
+  if (failures > 0) {
+    printf("共 %d 项检查失败\n", failures);
+    return 1;
+  }
+  printf("所有检查通过\n");
+  return 0;
+}
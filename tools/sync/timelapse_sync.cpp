@@ -0,0 +1,161 @@
+// ESP32-CAM 照片增量同步工具
+//
+// 通过设备的 /api/changes?since=<序号> 接口获取上次同步之后新增和删除的照片，
+// 用多个keep-alive连接并行下载新照片，删除本地已在设备上删除的照片。
+// 同步耗时只与新增数据量有关，与卡上照片总数无关。
+//
+// 用法: timelapse_sync <设备地址[:端口]> <本地目录> [-j 并发数]
+// 同步进度保存在 <本地目录>/.timelapse_sync_seq
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/changes.h"
+#include "../common/http_client.h"
+
+using timelapse::Change;
+using timelapse::HttpClient;
+using timelapse::HttpResponse;
+
+static void makeDirs(const std::string& path) {
+  for (size_t p = path.find('/', 1); p != std::string::npos; p = path.find('/', p + 1)) {
+    mkdir(path.substr(0, p).c_str(), 0755);
+  }
+}
+
+static uint32_t loadSeq(const std::string& file) {
+  std::ifstream in(file);
+  uint32_t seq = 0;
+  in >> seq;
+  return seq;
+}
+
+static void saveSeq(const std::string& file, uint32_t seq) {
+  std::string tmp = file + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    out << seq << "\n";
+  }
+  rename(tmp.c_str(), file.c_str());
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "用法: %s <设备地址[:端口]> <本地目录> [-j 并发数]\n", argv[0]);
+    return 2;
+  }
+  std::string host, port;
+  timelapse::splitHostPort(argv[1], host, port);
+  std::string dest = argv[2];
+  while (!dest.empty() && dest.back() == '/') dest.pop_back();
+  int jobs = 4;
+  for (int i = 3; i + 1 < argc; i++) {
+    if (std::string(argv[i]) == "-j") jobs = std::max(1, atoi(argv[++i]));
+  }
+  mkdir(dest.c_str(), 0755);
+  std::string seqFile = dest + "/.timelapse_sync_seq";
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t since = loadSeq(seqFile);
+  uint32_t startSeq = since;
+
+  // 1. 拉取全部变更记录（分页）
+  std::vector<Change> changes;
+  HttpClient api(host, port);
+  while (true) {
+    HttpResponse resp;
+    if (!api.get("/api/changes?since=" + std::to_string(since), resp) || resp.status != 200) {
+      fprintf(stderr, "获取变更失败 (HTTP %d)\n", resp.status);
+      return 1;
+    }
+    uint32_t next = since;
+    bool more = false;
+    if (!timelapse::parseChanges(resp.body, changes, next, more)) {
+      fprintf(stderr, "无法解析变更列表\n");
+      return 1;
+    }
+    if (next < since) {
+      // 设备上的记录被重置过，从头同步
+      fprintf(stderr, "设备序号小于本地记录，重新全量同步\n");
+      changes.clear();
+      since = 0;
+      continue;
+    }
+    since = next;
+    if (!more) break;
+  }
+
+  // 2. 合并：同一路径只看最后一次操作
+  std::map<std::string, Change> latest;
+  for (const Change& c : changes) latest[c.path] = c;
+  std::vector<Change> downloads;
+  size_t removed = 0;
+  for (auto& kv : latest) {
+    const Change& c = kv.second;
+    std::string local = dest + c.path;
+    if (c.op == '-') {
+      if (unlink(local.c_str()) == 0) removed++;
+    } else if (c.op == '+') {
+      struct stat st;
+      if (stat(local.c_str(), &st) == 0 && (uint64_t)st.st_size == c.size) continue;  // 已存在
+      downloads.push_back(c);
+    }
+  }
+  std::sort(downloads.begin(), downloads.end(), [](const Change& a, const Change& b) { return a.seq < b.seq; });
+
+  // 3. 并行下载，每个线程一个keep-alive连接
+  std::atomic<size_t> nextIndex(0);
+  std::atomic<uint64_t> totalBytes(0);
+  std::mutex failMutex;
+  uint32_t firstFailedSeq = UINT32_MAX;
+  std::vector<std::thread> workers;
+  for (int w = 0; w < jobs; w++) {
+    workers.emplace_back([&]() {
+      HttpClient client(host, port);
+      size_t i;
+      while ((i = nextIndex++) < downloads.size()) {
+        const Change& c = downloads[i];
+        HttpResponse resp;
+        bool ok = client.get("/photo?file=" + HttpClient::urlEncode(c.path) + "&download=1", resp) &&
+                  resp.status == 200 && (c.size == 0 || resp.body.size() == c.size);
+        if (ok) {
+          std::string local = dest + c.path;
+          std::string tmp = local + ".part";
+          makeDirs(local);
+          std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+          out.write(resp.body.data(), (std::streamsize)resp.body.size());
+          out.close();
+          ok = out.good() && rename(tmp.c_str(), local.c_str()) == 0;
+        }
+        if (ok) {
+          totalBytes += resp.body.size();
+        } else {
+          fprintf(stderr, "下载失败: %s\n", c.path.c_str());
+          std::lock_guard<std::mutex> lock(failMutex);
+          firstFailedSeq = std::min(firstFailedSeq, c.seq);
+        }
+      }
+    });
+  }
+  for (auto& t : workers) t.join();
+
+  // 4. 保存进度：有失败时只推进到第一个失败记录之前，下次重试
+  uint32_t saved = firstFailedSeq == UINT32_MAX ? since : firstFailedSeq - 1;
+  saveSeq(seqFile, std::max(saved, startSeq));
+
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("同步完成: 序号 %u -> %u, 变更 %zu 条, 下载 %zu 张 (%.2f MB), 删除 %zu 张, 耗时 %.2f s, %.2f MB/s\n",
+         startSeq, saved, changes.size(), downloads.size(), totalBytes / 1048576.0, removed, secs,
+         secs > 0 ? totalBytes / 1048576.0 / secs : 0.0);
+  return firstFailedSeq == UINT32_MAX ? 0 : 1;
+}